@@ -0,0 +1,93 @@
+# Sources and libraries shared by the application (Render.pro) and the benchmarks (bench/)
+HEADERS				+=  $$PWD/lib/glew/include/GL/glew.h \
+						$$PWD/lib/LodePNG/lodepng.h \
+						$$PWD/include/rendering/Render.hpp \
+						$$PWD/include/rendering/Sampler.hpp \
+						$$PWD/include/rendering/KpsEngine.hpp \
+						$$PWD/include/rendering/TargetPool.hpp \
+						$$PWD/include/rendering/Trace.hpp \
+						$$PWD/include/rendering/ShaderCache.hpp \
+						$$PWD/include/io/AnnotationStore.hpp \
+						$$PWD/include/io/ShardWriter.hpp \
+						$$PWD/include/io/RunManifest.hpp \
+						$$PWD/include/io/BoundedQueue.hpp \
+						$$PWD/include/io/SamplePipeline.hpp \
+						$$PWD/include/io/ModelCatalog.hpp \
+						$$PWD/include/io/OutputEncoder.hpp \
+						$$PWD/include/generation/SampleRng.hpp \
+						$$PWD/include/generation/ViewSampler.hpp \
+						$$PWD/include/generation/JobPlan.hpp \
+						$$PWD/include/modelling/Model.hpp \
+						$$PWD/include/modelling/Face.hpp \
+						$$PWD/include/modelling/Vertex.hpp \
+						$$PWD/include/modelling/Entity.hpp \
+						$$PWD/include/modelling/BB.hpp \
+						$$PWD/include/modelling/Texture.hpp \
+						$$PWD/include/modelling/Tree.hpp
+
+SOURCES				+=	$$PWD/lib/glew/src/glew.c \
+						$$PWD/lib/LodePNG/lodepng.cpp \
+						$$PWD/src/rendering/Render.cpp \
+						$$PWD/src/rendering/Sampler.cpp \
+						$$PWD/src/rendering/KpsEngine.cpp \
+						$$PWD/src/rendering/TargetPool.cpp \
+						$$PWD/src/rendering/Trace.cpp \
+						$$PWD/src/rendering/ShaderCache.cpp \
+						$$PWD/src/io/AnnotationStore.cpp \
+						$$PWD/src/io/ShardWriter.cpp \
+						$$PWD/src/io/RunManifest.cpp \
+						$$PWD/src/io/SamplePipeline.cpp \
+						$$PWD/src/io/ModelCatalog.cpp \
+						$$PWD/src/io/OutputEncoder.cpp \
+						$$PWD/src/generation/SampleRng.cpp \
+						$$PWD/src/generation/ViewSampler.cpp \
+						$$PWD/src/generation/JobPlan.cpp \
+						$$PWD/src/modelling/Model.cpp \
+						$$PWD/src/modelling/Face.cpp \
+						$$PWD/src/modelling/Vertex.cpp \
+						$$PWD/src/modelling/Entity.cpp \
+						$$PWD/src/modelling/BB.cpp \
+						$$PWD/src/modelling/Texture.cpp
+
+RESOURCES			+= 	$$PWD/data/resources.qrc
+
+INCLUDEPATH			+=	$$PWD/include \
+						$$PWD/lib \
+						$$PWD/lib/glew/include \
+						$$PWD/lib/soil/include \
+						$$PWD/lib/assimp/include \
+						$$PWD/lib/CImg \
+						$$PWD/lib/LodePNG \
+						$$PWD/lib/fbx/include
+						
+DEFINES				+=	GLEW_STATIC
+						
+win32 {
+	!contains(QMAKE_TARGET.arch, x86_64) {
+		message("Configuration 32 bits")
+		LIBS +=			-L$$PWD/lib/SOIL/x86 -lSOIL
+		CONFIG(debug, debug|release) {
+			DESTDIR = bin\debug
+			LIBS +=		-L$$PWD/lib/assimp/x86/debug -lassimp
+			QMAKE_POST_LINK = copy $$shell_path($$PWD/lib/assimp/x86/debug/*.dll) bin\debug
+		}
+		CONFIG(release, debug|release) {
+			DESTDIR = bin\release
+			LIBS +=		-L$$PWD/lib/assimp/x86/release -lassimp
+			QMAKE_POST_LINK = copy $$shell_path($$PWD/lib/assimp/x86/release/*.dll) bin\release
+		}
+	} else {
+		message("Configuration 64 bits")
+		LIBS +=			-L$$PWD/lib/SOIL/x64 -lSOIL
+		CONFIG(debug, debug|release) {
+			DESTDIR = bin\debug
+			LIBS +=		-L$$PWD/lib/assimp/x64/debug -lassimp
+			QMAKE_POST_LINK = copy $$shell_path($$PWD/lib/assimp/x64/debug/*.dll) bin\debug
+		}
+		CONFIG(release, debug|release) {
+			DESTDIR = bin\release
+			LIBS +=		-L$$PWD/lib/assimp/x64/release -lassimp
+			QMAKE_POST_LINK = copy $$shell_path($$PWD/lib/assimp/x64/release/*.dll) bin\release
+		}
+	}
+}
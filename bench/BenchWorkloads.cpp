@@ -0,0 +1,180 @@
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <math.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include <GL/glew.h>
+#include "lodepng.h"
+
+#include "BenchWorkloads.hpp"
+
+using namespace std;
+
+static void addWorkload(vector<BenchWorkload>& list, const string& name, const string& model, unsigned int triangles, bool isTextured,
+	unsigned int grid, unsigned int size, unsigned int numSamples)
+{
+	BenchWorkload workload;
+	workload.name = name;
+	workload.model = model;
+	workload.triangles = triangles;
+	workload.isTextured = isTextured;
+	workload.grid = grid;
+	workload.size = size;
+	// Whole atlases only (the last one would be encoded half empty)
+	unsigned int perAtlas = grid * grid;
+	workload.numSamples = (numSamples + perAtlas - 1) / perAtlas * perAtlas;
+	list.push_back(workload);
+}
+
+vector<BenchWorkload> getBenchWorkloads(bool isQuick)
+{
+	vector<BenchWorkload> list;
+	unsigned int scale = isQuick ? 2 : 1;
+
+	// Bundled models: one sample per image as in random generation
+	addWorkload(list, "sphere", "Sphere.obj", 0, false, 1, 512, 32 / scale);
+	addWorkload(list, "cylinder", "Cylinder.obj", 0, false, 1, 512, 32 / scale);
+
+	// Geometry load: procedural meshes with and without texture
+	unsigned int triangles[] = { 1000, 10000, 100000, 1000000, 5000000 };
+	unsigned int samples[] = { 32, 32, 32, 16, 8 };
+	unsigned int numMeshes = isQuick ? 3 : 5;
+	for(unsigned int i = 0; i < numMeshes; ++i)
+	{
+		stringstream name;
+		if(triangles[i] >= 1000000)
+			name << "mesh-" << triangles[i] / 1000000 << "m";
+		else
+			name << "mesh-" << triangles[i] / 1000 << "k";
+		addWorkload(list, name.str(), "", triangles[i], false, 1, 512, samples[i] / scale);
+		addWorkload(list, name.str() + "-tex", "", triangles[i], true, 1, 512, samples[i] / scale);
+	}
+
+	// Atlas layouts: readback, transfer and encoding cost per sample
+	unsigned int grids[] = { 1, 2, 4, 8 };
+	unsigned int sizes[] = { 128, 256, 512, 1024 };
+	for(unsigned int g = 0; g < 4; ++g)
+		for(unsigned int s = 0; s < 4; ++s)
+		{
+			if(isQuick && ((g != 0 && g != 2) || (s != 1 && s != 3)))
+				continue;
+			stringstream name;
+			name << "atlas-" << grids[g] << "x" << grids[g] << "-" << sizes[s];
+			addWorkload(list, name.str(), "Sphere.obj", 0, false, grids[g], sizes[s], 16 / scale);
+		}
+
+	return list;
+}
+
+string createBenchMesh(const string& dir, unsigned int numTriangles, bool isTextured)
+{
+	stringstream name;
+	name << dir << "/mesh_" << numTriangles << (isTextured ? "_tex" : "") << ".obj";
+	string path = name.str();
+	ifstream existing(path.c_str());
+	if(existing.is_open())
+		return path;
+
+	// UV sphere: stacks x slices quads, single triangles at the poles -> 4*stacks*(stacks-1) triangles with slices = 2*stacks
+	unsigned int stacks = (unsigned int)ceil(0.5 + sqrt(0.25 + numTriangles / 4.0));
+	if(stacks < 3)
+		stacks = 3;
+	unsigned int slices = 2 * stacks;
+
+	FILE* file = fopen(path.c_str(), "w");
+	if(file == NULL)
+	{
+		cout << "Bench: cannot create " << path << endl;
+		return "";
+	}
+	string mtlName = path.substr(dir.size() + 1, path.size() - dir.size() - 5) + ".mtl";
+	if(isTextured)
+		fprintf(file, "mtllib %s\nusemtl bench\n", mtlName.c_str());
+
+	// Vertices with a seam column for the texture coordinates, slightly bumpy so shading is not uniform
+	const double PI = 3.14159265358979;
+	for(unsigned int i = 0; i <= stacks; ++i)
+		for(unsigned int j = 0; j <= slices; ++j)
+		{
+			double theta = PI * i / stacks;
+			double phi = 2.0 * PI * j / slices;
+			double radius = 0.5 * (1.0 + 0.03 * sin(8.0 * theta) * sin(8.0 * phi));
+			double nx = sin(theta) * cos(phi), ny = cos(theta), nz = sin(theta) * sin(phi);
+			fprintf(file, "v %.5f %.5f %.5f\nvn %.4f %.4f %.4f\nvt %.5f %.5f\n", radius * nx, radius * ny, radius * nz, nx, ny, nz,
+				(double)j / slices, 1.0 - (double)i / stacks);
+		}
+	for(unsigned int i = 0; i < stacks; ++i)
+		for(unsigned int j = 0; j < slices; ++j)
+		{
+			unsigned int a = i * (slices + 1) + j + 1; // 1-based
+			unsigned int b = a + slices + 1;
+			if(i != 0)
+				fprintf(file, "f %u/%u/%u %u/%u/%u %u/%u/%u\n", a, a, a, b, b, b, a + 1, a + 1, a + 1);
+			if(i != stacks - 1)
+				fprintf(file, "f %u/%u/%u %u/%u/%u %u/%u/%u\n", a + 1, a + 1, a + 1, b, b, b, b + 1, b + 1, b + 1);
+		}
+	fclose(file);
+
+	if(isTextured)
+	{
+		ofstream mtl((dir + "/" + mtlName).c_str());
+		mtl << "newmtl bench" << endl << "Kd 0.8 0.8 0.8" << endl << "Ks 0.2 0.2 0.2" << endl << "map_Kd checker.png" << endl;
+
+		// 1024x1024 checker texture shared by the textured meshes
+		unsigned int size = 1024;
+		vector<unsigned char> image(size * size * 4);
+		for(unsigned int y = 0; y < size; ++y)
+			for(unsigned int x = 0; x < size; ++x)
+			{
+				unsigned char value = ((x / 64 + y / 64) % 2) ? 220 : 40;
+				unsigned char* pixel = &image[(y * size + x) * 4];
+				pixel[0] = value;
+				pixel[1] = (unsigned char)(x / 4);
+				pixel[2] = (unsigned char)(y / 4);
+				pixel[3] = 255;
+			}
+		lodepng::encode(dir + "/checker.png", image, size, size);
+	}
+
+	cout << "Bench: mesh of " << 4 * stacks * (stacks - 1) << " triangles written to " << path << endl;
+	return path;
+}
+
+double getPeakMemoryMB()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if(!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return -1.0;
+	return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+#else
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) != 0)
+		return -1.0;
+	return usage.ru_maxrss / 1024.0; // KB on Linux
+#endif
+}
+
+int getFreeVideoMemoryKB(string& source)
+{
+	GLint free[4] = { -1, -1, -1, -1 };
+	if(GLEW_NVX_gpu_memory_info)
+	{
+		glGetIntegerv(GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX, free);
+		source = "NVX";
+	}
+	else if(GLEW_ATI_meminfo)
+	{
+		glGetIntegerv(GL_TEXTURE_FREE_MEMORY_ATI, free);
+		source = "ATI";
+	}
+	return free[0];
+}
@@ -0,0 +1,31 @@
+#ifndef BENCHWORKLOADS_HPP
+#define BENCHWORKLOADS_HPP
+
+#include <vector>
+#include <string>
+
+// Fixed generation workload: one model rendered into numSamples viewports of a grid x grid atlas of size pixels
+struct BenchWorkload
+{
+	std::string name;
+	std::string model; // bundled .obj (data/models) or empty for a procedural mesh
+	unsigned int triangles;
+	bool isTextured;
+	unsigned int grid, size;
+	unsigned int numSamples; // multiple of grid x grid (whole atlases)
+};
+
+// Bundled models, procedural meshes (1K to 5M triangles, with and without texture) and atlas layouts (1x1 to 8x8, 128 to 1024 px)
+// Quick mode keeps the small meshes and the corners of the atlas sweep
+std::vector<BenchWorkload> getBenchWorkloads(bool isQuick);
+
+// Tessellated sphere of about numTriangles triangles written as .obj (+ .mtl and checker texture if textured)
+// into dir, kept between runs. Returns the model file or an empty string on failure.
+std::string createBenchMesh(const std::string& dir, unsigned int numTriangles, bool isTextured);
+
+// Peak resident memory of the process in MB
+double getPeakMemoryMB();
+// Free video memory in KB from the driver (NVX or ATI meminfo, source set to its name), -1 if not exposed
+int getFreeVideoMemoryKB(std::string& source);
+
+#endif
@@ -0,0 +1,17 @@
+# CPU kernel microbenchmarks (render-microbench): ns per element and MB/s of the sample path hot loops, see README.md
+TEMPLATE			 = app
+TARGET				 = render-microbench
+LANGUAGE			 = C++
+CONFIG				+= qt thread warn_on console debug_and_release
+QT					+= core gui opengl widgets
+
+include(../../Render.pri)
+
+INCLUDEPATH			+=	..
+
+HEADERS				+=  ../BenchWorkloads.hpp
+
+SOURCES				+=	main.cpp \
+						../BenchWorkloads.cpp
+
+win32:LIBS			+=	-lpsapi
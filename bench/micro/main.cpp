@@ -0,0 +1,405 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <math.h>
+
+#include <QApplication>
+#include <QDir>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "rendering/Render.hpp"
+#include "rendering/Sampler.hpp"
+#include "rendering/KpsEngine.hpp"
+#include "rendering/Trace.hpp"
+#include "modelling/Model.hpp"
+#include "BenchWorkloads.hpp"
+
+using namespace std;
+
+// Kernel run on one input: elements processed and bytes touched per run, best time over the repetitions
+struct MicroResult
+{
+	string kernel, input;
+	double elements, bytes, seconds;
+};
+
+static vector<MicroResult> results;
+static string filter;
+
+static bool isSelected(const string& kernel)
+{
+	return filter.empty() || kernel.find(filter) != string::npos;
+}
+
+static void addResult(const string& kernel, const string& input, double elements, double bytes, double seconds)
+{
+	MicroResult result;
+	result.kernel = kernel;
+	result.input = input;
+	result.elements = elements;
+	result.bytes = bytes;
+	result.seconds = seconds;
+	results.push_back(result);
+	cout << left << setw(18) << kernel << setw(22) << input << right << fixed
+		<< setw(12) << setprecision(0) << elements << setw(12) << setprecision(3) << seconds * 1e3
+		<< setw(12) << setprecision(2) << seconds * 1e9 / elements << setw(12) << setprecision(1) << bytes / seconds / (1024.0 * 1024.0) << endl;
+	cout.unsetf(ios::floatfield);
+	cout << setprecision(6);
+}
+
+// Best time of kernel() over at least minReps runs and minSeconds in total, setup() runs untimed before each one
+template<typename Setup, typename Kernel>
+static double measure(Setup& setup, Kernel& kernel, unsigned int minReps = 5, double minSeconds = 0.3)
+{
+	double best = 1e30, total = 0.0;
+	for(unsigned int rep = 0; rep < minReps || total < minSeconds; ++rep)
+	{
+		setup();
+		double start = Trace::now();
+		kernel();
+		double elapsed = (Trace::now() - start) / 1e6;
+		best = min(best, elapsed);
+		total += elapsed;
+	}
+	return best;
+}
+
+static string sizeName(unsigned int value, const string& unit)
+{
+	stringstream name;
+	if(value >= 1000000 && value % 1000000 == 0)
+		name << value / 1000000 << "M " << unit;
+	else if(value >= 1000 && value % 1000 == 0)
+		name << value / 1000 << "K " << unit;
+	else
+		name << value << " " << unit;
+	return name.str();
+}
+
+static unsigned int countVertices(Model& model)
+{
+	unsigned int vertices = 0;
+	for(unsigned int i = 0; i < model.getNumVisualEntities(); ++i)
+		vertices += model.getVisualEntity(i).getListVertices().size();
+	return vertices;
+}
+
+// Model::loadModelFromFile split by its trace zones: assimp import, getGeometry (aiScene -> entities), bind to OpenGL
+static void benchGeometry(const string& pathWork, unsigned int triangles)
+{
+	string file = createBenchMesh(pathWork, triangles, false);
+	unsigned int reps = triangles >= 1000000 ? 2 : 5;
+	vector<TraceStage> stages;
+	unsigned int vertices = 0;
+	Trace::begin(pathWork + "/trace-micro.json");
+	for(unsigned int rep = 0; rep < reps; ++rep)
+	{
+		Model model;
+		model.loadModelFromFile(file);
+		vertices = countVertices(model);
+	}
+	Trace::end(&stages);
+	for(unsigned int i = 0; i < stages.size(); ++i)
+		if(stages[i].name == "getGeometry")
+			addResult("getGeometry", sizeName(triangles, "triangles"), vertices, (double)vertices * sizeof(Vertex), stages[i].total / stages[i].count / 1e6);
+}
+
+static void benchUpdateBB(const string& pathWork, unsigned int triangles)
+{
+	Model model;
+	if(!model.loadModelFromFile(createBenchMesh(pathWork, triangles, false)))
+		return;
+	double vertices = countVertices(model);
+	struct Setup { void operator()() {} } setup;
+	struct Kernel { Model* model; void operator()() { model->updateBB(); } } kernel = { &model };
+	addResult("updateBB", sizeName(triangles, "triangles"), vertices, vertices * sizeof(Vertex), measure(setup, kernel));
+}
+
+// Faces of the model moved one by one from a labelled part to its brother (labelling tab: brush over an already labelled area)
+static void benchTreePartFace(const string& pathWork, unsigned int numFaces)
+{
+	Model model;
+	if(!model.loadModelFromFile(createBenchMesh(pathWork, 10000, false)))
+		return;
+	Entity& entity = model.getVisualEntity(0);
+	numFaces = min(numFaces, (unsigned int)entity.getListFaceIndices().size());
+
+	struct Setup
+	{
+		Model* model; Entity* entity; unsigned int numFaces;
+		void operator()()
+		{
+			model->resetTree();
+			model->addTreePart(vector<unsigned int>());
+			model->addTreePart(vector<unsigned int>());
+			model->setCurrentTreeNode(vector<unsigned int>(1, 1));
+			for(unsigned int f = 0; f < numFaces; ++f)
+			{
+				Face& face = entity->getFace(f);
+				model->addTreePartFace(entity->getVertex(face.getFaceIdx1()), entity->getVertex(face.getFaceIdx2()), entity->getVertex(face.getFaceIdx3()));
+			}
+			model->setCurrentTreeNode(vector<unsigned int>(1, 0));
+		}
+	} setup = { &model, &entity, numFaces };
+	struct Kernel
+	{
+		Model* model; Entity* entity; unsigned int numFaces;
+		void operator()()
+		{
+			for(unsigned int f = 0; f < numFaces; ++f)
+			{
+				Face& face = entity->getFace(f);
+				model->addTreePartFace(entity->getVertex(face.getFaceIdx1()), entity->getVertex(face.getFaceIdx2()), entity->getVertex(face.getFaceIdx3()));
+			}
+		}
+	} kernel = { &model, &entity, numFaces };
+	addResult("addTreePartFace", sizeName(numFaces, "faces"), numFaces, (double)numFaces * 3 * sizeof(Vertex), measure(setup, kernel, 3, 0.0));
+}
+
+// computeBB2D pixel scan over a binary view of the render size with an elliptic object
+static void benchScanMask(int size, float coverage)
+{
+	vector<GLubyte> mask(size * size * 4, 0);
+	float radius = sqrt(coverage / 3.14159f) * size;
+	for(int row = 0; row < size; ++row)
+		for(int col = 0; col < size; ++col)
+		{
+			float dx = (col - size / 2.0f) / radius, dy = (row - size / 2.0f) / (0.7f * radius);
+			if(dx * dx + dy * dy < 1.0f)
+				mask[4 * (row * size + col)] = 255;
+		}
+
+	struct Setup { void operator()() {} } setup;
+	struct Kernel
+	{
+		vector<GLubyte>* mask; int size;
+		void operator()() { BB bb; bb.reset(); Render::scanMask(*mask, size, 0, 0, size, size, bb); }
+	} kernel = { &mask, size };
+	stringstream input;
+	input << size << "x" << size << " " << (int)(coverage * 100) << "%";
+	addResult("scanMask", input.str(), (double)size * size, (double)size * size * 4, measure(setup, kernel));
+}
+
+// Row flip of an RGBA atlas before PNG encoding
+static void benchFlipRows(int size)
+{
+	vector<GLubyte> src(size * size * 4), dst(size * size * 4);
+	for(size_t i = 0; i < src.size(); ++i)
+		src[i] = (GLubyte)(i * 31);
+
+	struct Setup { void operator()() {} } setup;
+	struct Kernel
+	{
+		vector<GLubyte>* src; vector<GLubyte>* dst; int size;
+		void operator()() { Sampler::flipRows(src->data(), dst->data(), 4 * size, size); }
+	} kernel = { &src, &dst, size };
+	stringstream input;
+	input << size << "x" << size << " RGBA";
+	addResult("flipRows", input.str(), (double)size * size, 2.0 * size * size * 4, measure(setup, kernel));
+}
+
+// Keypoint projection and CPU visibility against an RG32F depth buffer (depth, coverage) of the render size
+static void benchKps(unsigned int numKps, int sizeDepth)
+{
+	// Proxy sphere (latitude x longitude grid) as set up by the renderer
+	vector<Vertex> sphere;
+	for(int i = 0; i <= 20; ++i)
+		for(int j = 0; j <= 20; ++j)
+		{
+			float theta = 3.14159f * i / 20.0f, phi = 2.0f * 3.14159f * j / 20.0f;
+			Vertex v;
+			v.setPosition(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+			sphere.push_back(v);
+		}
+	float centre[3] = { 0.0f, 0.0f, 0.0f };
+	KpsEngine engine;
+	engine.setSphere(sphere, centre);
+
+	vector<KpsInstance> kps;
+	for(unsigned int i = 0; i < numKps; ++i)
+		kps.push_back(KpsInstance(0.4f * cos(i * 2.4f), 0.3f * sin(i * 1.7f), 0.4f * sin(i * 2.4f), 0.02f, 0.02f, 0.02f));
+	glm::mat4 mvp = glm::perspective(45.0f, 1.0f, 0.01f, 100.0f) * glm::lookAt(glm::vec3(0.0f, 0.5f, 1.6f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+	// Object covering the centre of the view (coverage) with a depth ramp
+	vector<float> depth(sizeDepth * sizeDepth * 2, 0.0f);
+	for(int row = sizeDepth / 5; row < 4 * sizeDepth / 5; ++row)
+		for(int col = sizeDepth / 5; col < 4 * sizeDepth / 5; ++col)
+		{
+			float* texel = &depth[2 * (row * sizeDepth + col)];
+			texel[0] = 0.8f + 0.1f * row / sizeDepth;
+			texel[1] = 1.0f;
+		}
+
+	struct Setup { void operator()() {} } setup;
+	struct KernelProject
+	{
+		KpsEngine* engine; glm::mat4 mvp; vector<KpsInstance>* kps;
+		void operator()() { engine->project(mvp, *kps, 512.0f); }
+	} kernelProject = { &engine, mvp, &kps };
+	struct KernelVisibility
+	{
+		KpsEngine* engine; glm::mat4 mvp; vector<KpsInstance>* kps; vector<float>* depth; int size;
+		void operator()() { engine->testVisibility(mvp, *kps, *depth, size, size, true); }
+	} kernelVisibility = { &engine, mvp, &kps, &depth, sizeDepth };
+
+	if(isSelected("kpsProject"))
+		addResult("kpsProject", sizeName(numKps, "kps"), numKps, numKps * 3.0 * sizeof(float), measure(setup, kernelProject));
+	if(isSelected("kpsVisibility"))
+	{
+		// Each sphere vertex gathers one depth texel (value + coverage of RG32F)
+		double elements = (double)numKps * sphere.size();
+		addResult("kpsVisibility", sizeName(numKps, "kps") + " x " + sizeName(sphere.size(), "v"), elements, elements * 2 * sizeof(float), measure(setup, kernelVisibility));
+	}
+}
+
+// Part of a .seg file (v/n/t lines per vertex then f lines) parsed by Render::readSegmentation
+static void benchSegmentation(unsigned int numVertices)
+{
+	stringstream text;
+	text << setprecision(10);
+	for(unsigned int v = 0; v < numVertices; ++v)
+	{
+		float t = v * 0.001f;
+		text << "v " << sin(t) << " " << cos(t) << " " << t << endl;
+		text << "n " << cos(t) << " " << -sin(t) << " " << 0.0f << endl;
+		text << "t " << fmod(t, 1.0f) << " " << fmod(2.0f * t, 1.0f) << endl;
+	}
+	unsigned int numFaces = numVertices * 2;
+	for(unsigned int f = 0; f < numFaces; ++f)
+		text << "f " << f % numVertices << " " << (f + 1) % numVertices << " " << (f + 7) % numVertices << endl;
+	text << "# NEW LABEL:" << endl;
+	string content = text.str();
+
+	struct Setup
+	{
+		string* content; stringstream stream; Entity part;
+		void operator()() { stream.clear(); stream.str(*content); part.getListVertices().clear(); part.getListFaceIndices().clear(); }
+	} setup;
+	setup.content = &content;
+	struct Kernel
+	{
+		Setup* setup;
+		void operator()() { Render::readSegmentation(setup->stream, setup->part); }
+	} kernel = { &setup };
+	double lines = numVertices * 3.0 + numFaces + 1;
+	addResult("readSegmentation", sizeName(numVertices, "vertices"), lines, (double)content.size(), measure(setup, kernel, 3));
+}
+
+int main(int argc, char* argv[])
+{
+	string pathOut, pathWork = QDir::tempPath().toStdString() + "/render-bench";
+	bool isQuick = false;
+	for(int i = 1; i < argc; ++i)
+	{
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if(arg == "--quick")
+			isQuick = true;
+		else if(arg == "--filter" && hasValue)
+			filter = argv[++i];
+		else if(arg == "--work" && hasValue)
+			pathWork = argv[++i];
+		else if(arg == "--out" && hasValue)
+			pathOut = argv[++i];
+		else
+		{
+			cout << "render-microbench [--quick] [--filter KERNEL] [--work DIR] [--out FILE]" << endl;
+			cout << "Runs the CPU kernels of the sample path on generated inputs and reports ns per element and MB/s." << endl;
+			return 1;
+		}
+	}
+
+	// Models and labelling trees need a current context (hidden widget of the application format)
+	QApplication app(argc, argv);
+	QGLFormat glFormat;
+	glFormat.setVersion(4, 3);
+	glFormat.setProfile(QGLFormat::CoreProfile);
+	Sampler* context = new Sampler(NULL, glFormat);
+	context->setAttribute(Qt::WA_DontShowOnScreen);
+	context->show();
+	app.processEvents();
+	context->makeCurrent();
+	QDir().mkpath(pathWork.c_str());
+
+	cout << left << setw(18) << "kernel" << setw(22) << "input" << right
+		<< setw(12) << "elements" << setw(12) << "best ms" << setw(12) << "ns/elem" << setw(12) << "MB/s" << endl;
+
+	unsigned int meshes[] = { 10000, 100000, 1000000 };
+	unsigned int numMeshes = isQuick ? 2 : 3;
+	for(unsigned int i = 0; i < numMeshes; ++i)
+	{
+		if(isSelected("getGeometry"))
+			benchGeometry(pathWork, meshes[i]);
+		if(isSelected("updateBB"))
+			benchUpdateBB(pathWork, meshes[i]);
+	}
+	if(isSelected("addTreePartFace"))
+	{
+		benchTreePartFace(pathWork, 500);
+		if(!isQuick)
+			benchTreePartFace(pathWork, 2000);
+	}
+	if(isSelected("scanMask"))
+	{
+		benchScanMask(766, 0.1f);
+		benchScanMask(766, 0.5f);
+	}
+	if(isSelected("flipRows"))
+	{
+		benchFlipRows(512);
+		benchFlipRows(2048);
+		if(!isQuick)
+			benchFlipRows(4096);
+	}
+	if(isSelected("kps"))
+	{
+		benchKps(12, 766);
+		benchKps(64, 766);
+	}
+	if(isSelected("readSegmentation"))
+	{
+		benchSegmentation(1000);
+		if(!isQuick)
+			benchSegmentation(20000);
+	}
+
+	if(!pathOut.empty())
+	{
+		QJsonArray list;
+		for(unsigned int i = 0; i < results.size(); ++i)
+		{
+			QJsonObject result;
+			result["kernel"] = QString::fromStdString(results[i].kernel);
+			result["input"] = QString::fromStdString(results[i].input);
+			result["elements"] = results[i].elements;
+			result["bytes"] = results[i].bytes;
+			result["bestMs"] = results[i].seconds * 1e3;
+			result["nsPerElement"] = results[i].seconds * 1e9 / results[i].elements;
+			result["bytesPerSec"] = results[i].bytes / results[i].seconds;
+			list.append(result);
+		}
+		QJsonObject root;
+		root["kernels"] = list;
+		QFile file(pathOut.c_str());
+		if(file.open(QIODevice::WriteOnly))
+		{
+			file.write(QJsonDocument(root).toJson());
+			cout << "Results written to " << pathOut << endl;
+		}
+		else
+			cout << "Cannot create " << pathOut << endl;
+	}
+
+	delete context;
+	return 0;
+}
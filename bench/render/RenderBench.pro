@@ -0,0 +1,17 @@
+# End-to-end throughput benchmark (render-bench): generation pipeline on fixed workloads, see README.md
+TEMPLATE			 = app
+TARGET				 = render-bench
+LANGUAGE			 = C++
+CONFIG				+= qt thread warn_on console debug_and_release
+QT					+= core gui opengl widgets
+
+include(../../Render.pri)
+
+INCLUDEPATH			+=	..
+
+HEADERS				+=  ../BenchWorkloads.hpp
+
+SOURCES				+=	main.cpp \
+						../BenchWorkloads.cpp
+
+win32:LIBS			+=	-lpsapi
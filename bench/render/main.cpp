@@ -0,0 +1,272 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+#include <QApplication>
+#include <QDir>
+#include <QFile>
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <GL/glew.h>
+#include "rendering/Render.hpp"
+#include "rendering/Sampler.hpp"
+#include "rendering/TargetPool.hpp"
+#include "rendering/Trace.hpp"
+#include "BenchWorkloads.hpp"
+
+using namespace std;
+
+static void printUsage()
+{
+	cout << "render-bench [--quick] [--filter TEXT] [--models DIR] [--work DIR] [--out FILE]" << endl;
+	cout << "             [--baseline FILE] [--tolerance FRACTION] [--save-baseline FILE]" << endl;
+	cout << "Runs the generation pipeline on fixed workloads and writes samples/s, ms per stage, peak RSS (process-wide and growth per workload) and VRAM as JSON." << endl;
+	cout << "With --baseline, workloads slower than baseline * (1 - tolerance) are reported and the exit code is 2." << endl;
+}
+
+static QJsonObject readJson(const string& path)
+{
+	QFile file(path.c_str());
+	if(!file.open(QIODevice::ReadOnly))
+	{
+		cout << "Bench: cannot open " << path << endl;
+		return QJsonObject();
+	}
+	return QJsonDocument::fromJson(file.readAll()).object();
+}
+
+static bool writeJson(const string& path, const QJsonObject& object)
+{
+	QFile file(path.c_str());
+	if(!file.open(QIODevice::WriteOnly))
+	{
+		cout << "Bench: cannot create " << path << endl;
+		return false;
+	}
+	file.write(QJsonDocument(object).toJson());
+	return true;
+}
+
+static unsigned int countTriangles(Model* model)
+{
+	unsigned int triangles = 0;
+	for(unsigned int i = 0; i < model->getNumVisualEntities(); ++i)
+		triangles += model->getVisualEntity(i).getListFaceIndices().size();
+	return triangles;
+}
+
+// Bytes of the GPU buffers owned by the workload (mesh, atlas, sample target) when the driver does not report its memory
+static double estimateVideoMemoryMB(Model* model, Sampler* sampler)
+{
+	double bytes = 0.0;
+	for(unsigned int i = 0; i < model->getNumVisualEntities(); ++i)
+	{
+		Entity& entity = model->getVisualEntity(i);
+		bytes += sizeof(float) * 12.0 * entity.getListVertices().size() + sizeof(unsigned int) * 3.0 * entity.getListFaceIndices().size();
+	}
+	double atlas = TargetPool::roundUp(sampler->getWindowSize(), 32);
+	double target = TargetPool::roundUp(sampler->getSizeSample(), 32);
+	bytes += 4.0 * (atlas * atlas + target * target);
+	return bytes / (1024.0 * 1024.0);
+}
+
+int main(int argc, char* argv[])
+{
+	bool isQuick = false;
+	double tolerance = 0.10;
+	string filter, pathModels = "data/models", pathWork = QDir::tempPath().toStdString() + "/render-bench";
+	string pathOut = "bench-results.json", pathBaseline, pathSaveBaseline;
+	for(int i = 1; i < argc; ++i)
+	{
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if(arg == "--quick")
+			isQuick = true;
+		else if(arg == "--filter" && hasValue)
+			filter = argv[++i];
+		else if(arg == "--models" && hasValue)
+			pathModels = argv[++i];
+		else if(arg == "--work" && hasValue)
+			pathWork = argv[++i];
+		else if(arg == "--out" && hasValue)
+			pathOut = argv[++i];
+		else if(arg == "--baseline" && hasValue)
+			pathBaseline = argv[++i];
+		else if(arg == "--tolerance" && hasValue)
+			tolerance = atof(argv[++i]);
+		else if(arg == "--save-baseline" && hasValue)
+			pathSaveBaseline = argv[++i];
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+
+	QApplication app(argc, argv);
+
+	// Same widgets and GL format as the application, created without being shown on screen
+	QGLFormat glFormat;
+	glFormat.setVersion(4, 3);
+	glFormat.setProfile(QGLFormat::CoreProfile);
+	glFormat.setSampleBuffers(false);
+	glFormat.setSamples(64);
+	glFormat.setDepth(true);
+	glFormat.setDepthBufferSize(32);
+
+	Sampler* sampler = new Sampler(NULL, glFormat);
+	Sampler* depth = new Sampler(NULL, glFormat);
+	depth->setSizeSample(256);
+	depth->setNumSamples(1);
+	string pathOutput = pathWork + "/out";
+	string pathObj = pathModels;
+	Render* render = new Render(NULL, glFormat, sampler, depth, pathOutput, pathObj);
+	sampler->setAttribute(Qt::WA_DontShowOnScreen);
+	depth->setAttribute(Qt::WA_DontShowOnScreen);
+	render->setAttribute(Qt::WA_DontShowOnScreen);
+	sampler->resize(512, 512);
+	depth->resize(256, 256);
+	render->resize(766, 766);
+	sampler->show();
+	depth->show();
+	render->show();
+	app.processEvents();
+
+	QDir().mkpath(pathOutput.c_str());
+	render->makeCurrent();
+	string vramSource = "estimate";
+	int vramStart = getFreeVideoMemoryKB(vramSource);
+
+	QJsonObject baseline;
+	if(!pathBaseline.empty())
+		baseline = readJson(pathBaseline).value("workloads").toObject();
+
+	QJsonObject results, workloads;
+	results["date"] = QDateTime::currentDateTime().toString(Qt::ISODate);
+	results["quick"] = isQuick;
+	results["renderer"] = QString((const char*)glGetString(GL_RENDERER));
+	results["glVersion"] = QString((const char*)glGetString(GL_VERSION));
+
+	int numRegressions = 0;
+	vector<BenchWorkload> list = getBenchWorkloads(isQuick);
+	for(unsigned int idx = 0; idx < list.size(); ++idx)
+	{
+		const BenchWorkload& workload = list[idx];
+		if(!filter.empty() && workload.name.find(filter) == string::npos)
+			continue;
+
+		// Model (procedural meshes are generated once in the work folder)
+		string modelFile = workload.model.empty() ? createBenchMesh(pathWork, workload.triangles, workload.isTextured) : pathModels + "/" + workload.model;
+		render->makeCurrent();
+		double timeLoad = Trace::now();
+		if(modelFile.empty() || !render->loadModelFromFile(modelFile, render->getShader(TYPE_SHADER::PHONG)))
+		{
+			cout << "Bench: " << workload.name << " skipped, cannot load " << modelFile << endl;
+			continue;
+		}
+		timeLoad = (Trace::now() - timeLoad) / 1000.0;
+
+		// Atlas and viewpoints: numSamples azimuths over a full turn (step rounded up so the last one ends the turn)
+		sampler->makeCurrent();
+		sampler->setNumSamples(workload.grid);
+		sampler->updateSizeSample(workload.size);
+		render->makeCurrent();
+		sampler->setAngleX(15.0);
+		sampler->setDistance(1.6);
+		sampler->setTilt(0.0);
+
+		string pathSamples = pathOutput + "/" + workload.name;
+		QDir(pathSamples.c_str()).removeRecursively();
+		QDir().mkpath(pathSamples.c_str());
+
+		// Warm up: shaders, pooled targets and atlas texture of this size
+		unsigned int perAtlas = workload.grid * workload.grid;
+		sampler->setAngleY(360.0 / perAtlas + 1e-3);
+		sampler->resetCurrentAngleY();
+		sampler->setNumImg(1);
+		double peakStart = getPeakMemoryMB();
+		render->saveViewToImage(pathSamples);
+
+		sampler->setAngleY(360.0 / workload.numSamples + 1e-3);
+		sampler->resetCurrentAngleY();
+		vector<TraceStage> stages;
+		Trace::begin(pathWork + "/trace-" + workload.name + ".json");
+		double timeRun = Trace::now();
+		render->saveViewToImage(pathSamples);
+		render->flushOutputs();
+		timeRun = (Trace::now() - timeRun) / 1e6;
+		Trace::end(&stages);
+		render->closeAnnotations();
+
+		QJsonObject result;
+		double samplesPerSec = workload.numSamples / timeRun;
+		result["model"] = QString(workload.model.empty() ? "procedural" : workload.model.c_str());
+		result["triangles"] = (double)countTriangles(render->getModel());
+		result["textured"] = workload.isTextured;
+		result["grid"] = (int)workload.grid;
+		result["size"] = (int)workload.size;
+		result["samples"] = (int)workload.numSamples;
+		result["seconds"] = timeRun;
+		result["samplesPerSec"] = samplesPerSec;
+		result["loadModelMs"] = timeLoad;
+		// The peak RSS cannot be reset: the process-wide one only grows, the growth is what this workload raised it by
+		double peakEnd = getPeakMemoryMB();
+		result["processPeakRssMB"] = peakEnd;
+		result["peakRssGrowthMB"] = peakStart >= 0.0 && peakEnd >= 0.0 ? peakEnd - peakStart : -1.0;
+		int vramFree = getFreeVideoMemoryKB(vramSource);
+		result["vramMB"] = vramStart >= 0 && vramFree >= 0 ? (vramStart - vramFree) / 1024.0 : estimateVideoMemoryMB(render->getModel(), sampler);
+		result["vramSource"] = QString(vramSource.c_str());
+		QJsonObject stagesJson;
+		for(unsigned int i = 0; i < stages.size(); ++i)
+		{
+			QJsonObject stage;
+			stage["calls"] = (int)stages[i].count;
+			stage["totalMs"] = stages[i].total / 1000.0;
+			stage["selfMs"] = stages[i].self / 1000.0;
+			stage["msPerSample"] = stages[i].total / 1000.0 / workload.numSamples;
+			stagesJson[QString::fromStdString(stages[i].track + " " + stages[i].name).toLower()] = stage;
+		}
+		result["stages"] = stagesJson;
+
+		// Comparison with the stored baseline of the same workload
+		cout << "Bench: " << left << setw(20) << workload.name << right << fixed << setprecision(1) << setw(10) << samplesPerSec << " samples/s";
+		QJsonValue base = baseline.value(workload.name.c_str());
+		if(base.isObject())
+		{
+			double baseSamplesPerSec = base.toObject().value("samplesPerSec").toDouble();
+			double ratio = baseSamplesPerSec > 0.0 ? samplesPerSec / baseSamplesPerSec : 1.0;
+			result["baselineRatio"] = ratio;
+			cout << " (" << setprecision(2) << ratio << "x baseline";
+			if(ratio < 1.0 - tolerance)
+			{
+				cout << ", REGRESSION";
+				numRegressions++;
+			}
+			cout << ")";
+		}
+		cout << endl;
+		cout.unsetf(ios::floatfield);
+		cout << setprecision(6);
+		workloads[workload.name.c_str()] = result;
+
+		QDir(pathSamples.c_str()).removeRecursively();
+	}
+	results["workloads"] = workloads;
+
+	writeJson(pathOut, results);
+	cout << "Bench: results written to " << pathOut << endl;
+	if(!pathSaveBaseline.empty() && writeJson(pathSaveBaseline, results))
+		cout << "Bench: baseline saved to " << pathSaveBaseline << endl;
+	if(!pathBaseline.empty())
+		cout << "Bench: " << numRegressions << " workloads slower than the baseline by more than " << tolerance * 100.0 << "%" << endl;
+
+	render->makeCurrent();
+	delete render;
+	delete sampler;
+	delete depth;
+	return numRegressions > 0 ? 2 : 0;
+}
@@ -7,6 +7,7 @@ in vec2 texcoord;
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 ortho;
+uniform vec2 texScale; // used part of the texture
 
 out vec4 passColour;
 out vec2 passTexcoord;
@@ -14,6 +15,6 @@ out vec2 passTexcoord;
 void main()
 {
 	passColour = vec4(colour, 1.0);
-	passTexcoord = texcoord;
+	passTexcoord = texcoord * texScale;
     gl_Position = ortho * view * model * vec4(position, 0.0, 1.0);
 }
@@ -6,7 +6,7 @@ in float depth;
 
 // out vec4 outColour;
 layout (location = 0) out vec4 outColour;
-layout (location = 1) out vec4 outDepth;
+layout (location = 1) out vec2 outDepth; // depth, coverage
 
 uniform sampler2D tex;
 
@@ -15,5 +15,5 @@ void main()
 	vec4 texColour = texture(tex, passTexcoord);
 	vec3 mixColour = (passColour.rgb + texColour.a*texColour.rgb) / (1.0 + texColour.a);
 	outColour = vec4(mixColour, 1.0);
-	outDepth = vec4(1.0 - min(1.0, depth/10.0), 1.0 - min(1.0, depth/10.0), 1.0 - min(1.0, depth/10.0), 0.0);
+	outDepth = vec2(1.0 - min(1.0, depth/10.0), 0.0);
 }
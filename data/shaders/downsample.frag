@@ -0,0 +1,62 @@
+#version 330
+// Resolved scene filtered down to the sample: area average (box) by default, LANCZOS for a sharper 2-lobe Lanczos
+#define PI 3.14159265
+
+uniform sampler2D src;
+uniform vec2 scale; // source pixels per sample pixel (>= 1)
+uniform ivec2 srcSize; // used region of src (bottom-left corner)
+
+layout (location = 0) out vec4 outColour;
+
+#ifdef LANCZOS
+float lanczos(float x)
+{
+	if(abs(x) < 1e-5)
+		return 1.0;
+	if(abs(x) >= 2.0)
+		return 0.0;
+	float px = PI * x;
+	return 2.0 * sin(px) * sin(px / 2.0) / (px * px);
+}
+#endif
+
+void main()
+{
+	// Footprint of this pixel in the source
+	vec2 from = floor(gl_FragCoord.xy) * scale;
+	vec2 to = from + scale;
+	vec4 sum = vec4(0.0);
+	float sumWeights = 0.0;
+#ifdef LANCZOS
+	// Kernel stretched by the scale (2 lobes each side in sample pixels)
+	vec2 centre = (from + to) * 0.5;
+	ivec2 first = max(ivec2(0), ivec2(floor(centre - 2.0 * scale)));
+	ivec2 last = min(srcSize - 1, ivec2(ceil(centre + 2.0 * scale)));
+	for(int y = first.y; y <= last.y; ++y)
+	{
+		float wy = lanczos((float(y) + 0.5 - centre.y) / scale.y);
+		for(int x = first.x; x <= last.x; ++x)
+		{
+			float w = wy * lanczos((float(x) + 0.5 - centre.x) / scale.x);
+			sum += w * texelFetch(src, ivec2(x, y), 0);
+			sumWeights += w;
+		}
+	}
+	outColour = clamp(sum / sumWeights, 0.0, 1.0);
+#else
+	// Source pixels weighted by their overlap with the footprint
+	ivec2 first = ivec2(floor(from));
+	ivec2 last = min(srcSize - 1, ivec2(ceil(to)) - 1);
+	for(int y = first.y; y <= last.y; ++y)
+	{
+		float wy = min(to.y, float(y + 1)) - max(from.y, float(y));
+		for(int x = first.x; x <= last.x; ++x)
+		{
+			float w = wy * (min(to.x, float(x + 1)) - max(from.x, float(x)));
+			sum += w * texelFetch(src, ivec2(x, y), 0);
+			sumWeights += w;
+		}
+	}
+	outColour = sum / sumWeights;
+#endif
+}
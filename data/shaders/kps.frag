@@ -0,0 +1,13 @@
+#version 330
+
+in vec4 passColour;
+in float depth;
+
+layout (location = 0) out vec4 outColour;
+layout (location = 1) out vec2 outDepth; // depth, coverage
+
+void main()
+{
+	outColour = vec4(passColour.rgb, 1.0);
+	outDepth = vec2(1.0 - min(1.0, depth/10.0), 1.0);
+}
@@ -0,0 +1,24 @@
+#version 150
+
+in vec3 position;
+// per keypoint (instance) attributes
+in vec3 instPosition;
+in vec3 instScale;
+in vec4 instColour;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 proj;
+
+out vec4 passColour;
+out float depth;
+
+void main()
+{
+	passColour = instColour;
+
+	// Shared sphere placed and scaled per keypoint (instPosition already includes the sphere centre)
+	vec4 pos = proj * view * model * vec4(instScale*position + instPosition, 1.0);
+	depth = pos.z;
+    gl_Position = pos;
+}
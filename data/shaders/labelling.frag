@@ -1,15 +1,23 @@
 #version 330
 
 in float depth;
+in vec3 viewNormal;
 
 uniform vec3 labelColour;
 uniform float labelAlpha;
+uniform uint instanceId;
+uniform uint partId;
 
 layout (location = 0) out vec4 outColour;
-layout (location = 1) out vec4 outDepth;
+layout (location = 1) out vec2 outDepth; // depth, coverage
+layout (location = 2) out vec2 outNormal; // camera space x, y facing the camera
+layout (location = 3) out uvec2 outId; // instance, part
 
 void main()
 {
 	outColour = vec4(labelColour, 1.0);
-	outDepth = vec4(depth/10.0, depth/10.0, depth/10.0, 1.0);
+	outDepth = vec2(depth/10.0, 1.0);
+	vec3 viewN = normalize(viewNormal);
+	outNormal = viewN.z < 0.0 ? -viewN.xy : viewN.xy;
+	outId = uvec2(instanceId, partId);
 }
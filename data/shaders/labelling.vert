@@ -1,16 +1,20 @@
 #version 150
 
 in vec3 position;
+in vec3 normal;
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 proj;
+uniform mat3 normalMatrix;
 
 out float depth;
+out vec3 viewNormal;
 
 void main()
 {
 	vec4 pos = proj * view * model * vec4(position, 1.0);
 	depth = pos.z;
+	viewNormal = mat3(view) * normalMatrix * normal;
     gl_Position = pos;
 }
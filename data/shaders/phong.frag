@@ -1,53 +1,87 @@
 #version 330
-#define MAX_LIGHTS 8
+// Variants are compiled with defines after the version line (see Render::getPhongVariant):
+// NUM_LIGHTS (active lights packed first), UNTEXTURED (no texture lookup),
+// VERTEX_COLOUR or MATERIAL_COLOUR (ambient colour source, per vertex alpha without either), DEPTH_ONLY
+#ifndef NUM_LIGHTS
+#define NUM_LIGHTS 8
+#endif
+#if NUM_LIGHTS > 0
+#define LIGHT_SLOTS NUM_LIGHTS
+#else
+#define LIGHT_SLOTS 1
+#endif
 
+#ifndef DEPTH_ONLY
 in vec4  passColour;
 in vec2  passTexcoord;
 in vec4  eyeVertexPosition;
 in vec3  eyeNormal;
-in vec3  lightDir[MAX_LIGHTS];
+in vec3  viewNormal;
+in vec3  lightDir[LIGHT_SLOTS];
 in vec3  cameraVector;
-in float attenuation[MAX_LIGHTS];
+in float attenuation[LIGHT_SLOTS];
 in float depth;
 
 // lighting:
 uniform vec3 eyeLightPosition;
 uniform vec3 ambientLight;
-uniform vec3 diffuseLight[MAX_LIGHTS];
+uniform vec3 diffuseLight[LIGHT_SLOTS];
 uniform vec3 specularLight;
 
 // material:
+#ifndef UNTEXTURED
 uniform sampler2D tex;
+#endif
 uniform vec3      ambientMaterial;
 uniform vec3      diffuseMaterial;
 uniform vec3      specularMaterial;
 uniform float     shininessMaterial;
+#endif
 
 // out vec4 outColour;
 layout (location = 0) out vec4 outColour;
-layout (location = 1) out vec4 outDepth;
+layout (location = 1) out vec2 outDepth; // depth, coverage
+// extra outputs (only attached while requested, see Render::setOutputs):
+layout (location = 2) out vec2 outNormal; // camera space x, y facing the camera
+layout (location = 3) out uvec2 outId; // instance, part (label of the semantic tree, see Model::renderParts)
+uniform uint instanceId;
+uniform uint partId;
 
 void main()
 {
+#ifndef DEPTH_ONLY
     // PHONG LIGHTING
 	vec3 finalColour = vec3(0,0,0);
+#ifndef UNTEXTURED
 	vec3 partialTex = vec3(0,0,0);
 	vec4 texColour = texture(tex, passTexcoord);
+#endif
+#if defined(VERTEX_COLOUR)
+	vec3 ambientColour = passColour.rgb;
+#elif defined(MATERIAL_COLOUR)
+	vec3 ambientColour = passColour.rgb + ambientMaterial;
+#else
+	vec3 ambientColour = passColour.rgb;
+	if(passColour.a == 0.0)
+		ambientColour += ambientMaterial;
+#endif
 	vec3 N = normalize(eyeNormal); // normal
-	for(int i = 0; i < MAX_LIGHTS; ++i)
+	for(int i = 0; i < NUM_LIGHTS; ++i)
 	{
 		// -> AMBIENT LIGHT
-		finalColour += ambientLight*diffuseLight[i]*passColour.rgb;
-		if(passColour.a == 0.0)
-			finalColour += ambientLight*diffuseLight[i]*ambientMaterial;
+		finalColour += ambientLight*diffuseLight[i]*ambientColour;
+#ifndef UNTEXTURED
 		partialTex += ambientLight*diffuseLight[i]*texColour.rgb;
+#endif
 
 		// -> DIFFUSE LIGHT
 		vec3 L = normalize(lightDir[i]);
 		float lambertTerm = dot(N,L);
 		lambertTerm = max(0.0, lambertTerm);
 		finalColour += attenuation[i]*lambertTerm*diffuseLight[i]*diffuseMaterial; // / (MAX_LIGHTS/2);
+#ifndef UNTEXTURED
 		partialTex += attenuation[i]*lambertTerm*diffuseLight[i]*texColour.rgb; // / (MAX_LIGHTS/2);
+#endif
 		
 		// -> SPECULAR REFLECTION (NOT USED)
 		if(lambertTerm > 0.0)
@@ -56,15 +90,29 @@ void main()
 			vec3 E = normalize(cameraVector.xyz); // xzy
 			float specular = pow( max(dot(R,E), 0.0), shininessMaterial);
 			finalColour += attenuation[i]*specular*specularMaterial*specularLight; // / (MAX_LIGHTS/2);
+#ifndef UNTEXTURED
 			partialTex += attenuation[i]*specular*specularMaterial*specularLight; // / (MAX_LIGHTS/2);
+#endif
 		}
 	}
     
 	// FINAL RESULT
 	outColour = vec4(finalColour.rgb, 1.0);
 	// -> COLOUR
+#ifndef UNTEXTURED
 	if(texColour.a > 0.0)
 		outColour = vec4(partialTex.rgb, texColour.a);
+#endif
 	// -> DEPTH
-	outDepth = vec4(1.0 - min(1.0, depth/10.0), 1.0 - min(1.0, depth/10.0), 1.0 - min(1.0, depth/10.0), 1.0);
+	outDepth = vec2(1.0 - min(1.0, depth/10.0), 1.0);
+	// -> NORMAL
+	vec3 viewN = normalize(viewNormal);
+	outNormal = viewN.z < 0.0 ? -viewN.xy : viewN.xy;
+#else
+	// Depth only: colour writes are masked by the caller
+	outColour = vec4(1.0, 1.0, 1.0, 1.0);
+	outDepth = vec2(1.0, 1.0);
+	outNormal = vec2(0.0, 0.0);
+#endif
+	outId = uvec2(instanceId, partId);
 }
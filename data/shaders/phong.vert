@@ -1,43 +1,62 @@
 #version 150
-#define MAX_LIGHTS 8
+// Variants are compiled with defines after the version line (see Render::getPhongVariant):
+// NUM_LIGHTS (active lights packed first), DEPTH_ONLY (position only)
+#ifndef NUM_LIGHTS
+#define NUM_LIGHTS 8
+#endif
+#if NUM_LIGHTS > 0
+#define LIGHT_SLOTS NUM_LIGHTS
+#else
+#define LIGHT_SLOTS 1
+#endif
 
 in vec3 position;
 in vec4 colour;
 in vec2 texcoord;
 in vec3 normal;
 
+// Same position in every variant: the depth pre-pass (DEPTH_ONLY) is matched with GL_EQUAL
+// (GL_LEQUAL after an offset pre-pass with RENDER_DEPTH_PREPASS_OFFSET 1)
+invariant gl_Position;
+
 // scene transformations:
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 proj;
+uniform mat3 normalMatrix; // transpose(inverse(mat3(model))), once per object on the CPU
 
 // lighting:
-uniform vec3 lightPosition[MAX_LIGHTS];
+uniform vec3 lightPosition[LIGHT_SLOTS];
 uniform vec3 lightAttenuation;
 
+#ifndef DEPTH_ONLY
 out vec4 passColour;
 out vec2 passTexcoord;
 out vec4 eyeVertexPosition;
 out vec3 eyeNormal;
-out vec3 lightDir[MAX_LIGHTS];
+out vec3 viewNormal; // normal output (camera space)
+out vec3 lightDir[LIGHT_SLOTS];
 out vec3 cameraVector;
-out float attenuation[MAX_LIGHTS];
+out float attenuation[LIGHT_SLOTS];
 out float depth;
+#endif
 
 void main()
 {
+	vec4 worldPosition = model * vec4(position, 1.0);
+#ifndef DEPTH_ONLY
     // Eye space normal:
-	mat3 normalMatrix = transpose(inverse(mat3(model)));
-    eyeNormal = normalMatrix*(vec4(normal, 1.0)).xyz; // eyeNormal = normal;
+    eyeNormal = normalMatrix*normal;
+    viewNormal = mat3(view)*eyeNormal;
     // Eye space vertex position:
-    eyeVertexPosition = view * model * vec4(position, 1.0);
+    eyeVertexPosition = view * worldPosition;
 	// Calculate Camera vector with pixel
     cameraVector = -eyeVertexPosition.xyz;
     
-	for(int i = 0; i < MAX_LIGHTS; ++i)
+	for(int i = 0; i < NUM_LIGHTS; ++i)
 	{
 		// CALCULATE VERTEX<->LIGHT DIRECTIONS
-		lightDir[i] = vec3(lightPosition[i] - (model*vec4(position, 1.0)).xyz);
+		lightDir[i] = lightPosition[i] - worldPosition.xyz;
 		// LIGHT ATTENUATION
 		float d = length(lightDir[i]);
 		attenuation[i] = 1.0 / (lightAttenuation.x + lightAttenuation.y*d + lightAttenuation.z*d*d);
@@ -47,9 +66,12 @@ void main()
 	passTexcoord = texcoord;
 	// Pass vertex colour
 	passColour = colour;
+#endif
 
     // Projected vertex position used for the interpolation
-	vec4 pos = proj * view * model * vec4(position, 1.0);
+	vec4 pos = proj * view * worldPosition;
+#ifndef DEPTH_ONLY
 	depth = pos.z;
+#endif
     gl_Position = pos;
 }
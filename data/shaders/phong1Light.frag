@@ -24,7 +24,7 @@ uniform float     shininessMaterial;
 
 // out vec4 outColour;
 layout (location = 0) out vec4 outColour;
-layout (location = 1) out vec4 outDepth;
+layout (location = 1) out vec2 outDepth; // depth, coverage
 
 void main()
 {
@@ -47,5 +47,5 @@ void main()
 	vec4 texColour = texture(tex, passTexcoord);
 	vec3 mixColour = (finalColour.rgb + texColour.a*texColour.rgb) / (1.0 + texColour.a);
 	outColour = vec4(mixColour, 1.0);
-	outDepth = vec4(depth/10.0, depth/10.0, depth/10.0, 1.0);
+	outDepth = vec2(depth/10.0, 1.0);
 }
@@ -0,0 +1,15 @@
+#version 330
+// Multisample output read at sample 0 of the pixel under each sample pixel: depths, normals and ids of one surface, never averaged
+#ifdef INTEGER
+uniform usampler2DMS src;
+layout (location = 0) out uvec4 outColour;
+#else
+uniform sampler2DMS src;
+layout (location = 0) out vec4 outColour;
+#endif
+uniform vec2 scale; // source pixels per sample pixel (>= 1)
+
+void main()
+{
+	outColour = texelFetch(src, ivec2((floor(gl_FragCoord.xy) + 0.5) * scale), 0);
+}
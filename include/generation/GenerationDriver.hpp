@@ -0,0 +1,99 @@
+#ifndef GENERATIONDRIVER_HPP
+#define GENERATIONDRIVER_HPP
+
+#include <vector>
+#include <deque>
+#include <string>
+
+#include <QProcess>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+#include "generation/JobPlan.hpp"
+#include "io/RunManifest.hpp"
+
+// Tasks [firstTask, lastTask) handed to a worker: whole models, or a chunk of the views of a model too heavy for one worker
+struct WorkItem
+{
+	unsigned int firstTask, lastTask;
+	bool isSplit; // chunk of one model (not grouped with others), its annotation parts are merged in image order by the driver
+	float cost;
+	unsigned int numFailures; // workers stopped while running it
+};
+
+// Multi-process generation of a job file (Render --generate JOBFILE --workers N [--port P]): no GL in the driver,
+// each worker is a headless Render process with its own context (Render --worker JOBFILE ID ENCODERS).
+// - Before the workers start, the driver assigns the obj_ folders of all models in plan order (same as a serial run)
+// - Workers get contiguous runs of items and steal from the back of the most loaded queue once theirs is empty
+// - Each item is run under a new lease: the worker journals to manifest-wID-lLEASE.txt and writes its own shards
+//   (shard-wID-lLEASE-NUM.tar) and annotation parts (obj_N/annotations-cFIRST-wID-lLEASE.bin)
+// - Journals of stopped workers are appended to manifest.txt, their outputs are cut back to the journaled units
+//   (an annotation part by the worker taking its chunk over, shards at the end of the run)
+// - An item whose worker stops MAX_FAILURES times (a model crashing the importer...) is given up and reported,
+//   the run goes on with the others and is reported incomplete
+// - Once all items are done annotation parts are merged, so a later run (serial or not) resumes from them
+//   and images, annotations and their order are the ones of a serial run
+// With a port, workers of other machines join through Render --node (see GenerationNode) and get the same commands
+// over TCP, and refuse items whose plan checksum is not the one of their own plan. Without a line for LEASE_SECONDS (nodes send heartbeats while their worker runs and
+// stop it once silent for too long) the item goes to another worker and the lease is fenced: its journal is not read again, so what a stalled worker still writes is
+// cut off at the end of the run. Nodes need the job file at the same path and the output folders on a shared file system.
+class GenerationDriver
+{
+	public:
+
+		// Items queued per worker at the start (smaller items balance better, each one reloads its first model)
+		static const unsigned int ITEMS_PER_WORKER = 8;
+		// Longest time without progress of a worker (covers the load of a heavy model)
+		static const unsigned int LEASE_SECONDS = 120;
+		// Stopped workers per item before it is given up
+		static const unsigned int MAX_FAILURES = 3;
+
+		GenerationDriver();
+		~GenerationDriver();
+
+		// numWorkers local processes (0 without port: a quarter of the cores, rendering is bound by the GPU)
+		bool run(const std::string& jobFile, unsigned int numWorkers = 0, unsigned short port = 0);
+
+	private:
+
+		struct Worker
+		{
+			QProcess* process; // local worker
+			QTcpSocket* socket; // worker of a node
+			QIODevice* channel; // commands and answers of either
+			std::deque<unsigned int> items;
+			int current; // item being generated (-1: idle)
+			unsigned int lease; // lease of the current item
+			bool isAlive, isReady; // ready: waits for commands (started and not told to quit)
+			double lastSeen; // last line received or item assigned (lease of the remote workers)
+			unsigned int numDone, numStolen;
+			Worker() : process(NULL), socket(NULL), channel(NULL), current(-1), lease(0), isAlive(false), isReady(false), lastSeen(0.0), numDone(0), numStolen(0) {}
+		};
+
+		std::string jobFile;
+		JobPlan plan;
+		std::vector<WorkItem> items;
+		std::deque<unsigned int> orphans; // items without local owner or of stopped workers, taken before stealing
+		std::vector<Worker> workers;
+		unsigned int numDone, numFailed, numLeases;
+		unsigned int planHash; // JobPlan::getHash, sent with every item
+		std::vector<std::string> fenced; // journals of the leases taken away from stopped workers
+		QTcpServer server;
+
+		void splitItems(unsigned int numWorkers, unsigned int numExpected);
+		bool prepareOutputs();
+		void mergeOutputs(bool isComplete);
+		void foldJournal(const std::string& savePath, unsigned int idxWorker, unsigned int lease);
+		void mergeAnnotationParts(const std::string& objDir, RunManifest& manifest);
+
+		bool startWorkers(unsigned int numWorkers);
+		void acceptWorkers();
+		void readWorker(unsigned int idxWorker);
+		void assignItem(unsigned int idxWorker);
+		bool isFinished() { return numDone + numFailed == items.size(); }
+		bool isIdle(unsigned int idxWorker) { return workers[idxWorker].isAlive && workers[idxWorker].isReady && workers[idxWorker].current < 0; }
+		int takeItem(unsigned int idxWorker);
+		void lostWorker(unsigned int idxWorker);
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef GENERATIONNODE_HPP
+#define GENERATIONNODE_HPP
+
+#include <vector>
+#include <string>
+
+#include <QProcess>
+#include <QTcpSocket>
+
+// Machine joining a generation coordinator (Render --node HOST:PORT --workers N, see GenerationDriver):
+// one connection and one headless Render --worker per link, lines relayed both ways.
+// Heartbeats keep the lease of the item of a worker while its process runs. A worker without a line for stallSeconds
+// (@PROGRESS after each rendered view, unit and model load) is stopped: once its heartbeats end the item is handed over.
+class GenerationNode
+{
+	public:
+
+		static const unsigned int HEARTBEAT_SECONDS = 5;
+		static const unsigned int STALL_SECONDS = 1800;
+
+		GenerationNode();
+		~GenerationNode();
+
+		// numWorkers 0: a quarter of the cores
+		bool run(const std::string& host, unsigned short port, unsigned int numWorkers = 0, unsigned int stallSeconds = STALL_SECONDS);
+
+	private:
+
+		struct Link
+		{
+			QTcpSocket* socket;
+			QProcess* process;
+			bool isActive;
+			bool isBusy; // item running
+			double lastProgress; // last line of the worker
+			Link() : socket(NULL), process(NULL), isActive(false), isBusy(false), lastProgress(0.0) {}
+		};
+
+		std::vector<Link> links;
+
+		bool startLink(Link& link, const std::string& host, unsigned short port, unsigned int numEncoders);
+		void closeLink(Link& link);
+};
+
+#endif
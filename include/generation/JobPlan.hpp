@@ -0,0 +1,93 @@
+#ifndef JOBPLAN_HPP
+#define JOBPLAN_HPP
+
+#include <vector>
+#include <string>
+
+#include "generation/ViewSampler.hpp"
+
+// Generation parameters of one class (block of a job file or the script tab of the GUI)
+struct JobClass
+{
+	std::string name;
+	std::string modelDir, outputDir, ext;
+	std::string backgroundDir;
+	unsigned int numBackgrounds;
+
+	// Random samples (isRandom) or full azimuth turns per tilt x elevation x distance
+	bool isRandom, isRange;
+	std::vector<float> azimuths, elevations, tilts, distances;
+	float azStep, step;
+	unsigned int numSamplesModel;
+	VIEW_SAMPLING sampling;
+	unsigned int sizeSample, gridSamples; // atlas, 0 keeps the GUI values
+	unsigned int superSampling, msaa; // scene render size (x largest sample) and MSAA samples, 0 keeps the config values
+	unsigned int outputs; // images saved with each atlas besides the colour (mask of 1 << OUTPUT_TYPE)
+
+	bool isKpsNoAz, isKpsNoSelfOcc;
+	int roundFrom; // models from this folder index on (all subfolders counted) are rounded: no tilt, no azimuth keypoints, no scaling (-1: none)
+	bool isRound; // set by JobPlan::getModelParams
+	bool isShards;
+	unsigned int shardSizeMB;
+
+	// Filled by JobPlan::expand from the model catalog (model folder names and files, same order as the folders)
+	std::vector<std::string> models, modelFiles;
+	std::vector<unsigned int> modelTriangles, modelFolders;
+
+	JobClass();
+	std::string describe() const;
+};
+
+// One unit of work: images of a (model, view config) pair journaled together in the manifest
+struct RenderTask
+{
+	unsigned int idxClass, idxModel;
+	unsigned int idxSample; // random sample or index of the tilt x elevation x distance unit
+	std::string unitKey;
+	float tilt, elevation, distance;
+	unsigned int numRenders;
+	float cost;
+};
+
+// Declarative job (text file, see data/jobs) expanded up front into a flat list of tasks for an executor
+class JobPlan
+{
+	public:
+
+		JobPlan();
+
+		bool load(const std::string& path);
+		void addClass(const JobClass& job) { classes.push_back(job); }
+		bool expand();
+
+		void setSeed(unsigned long long newSeed) { seed = newSeed; }
+		unsigned long long getSeed() { return seed; }
+		std::vector<JobClass>& getClasses() { return classes; }
+		std::vector<RenderTask>& getTasks() { return tasks; }
+		float getTotalCost() { return totalCost; }
+
+		// Parameters of a model (class parameters with the rounded model exceptions)
+		JobClass getModelParams(unsigned int idxClass, unsigned int idxModel);
+		// Manifest key of the class configuration
+		std::string getRunKey(unsigned int idxClass);
+		// Checksum of the catalogued models and the task list: processes running task indices of the same plan agree on it
+		unsigned int getHash();
+
+		// Relative cost of a task: renders weighted by read back pixels and triangles (1 = one 512x512 sample of a light model)
+		static float estimateCost(unsigned int numRenders, unsigned int sizeSample, unsigned int numTriangles = 0);
+		// Relative cost of loading a model (paid by the first task of the model on a worker)
+		static float estimateLoadCost(unsigned int numTriangles);
+		// Output folder of a class with the README.txt describing its files
+		static bool prepareOutput(const JobClass& job);
+
+	private:
+
+		unsigned long long seed;
+		std::vector<JobClass> classes;
+		std::vector<RenderTask> tasks;
+		float totalCost;
+
+		bool setKey(JobClass& job, const std::string& key, const std::string& value);
+};
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef SAMPLERNG_HPP
+#define SAMPLERNG_HPP
+
+// Independent streams of a sample: adding draws to one of them does not change the others
+enum RNG_STREAM { RNG_SIZE, RNG_VIEW, RNG_BACKGROUND, RNG_LIGHTS, RNG_SCALE, RNG_PATTERN };
+
+// Counter-based generator (SplitMix64 finaliser over key + counter): value i of sample (seed, model, sample, stream)
+// only depends on those numbers, so any worker can regenerate a sample without the serial rand() sequence.
+class SampleRng
+{
+	public:
+
+		SampleRng(unsigned long long seed, unsigned int model, unsigned int sample, unsigned int stream = 0);
+
+		// Random access to the values of the stream
+		unsigned long long at(unsigned long long counter) { return mix(key + (counter + 1) * GOLDEN); }
+		unsigned long long next() { return at(counter++); }
+
+		float uniform() { return (float)(next() >> 40) * (1.0f / 16777216.0f); } // [0, 1)
+		float uniform(float min, float max) { return min + uniform() * (max - min); }
+		unsigned int integer(unsigned int n) { return (unsigned int)(((next() >> 32) * n) >> 32); } // [0, n)
+
+		static unsigned long long mix(unsigned long long x);
+
+	private:
+
+		static const unsigned long long GOLDEN = 0x9E3779B97F4A7C15ULL;
+		unsigned long long key, counter;
+};
+
+#endif
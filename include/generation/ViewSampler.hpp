@@ -0,0 +1,88 @@
+#ifndef VIEWSAMPLER_HPP
+#define VIEWSAMPLER_HPP
+
+#include <vector>
+
+#include "generation/SampleRng.hpp"
+
+struct RangeView
+{
+	RangeView(int minA, int maxA, int minE, int maxE) { minAzimuth = minA; maxAzimuth = maxA; minElevation = minE; maxElevation = maxE; }
+	int minAzimuth, maxAzimuth;
+	int minElevation, maxElevation;
+};
+
+// How the samples of a model cover the view space:
+// - RANDOM: independent uniform values
+// - STRATIFIED: one sample per stratum of each dimension (latin hypercube, strata shuffled per model)
+// - HALTON: Halton sequence (bases 2, 3, 5, 7) rotated per model
+// - FIBONACCI: Fibonacci lattice for azimuth x elevation (equal area on the sphere), Halton for tilt and distance
+enum VIEW_SAMPLING { VIEW_RANDOM, VIEW_STRATIFIED, VIEW_HALTON, VIEW_FIBONACCI };
+
+struct ViewSample
+{
+	float azimuth, elevation, tilt, distance;
+};
+
+// Values of one dimension: union of segments, mapped from [0, 1) in constant time through a guide table
+class ViewDomain
+{
+	public:
+
+		ViewDomain();
+
+		void setRange(float min, float max);
+		// Values within halfWidth of a listed value (discrete angles with tolerance), clipped to [min, max]
+		void setIntervals(const std::vector<float>& values, float min, float max, float halfWidth, bool isCircular);
+		// Density proportional to cos(angle) (equal area for elevations)
+		void setSphere(bool sphere) { isSphere = sphere; build(); }
+
+		float map(float u) const;
+		bool isEmpty() const { return segments.empty(); }
+
+	private:
+
+		struct Segment
+		{
+			float min, max;
+		};
+		std::vector<Segment> segments; // zero width segments only: uniform choice among their values
+		bool isSphere;
+
+		std::vector<float> cumWeights;
+		std::vector<unsigned int> guide;
+		void build();
+};
+
+class ViewSampler
+{
+	public:
+
+		ViewSampler();
+
+		// numSamples: samples per model (strata and lattice size), key: per model rotation/shuffle of the pattern
+		void setMode(VIEW_SAMPLING mode, unsigned int numSamples, unsigned int key);
+		// Constraints on (azimuth, elevation) of the views table, chosen by area
+		void setViews(const std::vector<RangeView>& views, bool isAzimuth, bool isElevation);
+
+		ViewDomain& getAzimuth() { return azimuth; }
+		ViewDomain& getElevation() { return elevation; }
+		ViewDomain& getTilt() { return tilt; }
+		ViewDomain& getDistance() { return distance; }
+
+		ViewSample sample(SampleRng& rng, unsigned int idxSample);
+
+	private:
+
+		VIEW_SAMPLING mode;
+		unsigned int numSamples, key;
+		ViewDomain azimuth, elevation, tilt, distance;
+
+		std::vector<RangeView> views;
+		std::vector<float> cumViews;
+		bool isViewAzimuth, isViewElevation;
+
+		void getPattern(SampleRng& rng, unsigned int idxSample, float* u);
+};
+
+#endif
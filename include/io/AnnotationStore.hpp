@@ -0,0 +1,122 @@
+#ifndef ANNOTATIONSTORE_HPP
+#define ANNOTATIONSTORE_HPP
+
+#include <vector>
+#include <string>
+#include <map>
+#include <fstream>
+
+// Keypoint of a sample: row/col in the atlas image (Matlab notation [1..size]) and visibility (1 visible, 0 occluded, -1 truncated)
+struct KpsAnnotation
+{
+	std::string name;
+	float row, col;
+	int vis;
+	KpsAnnotation(const std::string& pName = "", float pRow = 0.0f, float pCol = 0.0f, int pVis = 0) : name(pName), row(pRow), col(pCol), vis(pVis) {}
+};
+
+// One rendered sample (same information as a line of the legacy annotations.txt plus the model)
+struct AnnotationRecord
+{
+	std::string image, model;
+	int top, left, height, width;
+	float azimuth, elevation, tilt, distance;
+	std::vector<KpsAnnotation> kps;
+	AnnotationRecord() : top(0), left(0), height(0), width(0), azimuth(0.0f), elevation(0.0f), tilt(0.0f), distance(0.0f) {}
+};
+
+// Binary annotation file (little endian, native floats):
+// - Header: "RANN" + version
+// - Blocks of up to RECORDS_PER_BLOCK records: strings first seen in the block + one array per field (columnar)
+// - Footer: block index (offset, first record, number of records) + trailer pointing to it
+// Blocks are self-contained, so a file without footer (interrupted run) can still be read and appended.
+class AnnotationStore
+{
+	public:
+
+		static const unsigned int VERSION = 1;
+		static const unsigned int RECORDS_PER_BLOCK = 4096;
+
+		struct BlockInfo
+		{
+			unsigned long long offset;
+			unsigned int firstRecord, numRecords;
+		};
+
+		// Read the index of a store (scanning the blocks if the footer is missing)
+		static bool readIndex(std::ifstream& file, std::vector<BlockInfo>& blocks, std::vector<std::string>& strings, unsigned long long& endOffset);
+		// End of the blocks of a store (0 if there is none)
+		static unsigned long long getLength(const std::string& path);
+		// Drop the blocks after bytes (written after the last manifest commit) and write the index of the others
+		static bool truncate(const std::string& path, unsigned long long bytes);
+};
+
+// Buffered writer: one per output file and run, blocks are written when full or on close
+class AnnotationWriter
+{
+	public:
+
+		AnnotationWriter();
+		~AnnotationWriter();
+
+		// Opens a store, new records are appended to the existing ones
+		bool open(const std::string& path);
+		void write(const AnnotationRecord& record);
+		void flush();
+		void close();
+
+		bool isOpen() { return file.is_open(); }
+		const std::string& getPath() { return path; }
+		// End of the flushed blocks (buffered records are not counted)
+		unsigned long long getLength() { return file.is_open() ? (unsigned long long)file.tellp() : 0; }
+
+	private:
+
+		std::string path;
+		std::fstream file;
+		std::vector<AnnotationStore::BlockInfo> blocks;
+		unsigned int numRecords;
+
+		// String table (image, model and keypoint names)
+		std::map<std::string, unsigned int> stringIds;
+		unsigned int numStrings;
+		std::vector<std::string> newStrings;
+		unsigned int getStringId(const std::string& str);
+
+		// Columns of the current block
+		std::vector<unsigned int> colImage, colModel, colNumKps;
+		std::vector<int> colTop, colLeft, colHeight, colWidth;
+		std::vector<float> colAzimuth, colElevation, colTilt, colDistance;
+		std::vector<unsigned int> colKpsName;
+		std::vector<float> colKpsRow, colKpsCol;
+		std::vector<signed char> colKpsVis;
+		void clearColumns();
+		void writeFooter();
+};
+
+class AnnotationReader
+{
+	public:
+
+		AnnotationReader();
+		~AnnotationReader();
+
+		bool open(const std::string& path);
+		void close() { file.close(); }
+
+		unsigned int getNumBlocks() { return blocks.size(); }
+		unsigned int getNumRecords() { return blocks.empty() ? 0 : blocks.back().firstRecord + blocks.back().numRecords; }
+		bool readBlock(unsigned int idxBlock, std::vector<AnnotationRecord>& records);
+
+		// Legacy annotations.txt layout
+		static std::string toText(const AnnotationRecord& record);
+		static bool convertToText(const std::string& pathIn, const std::string& pathOut);
+
+	private:
+
+		std::ifstream file;
+		std::vector<AnnotationStore::BlockInfo> blocks;
+		std::vector<std::string> strings;
+};
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef BOUNDEDQUEUE_HPP
+#define BOUNDEDQUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+
+#include <QThread>
+
+// Bounded lock-free queue for any number of producers and consumers (ring of sequenced cells, D. Vyukov).
+// A cell is free for the producer of ticket t when its sequence is t and holds an item for the consumer when it is t+1.
+// Blocking push()/pop() back off (spin, yield, then sleep) instead of waiting on a lock.
+template<typename T>
+class BoundedQueue
+{
+	public:
+
+		// Capacity rounded up to a power of two
+		BoundedQueue(unsigned int minCapacity = 16)
+		{
+			capacity = 2;
+			while(capacity < minCapacity)
+				capacity *= 2;
+			cells = new Cell[capacity];
+			for(size_t i = 0; i < capacity; ++i)
+				cells[i].sequence.store(i, std::memory_order_relaxed);
+			enqueuePos.store(0, std::memory_order_relaxed);
+			dequeuePos.store(0, std::memory_order_relaxed);
+			isClosed.store(false);
+		}
+		~BoundedQueue() { delete[] cells; }
+
+		bool tryPush(const T& value)
+		{
+			size_t pos = enqueuePos.load(std::memory_order_relaxed);
+			for(;;)
+			{
+				Cell& cell = cells[pos & (capacity - 1)];
+				size_t sequence = cell.sequence.load(std::memory_order_acquire);
+				ptrdiff_t diff = (ptrdiff_t)sequence - (ptrdiff_t)pos;
+				if(diff == 0)
+				{
+					if(enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					{
+						cell.data = value;
+						cell.sequence.store(pos + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if(diff < 0)
+					return false; // full
+				else
+					pos = enqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+
+		bool tryPop(T& value)
+		{
+			size_t pos = dequeuePos.load(std::memory_order_relaxed);
+			for(;;)
+			{
+				Cell& cell = cells[pos & (capacity - 1)];
+				size_t sequence = cell.sequence.load(std::memory_order_acquire);
+				ptrdiff_t diff = (ptrdiff_t)sequence - (ptrdiff_t)(pos + 1);
+				if(diff == 0)
+				{
+					if(dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					{
+						value = cell.data;
+						cell.sequence.store(pos + capacity, std::memory_order_release);
+						return true;
+					}
+				}
+				else if(diff < 0)
+					return false; // empty
+				else
+					pos = dequeuePos.load(std::memory_order_relaxed);
+			}
+		}
+
+		void push(const T& value)
+		{
+			for(unsigned int spin = 0; !tryPush(value); ++spin)
+				backoff(spin);
+		}
+
+		// Waits for an item, false once the queue is closed and empty
+		bool pop(T& value)
+		{
+			for(unsigned int spin = 0; !tryPop(value); ++spin)
+			{
+				if(isClosed.load() && size() == 0)
+					return tryPop(value);
+				backoff(spin);
+			}
+			return true;
+		}
+
+		// No more pushes: consumers leave pop() once the remaining items are taken
+		void close() { isClosed.store(true); }
+		void reopen() { isClosed.store(false); }
+
+		// Items in the queue (approximate while other threads push or pop)
+		unsigned int size()
+		{
+			size_t tail = dequeuePos.load(std::memory_order_relaxed);
+			size_t head = enqueuePos.load(std::memory_order_relaxed);
+			return head > tail ? (unsigned int)(head - tail) : 0;
+		}
+		unsigned int getCapacity() { return (unsigned int)capacity; }
+
+		static void backoff(unsigned int spin)
+		{
+			if(spin < 16)
+				return;
+			else if(spin < 64)
+				QThread::yieldCurrentThread();
+			else
+				QThread::usleep(200);
+		}
+
+	private:
+
+		struct Cell
+		{
+			std::atomic<size_t> sequence;
+			T data;
+		};
+
+		// Producer and consumer positions on their own cache lines
+		Cell* cells;
+		size_t capacity;
+		char padding0[64];
+		std::atomic<size_t> enqueuePos;
+		char padding1[64];
+		std::atomic<size_t> dequeuePos;
+		char padding2[64];
+		std::atomic<bool> isClosed;
+
+		BoundedQueue(const BoundedQueue&);
+		BoundedQueue& operator=(const BoundedQueue&);
+};
+
+#endif
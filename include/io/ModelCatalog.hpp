@@ -0,0 +1,63 @@
+#ifndef MODELCATALOG_HPP
+#define MODELCATALOG_HPP
+
+#include <vector>
+#include <string>
+#include <atomic>
+
+// Model folder of a class: first 3D file with the extension and what generation needs to know before loading it
+struct CatalogEntry
+{
+	std::string model, file; // folder name and file name in it
+	unsigned int folder; // index of the folder among all subfolders of the class (folders without a model included)
+	std::string format; // lower case extension
+	unsigned long long fileSize;
+	unsigned int numVertices, numTriangles; // 0 when unknown (fbx)
+	unsigned int numMaterials, numTextures;
+	float bbMin[3], bbMax[3];
+	bool hasKps, hasSegmentation; // .kps and .seg files next to the model file
+	CatalogEntry();
+};
+
+// Index of the model folders of a class folder (tab separated line per model in folder order), kept in the output
+// folder of the class (catalog-HASH.txt, named after the class folder) so dataset folders are never written.
+// Built once in parallel (models are read by several threads: .obj by a line scan, other formats through assimp)
+// and reused while the class folder keeps its modification time, so runs start without listing every model folder.
+// Models edited in place are not detected: Render --build-catalog MODELDIR EXT OUTPUTDIR rebuilds it.
+class ModelCatalog
+{
+	public:
+
+		static const unsigned int VERSION = 2;
+
+		ModelCatalog();
+
+		// Catalog of the folder for the extension saved in cacheDir (false if missing or outdated)
+		bool load(const std::string& modelDir, const std::string& ext, const std::string& cacheDir);
+		// Scans the model folders with numThreads threads (0: all cores) and saves the catalog in cacheDir
+		bool build(const std::string& modelDir, const std::string& ext, const std::string& cacheDir, unsigned int numThreads = 0);
+		bool save();
+
+		std::vector<CatalogEntry>& getEntries() { return entries; }
+		std::string getModelPath(unsigned int idxEntry) { return dir + "/" + entries[idxEntry].model + "/" + entries[idxEntry].file; }
+
+		// Counts, bounding box and side files of one model (entry with model and file set)
+		static bool scanModel(const std::string& modelDir, CatalogEntry& entry);
+
+		// Worker threads of build()
+		void runScan();
+
+	private:
+
+		std::string dir, ext, cacheDir;
+		long long dirModified;
+		std::vector<CatalogEntry> entries;
+		std::atomic<unsigned int> nextEntry;
+
+		std::string getPath();
+		static long long getModified(const std::string& path);
+		static bool scanObj(const std::string& path, CatalogEntry& entry);
+		static bool scanAssimp(const std::string& path, CatalogEntry& entry);
+};
+
+#endif
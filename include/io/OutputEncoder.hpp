@@ -0,0 +1,36 @@
+#ifndef OUTPUTENCODER_HPP
+#define OUTPUTENCODER_HPP
+
+#include <vector>
+#include <string>
+
+// Images rendered in the same pass as the colour atlas (MRT attachments of the scene framebuffer)
+enum OUTPUT_TYPE { OUTPUT_DEPTH, OUTPUT_NORMAL, OUTPUT_INSTANCE, OUTPUT_PART, NUM_OUTPUTS };
+
+// Atlas of one output as read back (OpenGL row order, same layout as the colour atlas):
+// depth 1 x uint16 (outDepth of the shaders), normal 2 x int16 (view space x, y), instance and part 1 x uint16 (0: background)
+struct OutputAtlas
+{
+	unsigned int type;
+	std::vector<unsigned short> data;
+	std::vector<unsigned char> png;
+	OutputAtlas(unsigned int pType = OUTPUT_DEPTH) : type(pType) {}
+};
+
+// 16 bits PNG encoding of the outputs: grey for depth and ids, RGB for normals (z rebuilt, facing the camera)
+class OutputEncoder
+{
+	public:
+
+		static const char* getName(unsigned int type);
+		static unsigned int getChannels(unsigned int type) { return type == OUTPUT_NORMAL ? 2 : 1; }
+		// Mask (bit 1 << type) of a list of names, e.g. "DEPTH NORMAL INSTANCE PART"
+		static unsigned int parseMask(const std::string& names);
+
+		static void encode(const OutputAtlas& atlas, int size, std::vector<unsigned char>& png);
+		// File of an output next to its colour image (img3.png -> img3_depth.png) and its shard member extension
+		static std::string getPath(const std::string& imgPath, unsigned int type);
+		static std::string getExt(unsigned int type) { return std::string(getName(type)) + ".png"; }
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef RUNMANIFEST_HPP
+#define RUNMANIFEST_HPP
+
+#include <vector>
+#include <string>
+#include <map>
+#include <fstream>
+
+// Completed unit of a run: images [firstImg, firstImg+numImgs) of a model with the checksum of their pixels and annotations
+struct ManifestUnit
+{
+	unsigned int firstImg, numImgs;
+	unsigned int checksum;
+	ManifestUnit(unsigned int pFirst = 0, unsigned int pNum = 0, unsigned int pChecksum = 0) : firstImg(pFirst), numImgs(pNum), checksum(pChecksum) {}
+};
+
+// Append-only journal of a script run (manifest.txt in the output folder), tab separated lines:
+// - MODEL name objIdx: output folder obj_objIdx assigned to a model folder
+// - UNIT name unitKey firstImg numImgs crc32: finished (model, view config) unit
+// - OFFSET file bytes: length of an output file (annotation store, shard) holding exactly the finished units
+// - COMMIT: end of a group of UNIT and OFFSET lines, a group cut before it is ignored (ABORT marks it for the lines after)
+// Finished units are kept pending until commit(), which is called once the outputs have been flushed to disk.
+// Restarted runs load the journal, skip the finished units and new models get the next free obj_ folders;
+// output files are cut back to their committed length (see getOffsets) before anything is appended to them.
+class RunManifest
+{
+	public:
+
+		RunManifest();
+		~RunManifest();
+
+		bool open(const std::string& path);
+		// Replay another journal too (e.g. the one of the whole run from a worker journaling into its own), true if its last line is cut
+		bool load(const std::string& path);
+		void close();
+		bool isOpen() { return file.is_open(); }
+		unsigned int getNumDone() { return units.size(); }
+
+		// Output folder index of a model (recorded one or the next free)
+		unsigned int addModel(const std::string& model);
+
+		bool isDone(const std::string& model, const std::string& unit);
+		const ManifestUnit& getUnit(const std::string& model, const std::string& unit) { return units[model + "\t" + unit]; }
+		void markDone(const std::string& model, const std::string& unit, const ManifestUnit& info);
+		unsigned int getNumPending() { return pending.size(); }
+		// Length of an output file once the pending units are on disk, journaled by the next commit
+		void setOffset(const std::string& path, unsigned long long bytes);
+		void commit();
+
+		// Committed length of the output files (full paths)
+		std::map<std::string, unsigned long long> getOffsets();
+		bool getOffset(const std::string& path, unsigned long long& bytes);
+		// Cut the output files back to their committed length (nothing else may be writing them)
+		void truncateOutputs();
+
+		static unsigned int crc32(const unsigned char* data, size_t size, unsigned int crc = 0);
+		// Journal of a worker appended to the one of the run
+		static bool append(const std::string& path, const std::string& partPath);
+
+	private:
+
+		std::ofstream file;
+		std::string dir; // folder of the journal, OFFSET files are relative to it
+		std::map<std::string, unsigned int> models;
+		unsigned int nextObj;
+		std::map<std::string, ManifestUnit> units;
+		std::vector<std::string> pending;
+		std::map<std::string, unsigned long long> offsets, pendingOffsets;
+		bool isGroupOpen; // last group of the loaded journal without COMMIT
+};
+
+#endif
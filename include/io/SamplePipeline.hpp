@@ -0,0 +1,87 @@
+#ifndef SAMPLEPIPELINE_HPP
+#define SAMPLEPIPELINE_HPP
+
+#include <vector>
+#include <string>
+#include <atomic>
+
+#include <QThread>
+
+#include "io/BoundedQueue.hpp"
+#include "io/AnnotationStore.hpp"
+#include "io/ShardWriter.hpp"
+#include "io/OutputEncoder.hpp"
+
+// Image of samples on its way to disk (buffers keep their capacity through the free list)
+struct SampleJob
+{
+	unsigned long long sequence;
+	std::string path; // png file, or member key in the shards
+	bool isShard;
+	int size;
+	std::vector<unsigned char> atlas; // size x size RGBA in OpenGL row order
+	std::vector<OutputAtlas> outputs; // extra images of the samples (depth, normals, ids), same size
+	std::vector<AnnotationRecord> annotations;
+	std::string text;
+	std::vector<unsigned char> png;
+};
+
+// Work of a stage over a run: busy time of its threads and occupancy of its input queue (sampled by its single producer or consumer)
+struct PipelineStage
+{
+	std::string name;
+	unsigned int numThreads;
+	std::atomic<unsigned long long> busyUs, items;
+	unsigned long long occupancySum, occupancySamples;
+	unsigned int occupancyMax, capacity;
+	PipelineStage() : numThreads(0), occupancySum(0), occupancySamples(0), occupancyMax(0), capacity(0) { busyUs = 0; items = 0; }
+};
+
+// Output stages of the generation after the read back, each with its own threads:
+// render thread (prepare, render, read back, checksum) -> encode (PNGs, N threads) -> write (files/shards and annotations, 1 thread)
+// Jobs are written in submission order, so files, shards and annotation stores are the same as without the pipeline.
+// The number of jobs bounds the images in flight: the render thread waits on the free list when a later stage is slower.
+class SamplePipeline
+{
+	public:
+
+		static const unsigned int MAX_JOBS = 64;
+
+		SamplePipeline();
+		~SamplePipeline();
+
+		// Encoding threads (0: the cores left by the render and write threads) and images in flight
+		void start(AnnotationWriter* pAnnotations, ShardWriter* pShards, unsigned int numEncoders = 0, unsigned int numJobs = 8);
+		// Drains, joins the threads and prints the stage summary
+		void stop();
+		bool isRunning() { return !workers.empty(); }
+
+		// Render thread: free job (waits while all are in flight), handed over in submission order
+		SampleJob* acquire();
+		void submit(SampleJob* job);
+		// Waits until every submitted job is written (before the writers are flushed, closed or reopened)
+		void drain();
+
+		// Worker threads
+		void runEncode();
+		void runWrite();
+
+	private:
+
+		AnnotationWriter* annotations;
+		ShardWriter* shards;
+		std::vector<SampleJob*> jobs;
+		std::vector<QThread*> workers;
+		BoundedQueue<SampleJob*> freeJobs, encodeQueue, writeQueue;
+		unsigned long long numSubmitted;
+		std::atomic<unsigned long long> numWritten;
+
+		// Statistics
+		double timeStart;
+		PipelineStage stageRender, stageEncode, stageWrite;
+		unsigned long long waitFreeUs;
+		void sampleOccupancy(PipelineStage& stage, unsigned int occupancy, const char* counter);
+		void printSummary();
+};
+
+#endif
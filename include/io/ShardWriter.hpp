@@ -0,0 +1,59 @@
+#ifndef SHARDWRITER_HPP
+#define SHARDWRITER_HPP
+
+#include <vector>
+#include <string>
+#include <fstream>
+
+// File of a sample inside a shard (e.g. "png" with the encoded atlas, "txt" with its annotations)
+struct ShardEntry
+{
+	std::string ext;
+	std::vector<unsigned char> data;
+	ShardEntry(const std::string& pExt = "") : ext(pExt) {}
+};
+
+// Sequential writer of tar (ustar) shards: "key.ext" members, all files of a sample in the same shard.
+// Shards are rotated at a maximum size and each one gets a text index (member offset and size) next to it.
+class ShardWriter
+{
+	public:
+
+		ShardWriter();
+		~ShardWriter();
+
+		// Shards are named PREFIX-000000.tar, numbering continues after the existing ones
+		bool open(const std::string& dir, unsigned long long maxBytes, const std::string& prefix = "shard");
+		bool write(const std::string& key, const std::vector<ShardEntry>& entries);
+		void flush();
+		void close();
+
+		bool isOpen() { return file.is_open(); }
+		unsigned int getNumShards() { return numShards; }
+		// Current shard and its length once flushed (without the end of archive)
+		const std::string& getShardPath() { return shardName; }
+		unsigned long long getShardBytes() { return shardBytes; }
+
+		// Drop the members after bytes (written after the last manifest commit), end the archive and write its index again.
+		// isLast: the shards opened after this one only hold uncommitted members and are removed.
+		static bool truncate(const std::string& path, unsigned long long bytes, bool isLast);
+
+	private:
+
+		std::string dir, prefix;
+		unsigned long long maxBytes;
+		unsigned int idxShard, numShards;
+
+		// Current shard (writes go through a large buffer)
+		std::ofstream file;
+		std::string shardName;
+		unsigned long long shardBytes;
+		std::vector<char> buffer;
+		std::vector<std::string> index;
+		bool openShard();
+		void closeShard();
+		void flushBuffer();
+		void appendMember(const std::string& name, const std::vector<unsigned char>& data);
+};
+
+#endif
@@ -13,8 +13,10 @@
 #include "modelling/BB.hpp"
 #include "modelling/Tree.hpp"
 
-enum SHADER_IN { position, colour, texcoord, normal };
+enum SHADER_IN { position, colour, texcoord, normal, instPosition, instScale, instColour };
 enum DRAW_TYPE { SOLID = GL_TRIANGLES, LINES = GL_LINE_LOOP};
+// Compile-time specialisations of the phong shader (flags of an entity, see Render::getPhongVariant)
+enum SHADER_VARIANT { TEXTURED = 1, VERTEX_COLOUR = 2, MATERIAL_COLOUR = 4, DEPTH_ONLY = 8 };
 
 struct Kp
 {
@@ -37,9 +39,13 @@ class Model
 		void updateMeshes();
 		void updateLabels(Entity part) { bindLabelToOpenGL(part); }
 		void updateBB();
-		void render();
+		// variant >= 0: only the entities of that shader variant
+		void render(int variant = -1);
+		void renderInstanced(unsigned int numInstances, unsigned int baseInstance = 0);
 		void renderLabelling();
 		void renderParent();
+		// Labels of the semantic tree in pre-order (order of the .seg file), partId = index + 1 (1: root, whole model)
+		void renderParts();
 
 		// Setters
 		void setAllVertices(Vertex* vertices, unsigned int numAllVertices);
@@ -92,12 +98,17 @@ class Model
 		// Getters
 		std::vector<Vertex>& getListAllVertices() { return listAllVertices; }
 		std::string& getFullPath(std::string relativePath);
+		std::string& getFileName() { return fileName; }
 		GLuint getShader() { return mShader; }
 		float getTX() { return Tx; } float getTY() { return Ty; } float getTZ() { return Tz; }
 		float getRX() { return Rx; } float getRY() { return Ry; } float getRZ() { return Rz; }
 		float getSX() { return Sx; } float getSY() { return Sy; } float getSZ() { return Sz; }
 		Entity& getVisualEntity(unsigned int pos) { return visualEntities[pos]; }
 		unsigned int getNumVisualEntities() { return visualEntities.size(); }
+		// Distinct shader variants of the entities (one draw pass each)
+		std::vector<unsigned int>& getVariants() { return variants; }
+		// Triangles drawn by render() (counted with the variants)
+		unsigned int getNumTriangles() { return numTriangles; }
 		BB& getBB() { return boundingBox; }
 		DRAW_TYPE getDrawType() { return mDrawType; }
 		bool isObjectScenario() { return isObject; }
@@ -127,6 +138,9 @@ class Model
 		void bindToOpenGL();
 		void bindLabelToOpenGL(Entity part);
 		bool isFirstBind;
+		void updateVariants();
+		std::vector<unsigned int> entityVariants, variants;
+		unsigned int numTriangles;
 
 		// Geometry
 		std::vector<Vertex> listAllVertices;
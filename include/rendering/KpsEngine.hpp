@@ -0,0 +1,57 @@
+#ifndef KPSENGINE_HPP
+#define KPSENGINE_HPP
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "modelling/Vertex.hpp"
+
+// Keypoint sphere placement (object space translation and scaling)
+struct KpsInstance
+{
+	float X, Y, Z;
+	float Sx, Sy, Sz;
+	KpsInstance(float x = 0.0f, float y = 0.0f, float z = 0.0f, float sx = 1.0f, float sy = 1.0f, float sz = 1.0f) { X = x; Y = y; Z = z; Sx = sx; Sy = sy; Sz = sz; }
+};
+
+// Batched projection and visibility of all keypoints of a sample.
+// The MVP is built once per sample and keypoints / sphere vertices are processed as SoA arrays (4 lanes with SSE)
+class KpsEngine
+{
+	public:
+
+		KpsEngine();
+		~KpsEngine();
+
+		// Shared sphere mesh used to sample the keypoint surface (stored centred in SoA)
+		void setSphere(std::vector<Vertex>& vertices, float* centre);
+		bool hasSphere() { return numSphere > 0; }
+
+		// Project keypoint centres into sample pixels (y downwards) and keep clip depth in z
+		void project(const glm::mat4& mvp, const std::vector<KpsInstance>& kps, float sizeSample);
+		// Keypoint is visible when more than 2.5% of its sphere vertices pass the depth test (RG32F buffer: depth, coverage)
+		void testVisibility(const glm::mat4& mvp, const std::vector<KpsInstance>& kps, const std::vector<float>& depth, int widthDepth, int heightDepth, bool isSelfOcc);
+
+		// Getters
+		glm::vec3 getProj(unsigned int i) { return glm::vec3(projX[i], projY[i], projZ[i]); }
+		bool isVisible(unsigned int i) { return visible[i] != 0; }
+
+	private:
+
+		// Sphere vertices (centred) padded to a multiple of 4
+		std::vector<float> sphereX, sphereY, sphereZ;
+		unsigned int numSphere;
+
+		// Projected keypoints
+		std::vector<float> projX, projY, projZ;
+		std::vector<unsigned char> visible;
+
+		// Scratch for the depth gather
+		std::vector<int> gatherIdx;
+		std::vector<float> gatherV;
+
+		unsigned int countVisible(const glm::mat4& mvp, const KpsInstance& kp, const float* depth, int widthDepth, int heightDepth, bool isSelfOcc);
+};
+
+#endif
@@ -2,6 +2,7 @@
 #define RENDER_HPP
 
 #include <vector>
+#include <deque>
 #include <string>
 
 #include <math.h>
@@ -9,6 +10,7 @@
 
 #include <QGLWidget>
 #include <QTimer>
+#include <QThread>
 
 // Arithmetic operations
 #include <glm/glm.hpp>
@@ -17,11 +19,20 @@
 
 #include "modelling/Model.hpp"
 #include "rendering/Sampler.hpp"
+#include "rendering/KpsEngine.hpp"
+#include "rendering/TargetPool.hpp"
+#include "io/AnnotationStore.hpp"
+#include "io/ShardWriter.hpp"
+#include "io/RunManifest.hpp"
+#include "io/SamplePipeline.hpp"
+#include "io/OutputEncoder.hpp"
 
 #define STEP_TRANS 10.0f
 #define STEP_ROT 10.0f
 
-enum TYPE_SHADER { FLAT, PHONG, DEPTH, ORTHO, BACKGROUND, LABELLING };
+enum TYPE_SHADER { FLAT, PHONG, DEPTH, ORTHO, BACKGROUND, LABELLING, KPS };
+// Supersampled scene to sample: bilinear blit, area average or Lanczos-2 (shader pass)
+enum DOWNSAMPLE_FILTER { DOWNSAMPLE_LINEAR, DOWNSAMPLE_BOX, DOWNSAMPLE_LANCZOS };
 
 struct Camera
 {
@@ -70,6 +81,31 @@ struct Lights
 			attenuation[i] = glm::vec3(1.0f, 0.00f, 0.2f);
 		}
 	}
+	unsigned int getNumActive() const
+	{
+		unsigned int numActive = 0;
+		for(unsigned int i = 0; i < MAX_LIGHTS; ++i)
+			if(onLight[i])
+				numActive++;
+		return numActive;
+	}
+};
+
+// Occlusion queries of a keypoint proxy sphere, double buffered (slot of the frame): all its samples,
+// the ones on the object (scene depth < far) and the ones in front of the scene
+struct KpsQuery
+{
+	GLuint total[2], onObject[2], front[2];
+	KpsQuery() { total[0] = total[1] = onObject[0] = onObject[1] = front[0] = front[1] = 0; }
+};
+
+// Keypoints of an annotation waiting for the query results of their frame ("?": visibility from the queries)
+struct KpsPending
+{
+	unsigned int annotation, slot;
+	float azimuth;
+	std::vector<std::string> names, vis;
+	std::vector<glm::vec3> pos;
 };
 
 class Render : public QGLWidget
@@ -84,14 +120,47 @@ class Render : public QGLWidget
 		bool loadModelFromFile(const std::string& fileName, GLuint shader);
 		void saveSegmentationToFile(std::ofstream& segmentationFile, std::vector<unsigned int>& treePath);
 		bool loadSegmentationFromFile(std::ifstream& segmentationFile, std::vector<unsigned int>& treePath, float r, float g, float b);
+		// Semantic tree of the current model from the .seg file next to its model file (without the labelling widgets)
+		bool loadSegmentation(const std::string& modelFile);
+		// Vertices (v, n, t lines) and faces (f lines) of a part up to its closing line (false when the stream ends before)
+		static bool readSegmentation(std::istream& segmentationFile, Entity& part);
 		void loadBackgroundImgFromFile(const std::string& fileName);
 		void setAntiAliasing(bool isAA) { isAntiAliasing = isAA; }
+		// Scene framebuffers of saved samples (size 0: the interactive ones), applied by the next createSamples
+		void setSampleTargets(int size, int samples) { sampleRenderSize = size; sampleMSAA = samples; }
+		void setDownsampleFilter(DOWNSAMPLE_FILTER filter) { downsampleFilter = filter; }
+		// Images saved with each atlas besides the colour (mask of 1 << OUTPUT_TYPE), written by the same scene pass
+		void setOutputs(unsigned int mask) { outputMask = mask; }
+		// Phong models of at least this many triangles are drawn after a depth only pass (0: never),
+		// isOffset: pre-pass pushed back and matched with GL_LEQUAL (drivers without exact invariance)
+		void setDepthPrePass(unsigned int minTriangles, bool isOffset = false) { prePassTriangles = minTriangles; isPrePassOffset = isOffset; }
 		void setViewBoundingBox(bool isBB) { isViewBoundingBox = isBB; }		
 		void setFreeCamera(bool isFree) { isFreeCamera = isFree; }
 		void resetCamera() { cam = Camera(); }
 		bool previewSamples() { return createSamples(false); }
 		bool saveViewToImage(std::string& path = std::string()) { return createSamples(true, path); }
 		void runScript();
+		void closeAnnotations() { pipeline.drain(); annotationWriter.close(); }
+		// Annotation file of the model folders (workers write parts of their own, merged by the driver)
+		void setAnnotationName(const std::string& name) { annotationName = name; }
+		const std::string& getAnnotationName() { return annotationName; }
+		bool openShards(const std::string& dir, unsigned int sizeMB, const std::string& prefix = "shard") { pipeline.drain(); return shardWriter.open(dir, (unsigned long long)sizeMB * 1024 * 1024, prefix); }
+		void closeShards() { pipeline.drain(); shardWriter.close(); }
+		void flushOutputs() { pipeline.drain(); annotationWriter.flush(); shardWriter.flush(); }
+		// Files being written and their length after flushOutputs (journaled with the manifest commits, "" if none)
+		const std::string& getAnnotationPath() { return annotationWriter.getPath(); }
+		unsigned long long getAnnotationLength() { return annotationWriter.getLength(); }
+		const std::string& getShardPath() { return shardWriter.getShardPath(); }
+		unsigned long long getShardLength() { return shardWriter.getShardBytes(); }
+		// Saved images are encoded and written by pipeline threads between start and stop (outputs drained before any writer call)
+		void startPipeline(unsigned int numEncoders, unsigned int numJobs) { pipeline.start(&annotationWriter, &shardWriter, numEncoders, numJobs); }
+		void stopPipeline() { pipeline.stop(); }
+		void resetOutputChecksum() { outputChecksum = 0; }
+		unsigned int getOutputChecksum() { return outputChecksum; }
+		// Generation on a worker thread: the context is handed to it and the samplers only keep their atlas on the CPU
+		// (the thread makes the context current and moves it back to the GUI thread before finishing)
+		void beginWorker(QThread* thread);
+		void endWorker();
 
 		// I/O calls
 		virtual void keyPressEvent(QKeyEvent *event);
@@ -102,6 +171,8 @@ class Render : public QGLWidget
 
 		static float degree(float radian) { return (radian*180.0f) / 3.1416f; }
 		static float radian(float degree) { return (degree*3.1416f) / 180.0f; }
+		// Extend bb with the non-zero pixels of an RGBA mask inside [x0, x1) x [y0, y1)
+		static void scanMask(const std::vector<GLubyte>& mask, int width, int x0, int y0, int x1, int y1, BB& bb);
 
 		// Change values from GUI
 		// - Getters
@@ -143,6 +214,8 @@ class Render : public QGLWidget
 		// Keypoints
 		void createKp(Kp kp);
 		void destroyKp(std::string id);
+		// No keypoints until the next model is loaded (it does not inherit the ones of the current model)
+		void resetKps();
 		void drawActiveKps(std::string id);
 		void updateKpsX(std::string id, float X);
 		void updateKpsY(std::string id, float Y);
@@ -150,10 +223,9 @@ class Render : public QGLWidget
 		void updateKpsSx(std::string id, float Sx);
 		void updateKpsSy(std::string id, float Sy);
 		void updateKpsSz(std::string id, float Sz);
-		glm::vec3 computeKpsProj(Model* currentKp);
-		bool isKpsVisible(Model* currentKp);
 		void setIsKpsAz(bool isNo) { isKpsAz = isNo; }
 		void setIsKpsSelfOcc(bool isNo) { isKpsSelfOcc = isNo; }
+		void setIsKpsQuery(bool isQuery) { isKpsQuery = isQuery; }
 
     protected:
 
@@ -161,6 +233,9 @@ class Render : public QGLWidget
         virtual void initializeGL();
         virtual void paintGL();
         virtual void resizeGL(int width, int height);
+		// No painting from the GUI thread while a worker owns the context
+		virtual void paintEvent(QPaintEvent* event) { if(!isWorker) QGLWidget::paintEvent(event); }
+		virtual void resizeEvent(QResizeEvent* event) { if(!isWorker) QGLWidget::resizeEvent(event); }
 
 	protected slots:
 
@@ -182,19 +257,48 @@ class Render : public QGLWidget
 		Camera cam;
 		glm::vec3 vuv;
 		glm::mat4 model, view, proj, orthoProj;
+		glm::mat3 normalMatrix;
 		void updateViewMatrix();
+		void redraw();
 		void updateProjectionMatrix();
 
 		// Models in the scenario
 		bool isRenderLabelling;
 		void render(Model* obj, GLuint shader);
+		void useSceneShader(GLuint shader);
 		void renderUI();
 		void renderBackground();
 		void renderBrush();
 		void renderKps();
 		void computeBB2D();
-		GLuint fboRender, imgMSAA, depthMSAA, fboDepth, bufDepth, fboDepthVis, bufDepthVis, fboBinary, bufBinary;
+		GLuint fboRender, imgMSAA, depthMSAA, zMSAA, fboDepth, bufDepth, fboDepthVis, bufDepthVis, fboBinary, bufBinary;
 		int widthRender, heightRender;
+		// Scene, binary mask and depth framebuffers (kept while size and sample count do not change)
+		static const int VIEW_SIZE = 766; // interactive view (render widget)
+		void allocateRenderTargets(int width, int height, int samples, unsigned int outputs);
+		int numSamples, maxSamples, maxRenderSize;
+		int sampleRenderSize, sampleMSAA;
+		// MSAA resolve of the scene into a sample target (through resolvePool and a filter pass when supersampled)
+		void resolveSample(RenderTarget& target, int width, int height);
+		TargetPool resolvePool;
+		DOWNSAMPLE_FILTER downsampleFilter;
+		GLuint downsampleShaders[2], vaoDownsample; // box and Lanczos programs (compiled on first use)
+		// Extra outputs: normals (RG16F, attachment 2) and ids (RG16UI instance + part, attachment 3) only while requested,
+		// depth comes from attachment 1. With outputs these are multisample textures (maxTextureSamples) and
+		// integer ids limit the samples of the whole framebuffer (maxIntegerSamples).
+		unsigned int outputMask, allocatedOutputs;
+		GLuint normalMSAA, idMSAA;
+		int maxIntegerSamples, maxTextureSamples;
+		unsigned int currentInstance; // instanceId of the model being drawn (index + 1, 0: background)
+		GLuint createMultisample(GLenum internalFormat, bool isTexture);
+		// Multisample texture of an output read at sample 0 (one surface, never an average) into a target of the sample size
+		RenderTarget& resolveOutput(GLuint texture, TargetPool& samples, int width, int height);
+		GLuint outputShaders[2]; // float and integer programs (compiled on first use)
+		TargetPool depthPool, normalPool, idPool;
+		std::vector<OutputAtlas> outputAtlases;
+		std::vector<unsigned short> outputPixels;
+		void prepareOutputs();
+		void readOutputs(int width, int height, int x, int y);
 		std::vector<Model*> listModels;
 		std::vector<BB> listImgBB;
 		Model* uiQuad;
@@ -202,12 +306,19 @@ class Render : public QGLWidget
 		int backgroundWidth, backgroundHeight;
 		Model* brush;
 		int brushSize;
-		std::map<std::string, Model*> model_kps;
+		std::map<std::string, Kp> model_kps;
 		GLuint emptyTex, texBackground;
 
         // Shading
 		void loadShaders(std::vector<std::string> nameShaders);
+		// Vertex and fragment shader of the resources with defines added after their version line
+		GLuint compileProgram(const std::string& name, const std::string& defines, bool hasDepthOutput);
+		// Phong program specialised for a SHADER_VARIANT and the active lights (compiled on first use)
+		GLuint getPhongVariant(unsigned int variant);
+		unsigned int prePassTriangles;
+		bool isPrePassOffset;
 		std::vector<GLuint> programShaders;
+		std::map<unsigned int, GLuint> phongVariants;
 		unsigned int currentShader;
 
 		// Light conditions
@@ -225,22 +336,57 @@ class Render : public QGLWidget
 		bool isSampling;
 		bool isLabel, isEditMode, isEditPixelMode, isKpsMode;
 		Sampler *mSampler, *mDepth;
-		GLuint fboSample, texSample;
-		std::vector<GLubyte> binaryView, depthByte; // depth from main view		
-		std::vector<GLfloat> depth, depthKps; // depth from depth view
+		TargetPool samplePool;
+		std::vector<GLubyte> binaryView, depthByte; // depth preview (RGBA)
+		std::vector<GLfloat> depth, depthKps; // depth and coverage per pixel (RG), read only when keypoints need it
 		bool createSamples(bool toSave, std::string& path = std::string());
-		std::vector<std::string> listAnnotations;
+		std::vector<AnnotationRecord> listAnnotations;
+		AnnotationWriter annotationWriter;
+		std::string annotationName;
+		ShardWriter shardWriter;
+		SamplePipeline pipeline;
+		unsigned int outputChecksum;
 		void saveAnnotations(std::string& imgName, int posSampleX, int posSampleY);
+		// Worker thread rendering (previews posted as images at most every PREVIEW_INTERVAL ms)
+		bool isWorker;
+		double lastPreview;
+		static const int PREVIEW_INTERVAL = 250;
+		void postPreviews();
+		bool isPreviewDue();
 	
 		// Keypoints
 		bool isKpsAz;
 		bool isKpsSelfOcc;
+		Model* kpsSphere;
+		GLuint vboKps;
+		std::string activeKp;
+		bool isKpsDirty;
+		void updateKpsInstances();
+		KpsEngine kpsEngine;
+		glm::mat4 computeKpsModel();
+		// - GPU visibility (occlusion queries issued while sampling)
+		bool isKpsQuery;
+		std::map<std::string, KpsQuery> kpsQueries;
+		unsigned int kpsSlot; // slot of the next frame's queries
+		std::deque<KpsPending> pendingKps;
+		void queryKps();
+		void deleteKpsQuery(KpsQuery& query);
+		bool isKpsQueryAvailable(const KpsPending& pending);
+		bool isKpsQueryVisible(const std::string& name, unsigned int slot);
+		// Results are polled after the next frame is issued and only waited for when their slot is reused (or isFlush)
+		void resolveKpsQueries(bool isFlush);
+		void orderKps(const std::vector<std::string>& names, std::vector<glm::vec3>& pos, std::vector<std::string>& vis, float azimuth);
+		void setKpsAnnotation(AnnotationRecord& annotation, const std::vector<std::string>& names, const std::vector<glm::vec3>& pos, const std::vector<std::string>& vis);
 
 	signals:
 
 		void updateFPS(const QString& text);
 		void updateBrushGUI(int newValue);
 		void updateCompleteness();
+		void updateSamplePreview(const QImage& atlas, int size);
+		void updateDepthPreview(const QImage& depth, int size);
+		// Rendered view of a worker process (keeps its node from taking it for stalled)
+		void renderedView();
 };
 
 #endif
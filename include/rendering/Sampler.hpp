@@ -5,16 +5,13 @@
 #include <string>
 #include <iostream>
 #include <sstream>
+#include <math.h>
 
 #include <QGLWidget>
 #include <QTimer>
+#include <QImage>
 
-struct RangeView
-{
-	RangeView(int minA, int maxA, int minE, int maxE) { minAzimuth = minA; maxAzimuth = maxA; minElevation = minE; maxElevation = maxE; }
-	int minAzimuth, maxAzimuth;
-	int minElevation, maxElevation;
-};
+#include "generation/ViewSampler.hpp"
 
 class Sampler : public QGLWidget
 {
@@ -28,6 +25,12 @@ class Sampler : public QGLWidget
 		void transferViewportDepth(GLubyte* viewportDepth);
 		void defineCleanTexture();
 		void saveToImg(std::string& imgPath);
+		void encodeImg(std::vector<unsigned char>& png);
+		// Reverse the row order of an image (OpenGL bottom-up <-> top-down)
+		static void flipRows(const GLubyte* src, GLubyte* dst, int rowBytes, int numRows);
+		// Copy of the atlas (OpenGL row order) to be shown from another thread
+		QImage getAtlasImage();
+		const std::vector<GLubyte>& getAtlas() { return arrayTex; }
 		
 		// Getters
 		int getSizeSample() { return sizeSample; }
@@ -43,6 +46,8 @@ class Sampler : public QGLWidget
 		bool isAzimuth() { return bAzimuth; }
 		bool isElevation() { return bElevation; }
 		unsigned int getNumImg() { return numImg; }
+		// Views of a full azimuth turn: the count of the task being generated, else the steps of the azimuth angle (as JobPlan::expand)
+		unsigned int getViewsPerTurn() { return viewsPerTurn > 0 ? viewsPerTurn : (unsigned int)ceil(360.0f / angleY - 1e-4f); }
 
 		// Setters
 		void setSizeSample(int newValue) { sizeSample = newValue; windowSize = sizeSample*numSamples; }
@@ -62,6 +67,9 @@ class Sampler : public QGLWidget
 		void setIsElevation(bool isE) { bElevation = isE; }
 		void setNumImg(unsigned int num) { numImg = num; }
 		void updateNumImg() { numImg++; }
+		void setViewsPerTurn(unsigned int num) { viewsPerTurn = num; }
+		// Atlas kept on the CPU only while another thread renders (the preview is refreshed through showAtlas)
+		void setDeferredUpload(bool isDeferred) { isDeferredUpload = isDeferred; }
 
 		std::string IntToStr(int number)
 		{
@@ -77,7 +85,10 @@ class Sampler : public QGLWidget
         virtual void paintGL();
         virtual void resizeGL(int width, int height);
 
-	protected slots:		
+	public slots:
+
+		// Queued from the generation thread: copy of the atlas and its size, uploaded by the next paint
+		void showAtlas(const QImage& atlas, int size);
 
     private:
 
@@ -101,12 +112,18 @@ class Sampler : public QGLWidget
 		float distance;
 		float tilt;
 		unsigned int numImg;
+		unsigned int viewsPerTurn;
 
 		// Output image
 		void createQuad();
 		void updateTexture();
 		GLuint outTex;
-		std::vector<GLubyte> arrayTex;
+		int texCapacity; // preview texture size (rounded up, only grows)
+		std::vector<GLubyte> arrayTex; // atlas on the CPU (OpenGL row order), encoded from there
+		bool isDeferredUpload;
+		void uploadTexture(const GLubyte* data, int size);
+		QImage previewAtlas; // last copy received by showAtlas (painted once)
+		int previewSize;
 	
 	signals:
 
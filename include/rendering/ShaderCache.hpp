@@ -0,0 +1,38 @@
+#ifndef SHADERCACHE_HPP
+#define SHADERCACHE_HPP
+
+#include <string>
+
+#include <GL/glew.h>
+
+// Linked programs kept on disk as driver binaries (glGetProgramBinary), one file per program named after a hash of
+// its sources, link bindings, renderer and driver version: later runs and every worker process skip compile and link.
+// A binary of another driver or rejected by glProgramBinary is compiled again and its file replaced.
+// Files are written under a temporary name and renamed, so processes of a run can share the folder.
+class ShaderCache
+{
+	public:
+
+		// Folder of the binaries (empty: disabled), created if missing
+		static void setDir(const std::string& path);
+		static bool isEnabled() { return !dir.empty(); }
+
+		// Key of a program for the current context (linkInfo: anything else changing the linked program, e.g. bindings)
+		static std::string getKey(const std::string& vertexSource, const std::string& fragmentSource, const std::string& linkInfo);
+		// Program created from the binary of the key (0: missing or rejected, compile it)
+		static GLuint load(const std::string& key);
+		// Before glLinkProgram of a program that will be saved
+		static void prepare(GLuint program);
+		// Binary of a linked program stored under the key
+		static bool save(const std::string& key, GLuint program);
+
+	private:
+
+		static std::string dir;
+
+		static bool isSupported();
+		static std::string getDriver();
+		static std::string getPath(const std::string& key) { return dir + "/" + key + ".bin"; }
+};
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef TARGETPOOL_HPP
+#define TARGETPOOL_HPP
+
+#include <map>
+#include <utility>
+
+#include <GL/glew.h>
+
+// Texture + FBO of a size bucket (the used region is the bottom-left width x height)
+struct RenderTarget
+{
+	GLuint fbo, tex;
+	int width, height;
+};
+
+// Render targets bucketed by size (rounded up to a multiple of bucket pixels) and reused across samples:
+// no GL allocation per sample once every bucket has been seen. Needs the owner context current.
+class TargetPool
+{
+	public:
+
+		// format and type: pixel transfer matching the internal format (e.g. GL_RG_INTEGER for integer textures)
+		TargetPool(GLenum internalFormat = GL_RGBA8, int bucket = 32, GLenum format = GL_RGBA, GLenum type = GL_UNSIGNED_BYTE);
+		~TargetPool() {}
+
+		RenderTarget& acquire(int width, int height);
+		void release();
+
+		unsigned int getNumTargets() { return targets.size(); }
+		static int roundUp(int size, int bucket) { return (size + bucket - 1) / bucket * bucket; }
+
+	private:
+
+		GLenum internalFormat, format, type;
+		int bucket;
+		std::map<std::pair<int, int>, RenderTarget> targets;
+};
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <string>
+#include <vector>
+#include <atomic>
+
+#include <GL/glew.h>
+
+// Time spent in a zone over a trace (microseconds): total with the nested zones, self without them
+struct TraceStage
+{
+	std::string name, track; // track: name of the threads running the zone ("CPU", "GPU", "Encode"...)
+	bool isGpu;
+	unsigned int count, numThreads; // numThreads: threads of the track during the trace
+	double total, self, max;
+	TraceStage() : isGpu(false), count(0), numThreads(0), total(0.0), self(0.0), max(0.0) {}
+};
+
+// Stage timings of a run written as a Chrome trace (chrome://tracing or ui.perfetto.dev):
+// - CPU zones: wall clock of a scope (thread "CPU")
+// - GPU zones: GL_TIMESTAMP queries at both ends of a scope, resolved once available so the pipeline is not stalled (thread "GPU")
+// - Counters: values over time such as queue occupancy
+// CPU zones can come from any thread (one track per thread, the one calling begin() is "CPU"), GPU zones from the thread of the context.
+// end() prints the time per stage of each track (threads of the same name together) aggregated over the run: run % is the
+// self time over the run time of the threads of the track, so the stages of a track add up to 100 at most.
+// Zones only cost a test while no trace is running.
+class Trace
+{
+	public:
+
+		static bool begin(const std::string& path);
+		// Stages sorted by track (CPU first, GPU last) and self time copied to stages if given
+		static void end(std::vector<TraceStage>* stages = NULL);
+		static bool isEnabled() { return isRunning; }
+
+		// Monotonic wall clock in microseconds (from the start of the process)
+		static double now();
+
+		static void addCpuEvent(const char* name, double start, double duration);
+		static void addCounter(const char* name, double value);
+		// Track name of the calling thread (kept for later traces)
+		static void setThreadName(const char* name);
+		// Timestamp query at this point of the GL command stream (0 without timer queries), context of the trace current
+		static GLuint addTimestamp();
+		static void addGpuEvent(const char* name, GLuint queryBegin, GLuint queryEnd);
+
+	private:
+
+		// Read by the zones of every thread without the lock
+		static std::atomic<bool> isRunning;
+};
+
+// Scoped CPU zone (name must outlive the trace, use literals)
+class TraceZone
+{
+	public:
+
+		TraceZone(const char* pName) : name(pName), start(Trace::isEnabled() ? Trace::now() : -1.0) {}
+		~TraceZone() { if(start >= 0.0 && Trace::isEnabled()) Trace::addCpuEvent(name, start, Trace::now() - start); }
+
+	private:
+
+		const char* name;
+		double start;
+};
+
+// Scoped GPU zone: time between the commands issued before and after the scope
+class TraceGpuZone
+{
+	public:
+
+		TraceGpuZone(const char* pName) : name(pName), query(Trace::isEnabled() ? Trace::addTimestamp() : 0) {}
+		~TraceGpuZone() { if(query != 0 && Trace::isEnabled()) Trace::addGpuEvent(name, query, Trace::addTimestamp()); }
+
+	private:
+
+		const char* name;
+		GLuint query;
+};
+
+#endif
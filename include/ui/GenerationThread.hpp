@@ -0,0 +1,44 @@
+#ifndef GENERATIONTHREAD_HPP
+#define GENERATIONTHREAD_HPP
+
+#include <QThread>
+#include <QAtomicInt>
+#include <QString>
+
+#include "generation/JobPlan.hpp"
+
+class MainWindow;
+class Render;
+
+// Runs a job plan away from the GUI thread with the context of the main render (see Render::beginWorker).
+// Progress is posted through queued signals and cancellation is checked between tasks.
+class GenerationThread : public QThread
+{
+    Q_OBJECT
+
+    public:
+
+        GenerationThread(MainWindow* pWindow, Render* pView);
+
+		void setPlan(const JobPlan& newPlan) { plan = newPlan; }
+		void cancel() { isCancelled = 1; }
+		bool isCancelRequested() { return isCancelled.load() != 0; }
+		void reportProgress(int percent, const QString& text) { emit updateProgress(percent, text); }
+
+	protected:
+
+		virtual void run();
+
+    private:
+
+		MainWindow* window;
+		Render* glView;
+		JobPlan plan;
+		QAtomicInt isCancelled;
+
+	signals:
+
+		void updateProgress(int percent, const QString& text);
+};
+
+#endif
@@ -3,15 +3,20 @@
 
 #include <sstream>
 #include <fstream> 
+#include <climits>
 
 #include <QMessageBox>
 #include <QKeyEvent>
 #include <QLineEdit>
 #include <QListWidgetItem>
+#include <QProgressDialog>
 
 #include "ui_MainWindow.h"
 #include "rendering/Render.hpp"
 #include "rendering/Sampler.hpp"
+#include "generation/SampleRng.hpp"
+#include "generation/JobPlan.hpp"
+#include "ui/GenerationThread.hpp"
 
 #define valueRange 50.0f;
 #define rangeAbove 1.0f/8.0f
@@ -30,11 +35,17 @@ class MainWindow : public QMainWindow , private Ui::MainWindow
 {
     Q_OBJECT
 
+	friend class GenerationThread;
+
     public:
 
-        MainWindow(QWidget* parent = 0);
+        // Headless: windows are never shown on screen (worker processes of --generate)
+        MainWindow(QWidget* parent = 0, bool isHeadless = false);
         ~MainWindow();
 
+		// Worker of a multi-process generation (see GenerationDriver): runs the task ranges read from stdin until QUIT
+		int runWorker(const std::string& jobFile, unsigned int id, unsigned int numEncoders);
+
     protected:
 
         virtual void keyPressEvent(QKeyEvent *event)
@@ -195,7 +206,6 @@ class MainWindow : public QMainWindow , private Ui::MainWindow
         void on_boxAngleY_valueChanged(double newValue) { imgSampler->setAngleY(newValue); }
         // void on_lineAngleX_textChanged(QString newText) { imgSampler->setAngleX(newValue); }
         // void on_lineDistance_textChanged(QString newText) { imgSampler->setDistance(newValue); }
-		float findAngle(std::vector<float> intervals, float min, float max, float range, bool isCircular);
 
         // Image storage:
 		void on_buttonModelFolder_clicked();
@@ -215,7 +225,13 @@ class MainWindow : public QMainWindow , private Ui::MainWindow
         void on_buttonSaveView_clicked();
         void cleanPreviewWidget() { delete imgSampler; }
         void on_buttonScript_clicked();
-		void runScript();
+		bool planScript(JobPlan& plan);
+		bool planJobFile(const std::string& path, JobPlan& plan);
+		// Generation thread: progress dialog (window modal) and end of the run on the GUI thread
+		void startGeneration(JobPlan& plan);
+		void updateGenerationProgress(int percent, const QString& text);
+		void cancelGeneration();
+		void endGeneration();
 
 		// KEYPOINT tab
 		// - Kps list updates
@@ -255,8 +271,32 @@ class MainWindow : public QMainWindow , private Ui::MainWindow
     private:
 
         DefaultParams defaultParams;
-		std::string PATH_MODEL, PATH_BACKGROUND, PATH_OUTPUT, PATH_OBJ, PATH_INSTANCE, modelFileName;
+		std::string PATH_MODEL, PATH_BACKGROUND, PATH_OUTPUT, PATH_OBJ, PATH_INSTANCE, PATH_JOB, modelFileName;
         void getPaths();
+		bool isKpsQuery;
+		bool isShardOutput;
+		unsigned int shardSizeMB;
+		unsigned long long runSeed;
+		VIEW_SAMPLING viewSampling;
+		bool isTrace;
+		unsigned int pipelineThreads, pipelineImages;
+		unsigned int renderSuperSampling, renderMSAA;
+		DOWNSAMPLE_FILTER downsampleFilter;
+		unsigned int depthPrePassTriangles;
+		bool isDepthPrePassOffset;
+		// Script: plan of the script tab or a job file, executed task by task on the generation thread
+		// (a worker process executes a range of tasks under a lease: journal, shards and annotation parts of its own)
+		JobClass getScriptJob();
+		void executePlan(JobPlan& plan, unsigned int firstTask = 0, unsigned int lastTask = UINT_MAX);
+		int workerId; // -1: not a worker
+		unsigned int workerLease, workerUnits;
+		double workerBeat;
+		void reportWorkerProgress();
+		GenerationThread* generation;
+		QProgressDialog* progressGeneration;
+		void saveUnit(RunManifest& manifest, const std::string& model, const std::string& unit, std::string& saveObj);
+		void commitOutputs(RunManifest& manifest);
+		std::string getBackgroundPath(const JobClass& job, unsigned int idxBackground);
 
         void embedGLWidget(QWidget* base, QWidget* glView);
         Render *glView;
@@ -0,0 +1,484 @@
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+#include <map>
+#include <algorithm>
+
+#include <QCoreApplication>
+#include <QThread>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTimer>
+
+#include "generation/GenerationDriver.hpp"
+#include "io/RunManifest.hpp"
+#include "io/AnnotationStore.hpp"
+#include "rendering/Trace.hpp"
+
+using namespace std;
+
+static string toString(unsigned int value)
+{
+	stringstream ss;
+	ss << value;
+	return ss.str();
+}
+
+GenerationDriver::GenerationDriver() : numDone(0), numFailed(0), numLeases(0), planHash(0)
+{
+}
+
+GenerationDriver::~GenerationDriver()
+{
+	for(unsigned int i = 0; i < workers.size(); ++i)
+	{
+		if(workers[i].process != NULL && workers[i].process->state() != QProcess::NotRunning)
+		{
+			workers[i].process->kill();
+			workers[i].process->waitForFinished();
+		}
+		if(workers[i].socket != NULL)
+			workers[i].socket->abort();
+		delete workers[i].process;
+		delete workers[i].socket;
+	}
+}
+
+bool GenerationDriver::run(const string& pJobFile, unsigned int numWorkers, unsigned short port)
+{
+	double timeStart = Trace::now();
+	jobFile = QFileInfo(pJobFile.c_str()).absoluteFilePath().toStdString();
+	if(!plan.load(jobFile) || !plan.expand())
+		return false;
+	planHash = plan.getHash();
+	if(numWorkers == 0 && port == 0)
+		numWorkers = max(1, QThread::idealThreadCount() / 4);
+
+	// Items sized for the local workers and, with a port, at least one node of the default size of this machine
+	unsigned int numExpected = numWorkers;
+	if(port != 0)
+		numExpected += max(1, QThread::idealThreadCount() / 4);
+	splitItems(numWorkers, numExpected);
+	if(!prepareOutputs())
+		return false;
+	cout << "Generation: " << plan.getTasks().size() << " tasks in " << items.size() << " items for " << numWorkers << " local workers" << endl;
+	if(port != 0)
+	{
+		if(!server.listen(QHostAddress::Any, port))
+		{
+			cout << "Generation: cannot listen on port " << port << " (" << server.errorString().toStdString() << ")" << endl;
+			return false;
+		}
+		cout << "Generation: waiting for nodes on port " << port << endl;
+	}
+	if(!startWorkers(numWorkers) && port == 0)
+		return false;
+
+	// Worker output is read as it comes and commands are answered right away, leases are checked every second
+	QTimer wake;
+	wake.start(1000);
+	for(;;)
+	{
+		QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+		acceptWorkers();
+		bool isAlive = false;
+		for(unsigned int i = 0; i < workers.size(); ++i)
+		{
+			Worker& worker = workers[i];
+			if(!worker.isAlive)
+				continue;
+			readWorker(i);
+			bool isStopped = worker.process != NULL ? worker.process->state() == QProcess::NotRunning : worker.socket->state() != QAbstractSocket::ConnectedState;
+			if(!isStopped && worker.socket != NULL && worker.current >= 0 && Trace::now() - worker.lastSeen > LEASE_SECONDS * 1e6)
+			{
+				cout << "Generation: lease of worker " << i << " expired" << endl;
+				worker.socket->abort();
+				isStopped = true;
+			}
+			if(isStopped)
+				lostWorker(i);
+			isAlive = isAlive || workers[i].isAlive;
+		}
+
+		// Nodes can still join while items are left
+		if(!isAlive && (isFinished() || !server.isListening()))
+			break;
+	}
+	server.close();
+
+	mergeOutputs(numDone == items.size());
+	cout << endl << "Generation: " << numDone << "/" << items.size() << " items in " << (Trace::now() - timeStart) / 1e6 << "s" << endl;
+	for(unsigned int i = 0; i < items.size(); ++i)
+		if(items[i].numFailures >= MAX_FAILURES)
+			cout << "Generation: tasks " << items[i].firstTask << " to " << items[i].lastTask - 1 << " failed" << endl;
+	for(unsigned int i = 0; i < workers.size(); ++i)
+		cout << "Worker " << i << ": " << workers[i].numDone << " items (" << workers[i].numStolen << " stolen)" << endl;
+	return numDone == items.size();
+}
+
+void GenerationDriver::splitItems(unsigned int numWorkers, unsigned int numExpected)
+{
+	vector<RenderTask>& tasks = plan.getTasks();
+	float target = plan.getTotalCost() / (numExpected * ITEMS_PER_WORKER);
+
+	// Light models are grouped, heavy ones are split into chunks of views (task boundaries)
+	items.clear();
+	unsigned int idxTask = 0;
+	while(idxTask < tasks.size())
+	{
+		unsigned int endTask = idxTask;
+		float cost = 0.0f;
+		while(endTask < tasks.size() && tasks[endTask].idxClass == tasks[idxTask].idxClass && tasks[endTask].idxModel == tasks[idxTask].idxModel)
+			cost += tasks[endTask++].cost;
+
+		if(cost > 2.0f * target && endTask - idxTask > 1)
+		{
+			WorkItem chunk = { idxTask, idxTask, true, 0.0f, 0 };
+			for(unsigned int i = idxTask; i < endTask; ++i)
+			{
+				chunk.cost += tasks[i].cost;
+				if(chunk.cost >= target || i == endTask - 1)
+				{
+					chunk.lastTask = i + 1;
+					items.push_back(chunk);
+					chunk.firstTask = i + 1;
+					chunk.cost = 0.0f;
+				}
+			}
+		}
+		else if(!items.empty() && !items.back().isSplit && items.back().cost + cost <= target)
+		{
+			items.back().lastTask = endTask;
+			items.back().cost += cost;
+		}
+		else
+		{
+			WorkItem item = { idxTask, endTask, false, cost, 0 };
+			items.push_back(item);
+		}
+		idxTask = endTask;
+	}
+
+	// Contiguous runs of items of equal cost per worker: neighbouring models stay on one worker until it steals
+	// (without local workers the nodes take them in order)
+	workers.resize(numWorkers);
+	orphans.clear();
+	for(unsigned int i = 0; i < items.size() && numWorkers == 0; ++i)
+		orphans.push_back(i);
+	float doneCost = 0.0f;
+	for(unsigned int i = 0; i < items.size() && numWorkers > 0; ++i)
+	{
+		unsigned int idxWorker = plan.getTotalCost() > 0.0f ? (unsigned int)((doneCost + items[i].cost / 2.0f) / plan.getTotalCost() * numWorkers) : 0;
+		workers[min(idxWorker, numWorkers - 1)].items.push_back(i);
+		doneCost += items[i].cost;
+	}
+}
+
+bool GenerationDriver::prepareOutputs()
+{
+	// Folders and README before any worker, then journals and annotations left by an interrupted run
+	for(unsigned int i = 0; i < plan.getClasses().size(); ++i)
+		if(!JobPlan::prepareOutput(plan.getClasses()[i]))
+			return false;
+	mergeOutputs(false);
+	return true;
+}
+
+void GenerationDriver::mergeOutputs(bool isComplete)
+{
+	for(unsigned int idxClass = 0; idxClass < plan.getClasses().size(); ++idxClass)
+	{
+		const JobClass& job = plan.getClasses()[idxClass];
+		string savePath = job.outputDir + "/";
+		QStringList journals = QDir(savePath.c_str()).entryList(QStringList("manifest-w*.txt"), QDir::Files);
+		for(int i = 0; i < journals.size(); ++i)
+		{
+			// Fenced leases were folded when they were taken away, later lines are ignored
+			string journal = savePath + journals[i].toStdString();
+			if(find(fenced.begin(), fenced.end(), journal) != fenced.end())
+				QFile::remove(journal.c_str());
+			else if(RunManifest::append(savePath + "manifest.txt", journal))
+				QFile::remove(journal.c_str());
+		}
+
+		// Outputs of stopped workers cut back to their journaled units, then output folders of the models in plan order
+		// (the ones of a serial run, workers find them in the manifest). Parts are merged once all items are done.
+		RunManifest manifest;
+		if(!manifest.open(savePath + "manifest.txt"))
+			continue;
+		manifest.truncateOutputs();
+		for(unsigned int idxModel = 0; idxModel < job.models.size(); ++idxModel)
+		{
+			unsigned int idxObj = manifest.addModel(job.models[idxModel]);
+			if(isComplete)
+				mergeAnnotationParts(job.outputDir + "/obj_" + toString(idxObj), manifest);
+		}
+		manifest.close();
+	}
+}
+
+void GenerationDriver::foldJournal(const string& savePath, unsigned int idxWorker, unsigned int lease)
+{
+	string journal = savePath + "manifest-w" + toString(idxWorker) + "-l" + toString(lease) + ".txt";
+	if(QFile::exists(journal.c_str()) && RunManifest::append(savePath + "manifest.txt", journal))
+		QFile::remove(journal.c_str());
+	fenced.push_back(journal);
+}
+
+static unsigned int getImageNumber(const AnnotationRecord& record)
+{
+	return record.image.compare(0, 3, "img") == 0 ? atoi(record.image.c_str() + 3) : 0;
+}
+
+static bool isImageBefore(const AnnotationRecord& a, const AnnotationRecord& b)
+{
+	return getImageNumber(a) < getImageNumber(b);
+}
+
+void GenerationDriver::mergeAnnotationParts(const string& objDir, RunManifest& manifest)
+{
+	QStringList parts = QDir(objDir.c_str()).entryList(QStringList("annotations-c*.bin"), QDir::Files);
+	if(parts.isEmpty())
+		return;
+
+	// Records of the store and its parts (already cut back to their journaled units) in image order:
+	// the order of a serial run, whatever chunks generated them and in which order
+	string storePath = objDir + "/annotations.bin";
+	vector<string> sources(1, storePath);
+	for(int i = 0; i < parts.size(); ++i)
+		sources.push_back(objDir + "/" + parts[i].toStdString());
+	vector<AnnotationRecord> records, block;
+	for(unsigned int s = 0; s < sources.size(); ++s)
+	{
+		AnnotationReader reader;
+		if(!QFile::exists(sources[s].c_str()))
+			continue;
+		if(!reader.open(sources[s]))
+		{
+			cout << "Annotations: cannot read " << sources[s] << ", parts of " << objDir << " not merged" << endl;
+			return;
+		}
+		for(unsigned int i = 0; i < reader.getNumBlocks(); ++i)
+		{
+			if(!reader.readBlock(i, block))
+			{
+				cout << "Annotations: block " << i << " of " << sources[s] << " is corrupted, parts of " << objDir << " not merged" << endl;
+				return;
+			}
+			records.insert(records.end(), block.begin(), block.end());
+		}
+	}
+	stable_sort(records.begin(), records.end(), isImageBefore);
+
+	string mergedPath = objDir + "/annotations-merged.tmp";
+	QFile::remove(mergedPath.c_str());
+	AnnotationWriter writer;
+	if(!writer.open(mergedPath))
+		return;
+	for(unsigned int r = 0; r < records.size(); ++r)
+		writer.write(records[r]);
+	writer.close();
+	QFile::remove(storePath.c_str());
+	if(!QFile::rename(mergedPath.c_str(), storePath.c_str()))
+	{
+		cout << "Annotations: cannot replace " << storePath << endl;
+		return;
+	}
+
+	// Journaled with their new length before the parts are removed
+	manifest.setOffset(storePath, AnnotationStore::getLength(storePath));
+	for(unsigned int s = 1; s < sources.size(); ++s)
+		manifest.setOffset(sources[s], 0);
+	manifest.commit();
+	for(unsigned int s = 1; s < sources.size(); ++s)
+		QFile::remove(sources[s].c_str());
+}
+
+bool GenerationDriver::startWorkers(unsigned int numWorkers)
+{
+	// Encoding threads: the cores left per worker by its render and write threads
+	unsigned int numEncoders = max(1, QThread::idealThreadCount() / (int)numWorkers - 2);
+	for(unsigned int i = 0; i < numWorkers; ++i)
+	{
+		Worker& worker = workers[i];
+		worker.process = new QProcess();
+		worker.process->setProcessChannelMode(QProcess::MergedChannels);
+		worker.channel = worker.process;
+		QStringList args;
+		args << "--worker" << jobFile.c_str() << QString::number(i) << QString::number(numEncoders);
+		worker.process->start(QCoreApplication::applicationFilePath(), args);
+		worker.isAlive = worker.process->waitForStarted();
+		if(!worker.isAlive)
+		{
+			cout << "Generation: cannot start worker " << i << endl;
+			lostWorker(i);
+		}
+	}
+
+	for(unsigned int i = 0; i < workers.size(); ++i)
+		if(workers[i].isAlive)
+			return true;
+	return false;
+}
+
+void GenerationDriver::acceptWorkers()
+{
+	// One connection per worker process of a node: its id (journal and shard names) and the job file come first
+	while(server.hasPendingConnections())
+	{
+		Worker worker;
+		worker.socket = server.nextPendingConnection();
+		worker.socket->setParent(NULL);
+		worker.channel = worker.socket;
+		worker.isAlive = true;
+		worker.lastSeen = Trace::now();
+		unsigned int idxWorker = workers.size();
+		workers.push_back(worker);
+		worker.socket->write(("WORKER " + toString(idxWorker) + " " + jobFile + "\n").c_str());
+		cout << "Generation: worker " << idxWorker << " joined from " << worker.socket->peerAddress().toString().toStdString() << endl;
+	}
+}
+
+void GenerationDriver::readWorker(unsigned int idxWorker)
+{
+	Worker& worker = workers[idxWorker];
+	while(worker.channel->canReadLine())
+	{
+		string line = QString(worker.channel->readLine()).trimmed().toStdString();
+		worker.lastSeen = Trace::now();
+		if(line == "@HEARTBEAT" || line.compare(0, 9, "@PROGRESS") == 0)
+			continue;
+		else if(line == "@READY")
+		{
+			worker.isReady = true;
+			assignItem(idxWorker);
+		}
+		else if(line.compare(0, 8, "@REFUSED") == 0)
+		{
+			// Its item goes to another worker right away (not a failure of the item)
+			cout << "Generation: worker " << idxWorker << " refused its item, its models or tasks differ from the driver's (job file or model folders)" << endl;
+			worker.isReady = false;
+			if(worker.current >= 0)
+			{
+				orphans.push_front(worker.current);
+				worker.current = -1;
+				for(unsigned int i = 0; i < workers.size(); ++i)
+					if(isIdle(i))
+						assignItem(i);
+			}
+		}
+		else if(line.compare(0, 5, "@DONE") == 0 && worker.current >= 0)
+		{
+			worker.current = -1;
+			worker.numDone++;
+			numDone++;
+			if(isFinished())
+			{
+				for(unsigned int i = 0; i < workers.size(); ++i)
+					if(isIdle(i))
+						assignItem(i);
+			}
+			else
+				assignItem(idxWorker);
+		}
+		else
+			cout << "[w" << idxWorker << "] " << line << endl;
+	}
+}
+
+void GenerationDriver::assignItem(unsigned int idxWorker)
+{
+	// Nothing left to take: waits while items are in flight elsewhere (handed over if their worker stops)
+	Worker& worker = workers[idxWorker];
+	int idxItem = takeItem(idxWorker);
+	stringstream command;
+	if(idxItem >= 0)
+	{
+		const WorkItem& item = items[idxItem];
+		worker.current = idxItem;
+		worker.lease = numLeases++;
+		worker.lastSeen = Trace::now();
+		command << "RUN " << item.firstTask << " " << item.lastTask << " " << worker.lease << " " << planHash << endl;
+	}
+	else if(isFinished())
+	{
+		command << "QUIT" << endl;
+		worker.isReady = false;
+	}
+	worker.channel->write(command.str().c_str());
+}
+
+int GenerationDriver::takeItem(unsigned int idxWorker)
+{
+	Worker& worker = workers[idxWorker];
+	if(!worker.items.empty())
+	{
+		unsigned int idxItem = worker.items.front();
+		worker.items.pop_front();
+		return idxItem;
+	}
+	if(!orphans.empty())
+	{
+		unsigned int idxItem = orphans.front();
+		orphans.pop_front();
+		return idxItem;
+	}
+
+	// Steal the last item of the queue with most work left (farthest from the models its owner has loaded)
+	int victim = -1;
+	float victimCost = 0.0f;
+	for(unsigned int i = 0; i < workers.size(); ++i)
+	{
+		float cost = 0.0f;
+		for(unsigned int j = 0; j < workers[i].items.size(); ++j)
+			cost += items[workers[i].items[j]].cost;
+		if(!workers[i].items.empty() && cost > victimCost)
+		{
+			victim = i;
+			victimCost = cost;
+		}
+	}
+	if(victim < 0)
+		return -1;
+	unsigned int idxItem = workers[victim].items.back();
+	workers[victim].items.pop_back();
+	worker.numStolen++;
+	return idxItem;
+}
+
+void GenerationDriver::lostWorker(unsigned int idxWorker)
+{
+	Worker& worker = workers[idxWorker];
+	worker.isAlive = false;
+	readWorker(idxWorker);
+	if(worker.current < 0 && worker.items.empty())
+		return;
+
+	// Finished units of the worker go to the run manifest so the next owner of its item skips them,
+	// its queue is left for the others to steal
+	if(worker.current >= 0)
+	{
+		WorkItem& item = items[worker.current];
+		for(unsigned int i = 0; i < plan.getClasses().size(); ++i)
+			foldJournal(plan.getClasses()[i].outputDir + "/", idxWorker, worker.lease);
+		if(++item.numFailures < MAX_FAILURES)
+		{
+			cout << "Generation: worker " << idxWorker << " stopped, task " << item.firstTask << " is handed over" << endl;
+			orphans.push_front(worker.current);
+		}
+		else
+		{
+			// Given up: its finished units stay journaled, a later run tries the rest again
+			cout << "Generation: worker " << idxWorker << " stopped, tasks " << item.firstTask << " to " << item.lastTask - 1
+				<< " failed " << item.numFailures << " times and are skipped" << endl;
+			numFailed++;
+		}
+		worker.current = -1;
+	}
+
+	// Idle workers waiting for work take it over (or quit once the others are done)
+	for(unsigned int i = 0; i < workers.size(); ++i)
+		if(isIdle(i))
+			assignItem(i);
+}
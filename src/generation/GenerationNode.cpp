@@ -0,0 +1,165 @@
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+
+#include <QCoreApplication>
+#include <QThread>
+#include <QTimer>
+
+#include "generation/GenerationNode.hpp"
+#include "rendering/Trace.hpp"
+
+using namespace std;
+
+GenerationNode::GenerationNode()
+{
+}
+
+GenerationNode::~GenerationNode()
+{
+	for(unsigned int i = 0; i < links.size(); ++i)
+	{
+		if(links[i].process != NULL && links[i].process->state() != QProcess::NotRunning)
+		{
+			links[i].process->kill();
+			links[i].process->waitForFinished();
+		}
+		delete links[i].process;
+		delete links[i].socket;
+	}
+}
+
+bool GenerationNode::run(const string& host, unsigned short port, unsigned int numWorkers, unsigned int stallSeconds)
+{
+	if(numWorkers == 0)
+		numWorkers = max(1, QThread::idealThreadCount() / 4);
+	unsigned int numEncoders = max(1, QThread::idealThreadCount() / (int)numWorkers - 2);
+
+	links.resize(numWorkers);
+	unsigned int numStarted = 0;
+	for(unsigned int i = 0; i < links.size(); ++i)
+		if(startLink(links[i], host, port, numEncoders))
+			numStarted++;
+	cout << "Node: " << numStarted << "/" << numWorkers << " workers connected to " << host << ":" << port << endl;
+	if(numStarted == 0)
+		return false;
+
+	// Relay until every worker is done (QUIT from the coordinator) or lost
+	QTimer wake;
+	wake.start(HEARTBEAT_SECONDS * 1000);
+	double lastBeat = Trace::now();
+	bool isActive = true;
+	while(isActive)
+	{
+		QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+		bool isBeat = Trace::now() - lastBeat >= HEARTBEAT_SECONDS * 1e6;
+		if(isBeat)
+			lastBeat = Trace::now();
+
+		isActive = false;
+		for(unsigned int i = 0; i < links.size(); ++i)
+		{
+			Link& link = links[i];
+			if(!link.isActive)
+				continue;
+			while(link.socket->canReadLine())
+			{
+				QByteArray line = link.socket->readLine();
+				if(line.startsWith("RUN"))
+				{
+					link.isBusy = true;
+					link.lastProgress = Trace::now();
+				}
+				link.process->write(line);
+			}
+			while(link.process->canReadLine())
+			{
+				// Any line shows the worker answers, progress is folded into the heartbeats
+				QByteArray line = link.process->readLine();
+				link.lastProgress = Trace::now();
+				if(line.startsWith("@PROGRESS"))
+					continue;
+				if(line.startsWith("@DONE") || line.startsWith("@READY"))
+					link.isBusy = false;
+				link.socket->write(line);
+			}
+			if(isBeat && link.process->state() != QProcess::NotRunning)
+				link.socket->write("@HEARTBEAT\n");
+
+			// Stalled worker: stopped, its heartbeats end and the coordinator hands its item over after the lease
+			if(link.isBusy && Trace::now() - link.lastProgress > stallSeconds * 1e6)
+			{
+				cout << "Node: worker " << i << " silent for " << (Trace::now() - link.lastProgress) / 1e6 << "s, stopped" << endl;
+				link.process->kill();
+				link.process->waitForFinished();
+			}
+
+			if(link.process->state() == QProcess::NotRunning)
+			{
+				cout << "Node: worker " << i << " finished" << endl;
+				closeLink(link);
+			}
+			else if(link.socket->state() != QAbstractSocket::ConnectedState)
+			{
+				// Its item is handed over by the coordinator once the lease expires
+				cout << "Node: coordinator lost, worker " << i << " stopped" << endl;
+				link.process->kill();
+				link.process->waitForFinished();
+				closeLink(link);
+			}
+			isActive = isActive || link.isActive;
+		}
+	}
+	return true;
+}
+
+bool GenerationNode::startLink(Link& link, const string& host, unsigned short port, unsigned int numEncoders)
+{
+	link.socket = new QTcpSocket();
+	link.socket->connectToHost(host.c_str(), port);
+	if(!link.socket->waitForConnected(10000))
+	{
+		cout << "Node: cannot connect to " << host << ":" << port << " (" << link.socket->errorString().toStdString() << ")" << endl;
+		return false;
+	}
+
+	// Worker id and job file of the coordinator
+	while(!link.socket->canReadLine() && link.socket->waitForReadyRead(10000))
+		continue;
+	stringstream command(QString(link.socket->readLine()).trimmed().toStdString());
+	string name, jobFile;
+	unsigned int id = 0;
+	command >> name >> id;
+	getline(command >> ws, jobFile);
+	if(name != "WORKER" || jobFile.empty())
+	{
+		cout << "Node: no worker id from the coordinator" << endl;
+		link.socket->abort();
+		return false;
+	}
+
+	link.process = new QProcess();
+	link.process->setProcessChannelMode(QProcess::MergedChannels);
+	QStringList args;
+	args << "--worker" << jobFile.c_str() << QString::number(id) << QString::number(numEncoders);
+	link.process->start(QCoreApplication::applicationFilePath(), args);
+	if(!link.process->waitForStarted())
+	{
+		cout << "Node: cannot start worker " << id << endl;
+		link.socket->abort();
+		return false;
+	}
+	link.isActive = true;
+	return true;
+}
+
+void GenerationNode::closeLink(Link& link)
+{
+	// Last lines of the worker before the connection closes (pending data is still sent)
+	while(link.process->canReadLine())
+		link.socket->write(link.process->readLine());
+	link.socket->disconnectFromHost();
+	if(link.socket->state() != QAbstractSocket::UnconnectedState)
+		link.socket->waitForDisconnected(5000);
+	link.isActive = false;
+}
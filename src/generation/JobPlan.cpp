@@ -0,0 +1,391 @@
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <cstdlib>
+#include <cmath>
+#include <QDir>
+
+#include "generation/JobPlan.hpp"
+#include "io/RunManifest.hpp"
+#include "io/ModelCatalog.hpp"
+#include "io/OutputEncoder.hpp"
+
+using namespace std;
+
+static vector<float> parseList(const string& text)
+{
+	vector<float> values;
+	stringstream ss(text);
+	string item;
+	while(getline(ss, item, ','))
+		if(item.find_first_not_of(" \t") != string::npos)
+			values.push_back((float)atof(item.c_str()));
+	return values;
+}
+
+static void replaceAll(string& str, const string& from, const string& to)
+{
+	size_t pos = 0;
+	while((pos = str.find(from, pos)) != string::npos)
+	{
+		str.replace(pos, from.size(), to);
+		pos += to.size();
+	}
+}
+
+JobClass::JobClass()
+{
+	ext = ".obj";
+	numBackgrounds = 7517;
+	isRandom = true;
+	isRange = false;
+	azStep = 15.0f;
+	step = 1.0f;
+	numSamplesModel = 1000;
+	sampling = VIEW_RANDOM;
+	sizeSample = 0;
+	gridSamples = 0;
+	superSampling = 0;
+	msaa = 0;
+	outputs = 0;
+	isKpsNoAz = false;
+	isKpsNoSelfOcc = false;
+	roundFrom = -1;
+	isRound = false;
+	isShards = false;
+	shardSizeMB = 1024;
+}
+
+string JobClass::describe() const
+{
+	stringstream ss;
+	ss << isRandom << " " << isRange << " " << sampling << " " << azStep << " " << step << " " << numSamplesModel << " "
+		<< sizeSample << " " << gridSamples << " " << ext << " " << roundFrom << " " << isKpsNoAz << " " << isKpsNoSelfOcc;
+	const vector<float>* lists[4] = { &azimuths, &elevations, &tilts, &distances };
+	for(unsigned int l = 0; l < 4; ++l)
+	{
+		ss << " |";
+		for(unsigned int i = 0; i < lists[l]->size(); ++i)
+			ss << " " << (*lists[l])[i];
+	}
+	return ss.str();
+}
+
+JobPlan::JobPlan() : seed(1), totalCost(0.0f)
+{
+}
+
+bool JobPlan::setKey(JobClass& job, const string& key, const string& value)
+{
+	stringstream ss(value);
+	string word;
+	if(key == "MODELS")
+		job.modelDir = value;
+	else if(key == "OUTPUT")
+		job.outputDir = value;
+	else if(key == "EXT")
+		job.ext = value;
+	else if(key == "BACKGROUNDS")
+	{
+		// DIR [NUM]: images DIR/000001.png ... DIR/NUM.png
+		size_t pos = value.find_last_of(' ');
+		if(pos != string::npos && atoi(value.substr(pos + 1).c_str()) > 0)
+		{
+			job.backgroundDir = value.substr(0, pos);
+			job.numBackgrounds = atoi(value.substr(pos + 1).c_str());
+		}
+		else
+			job.backgroundDir = value;
+	}
+	else if(key == "MODE")
+		job.isRandom = value != "GRID";
+	else if(key == "ANGLES")
+		job.isRange = value == "RANGES";
+	else if(key == "AZIMUTH")
+		job.azimuths = parseList(value);
+	else if(key == "ELEVATION")
+		job.elevations = parseList(value);
+	else if(key == "TILT")
+		job.tilts = parseList(value);
+	else if(key == "DISTANCE")
+		job.distances = parseList(value);
+	else if(key == "AZIMUTH_STEP")
+		job.azStep = (float)atof(value.c_str());
+	else if(key == "STEP")
+		job.step = (float)atof(value.c_str());
+	else if(key == "SAMPLES")
+		job.numSamplesModel = atoi(value.c_str());
+	else if(key == "SAMPLING")
+		job.sampling = value == "STRATIFIED" ? VIEW_STRATIFIED : value == "HALTON" ? VIEW_HALTON : value == "FIBONACCI" ? VIEW_FIBONACCI : VIEW_RANDOM;
+	else if(key == "SIZE")
+		job.sizeSample = atoi(value.c_str());
+	else if(key == "GRID")
+		job.gridSamples = atoi(value.c_str());
+	else if(key == "SUPERSAMPLING")
+		job.superSampling = atoi(value.c_str());
+	else if(key == "MSAA")
+		job.msaa = atoi(value.c_str());
+	else if(key == "OUTPUTS")
+		job.outputs = OutputEncoder::parseMask(value);
+	else if(key == "KPS_NO_AZIMUTH")
+		job.isKpsNoAz = atoi(value.c_str()) != 0;
+	else if(key == "KPS_NO_SELF_OCCLUSION")
+		job.isKpsNoSelfOcc = atoi(value.c_str()) != 0;
+	else if(key == "ROUND_FROM")
+		job.roundFrom = atoi(value.c_str());
+	else if(key == "SINK")
+	{
+		// FILES or SHARDS [SIZE_MB] (a size of 0 would rotate the shard on every sample)
+		ss >> word;
+		job.isShards = word == "SHARDS";
+		if(ss >> word)
+		{
+			int sizeMB = atoi(word.c_str());
+			if(sizeMB > 0)
+				job.shardSizeMB = sizeMB;
+			else
+				cout << "Job: invalid shard size " << word << ", keeping " << job.shardSizeMB << " MB" << endl;
+		}
+	}
+	else
+		return false;
+	return true;
+}
+
+bool JobPlan::load(const string& path)
+{
+	ifstream file(path.c_str());
+	if(!file.is_open())
+	{
+		cout << "Job: cannot open " << path << endl;
+		return false;
+	}
+
+	// Keys before the first CLASS are the defaults of all classes
+	JobClass defaults;
+	int idxCurrent = -1;
+	string line;
+	unsigned int numLine = 0;
+	while(getline(file, line))
+	{
+		numLine++;
+		if(!line.empty() && line[line.size() - 1] == '\r')
+			line.erase(line.size() - 1);
+		size_t start = line.find_first_not_of(" \t");
+		if(start == string::npos || line[start] == '#')
+			continue;
+		line = line.substr(start);
+
+		size_t split = line.find_first_of(" \t");
+		string key = line.substr(0, split);
+		string value = split == string::npos ? "" : line.substr(line.find_first_not_of(" \t", split));
+
+		if(key == "CLASS")
+		{
+			classes.push_back(defaults);
+			classes.back().name = value;
+			idxCurrent = classes.size() - 1;
+		}
+		else if(key == "SEED")
+			seed = strtoull(value.c_str(), NULL, 10);
+		else if(!setKey(idxCurrent < 0 ? defaults : classes[idxCurrent], key, value))
+			cout << "Job: unknown key " << key << " (" << path << ":" << numLine << ")" << endl;
+	}
+	if(classes.empty())
+		classes.push_back(defaults);
+
+	// %CLASS% in paths is the name of the class
+	for(unsigned int c = 0; c < classes.size(); ++c)
+	{
+		replaceAll(classes[c].modelDir, "%CLASS%", classes[c].name);
+		replaceAll(classes[c].outputDir, "%CLASS%", classes[c].name);
+		replaceAll(classes[c].backgroundDir, "%CLASS%", classes[c].name);
+	}
+	return true;
+}
+
+JobClass JobPlan::getModelParams(unsigned int idxClass, unsigned int idxModel)
+{
+	JobClass job = classes[idxClass];
+	// Folder index as listed, like the original script (folders without a model still count)
+	unsigned int folder = idxModel < job.modelFolders.size() ? job.modelFolders[idxModel] : idxModel;
+	if(job.roundFrom >= 0 && (int)folder >= job.roundFrom)
+	{
+		job.isRound = true;
+		job.tilts.assign(job.isRandom && job.isRange ? 2 : 1, 0.0f);
+		job.step = 1.0f;
+		job.isKpsNoAz = true;
+	}
+	return job;
+}
+
+string JobPlan::getRunKey(unsigned int idxClass)
+{
+	stringstream config;
+	config << seed << " " << classes[idxClass].describe();
+	string strConfig = config.str();
+	stringstream runKey;
+	runKey << hex << RunManifest::crc32((const unsigned char*)strConfig.data(), strConfig.size());
+	return runKey.str();
+}
+
+unsigned int JobPlan::getHash()
+{
+	// Models of every class (as catalogued) and the task list
+	stringstream text;
+	for(unsigned int c = 0; c < classes.size(); ++c)
+		for(unsigned int m = 0; m < classes[c].modelFiles.size(); ++m)
+			text << c << "\t" << classes[c].modelFiles[m] << "\t" << classes[c].modelFolders[m] << "\t" << classes[c].modelTriangles[m] << "\n";
+	for(unsigned int t = 0; t < tasks.size(); ++t)
+		text << tasks[t].idxClass << " " << tasks[t].idxModel << " " << tasks[t].unitKey << " " << tasks[t].numRenders << "\n";
+	string strText = text.str();
+	return RunManifest::crc32((const unsigned char*)strText.data(), strText.size());
+}
+
+float JobPlan::estimateCost(unsigned int numRenders, unsigned int sizeSample, unsigned int numTriangles)
+{
+	// Fixed part (scene draw, queries) + read back and encoding proportional to the pixels + geometry (draw and bounding box)
+	float pixels = (float)sizeSample * sizeSample / (512.0f * 512.0f);
+	return numRenders * (0.5f + 0.5f * pixels + 0.25f * numTriangles / 1e6f);
+}
+
+float JobPlan::estimateLoadCost(unsigned int numTriangles)
+{
+	// Import, buffers and tree of parts: about 2 samples per million triangles
+	return 0.5f + 2.0f * numTriangles / 1e6f;
+}
+
+bool JobPlan::prepareOutput(const JobClass& job)
+{
+	// Create save directory if does not exist
+	string savePath = job.outputDir + "/";
+	QDir saveDir(savePath.c_str());
+	if(!saveDir.exists() && !QDir().mkpath(savePath.c_str()))
+	{
+		cout << "Cannot create output folder " << savePath << endl;
+		return false;
+	}
+
+	// Create a README.txt file to describe annotations and names
+	ofstream readmeFile;
+	readmeFile.open((savePath + "README.txt").c_str());
+	if(readmeFile.is_open())
+	{
+		readmeFile << ">> README.txt" << endl;
+		readmeFile << "FOLDER STRUCTURE: " << endl;
+		readmeFile << "img_pNUM_INSTANCE" << endl;
+		readmeFile << "ANNOTATION STRUCTURE: " << endl;
+		readmeFile << "IMG_NAME ROW COL HEIGHT WIDTH AZIMUTH ELEVATION DISTANCE PART_NAME_1 PART_1_X PART_1_Y PART_1_Z" << endl;
+		readmeFile << "ANNOTATION FILE: obj_NUM/annotations.bin (txt version: Render --convert-annotations annotations.bin annotations.txt)" << endl;
+		readmeFile << "RUN MANIFEST: manifest.txt (finished units, delete it to generate again from scratch)" << endl;
+		if(job.isShards)
+			readmeFile << "SHARDS: shard-NUM.tar with obj_NUM/imgNUM.png + obj_NUM/imgNUM.txt (member offsets in shard-NUM.idx, shard-wWORKER-NUM.tar with --generate)" << endl;
+	}
+	readmeFile.close();
+	return true;
+}
+
+bool JobPlan::expand()
+{
+	tasks.clear();
+	totalCost = 0.0f;
+	for(unsigned int c = 0; c < classes.size(); ++c)
+	{
+		JobClass& job = classes[c];
+		string label = job.name.empty() ? job.modelDir : job.name;
+
+		// Same checks as the script tab
+		if(job.elevations.empty() || job.distances.empty() || job.tilts.empty() || (job.isRandom && !job.isRange && job.azimuths.empty()))
+		{
+			cout << "Job " << label << ": wrong elevation, distance or tilt selection" << endl;
+			return false;
+		}
+		if(job.isRandom && job.numSamplesModel == 0)
+		{
+			cout << "Job " << label << ": wrong input for number of random samples per model" << endl;
+			return false;
+		}
+		if(job.isRandom && job.isRange && (job.elevations.size() != 2 || job.distances.size() != 2 || job.tilts.size() != 2))
+		{
+			cout << "Job " << label << ": wrong input for elevation/distance ranges (2 elems: lower and upper bound)" << endl;
+			return false;
+		}
+		if(job.azStep <= 0.0f)
+		{
+			cout << "Job " << label << ": wrong azimuth step" << endl;
+			return false;
+		}
+
+		// Model folders with a readable 3D file (first one), from the catalog of the class kept in its output folder (built on the first run)
+		job.models.clear();
+		job.modelFiles.clear();
+		job.modelTriangles.clear();
+		job.modelFolders.clear();
+		ModelCatalog catalog;
+		if(!catalog.load(job.modelDir, job.ext, job.outputDir))
+			catalog.build(job.modelDir, job.ext, job.outputDir);
+		for(unsigned int iModel = 0; iModel < catalog.getEntries().size(); ++iModel)
+		{
+			job.models.push_back(catalog.getEntries()[iModel].model);
+			job.modelFiles.push_back(catalog.getModelPath(iModel));
+			job.modelTriangles.push_back(catalog.getEntries()[iModel].numTriangles);
+			job.modelFolders.push_back(catalog.getEntries()[iModel].folder);
+		}
+
+		string runKey = getRunKey(c);
+		unsigned int sizeSample = job.sizeSample > 0 ? job.sizeSample : 512;
+		unsigned int numViews = (unsigned int)ceil(360.0f / job.azStep - 1e-4f);
+		for(unsigned int m = 0; m < job.models.size(); ++m)
+		{
+			JobClass params = getModelParams(c, m);
+			unsigned int numTriangles = job.modelTriangles[m];
+			size_t firstTask = tasks.size();
+			RenderTask task;
+			task.idxClass = c;
+			task.idxModel = m;
+			task.tilt = task.elevation = task.distance = 0.0f;
+			if(params.isRandom)
+			{
+				// One sample per task (size drawn in [0.75, 1.25] x 512)
+				for(unsigned int s = 0; s < params.numSamplesModel; ++s)
+				{
+					stringstream key;
+					key << runKey << "/r" << s;
+					task.idxSample = s;
+					task.unitKey = key.str();
+					task.numRenders = 1;
+					task.cost = estimateCost(1, 512, numTriangles);
+					tasks.push_back(task);
+				}
+			}
+			else
+			{
+				// One task per full azimuth turn
+				for(unsigned int t = 0; t < params.tilts.size(); ++t)
+					for(unsigned int e = 0; e < params.elevations.size(); ++e)
+						for(unsigned int d = 0; d < params.distances.size(); ++d)
+						{
+							stringstream key;
+							key << runKey << "/t" << params.tilts[t] << "_e" << params.elevations[e] << "_d" << params.distances[d];
+							task.idxSample = (t*params.elevations.size() + e)*params.distances.size() + d;
+							task.unitKey = key.str();
+							task.tilt = params.tilts[t];
+							task.elevation = params.elevations[e];
+							task.distance = params.distances[d];
+							task.numRenders = numViews;
+							task.cost = estimateCost(numViews, sizeSample, numTriangles);
+							tasks.push_back(task);
+						}
+			}
+			if(tasks.size() > firstTask)
+				tasks[firstTask].cost += estimateLoadCost(numTriangles);
+		}
+
+		cout << "Job " << label << ": " << job.models.size() << " models" << endl;
+	}
+
+	for(unsigned int i = 0; i < tasks.size(); ++i)
+		totalCost += tasks[i].cost;
+	cout << "Job plan: " << tasks.size() << " tasks, estimated cost " << totalCost << endl;
+	return true;
+}
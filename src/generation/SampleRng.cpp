@@ -0,0 +1,16 @@
+#include "generation/SampleRng.hpp"
+
+SampleRng::SampleRng(unsigned long long seed, unsigned int model, unsigned int sample, unsigned int stream) : counter(0)
+{
+	// Chain the identifiers through the mixer so that neighbouring samples/models get unrelated keys
+	key = mix(seed + GOLDEN);
+	key = mix(key ^ ((unsigned long long)model << 32 | stream));
+	key = mix(key ^ (unsigned long long)sample * GOLDEN);
+}
+
+unsigned long long SampleRng::mix(unsigned long long x)
+{
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
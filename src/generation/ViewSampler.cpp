@@ -0,0 +1,271 @@
+#include <cmath>
+#include <algorithm>
+
+#include "generation/ViewSampler.hpp"
+
+using namespace std;
+
+static const float DEG2RAD = 3.14159265358979f / 180.0f;
+
+static bool compareSegments(const pair<float, float>& a, const pair<float, float>& b)
+{
+	return a.first < b.first;
+}
+
+// Radical inverse of the Halton sequence
+static float halton(unsigned int index, unsigned int base)
+{
+	float result = 0.0f;
+	float f = 1.0f / base;
+	while(index > 0)
+	{
+		result += f * (index % base);
+		index /= base;
+		f /= base;
+	}
+	return result;
+}
+
+// Keyed permutation of [0, size) (hash with cycle walking, Kensler 2013)
+static unsigned int permute(unsigned int i, unsigned int size, unsigned int key)
+{
+	unsigned int w = size - 1;
+	w |= w >> 1; w |= w >> 2; w |= w >> 4; w |= w >> 8; w |= w >> 16;
+	do
+	{
+		i ^= key; i *= 0xe170893d;
+		i ^= key >> 16; i ^= (i & w) >> 4;
+		i ^= key >> 8; i *= 0x0929eb3f;
+		i ^= key >> 23; i ^= (i & w) >> 1;
+		i *= 1 | key >> 27; i *= 0x6935fa69;
+		i ^= (i & w) >> 11; i *= 0x74dcb303;
+		i ^= (i & w) >> 2; i *= 0x9e501cc3;
+		i ^= (i & w) >> 2; i *= 0xc860a3df;
+		i &= w;
+		i ^= i >> 5;
+	} while(i >= size);
+	return (i + key) % size;
+}
+
+static float fract(float x)
+{
+	return x - floor(x);
+}
+
+ViewDomain::ViewDomain() : isSphere(false)
+{
+}
+
+void ViewDomain::setRange(float min, float max)
+{
+	segments.clear();
+	Segment segment;
+	segment.min = std::min(min, max);
+	segment.max = std::max(min, max);
+	segments.push_back(segment);
+	build();
+}
+
+void ViewDomain::setIntervals(const vector<float>& values, float min, float max, float halfWidth, bool isCircular)
+{
+	float period = max - min;
+	vector<pair<float, float> > raw;
+	for(unsigned int i = 0; i < values.size(); ++i)
+	{
+		float a = values[i] - halfWidth;
+		float b = values[i] + halfWidth;
+		if(isCircular)
+		{
+			if(b - a >= period)
+			{
+				a = min;
+				b = max;
+			}
+			else
+			{
+				// Move into [min, max) and split windows crossing the end of the circle
+				float shift = floor((a - min) / period) * period;
+				a -= shift;
+				b -= shift;
+				if(b > max)
+				{
+					raw.push_back(make_pair(min, b - period));
+					b = max;
+				}
+			}
+		}
+		a = std::max(a, min);
+		b = std::min(b, max);
+		if(a <= b)
+			raw.push_back(make_pair(a, b));
+	}
+
+	// Sorted union of the windows
+	sort(raw.begin(), raw.end(), compareSegments);
+	segments.clear();
+	for(unsigned int i = 0; i < raw.size(); ++i)
+	{
+		if(!segments.empty() && raw[i].first <= segments.back().max)
+			segments.back().max = std::max(segments.back().max, raw[i].second);
+		else
+		{
+			Segment segment;
+			segment.min = raw[i].first;
+			segment.max = raw[i].second;
+			segments.push_back(segment);
+		}
+	}
+	build();
+}
+
+void ViewDomain::build()
+{
+	cumWeights.assign(1, 0.0f);
+	guide.clear();
+	for(unsigned int i = 0; i < segments.size(); ++i)
+	{
+		float weight = isSphere ? sin(segments[i].max * DEG2RAD) - sin(segments[i].min * DEG2RAD) : segments[i].max - segments[i].min;
+		cumWeights.push_back(cumWeights.back() + weight);
+	}
+	float total = cumWeights.back();
+	if(segments.empty() || total <= 0.0f)
+		return;
+
+	// guide[g]: first segment that contains the value u = g/size
+	unsigned int size = 4 * segments.size() + 16;
+	guide.resize(size);
+	unsigned int idxSegment = 0;
+	for(unsigned int g = 0; g < size; ++g)
+	{
+		float x = (float)g / size * total;
+		while(idxSegment + 1 < segments.size() && cumWeights[idxSegment + 1] <= x)
+			idxSegment++;
+		guide[g] = idxSegment;
+	}
+}
+
+float ViewDomain::map(float u) const
+{
+	if(segments.empty())
+		return 0.0f;
+
+	unsigned int num = segments.size();
+	if(guide.empty())
+		return segments[std::min((unsigned int)(u * num), num - 1)].min;
+
+	float x = u * cumWeights.back();
+	unsigned int i = guide[std::min((unsigned int)(u * guide.size()), (unsigned int)guide.size() - 1)];
+	while(i + 1 < num && cumWeights[i + 1] <= x)
+		i++;
+	float t = x - cumWeights[i];
+
+	float value;
+	if(isSphere)
+	{
+		float s = sin(segments[i].min * DEG2RAD) + t;
+		value = asin(std::max(-1.0f, std::min(1.0f, s))) / DEG2RAD;
+	}
+	else
+		value = segments[i].min + t;
+	return std::max(segments[i].min, std::min(segments[i].max, value));
+}
+
+ViewSampler::ViewSampler() : mode(VIEW_RANDOM), numSamples(1), key(0), isViewAzimuth(false), isViewElevation(false)
+{
+}
+
+void ViewSampler::setMode(VIEW_SAMPLING newMode, unsigned int newNumSamples, unsigned int newKey)
+{
+	mode = newMode;
+	numSamples = std::max(newNumSamples, 1u);
+	key = newKey;
+	elevation.setSphere(mode == VIEW_FIBONACCI);
+}
+
+void ViewSampler::setViews(const vector<RangeView>& newViews, bool isAzimuth, bool isElevation)
+{
+	views.clear();
+	cumViews.assign(1, 0.0f);
+	isViewAzimuth = isAzimuth;
+	isViewElevation = isElevation;
+	if(!isAzimuth && !isElevation)
+		return;
+
+	for(unsigned int i = 0; i < newViews.size(); ++i)
+	{
+		const RangeView& view = newViews[i];
+		if(view.maxAzimuth < view.minAzimuth || view.maxElevation < view.minElevation)
+			continue;
+		float weight = 1.0f;
+		if(isAzimuth)
+			weight *= std::max(view.maxAzimuth - view.minAzimuth, 1);
+		if(isElevation)
+			weight *= std::max(view.maxElevation - view.minElevation, 1);
+		views.push_back(view);
+		cumViews.push_back(cumViews.back() + weight);
+	}
+}
+
+void ViewSampler::getPattern(SampleRng& rng, unsigned int idxSample, float* u)
+{
+	// Per model rotation of the deterministic patterns
+	float offset[4];
+	for(unsigned int d = 0; d < 4; ++d)
+		offset[d] = (float)(SampleRng::mix(key + d) >> 40) * (1.0f / 16777216.0f);
+
+	unsigned int i = idxSample % numSamples;
+	switch(mode)
+	{
+		case VIEW_STRATIFIED:
+			for(unsigned int d = 0; d < 4; ++d)
+				u[d] = (permute(i, numSamples, key * (2 * d + 1) + d) + rng.uniform()) / numSamples;
+			break;
+		case VIEW_HALTON:
+		{
+			const unsigned int bases[4] = { 2, 3, 5, 7 };
+			for(unsigned int d = 0; d < 4; ++d)
+				u[d] = fract(halton(idxSample + 1, bases[d]) + offset[d]);
+			break;
+		}
+		case VIEW_FIBONACCI:
+			u[0] = fract(i * 0.618033988749895f + offset[0]);
+			u[1] = fract((i + 0.5f) / numSamples + offset[1]);
+			u[2] = fract(halton(idxSample + 1, 2) + offset[2]);
+			u[3] = fract(halton(idxSample + 1, 3) + offset[3]);
+			break;
+		default:
+			for(unsigned int d = 0; d < 4; ++d)
+				u[d] = rng.uniform();
+	}
+
+	for(unsigned int d = 0; d < 4; ++d)
+		u[d] = std::min(u[d], 0.99999994f);
+}
+
+ViewSample ViewSampler::sample(SampleRng& rng, unsigned int idxSample)
+{
+	float u[4];
+	getPattern(rng, idxSample, u);
+
+	ViewSample view;
+	if(views.empty())
+	{
+		view.azimuth = azimuth.map(u[0]);
+		view.elevation = elevation.map(u[1]);
+	}
+	else
+	{
+		// Choose a view by area with the first value and reuse the remainder inside it
+		float x = u[0] * cumViews.back();
+		unsigned int j = 0;
+		while(j + 1 < views.size() && cumViews[j + 1] <= x)
+			j++;
+		float u0 = std::min((x - cumViews[j]) / (cumViews[j + 1] - cumViews[j]), 0.99999994f);
+		const RangeView& range = views[j];
+		view.azimuth = isViewAzimuth ? range.minAzimuth + u0 * (range.maxAzimuth - range.minAzimuth) : azimuth.map(u0);
+		view.elevation = isViewElevation ? range.minElevation + u[1] * (range.maxElevation - range.minElevation) : elevation.map(u[1]);
+	}
+	view.tilt = tilt.map(u[2]);
+	view.distance = distance.map(u[3]);
+	return view;
+}
@@ -0,0 +1,479 @@
+#include <iostream>
+#include <sstream>
+
+#include <QFile>
+
+#include "io/AnnotationStore.hpp"
+
+using namespace std;
+
+static const unsigned int FILE_MAGIC = 0x4E4E4152; // "RANN"
+static const unsigned int BLOCK_MAGIC = 0x4B4C4252; // "RBLK"
+static const unsigned int INDEX_MAGIC = 0x58444952; // "RIDX"
+static const unsigned int FOOTER_MAGIC = 0x444E4552; // "REND"
+static const unsigned int HEADER_BYTES = 8;
+static const unsigned int BLOCK_HEADER_BYTES = 20;
+static const unsigned int TRAILER_BYTES = 12;
+
+// Binary helpers
+template<class T> static void writeValue(ostream& out, const T& value)
+{
+	out.write((const char*)&value, sizeof(T));
+}
+
+template<class T> static void writeColumn(ostream& out, const vector<T>& column)
+{
+	if(!column.empty())
+		out.write((const char*)column.data(), sizeof(T)*column.size());
+}
+
+template<class T> static bool readValue(istream& in, T& value)
+{
+	return (bool)in.read((char*)&value, sizeof(T));
+}
+
+template<class T> static bool readColumn(istream& in, vector<T>& column, unsigned int size)
+{
+	column.resize(size);
+	return size == 0 || (bool)in.read((char*)column.data(), sizeof(T)*size);
+}
+
+struct BlockHeader
+{
+	unsigned int magic, numRecords, numKps, numNewStrings, numBytes;
+};
+
+static bool readBlockHeader(istream& in, BlockHeader& header, vector<string>& strings)
+{
+	if(!readValue(in, header.magic) || header.magic != BLOCK_MAGIC)
+		return false;
+	readValue(in, header.numRecords);
+	readValue(in, header.numKps);
+	readValue(in, header.numNewStrings);
+	if(!readValue(in, header.numBytes))
+		return false;
+
+	for(unsigned int i = 0; i < header.numNewStrings; ++i)
+	{
+		unsigned int length;
+		if(!readValue(in, length))
+			return false;
+		string str(length, ' ');
+		if(length > 0 && !in.read(&str[0], length))
+			return false;
+		strings.push_back(str);
+	}
+	return true;
+}
+
+bool AnnotationStore::readIndex(ifstream& file, vector<BlockInfo>& blocks, vector<string>& strings, unsigned long long& endOffset)
+{
+	blocks.clear();
+	strings.clear();
+
+	file.seekg(0, ios::end);
+	unsigned long long fileSize = file.tellg();
+	file.seekg(0, ios::beg);
+	unsigned int magic, version;
+	if(!readValue(file, magic) || !readValue(file, version) || magic != FILE_MAGIC || version != VERSION)
+		return false;
+
+	// Footer index (written on close)
+	bool isFooter = false;
+	if(fileSize >= HEADER_BYTES + TRAILER_BYTES)
+	{
+		unsigned long long footerOffset;
+		file.seekg(fileSize - TRAILER_BYTES, ios::beg);
+		readValue(file, footerOffset);
+		readValue(file, magic);
+		if(magic == FOOTER_MAGIC && footerOffset >= HEADER_BYTES && footerOffset < fileSize)
+		{
+			file.seekg(footerOffset, ios::beg);
+			unsigned int numBlocks;
+			if(readValue(file, magic) && magic == INDEX_MAGIC && readValue(file, numBlocks))
+			{
+				blocks.resize(numBlocks);
+				isFooter = true;
+				for(unsigned int i = 0; i < numBlocks && isFooter; ++i)
+					isFooter = readValue(file, blocks[i].offset) && readValue(file, blocks[i].firstRecord) && readValue(file, blocks[i].numRecords);
+
+				// Strings are stored inside the blocks
+				for(unsigned int i = 0; i < blocks.size() && isFooter; ++i)
+				{
+					BlockHeader header;
+					file.seekg(blocks[i].offset, ios::beg);
+					isFooter = readBlockHeader(file, header, strings);
+				}
+				endOffset = footerOffset;
+			}
+		}
+	}
+	if(isFooter)
+		return true;
+
+	// No (valid) footer: interrupted run, recover all complete blocks
+	blocks.clear();
+	strings.clear();
+	file.clear();
+	unsigned long long offset = HEADER_BYTES;
+	unsigned int numRecords = 0;
+	while(offset + BLOCK_HEADER_BYTES <= fileSize)
+	{
+		BlockHeader header;
+		file.seekg(offset, ios::beg);
+		size_t numStrings = strings.size();
+		if(!readBlockHeader(file, header, strings) || offset + BLOCK_HEADER_BYTES + header.numBytes > fileSize)
+		{
+			strings.resize(numStrings);
+			break;
+		}
+		BlockInfo block;
+		block.offset = offset;
+		block.firstRecord = numRecords;
+		block.numRecords = header.numRecords;
+		blocks.push_back(block);
+		numRecords += header.numRecords;
+		offset += BLOCK_HEADER_BYTES + header.numBytes;
+	}
+	file.clear();
+	endOffset = offset;
+	if(offset != fileSize)
+		cout << "Annotations: recovered " << blocks.size() << " blocks (" << numRecords << " records) without index" << endl;
+
+	return true;
+}
+
+unsigned long long AnnotationStore::getLength(const string& path)
+{
+	ifstream file(path.c_str(), ios::binary);
+	vector<BlockInfo> blocks;
+	vector<string> strings;
+	unsigned long long endOffset = 0;
+	if(!file.is_open() || !readIndex(file, blocks, strings, endOffset))
+		return 0;
+	return endOffset;
+}
+
+bool AnnotationStore::truncate(const string& path, unsigned long long bytes)
+{
+	unsigned long long endOffset = getLength(path);
+	if(endOffset == bytes)
+		return true;
+
+	// Nothing committed: the store is started again
+	if(bytes <= HEADER_BYTES)
+		return !QFile::exists(path.c_str()) || QFile::remove(path.c_str());
+	if(endOffset < bytes || !QFile::resize(path.c_str(), bytes))
+	{
+		cout << "Annotations: cannot cut " << path << " back to " << bytes << " bytes" << endl;
+		return false;
+	}
+	cout << "Annotations: " << endOffset - bytes << " bytes of uncommitted records dropped from " << path << endl;
+
+	// Footer of the remaining blocks
+	AnnotationWriter writer;
+	if(!writer.open(path))
+		return false;
+	writer.close();
+	return true;
+}
+
+AnnotationWriter::AnnotationWriter() : numRecords(0), numStrings(0)
+{
+}
+
+AnnotationWriter::~AnnotationWriter()
+{
+	close();
+}
+
+bool AnnotationWriter::open(const string& pPath)
+{
+	close();
+	path = pPath;
+	blocks.clear();
+	stringIds.clear();
+	newStrings.clear();
+	clearColumns();
+	numRecords = 0;
+	numStrings = 0;
+
+	// Continue an existing store
+	unsigned long long endOffset = HEADER_BYTES;
+	ifstream in(path.c_str(), ios::binary);
+	if(in.is_open() && in.seekg(0, ios::end) && in.tellg() > 0)
+	{
+		vector<string> strings;
+		if(!AnnotationStore::readIndex(in, blocks, strings, endOffset))
+		{
+			cout << "Annotations: " << path << " is not a valid annotation file" << endl;
+			path = "";
+			return false;
+		}
+		for(unsigned int i = 0; i < strings.size(); ++i)
+			stringIds[strings[i]] = i;
+		numStrings = strings.size();
+		if(!blocks.empty())
+			numRecords = blocks.back().firstRecord + blocks.back().numRecords;
+		in.close();
+	}
+	else
+	{
+		in.close();
+		ofstream out(path.c_str(), ios::binary);
+		unsigned int version = AnnotationStore::VERSION;
+		writeValue(out, FILE_MAGIC);
+		writeValue(out, version);
+	}
+
+	file.open(path.c_str(), ios::in | ios::out | ios::binary);
+	if(!file.is_open())
+	{
+		cout << "Annotations: cannot open " << path << endl;
+		path = "";
+		return false;
+	}
+	file.seekp(endOffset, ios::beg);
+
+	return true;
+}
+
+unsigned int AnnotationWriter::getStringId(const string& str)
+{
+	map<string, unsigned int>::iterator it = stringIds.find(str);
+	if(it != stringIds.end())
+		return it->second;
+
+	stringIds[str] = numStrings;
+	newStrings.push_back(str);
+	return numStrings++;
+}
+
+void AnnotationWriter::write(const AnnotationRecord& record)
+{
+	if(!file.is_open())
+		return;
+
+	colImage.push_back(getStringId(record.image));
+	colModel.push_back(getStringId(record.model));
+	colTop.push_back(record.top);
+	colLeft.push_back(record.left);
+	colHeight.push_back(record.height);
+	colWidth.push_back(record.width);
+	colAzimuth.push_back(record.azimuth);
+	colElevation.push_back(record.elevation);
+	colTilt.push_back(record.tilt);
+	colDistance.push_back(record.distance);
+	colNumKps.push_back(record.kps.size());
+	for(unsigned int i = 0; i < record.kps.size(); ++i)
+	{
+		colKpsName.push_back(getStringId(record.kps[i].name));
+		colKpsRow.push_back(record.kps[i].row);
+		colKpsCol.push_back(record.kps[i].col);
+		colKpsVis.push_back((signed char)record.kps[i].vis);
+	}
+
+	if(colImage.size() >= AnnotationStore::RECORDS_PER_BLOCK)
+		flush();
+}
+
+void AnnotationWriter::flush()
+{
+	if(!file.is_open() || colImage.empty())
+		return;
+
+	// Size of everything after the block header (lets readers skip or validate the block)
+	unsigned int numBytes = 0;
+	for(unsigned int i = 0; i < newStrings.size(); ++i)
+		numBytes += sizeof(unsigned int) + newStrings[i].size();
+	numBytes += colImage.size() * (11 * 4);
+	numBytes += colKpsName.size() * (3 * 4 + 1);
+
+	AnnotationStore::BlockInfo block;
+	block.offset = file.tellp();
+	block.firstRecord = numRecords;
+	block.numRecords = colImage.size();
+
+	writeValue(file, BLOCK_MAGIC);
+	writeValue(file, block.numRecords);
+	writeValue(file, (unsigned int)colKpsName.size());
+	writeValue(file, (unsigned int)newStrings.size());
+	writeValue(file, numBytes);
+	for(unsigned int i = 0; i < newStrings.size(); ++i)
+	{
+		writeValue(file, (unsigned int)newStrings[i].size());
+		file.write(newStrings[i].data(), newStrings[i].size());
+	}
+	writeColumn(file, colImage);
+	writeColumn(file, colModel);
+	writeColumn(file, colTop);
+	writeColumn(file, colLeft);
+	writeColumn(file, colHeight);
+	writeColumn(file, colWidth);
+	writeColumn(file, colAzimuth);
+	writeColumn(file, colElevation);
+	writeColumn(file, colTilt);
+	writeColumn(file, colDistance);
+	writeColumn(file, colNumKps);
+	writeColumn(file, colKpsName);
+	writeColumn(file, colKpsRow);
+	writeColumn(file, colKpsCol);
+	writeColumn(file, colKpsVis);
+	file.flush();
+
+	blocks.push_back(block);
+	numRecords += block.numRecords;
+	newStrings.clear();
+	clearColumns();
+}
+
+void AnnotationWriter::writeFooter()
+{
+	unsigned long long footerOffset = file.tellp();
+	writeValue(file, INDEX_MAGIC);
+	writeValue(file, (unsigned int)blocks.size());
+	for(unsigned int i = 0; i < blocks.size(); ++i)
+	{
+		writeValue(file, blocks[i].offset);
+		writeValue(file, blocks[i].firstRecord);
+		writeValue(file, blocks[i].numRecords);
+	}
+	writeValue(file, footerOffset);
+	writeValue(file, FOOTER_MAGIC);
+}
+
+void AnnotationWriter::close()
+{
+	if(!file.is_open())
+		return;
+
+	flush();
+	writeFooter();
+	file.close();
+	path = "";
+}
+
+void AnnotationWriter::clearColumns()
+{
+	colImage.clear(); colModel.clear(); colNumKps.clear();
+	colTop.clear(); colLeft.clear(); colHeight.clear(); colWidth.clear();
+	colAzimuth.clear(); colElevation.clear(); colTilt.clear(); colDistance.clear();
+	colKpsName.clear(); colKpsRow.clear(); colKpsCol.clear(); colKpsVis.clear();
+}
+
+AnnotationReader::AnnotationReader()
+{
+}
+
+AnnotationReader::~AnnotationReader()
+{
+	close();
+}
+
+bool AnnotationReader::open(const string& path)
+{
+	close();
+	file.clear();
+	file.open(path.c_str(), ios::binary);
+	if(!file.is_open())
+		return false;
+
+	unsigned long long endOffset;
+	return AnnotationStore::readIndex(file, blocks, strings, endOffset);
+}
+
+bool AnnotationReader::readBlock(unsigned int idxBlock, vector<AnnotationRecord>& records)
+{
+	records.clear();
+	if(idxBlock >= blocks.size())
+		return false;
+
+	file.clear();
+	file.seekg(blocks[idxBlock].offset, ios::beg);
+	BlockHeader header;
+	vector<string> blockStrings;
+	if(!readBlockHeader(file, header, blockStrings))
+		return false;
+
+	unsigned int n = header.numRecords;
+	unsigned int m = header.numKps;
+	vector<unsigned int> colImage, colModel, colNumKps, colKpsName;
+	vector<int> colTop, colLeft, colHeight, colWidth;
+	vector<float> colAzimuth, colElevation, colTilt, colDistance, colKpsRow, colKpsCol;
+	vector<signed char> colKpsVis;
+	bool isOk = readColumn(file, colImage, n) && readColumn(file, colModel, n)
+		&& readColumn(file, colTop, n) && readColumn(file, colLeft, n) && readColumn(file, colHeight, n) && readColumn(file, colWidth, n)
+		&& readColumn(file, colAzimuth, n) && readColumn(file, colElevation, n) && readColumn(file, colTilt, n) && readColumn(file, colDistance, n)
+		&& readColumn(file, colNumKps, n)
+		&& readColumn(file, colKpsName, m) && readColumn(file, colKpsRow, m) && readColumn(file, colKpsCol, m) && readColumn(file, colKpsVis, m);
+	if(!isOk)
+		return false;
+
+	records.resize(n);
+	unsigned int idxKp = 0;
+	for(unsigned int i = 0; i < n; ++i)
+	{
+		AnnotationRecord& record = records[i];
+		record.image = colImage[i] < strings.size() ? strings[colImage[i]] : "";
+		record.model = colModel[i] < strings.size() ? strings[colModel[i]] : "";
+		record.top = colTop[i];
+		record.left = colLeft[i];
+		record.height = colHeight[i];
+		record.width = colWidth[i];
+		record.azimuth = colAzimuth[i];
+		record.elevation = colElevation[i];
+		record.tilt = colTilt[i];
+		record.distance = colDistance[i];
+		for(unsigned int k = 0; k < colNumKps[i] && idxKp < m; ++k, ++idxKp)
+		{
+			string name = colKpsName[idxKp] < strings.size() ? strings[colKpsName[idxKp]] : "";
+			record.kps.push_back(KpsAnnotation(name, colKpsRow[idxKp], colKpsCol[idxKp], colKpsVis[idxKp]));
+		}
+	}
+
+	return true;
+}
+
+string AnnotationReader::toText(const AnnotationRecord& record)
+{
+	// IMGNAME ROW COL HEIGHT WIDTH AZIMUTH ELEVATION TILT DISTANCE [KP_NAME KP_ROW KP_COL KP_VIS]*
+	stringstream annotationStr;
+	annotationStr << record.image << " ";
+	annotationStr << record.top << " " << record.left << " " << record.height << " " << record.width << " ";
+	annotationStr << record.azimuth << " " << record.elevation << " " << record.tilt << " " << record.distance << " ";
+	for(unsigned int i = 0; i < record.kps.size(); ++i)
+		annotationStr << record.kps[i].name << " " << record.kps[i].row << " " << record.kps[i].col << " " << record.kps[i].vis << " ";
+	return annotationStr.str();
+}
+
+bool AnnotationReader::convertToText(const string& pathIn, const string& pathOut)
+{
+	AnnotationReader reader;
+	if(!reader.open(pathIn))
+	{
+		cout << "Annotations: cannot read " << pathIn << endl;
+		return false;
+	}
+
+	ofstream out(pathOut.c_str());
+	if(!out.is_open())
+	{
+		cout << "Annotations: cannot write " << pathOut << endl;
+		return false;
+	}
+
+	vector<AnnotationRecord> records;
+	for(unsigned int i = 0; i < reader.getNumBlocks(); ++i)
+	{
+		if(!reader.readBlock(i, records))
+		{
+			cout << "Annotations: block " << i << " of " << pathIn << " is corrupted" << endl;
+			return false;
+		}
+		for(unsigned int r = 0; r < records.size(); ++r)
+			out << toText(records[r]) << endl;
+	}
+	cout << "Annotations: " << reader.getNumRecords() << " records converted into " << pathOut << endl;
+
+	return true;
+}
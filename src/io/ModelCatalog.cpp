@@ -0,0 +1,365 @@
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <algorithm>
+
+#include <QDir>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QThread>
+
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+
+#include "io/ModelCatalog.hpp"
+#include "io/RunManifest.hpp"
+#include "rendering/Trace.hpp"
+
+using namespace std;
+
+class CatalogWorker : public QThread
+{
+	public:
+
+		CatalogWorker(ModelCatalog* pCatalog) : catalog(pCatalog) {}
+
+	protected:
+
+		virtual void run() { catalog->runScan(); }
+
+	private:
+
+		ModelCatalog* catalog;
+};
+
+static string trimLine(const char* text)
+{
+	string value(text);
+	size_t first = value.find_first_not_of(" \t\r\n");
+	size_t last = value.find_last_not_of(" \t\r\n");
+	return first == string::npos ? "" : value.substr(first, last - first + 1);
+}
+
+CatalogEntry::CatalogEntry() : folder(0), fileSize(0), numVertices(0), numTriangles(0), numMaterials(0), numTextures(0), hasKps(false), hasSegmentation(false)
+{
+	bbMin[0] = bbMin[1] = bbMin[2] = 0.0f;
+	bbMax[0] = bbMax[1] = bbMax[2] = 0.0f;
+}
+
+ModelCatalog::ModelCatalog() : dirModified(0)
+{
+	nextEntry = 0;
+}
+
+long long ModelCatalog::getModified(const string& path)
+{
+	return QFileInfo(path.c_str()).lastModified().toMSecsSinceEpoch() / 1000;
+}
+
+string ModelCatalog::getPath()
+{
+	// Classes may share an output folder: one file per class folder
+	stringstream path;
+	path << cacheDir << "/catalog-" << hex << RunManifest::crc32((const unsigned char*)dir.data(), dir.size()) << ".txt";
+	return path.str();
+}
+
+bool ModelCatalog::load(const string& modelDir, const string& pExt, const string& pCacheDir)
+{
+	entries.clear();
+	dir = modelDir;
+	ext = pExt;
+	cacheDir = pCacheDir;
+	ifstream file(getPath().c_str());
+	if(!file.is_open())
+		return false;
+
+	// Header: version, extension, modification time of the class folder when it was built and the folder
+	string line;
+	getline(file, line);
+	stringstream header(line);
+	string tag, fileExt, fileDir;
+	unsigned int version = 0;
+	getline(header, tag, '\t');
+	header >> version;
+	header.ignore();
+	getline(header, fileExt, '\t');
+	header >> dirModified;
+	header.ignore();
+	getline(header, fileDir);
+	if(tag != "CATALOG" || version != VERSION || fileExt != ext || dirModified != getModified(modelDir) || fileDir != dir)
+		return false;
+
+	while(getline(file, line))
+	{
+		vector<string> fields;
+		stringstream ss(line);
+		string field;
+		while(getline(ss, field, '\t'))
+			fields.push_back(field);
+		if(fields.size() != 17)
+		{
+			entries.clear();
+			return false;
+		}
+		CatalogEntry entry;
+		entry.model = fields[0];
+		entry.file = fields[1];
+		entry.format = fields[2];
+		entry.fileSize = strtoull(fields[3].c_str(), NULL, 10);
+		entry.numVertices = atoi(fields[4].c_str());
+		entry.numTriangles = atoi(fields[5].c_str());
+		entry.numMaterials = atoi(fields[6].c_str());
+		entry.numTextures = atoi(fields[7].c_str());
+		for(unsigned int i = 0; i < 3; ++i)
+		{
+			entry.bbMin[i] = (float)atof(fields[8 + i].c_str());
+			entry.bbMax[i] = (float)atof(fields[11 + i].c_str());
+		}
+		entry.hasKps = fields[14] == "1";
+		entry.hasSegmentation = fields[15] == "1";
+		entry.folder = atoi(fields[16].c_str());
+		entries.push_back(entry);
+	}
+	return true;
+}
+
+bool ModelCatalog::save()
+{
+	QDir().mkpath(cacheDir.c_str());
+	ofstream file(getPath().c_str());
+	if(!file.is_open())
+	{
+		cout << "Catalog: cannot write " << getPath() << endl;
+		return false;
+	}
+	file << "CATALOG\t" << VERSION << "\t" << ext << "\t" << dirModified << "\t" << dir << endl;
+	for(unsigned int i = 0; i < entries.size(); ++i)
+	{
+		const CatalogEntry& entry = entries[i];
+		file << entry.model << "\t" << entry.file << "\t" << entry.format << "\t" << entry.fileSize << "\t"
+			<< entry.numVertices << "\t" << entry.numTriangles << "\t" << entry.numMaterials << "\t" << entry.numTextures;
+		for(unsigned int j = 0; j < 3; ++j)
+			file << "\t" << entry.bbMin[j];
+		for(unsigned int j = 0; j < 3; ++j)
+			file << "\t" << entry.bbMax[j];
+		file << "\t" << (entry.hasKps ? 1 : 0) << "\t" << (entry.hasSegmentation ? 1 : 0) << "\t" << entry.folder << endl;
+	}
+	return file.good();
+}
+
+bool ModelCatalog::build(const string& modelDir, const string& pExt, const string& pCacheDir, unsigned int numThreads)
+{
+	double timeStart = Trace::now();
+	entries.clear();
+	dir = modelDir;
+	ext = pExt;
+	cacheDir = pCacheDir;
+	dirModified = getModified(modelDir);
+
+	// Model folders with a readable 3D file (first one), in the order of the folder listing
+	QDir dirModels(modelDir.c_str());
+	if(!dirModels.exists())
+	{
+		cout << "Catalog: no model folder " << modelDir << endl;
+		return false;
+	}
+	dirModels.setFilter(QDir::Dirs | QDir::NoDotAndDotDot);
+	QStringList listModels = dirModels.entryList();
+	QStringList extFiles;
+	extFiles << QString("*").append(ext.c_str());
+	for(int iModel = 0; iModel < listModels.size(); ++iModel)
+	{
+		QDir dirFiles((modelDir + "/" + listModels[iModel].toStdString()).c_str());
+		dirFiles.setFilter(QDir::Files | QDir::NoDotAndDotDot);
+		dirFiles.setNameFilters(extFiles);
+		QStringList listFiles = dirFiles.entryList();
+		if(listFiles.empty())
+			continue;
+		CatalogEntry entry;
+		entry.model = listModels[iModel].toStdString();
+		entry.file = listFiles[0].toStdString();
+		entry.folder = iModel;
+		entries.push_back(entry);
+	}
+
+	// Models are independent: each thread takes the next one until none is left
+	if(numThreads == 0)
+		numThreads = max(1, QThread::idealThreadCount());
+	numThreads = min(numThreads, max(1u, (unsigned int)entries.size()));
+	nextEntry = 0;
+	vector<CatalogWorker*> workers;
+	for(unsigned int i = 0; i < numThreads; ++i)
+	{
+		workers.push_back(new CatalogWorker(this));
+		workers.back()->start();
+	}
+	for(unsigned int i = 0; i < workers.size(); ++i)
+	{
+		workers[i]->wait();
+		delete workers[i];
+	}
+
+	unsigned long long numTriangles = 0;
+	for(unsigned int i = 0; i < entries.size(); ++i)
+		numTriangles += entries[i].numTriangles;
+	cout << "Catalog: " << entries.size() << " models (" << numTriangles << " triangles) of " << modelDir << " scanned in "
+		<< (Trace::now() - timeStart) / 1e6 << "s with " << numThreads << " threads" << endl;
+	return save();
+}
+
+void ModelCatalog::runScan()
+{
+	for(;;)
+	{
+		unsigned int idxEntry = nextEntry++;
+		if(idxEntry >= entries.size())
+			break;
+		if(!scanModel(dir, entries[idxEntry]))
+			cout << "Catalog: cannot read " << getModelPath(idxEntry) << endl;
+	}
+}
+
+bool ModelCatalog::scanModel(const string& modelDir, CatalogEntry& entry)
+{
+	string path = modelDir + "/" + entry.model + "/" + entry.file;
+	size_t dot = entry.file.find_last_of(".");
+	entry.format = dot == string::npos ? "" : entry.file.substr(dot + 1);
+	transform(entry.format.begin(), entry.format.end(), entry.format.begin(), ::tolower);
+	entry.fileSize = QFileInfo(path.c_str()).size();
+
+	// Keypoints and segmentation as looked up by the model loader and the labelling tab
+	string base = path.substr(0, path.find_last_of("."));
+	entry.hasKps = QFileInfo((base + ".kps").c_str()).exists();
+	entry.hasSegmentation = QFileInfo((base + ".seg").c_str()).exists();
+
+	// Fbx goes through its own SDK at load time: size only
+	if(entry.format == "obj")
+		return scanObj(path, entry);
+	else if(entry.format != "fbx")
+		return scanAssimp(path, entry);
+	return true;
+}
+
+bool ModelCatalog::scanObj(const string& path, CatalogEntry& entry)
+{
+	FILE* file = fopen(path.c_str(), "rb");
+	if(file == NULL)
+		return false;
+
+	// Line scan without building the mesh: polygons count as the triangles of their fan
+	set<string> materials, libraries;
+	float bbMin[3] = { 1e30f, 1e30f, 1e30f };
+	float bbMax[3] = { -1e30f, -1e30f, -1e30f };
+	char line[4096];
+	bool isLineStart = true;
+	while(fgets(line, sizeof(line), file) != NULL)
+	{
+		bool isStart = isLineStart;
+		isLineStart = strchr(line, '\n') != NULL;
+		if(!isStart) // rest of a line longer than the buffer
+			continue;
+		if(line[0] == 'v' && line[1] == ' ')
+		{
+			float v[3];
+			if(sscanf(line + 2, "%f %f %f", &v[0], &v[1], &v[2]) != 3)
+				continue;
+			entry.numVertices++;
+			for(unsigned int i = 0; i < 3; ++i)
+			{
+				bbMin[i] = min(bbMin[i], v[i]);
+				bbMax[i] = max(bbMax[i], v[i]);
+			}
+		}
+		else if(line[0] == 'f' && line[1] == ' ')
+		{
+			unsigned int numCorners = 0;
+			bool isSpace = true;
+			for(const char* c = line + 2; *c != '\0' && *c != '\n'; ++c)
+			{
+				bool isToken = *c != ' ' && *c != '\t' && *c != '\r';
+				if(isToken && isSpace)
+					numCorners++;
+				isSpace = !isToken;
+			}
+			if(numCorners >= 3)
+				entry.numTriangles += numCorners - 2;
+		}
+		else if(strncmp(line, "usemtl", 6) == 0)
+			materials.insert(trimLine(line + 6));
+		else if(strncmp(line, "mtllib", 6) == 0)
+			libraries.insert(trimLine(line + 6));
+	}
+	fclose(file);
+	if(entry.numVertices > 0)
+		for(unsigned int i = 0; i < 3; ++i)
+		{
+			entry.bbMin[i] = bbMin[i];
+			entry.bbMax[i] = bbMax[i];
+		}
+	entry.numMaterials = materials.size();
+
+	// Textures referenced by the material libraries (map_Kd, map_Bump, ...)
+	string dir = path.substr(0, path.find_last_of("/\\") + 1);
+	set<string> textures;
+	for(set<string>::iterator it = libraries.begin(); it != libraries.end(); ++it)
+	{
+		ifstream mtl((dir + *it).c_str());
+		string mtlLine;
+		while(getline(mtl, mtlLine))
+		{
+			string value = trimLine(mtlLine.c_str());
+			if(value.compare(0, 4, "map_") == 0 && value.find_last_of(" \t") != string::npos)
+				textures.insert(value.substr(value.find_last_of(" \t") + 1));
+		}
+	}
+	entry.numTextures = textures.size();
+	return true;
+}
+
+bool ModelCatalog::scanAssimp(const string& path, CatalogEntry& entry)
+{
+	// Same processing as the model loader, so counts are the ones rendered
+	Assimp::Importer importer;
+	const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_SortByPType);
+	if(scene == NULL)
+		return false;
+
+	bool isFirst = true;
+	for(unsigned int m = 0; m < scene->mNumMeshes; ++m)
+	{
+		const aiMesh* mesh = scene->mMeshes[m];
+		entry.numVertices += mesh->mNumVertices;
+		for(unsigned int f = 0; f < mesh->mNumFaces; ++f)
+			if(mesh->mFaces[f].mNumIndices == 3)
+				entry.numTriangles++;
+		for(unsigned int v = 0; v < mesh->mNumVertices; ++v)
+		{
+			const aiVector3D& pos = mesh->mVertices[v];
+			float coords[3] = { pos.x, pos.y, pos.z };
+			for(unsigned int i = 0; i < 3; ++i)
+			{
+				entry.bbMin[i] = isFirst ? coords[i] : min(entry.bbMin[i], coords[i]);
+				entry.bbMax[i] = isFirst ? coords[i] : max(entry.bbMax[i], coords[i]);
+			}
+			isFirst = false;
+		}
+	}
+	entry.numMaterials = scene->mNumMaterials;
+	set<string> textures;
+	for(unsigned int m = 0; m < scene->mNumMaterials; ++m)
+		for(unsigned int type = aiTextureType_DIFFUSE; type <= aiTextureType_UNKNOWN; ++type)
+			for(unsigned int t = 0; t < scene->mMaterials[m]->GetTextureCount((aiTextureType)type); ++t)
+			{
+				aiString texture;
+				if(scene->mMaterials[m]->GetTexture((aiTextureType)type, t, &texture) == AI_SUCCESS)
+					textures.insert(texture.C_Str());
+			}
+	entry.numTextures = textures.size();
+	return true;
+}
@@ -0,0 +1,87 @@
+#include <sstream>
+#include <cmath>
+#include <algorithm>
+
+#include "lodepng.h"
+
+#include "io/OutputEncoder.hpp"
+#include "rendering/Trace.hpp"
+
+using namespace std;
+
+static const char* OUTPUT_NAMES[NUM_OUTPUTS] = { "depth", "normal", "instance", "part" };
+
+const char* OutputEncoder::getName(unsigned int type)
+{
+	return type < NUM_OUTPUTS ? OUTPUT_NAMES[type] : "";
+}
+
+unsigned int OutputEncoder::parseMask(const string& names)
+{
+	stringstream ss(names);
+	string word;
+	unsigned int mask = 0;
+	while(ss >> word)
+	{
+		transform(word.begin(), word.end(), word.begin(), ::tolower);
+		for(unsigned int type = 0; type < NUM_OUTPUTS; ++type)
+			if(word == OUTPUT_NAMES[type])
+				mask |= 1 << type;
+	}
+	return mask;
+}
+
+static void putValue(unsigned char* dst, unsigned short value)
+{
+	// PNG samples of 16 bits are big endian
+	dst[0] = (unsigned char)(value >> 8);
+	dst[1] = (unsigned char)(value & 0xFF);
+}
+
+void OutputEncoder::encode(const OutputAtlas& atlas, int size, vector<unsigned char>& png)
+{
+	TraceZone zone("png encode output");
+	unsigned int channels = getChannels(atlas.type);
+	unsigned int channelsPng = atlas.type == OUTPUT_NORMAL ? 3 : 1;
+	vector<unsigned char> image(size * size * channelsPng * 2);
+
+	// Rows are stored bottom-up (OpenGL) and images are top-down
+	for(int row = 0; row < size; ++row)
+	{
+		const unsigned short* src = &atlas.data[(size - 1 - row) * size * channels];
+		unsigned char* dst = &image[row * size * channelsPng * 2];
+		for(int col = 0; col < size; ++col, src += channels, dst += channelsPng * 2)
+		{
+			if(atlas.type != OUTPUT_NORMAL)
+			{
+				putValue(dst, src[0]);
+				continue;
+			}
+			// Cleared background (0, 0) stays black, normals are mapped from [-1, 1]
+			if(src[0] == 0 && src[1] == 0)
+			{
+				putValue(dst, 0); putValue(dst + 2, 0); putValue(dst + 4, 0);
+				continue;
+			}
+			float x = (short)src[0] / 32767.0f;
+			float y = (short)src[1] / 32767.0f;
+			float z = sqrt(max(0.0f, 1.0f - x*x - y*y));
+			putValue(dst, (unsigned short)((x * 0.5f + 0.5f) * 65535.0f + 0.5f));
+			putValue(dst + 2, (unsigned short)((y * 0.5f + 0.5f) * 65535.0f + 0.5f));
+			putValue(dst + 4, (unsigned short)((z * 0.5f + 0.5f) * 65535.0f + 0.5f));
+		}
+	}
+
+	png.clear();
+	lodepng::encode(png, image.data(), size, size, channelsPng == 3 ? LCT_RGB : LCT_GREY, 16);
+}
+
+string OutputEncoder::getPath(const string& imgPath, unsigned int type)
+{
+	string path = imgPath;
+	size_t pos = path.find_last_of('.');
+	if(pos == string::npos || path.find_first_of("/\\", pos) != string::npos)
+		pos = path.size();
+	path.insert(pos, string("_") + getName(type));
+	return path;
+}
@@ -0,0 +1,249 @@
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <cstdlib>
+#include <iterator>
+
+#include "io/RunManifest.hpp"
+#include "io/AnnotationStore.hpp"
+#include "io/ShardWriter.hpp"
+
+using namespace std;
+
+RunManifest::RunManifest() : nextObj(0), isGroupOpen(false)
+{
+}
+
+RunManifest::~RunManifest()
+{
+	close();
+}
+
+bool RunManifest::open(const string& path)
+{
+	close();
+	models.clear();
+	units.clear();
+	offsets.clear();
+	pendingOffsets.clear();
+	nextObj = 0;
+	dir = path.substr(0, path.find_last_of("/\\") + 1);
+
+	// Journal cut in the middle of a line (interrupted run): terminate it before appending
+	bool isCut = load(path);
+	file.open(path.c_str(), ios::app);
+	if(!file.is_open())
+	{
+		cout << "Manifest: cannot open " << path << endl;
+		return false;
+	}
+	if(isCut)
+		file << endl;
+	if(isGroupOpen)
+		file << "ABORT" << endl;
+	if(!units.empty())
+		cout << "Manifest: resuming run with " << units.size() << " finished units of " << models.size() << " models" << endl;
+	return true;
+}
+
+bool RunManifest::load(const string& path)
+{
+	// Replay the journal of a previous run (an incomplete last line or group is ignored)
+	ifstream existing(path.c_str());
+	string line;
+	vector<pair<string, ManifestUnit> > groupUnits;
+	map<string, unsigned long long> groupOffsets;
+	while(getline(existing, line))
+	{
+		if(!line.empty() && line[line.size() - 1] == '\r')
+			line.erase(line.size() - 1);
+		vector<string> fields;
+		stringstream ss(line);
+		string field;
+		while(getline(ss, field, '\t'))
+			fields.push_back(field);
+
+		if(fields.size() == 3 && fields[0] == "MODEL")
+		{
+			unsigned int idx = atoi(fields[2].c_str());
+			models[fields[1]] = idx;
+			if(idx >= nextObj)
+				nextObj = idx + 1;
+		}
+		else if(fields.size() == 6 && fields[0] == "UNIT")
+		{
+			ManifestUnit info(atoi(fields[3].c_str()), atoi(fields[4].c_str()), strtoul(fields[5].c_str(), NULL, 16));
+			groupUnits.push_back(make_pair(fields[1] + "\t" + fields[2], info));
+		}
+		else if(fields.size() == 3 && fields[0] == "OFFSET")
+		{
+			unsigned long long bytes = 0;
+			stringstream(fields[2]) >> bytes;
+			groupOffsets[fields[1]] = bytes;
+		}
+		else if(fields.size() == 1 && fields[0] == "COMMIT")
+		{
+			for(unsigned int i = 0; i < groupUnits.size(); ++i)
+				units[groupUnits[i].first] = groupUnits[i].second;
+			for(map<string, unsigned long long>::iterator it = groupOffsets.begin(); it != groupOffsets.end(); ++it)
+				offsets[it->first] = it->second;
+			groupUnits.clear();
+			groupOffsets.clear();
+		}
+		else if(fields.size() == 1 && fields[0] == "ABORT")
+		{
+			groupUnits.clear();
+			groupOffsets.clear();
+		}
+	}
+	isGroupOpen = !groupUnits.empty() || !groupOffsets.empty();
+	bool isCut = false;
+	existing.clear();
+	if(existing.seekg(-1, ios::end))
+	{
+		char last;
+		isCut = existing.get(last) && last != '\n';
+	}
+	return isCut;
+}
+
+bool RunManifest::append(const string& path, const string& partPath)
+{
+	// Committed groups only: the lines after the last COMMIT of an interrupted worker are dropped (its units are generated again)
+	ifstream part(partPath.c_str());
+	if(!part.is_open())
+		return false;
+	string content((istreambuf_iterator<char>(part)), istreambuf_iterator<char>());
+	part.close();
+	size_t end = content.rfind("COMMIT\n");
+	while(end != string::npos && end > 0 && content[end - 1] != '\n')
+		end = content.rfind("COMMIT\n", end - 1);
+	content = end == string::npos ? string() : content.substr(0, end + 7);
+
+	RunManifest manifest;
+	if(!manifest.open(path))
+		return false;
+	manifest.file << content;
+	manifest.file.flush();
+	return manifest.file.good();
+}
+
+void RunManifest::close()
+{
+	if(!file.is_open())
+		return;
+	commit();
+	file.close();
+}
+
+unsigned int RunManifest::addModel(const string& model)
+{
+	map<string, unsigned int>::iterator it = models.find(model);
+	if(it != models.end())
+		return it->second;
+
+	unsigned int idx = nextObj++;
+	models[model] = idx;
+	if(file.is_open())
+	{
+		file << "MODEL\t" << model << "\t" << idx << endl;
+		file.flush();
+	}
+	return idx;
+}
+
+bool RunManifest::isDone(const string& model, const string& unit)
+{
+	return units.find(model + "\t" + unit) != units.end();
+}
+
+void RunManifest::markDone(const string& model, const string& unit, const ManifestUnit& info)
+{
+	units[model + "\t" + unit] = info;
+	stringstream entry;
+	entry << "UNIT\t" << model << "\t" << unit << "\t" << info.firstImg << "\t" << info.numImgs << "\t" << hex << setw(8) << setfill('0') << info.checksum;
+	pending.push_back(entry.str());
+}
+
+void RunManifest::setOffset(const string& path, unsigned long long bytes)
+{
+	string name = path.compare(0, dir.size(), dir) == 0 ? path.substr(dir.size()) : path;
+	pendingOffsets[name] = bytes;
+}
+
+void RunManifest::commit()
+{
+	if(!file.is_open() || (pending.empty() && pendingOffsets.empty()))
+		return;
+	for(unsigned int i = 0; i < pending.size(); ++i)
+		file << pending[i] << "\n";
+	for(map<string, unsigned long long>::iterator it = pendingOffsets.begin(); it != pendingOffsets.end(); ++it)
+	{
+		file << "OFFSET\t" << it->first << "\t" << it->second << "\n";
+		offsets[it->first] = it->second;
+	}
+	file << "COMMIT\n";
+	file.flush();
+	pending.clear();
+	pendingOffsets.clear();
+}
+
+bool RunManifest::getOffset(const string& path, unsigned long long& bytes)
+{
+	string name = path.compare(0, dir.size(), dir) == 0 ? path.substr(dir.size()) : path;
+	map<string, unsigned long long>::iterator it = offsets.find(name);
+	if(it == offsets.end())
+		return false;
+	bytes = it->second;
+	return true;
+}
+
+void RunManifest::truncateOutputs()
+{
+	// Outputs written after the last commit of an interrupted run (generated again) are dropped before appending
+	map<string, unsigned long long> paths = getOffsets();
+	for(map<string, unsigned long long>::iterator it = paths.begin(); it != paths.end(); ++it)
+	{
+		const string& path = it->first;
+		if(path.size() > 11 && path.compare(path.size() - 4, 4, ".tar") == 0)
+		{
+			// Last journaled shard of its prefix (names are numbered with a fixed width)
+			map<string, unsigned long long>::iterator next = it;
+			++next;
+			bool isLast = next == paths.end() || next->first.compare(0, path.size() - 10, path, 0, path.size() - 10) != 0;
+			ShardWriter::truncate(path, it->second, isLast);
+		}
+		else
+			AnnotationStore::truncate(path, it->second);
+	}
+}
+
+map<string, unsigned long long> RunManifest::getOffsets()
+{
+	map<string, unsigned long long> paths;
+	for(map<string, unsigned long long>::iterator it = offsets.begin(); it != offsets.end(); ++it)
+		paths[dir + it->first] = it->second;
+	return paths;
+}
+
+unsigned int RunManifest::crc32(const unsigned char* data, size_t size, unsigned int crc)
+{
+	static unsigned int table[256];
+	static bool isTable = false;
+	if(!isTable)
+	{
+		for(unsigned int i = 0; i < 256; ++i)
+		{
+			unsigned int c = i;
+			for(int k = 0; k < 8; ++k)
+				c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+		isTable = true;
+	}
+
+	crc = ~crc;
+	for(size_t i = 0; i < size; ++i)
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
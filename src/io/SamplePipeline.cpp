@@ -0,0 +1,272 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <cstring>
+#include <map>
+
+#include "lodepng.h"
+
+#include "io/SamplePipeline.hpp"
+#include "rendering/Trace.hpp"
+
+using namespace std;
+
+enum PIPELINE_STAGE { STAGE_ENCODE, STAGE_WRITE };
+
+class PipelineWorker : public QThread
+{
+	public:
+
+		PipelineWorker(SamplePipeline* pPipeline, PIPELINE_STAGE pStage) : pipeline(pPipeline), stage(pStage) {}
+
+	protected:
+
+		virtual void run()
+		{
+			if(stage == STAGE_ENCODE)
+				pipeline->runEncode();
+			else
+				pipeline->runWrite();
+		}
+
+	private:
+
+		SamplePipeline* pipeline;
+		PIPELINE_STAGE stage;
+};
+
+SamplePipeline::SamplePipeline() : annotations(NULL), shards(NULL), freeJobs(MAX_JOBS), encodeQueue(MAX_JOBS), writeQueue(MAX_JOBS), numSubmitted(0), timeStart(0.0), waitFreeUs(0)
+{
+	numWritten = 0;
+}
+
+SamplePipeline::~SamplePipeline()
+{
+	stop();
+}
+
+void SamplePipeline::start(AnnotationWriter* pAnnotations, ShardWriter* pShards, unsigned int numEncoders, unsigned int numJobs)
+{
+	stop();
+	annotations = pAnnotations;
+	shards = pShards;
+	if(numEncoders == 0)
+		numEncoders = max(1, QThread::idealThreadCount() - 2);
+	numJobs = min(max(2u, numJobs), (unsigned int)MAX_JOBS);
+
+	// Queues hold every job, so a push never waits: the free list is the only back pressure
+	freeJobs.reopen();
+	encodeQueue.reopen();
+	writeQueue.reopen();
+	for(unsigned int i = 0; i < numJobs; ++i)
+	{
+		jobs.push_back(new SampleJob());
+		freeJobs.push(jobs.back());
+	}
+	numSubmitted = 0;
+	numWritten = 0;
+
+	stageRender.name = "render";
+	stageRender.numThreads = 1;
+	stageRender.capacity = freeJobs.getCapacity();
+	stageEncode.name = "encode";
+	stageEncode.numThreads = numEncoders;
+	stageEncode.capacity = encodeQueue.getCapacity();
+	stageWrite.name = "write";
+	stageWrite.numThreads = 1;
+	stageWrite.capacity = writeQueue.getCapacity();
+	PipelineStage* stages[] = { &stageRender, &stageEncode, &stageWrite };
+	for(unsigned int i = 0; i < 3; ++i)
+	{
+		stages[i]->busyUs = 0;
+		stages[i]->items = 0;
+		stages[i]->occupancySum = stages[i]->occupancySamples = 0;
+		stages[i]->occupancyMax = 0;
+	}
+	waitFreeUs = 0;
+	timeStart = Trace::now();
+
+	for(unsigned int i = 0; i < numEncoders; ++i)
+		workers.push_back(new PipelineWorker(this, STAGE_ENCODE));
+	workers.push_back(new PipelineWorker(this, STAGE_WRITE));
+	for(unsigned int i = 0; i < workers.size(); ++i)
+		workers[i]->start();
+	cout << "Output pipeline: " << numEncoders << " encoding threads, " << numJobs << " images in flight" << endl;
+}
+
+void SamplePipeline::stop()
+{
+	if(!isRunning())
+		return;
+
+	drain();
+	encodeQueue.close();
+	writeQueue.close();
+	for(unsigned int i = 0; i < workers.size(); ++i)
+	{
+		workers[i]->wait();
+		delete workers[i];
+	}
+	workers.clear();
+	printSummary();
+
+	SampleJob* job;
+	while(freeJobs.tryPop(job))
+		continue;
+	for(unsigned int i = 0; i < jobs.size(); ++i)
+		delete jobs[i];
+	jobs.clear();
+}
+
+SampleJob* SamplePipeline::acquire()
+{
+	SampleJob* job;
+	if(!freeJobs.tryPop(job))
+	{
+		TraceZone zone("wait free image");
+		double start = Trace::now();
+		freeJobs.pop(job);
+		waitFreeUs += (unsigned long long)(Trace::now() - start);
+	}
+	job->annotations.clear();
+	job->text.clear();
+	return job;
+}
+
+void SamplePipeline::submit(SampleJob* job)
+{
+	job->sequence = numSubmitted++;
+	stageRender.items++;
+	sampleOccupancy(stageEncode, encodeQueue.size(), "encode queue");
+	encodeQueue.push(job);
+}
+
+void SamplePipeline::drain()
+{
+	if(!isRunning())
+		return;
+	TraceZone zone("drain outputs");
+	for(unsigned int spin = 0; numWritten.load() < numSubmitted; ++spin)
+		BoundedQueue<SampleJob*>::backoff(spin);
+}
+
+void SamplePipeline::sampleOccupancy(PipelineStage& stage, unsigned int occupancy, const char* counter)
+{
+	// A queue that stays full is in front of the slowest stage
+	stage.occupancySum += occupancy;
+	stage.occupancySamples++;
+	stage.occupancyMax = max(stage.occupancyMax, occupancy);
+	if(Trace::isEnabled())
+		Trace::addCounter(counter, occupancy);
+}
+
+void SamplePipeline::runEncode()
+{
+	Trace::setThreadName("Encode");
+	vector<unsigned char> flipped;
+	SampleJob* job;
+	while(encodeQueue.pop(job))
+	{
+		double start = Trace::now();
+		{
+			TraceZone zone("png encode");
+			// Rows are stored bottom-up (OpenGL) and images are top-down
+			unsigned int rowBytes = 4 * job->size;
+			flipped.resize(job->atlas.size());
+			for(int row = 0; row < job->size; ++row)
+				memcpy(&flipped[row * rowBytes], &job->atlas[(job->size - 1 - row) * rowBytes], rowBytes);
+			job->png.clear();
+			lodepng::encode(job->png, flipped.data(), job->size, job->size);
+			for(unsigned int i = 0; i < job->outputs.size(); ++i)
+				OutputEncoder::encode(job->outputs[i], job->size, job->outputs[i].png);
+		}
+		stageEncode.busyUs += (unsigned long long)(Trace::now() - start);
+		stageEncode.items++;
+		writeQueue.push(job);
+	}
+}
+
+void SamplePipeline::runWrite()
+{
+	Trace::setThreadName("Write");
+	// Encoders finish out of order: jobs wait here until the previous ones are written
+	map<unsigned long long, SampleJob*> waiting;
+	unsigned long long nextSequence = 0;
+	SampleJob* job;
+	while(writeQueue.pop(job))
+	{
+		// Several encoders push: occupancy of the write queue is sampled by its only consumer (popped job included)
+		sampleOccupancy(stageWrite, writeQueue.size() + 1, "write queue");
+		waiting[job->sequence] = job;
+		while(!waiting.empty() && waiting.begin()->first == nextSequence)
+		{
+			job = waiting.begin()->second;
+			waiting.erase(waiting.begin());
+			double start = Trace::now();
+			{
+				TraceZone zone("write sample");
+				if(job->isShard)
+				{
+					vector<ShardEntry> entries;
+					entries.push_back(ShardEntry("png"));
+					entries.back().data.swap(job->png);
+					for(unsigned int i = 0; i < job->outputs.size(); ++i)
+					{
+						entries.push_back(ShardEntry(OutputEncoder::getExt(job->outputs[i].type)));
+						entries.back().data.swap(job->outputs[i].png);
+					}
+					entries.push_back(ShardEntry("txt"));
+					entries.back().data.assign(job->text.begin(), job->text.end());
+					shards->write(job->path, entries);
+					job->png.swap(entries[0].data);
+					for(unsigned int i = 0; i < job->outputs.size(); ++i)
+						job->outputs[i].png.swap(entries[1 + i].data);
+				}
+				else
+				{
+					lodepng::save_file(job->png, job->path);
+					for(unsigned int i = 0; i < job->outputs.size(); ++i)
+						lodepng::save_file(job->outputs[i].png, OutputEncoder::getPath(job->path, job->outputs[i].type));
+				}
+				for(unsigned int i = 0; i < job->annotations.size(); ++i)
+					annotations->write(job->annotations[i]);
+			}
+			stageWrite.busyUs += (unsigned long long)(Trace::now() - start);
+			stageWrite.items++;
+			nextSequence++;
+			numWritten++;
+			freeJobs.push(job);
+		}
+	}
+}
+
+void SamplePipeline::printSummary()
+{
+	double duration = Trace::now() - timeStart;
+	if(stageRender.items == 0 || duration <= 0.0)
+		return;
+
+	// Render thread: everything but the waits for a free image
+	stageRender.busyUs = (unsigned long long)duration - waitFreeUs;
+	PipelineStage* stages[] = { &stageRender, &stageEncode, &stageWrite };
+	PipelineStage* slowest = stages[0];
+	cout << endl << "Output pipeline: " << stageRender.items.load() << " images in " << fixed << setprecision(1) << duration / 1e6 << "s" << endl;
+	cout << left << setw(10) << "stage" << right << setw(9) << "threads" << setw(10) << "images" << setw(9) << "busy %" << setw(22) << "input queue mean/max" << endl;
+	for(unsigned int i = 0; i < 3; ++i)
+	{
+		PipelineStage& stage = *stages[i];
+		double busy = 100.0 * stage.busyUs / (duration * stage.numThreads);
+		if(busy > 100.0 * slowest->busyUs / (duration * slowest->numThreads))
+			slowest = stages[i];
+		stringstream queue;
+		if(stage.occupancySamples > 0)
+			queue << fixed << setprecision(1) << (double)stage.occupancySum / stage.occupancySamples << "/" << stage.occupancyMax << " of " << stage.capacity;
+		else
+			queue << "-";
+		cout << left << setw(10) << stage.name << right << setw(9) << stage.numThreads << setw(10) << stage.items.load()
+			<< setw(9) << setprecision(1) << busy << setw(22) << queue.str() << endl;
+	}
+	cout << "Slowest stage: " << slowest->name << " (render thread waited " << setprecision(1) << waitFreeUs / 1000.0 << "ms for free images)" << endl;
+	cout.unsetf(ios::floatfield);
+	cout << setprecision(6) << endl;
+}
@@ -0,0 +1,259 @@
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+
+#include <QFile>
+#include <QFileInfo>
+
+#include "io/ShardWriter.hpp"
+
+using namespace std;
+
+static const unsigned int TAR_BLOCK = 512;
+static const unsigned int BUFFER_BYTES = 16 * 1024 * 1024;
+
+// Octal number of a tar header field (width includes the terminating NUL)
+static void writeOctal(char* field, unsigned int width, unsigned long long value)
+{
+	field[width - 1] = '\0';
+	for(int i = width - 2; i >= 0; --i)
+	{
+		field[i] = '0' + (value & 7);
+		value >>= 3;
+	}
+}
+
+// Value of an octal tar header field
+static unsigned long long readOctal(const char* field, unsigned int width)
+{
+	unsigned long long value = 0;
+	for(unsigned int i = 0; i < width && field[i] >= '0' && field[i] <= '7'; ++i)
+		value = value * 8 + (field[i] - '0');
+	return value;
+}
+
+ShardWriter::ShardWriter() : maxBytes(0), idxShard(0), numShards(0), shardBytes(0)
+{
+}
+
+ShardWriter::~ShardWriter()
+{
+	close();
+}
+
+bool ShardWriter::open(const string& pDir, unsigned long long pMaxBytes, const string& pPrefix)
+{
+	close();
+	dir = pDir;
+	prefix = pPrefix;
+	maxBytes = pMaxBytes;
+	numShards = 0;
+
+	// Continue numbering after shards of previous runs
+	idxShard = 0;
+	while(true)
+	{
+		stringstream name;
+		name << dir << "/" << prefix << "-" << setw(6) << setfill('0') << idxShard << ".tar";
+		ifstream existing(name.str().c_str());
+		if(!existing.is_open())
+			break;
+		idxShard++;
+	}
+
+	return openShard();
+}
+
+bool ShardWriter::openShard()
+{
+	stringstream name;
+	name << dir << "/" << prefix << "-" << setw(6) << setfill('0') << idxShard << ".tar";
+	shardName = name.str();
+	file.open(shardName.c_str(), ios::binary);
+	if(!file.is_open())
+	{
+		cout << "Shards: cannot create " << shardName << endl;
+		return false;
+	}
+	shardBytes = 0;
+	buffer.clear();
+	buffer.reserve(BUFFER_BYTES + TAR_BLOCK);
+	index.clear();
+	numShards++;
+	return true;
+}
+
+void ShardWriter::closeShard()
+{
+	if(!file.is_open())
+		return;
+
+	// End of archive: two empty blocks
+	buffer.insert(buffer.end(), 2 * TAR_BLOCK, 0);
+	flushBuffer();
+	file.close();
+
+	// Index: NAME OFFSET SIZE (offset of the member data inside the tar)
+	string indexName = shardName.substr(0, shardName.size() - 4) + ".idx";
+	ofstream indexFile(indexName.c_str());
+	for(unsigned int i = 0; i < index.size(); ++i)
+		indexFile << index[i] << endl;
+	indexFile.close();
+
+	cout << "Shard " << shardName << " closed: " << index.size() << " files, " << shardBytes / (1024 * 1024) << "MB" << endl;
+	idxShard++;
+}
+
+void ShardWriter::close()
+{
+	closeShard();
+	shardName = "";
+	shardBytes = 0;
+}
+
+bool ShardWriter::truncate(const string& path, unsigned long long bytes, bool isLast)
+{
+	// Following shards (PREFIX-NUM.tar)
+	if(isLast && path.size() > 11)
+	{
+		string prefix = path.substr(0, path.size() - 10);
+		for(unsigned int idx = atoi(path.substr(path.size() - 10, 6).c_str()) + 1; ; ++idx)
+		{
+			stringstream name;
+			name << prefix << setw(6) << setfill('0') << idx;
+			if(!QFile::exists((name.str() + ".tar").c_str()))
+				break;
+			QFile::remove((name.str() + ".tar").c_str());
+			QFile::remove((name.str() + ".idx").c_str());
+			cout << "Shards: " << name.str() << ".tar removed (uncommitted)" << endl;
+		}
+	}
+
+	string indexName = path.substr(0, path.size() - 4) + ".idx";
+	unsigned long long size = QFileInfo(path.c_str()).size();
+	if(size == bytes + 2 * TAR_BLOCK && QFile::exists(indexName.c_str()))
+		return true;
+	if(size < bytes || !QFile::resize(path.c_str(), bytes))
+	{
+		cout << "Shards: cannot cut " << path << " back to " << bytes << " bytes" << endl;
+		return false;
+	}
+
+	// Index from the member headers, then the end of archive
+	fstream file(path.c_str(), ios::in | ios::out | ios::binary);
+	ofstream indexFile(indexName.c_str());
+	unsigned long long offset = 0;
+	unsigned int numFiles = 0;
+	char header[TAR_BLOCK];
+	while(offset + TAR_BLOCK <= bytes && file.seekg(offset, ios::beg) && file.read(header, TAR_BLOCK))
+	{
+		string name(header, strnlen(header, 100));
+		if(header[345] != '\0')
+			name = string(header + 345, strnlen(header + 345, 155)) + "/" + name;
+		unsigned long long dataSize = readOctal(header + 124, 12);
+		indexFile << name << " " << offset + TAR_BLOCK << " " << dataSize << endl;
+		offset += TAR_BLOCK + (dataSize + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+		numFiles++;
+	}
+	file.clear();
+	file.seekp(bytes, ios::beg);
+	vector<char> end(2 * TAR_BLOCK, 0);
+	file.write(end.data(), end.size());
+	cout << "Shards: " << path << " cut back to " << numFiles << " committed files" << endl;
+	return file.good();
+}
+
+void ShardWriter::flush()
+{
+	if(!file.is_open())
+		return;
+	flushBuffer();
+	file.flush();
+}
+
+void ShardWriter::flushBuffer()
+{
+	if(!buffer.empty())
+		file.write(buffer.data(), buffer.size());
+	buffer.clear();
+}
+
+bool ShardWriter::write(const string& key, const vector<ShardEntry>& entries)
+{
+	if(!file.is_open())
+		return false;
+
+	// Rotate before the sample so that all its files stay in the same shard
+	unsigned long long sampleBytes = 0;
+	for(unsigned int i = 0; i < entries.size(); ++i)
+		sampleBytes += TAR_BLOCK + (entries[i].data.size() + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+	if(shardBytes > 0 && shardBytes + sampleBytes + 2 * TAR_BLOCK > maxBytes)
+	{
+		closeShard();
+		if(!openShard())
+			return false;
+	}
+
+	for(unsigned int i = 0; i < entries.size(); ++i)
+		appendMember(key + "." + entries[i].ext, entries[i].data);
+
+	if(buffer.size() >= BUFFER_BYTES)
+		flushBuffer();
+
+	return true;
+}
+
+void ShardWriter::appendMember(const string& name, const vector<unsigned char>& data)
+{
+	// ustar header
+	char header[TAR_BLOCK];
+	memset(header, 0, TAR_BLOCK);
+	string memberName = name;
+	if(memberName.size() > 100)
+	{
+		// Long names: directory part goes into the prefix field
+		size_t split = memberName.rfind('/', 155);
+		if(split != string::npos && memberName.size() - split - 1 <= 100)
+		{
+			memcpy(header + 345, memberName.data(), split);
+			memberName = memberName.substr(split + 1);
+		}
+		else
+		{
+			cout << "Shards: name too long, truncated: " << name << endl;
+			memberName = memberName.substr(memberName.size() - 100);
+		}
+	}
+	memcpy(header, memberName.data(), memberName.size());
+	writeOctal(header + 100, 8, 0644);
+	writeOctal(header + 108, 8, 0);
+	writeOctal(header + 116, 8, 0);
+	writeOctal(header + 124, 12, data.size());
+	// mtime 0: shards of identical members are identical (reruns and resumed runs)
+	writeOctal(header + 136, 12, 0);
+	header[156] = '0';
+	memcpy(header + 257, "ustar", 6);
+	memcpy(header + 263, "00", 2);
+
+	// Checksum computed with its own field filled with spaces
+	memset(header + 148, ' ', 8);
+	unsigned int checksum = 0;
+	for(unsigned int i = 0; i < TAR_BLOCK; ++i)
+		checksum += (unsigned char)header[i];
+	writeOctal(header + 148, 7, checksum);
+	header[155] = ' ';
+
+	buffer.insert(buffer.end(), header, header + TAR_BLOCK);
+	stringstream entry;
+	entry << name << " " << shardBytes + TAR_BLOCK << " " << data.size();
+	index.push_back(entry.str());
+
+	// Data padded to full blocks
+	buffer.insert(buffer.end(), data.begin(), data.end());
+	unsigned int padding = (TAR_BLOCK - data.size() % TAR_BLOCK) % TAR_BLOCK;
+	buffer.insert(buffer.end(), padding, 0);
+	shardBytes += TAR_BLOCK + data.size() + padding;
+}
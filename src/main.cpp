@@ -1,10 +1,62 @@
+#include <string>
+#include <cstdlib>
+
 #include <QApplication>
 #include <QStyleFactory>
 #include "ui/MainWindow.hpp"
+#include "io/AnnotationStore.hpp"
+#include "generation/GenerationDriver.hpp"
+#include "generation/GenerationNode.hpp"
+#include "io/ModelCatalog.hpp"
 
 // Main app
 int main(int argc, char* argv[])
 {
+	// Conversion of a binary annotation file into the legacy txt layout (no GUI)
+	if (argc == 4 && std::string(argv[1]) == "--convert-annotations")
+		return AnnotationReader::convertToText(argv[2], argv[3]) ? 0 : 1;
+
+	// Catalog of a class folder built again (models changed in place) into its output folder, e.g. Render --build-catalog D:/Models/car .obj D:/Syn/car
+	if (argc >= 5 && std::string(argv[1]) == "--build-catalog")
+	{
+		ModelCatalog catalog;
+		return catalog.build(argv[2], argv[3], argv[4], argc >= 6 ? atoi(argv[5]) : 0) ? 0 : 1;
+	}
+
+	// Multi-process generation of a job file: driver without GUI, one headless render process per worker
+	// (--port: coordinator of the nodes joining with --node HOST:PORT)
+	if (argc >= 3 && (std::string(argv[1]) == "--generate" || std::string(argv[1]) == "--node"))
+	{
+		QCoreApplication app(argc, argv);
+		unsigned int numWorkers = 0;
+		unsigned short port = 0;
+		unsigned int stallSeconds = GenerationNode::STALL_SECONDS;
+		for (int i = 3; i + 1 < argc; i += 2)
+		{
+			if (std::string(argv[i]) == "--workers")
+				numWorkers = atoi(argv[i + 1]);
+			else if (std::string(argv[i]) == "--port")
+				port = (unsigned short)atoi(argv[i + 1]);
+			else if (std::string(argv[i]) == "--stall" && atoi(argv[i + 1]) > 0)
+				stallSeconds = atoi(argv[i + 1]);
+		}
+		if (std::string(argv[1]) == "--node")
+		{
+			std::string address = argv[2];
+			size_t colon = address.rfind(':');
+			GenerationNode node;
+			return colon != std::string::npos && node.run(address.substr(0, colon), (unsigned short)atoi(address.substr(colon + 1).c_str()), numWorkers, stallSeconds) ? 0 : 1;
+		}
+		GenerationDriver driver;
+		return driver.run(argv[2], numWorkers, port) ? 0 : 1;
+	}
+	if (argc >= 4 && std::string(argv[1]) == "--worker")
+	{
+		QApplication app(argc, argv);
+		MainWindow window(NULL, true);
+		return window.runWorker(argv[2], atoi(argv[3]), argc >= 5 ? atoi(argv[4]) : 0);
+	}
+
     QApplication app(argc, argv);
 
 	qApp->setStyle(QStyleFactory::create("Fusion"));
@@ -1,6 +1,7 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <algorithm>
 #include <stdlib.h>
 
 #include <GL/glew.h>
@@ -8,6 +9,7 @@
 
 #include "modelling/Model.hpp"
 #include "modelling/Vertex.hpp"
+#include "rendering/Trace.hpp"
 
 using namespace std;
 
@@ -18,6 +20,7 @@ Model::Model(GLuint pShader) : mShader(pShader), mDrawType(SOLID), isObject(fals
     Sx = Sy = Sz = 1.0;
 
     isFirstBind = true;
+    numTriangles = 0;
 }
 
 Model::~Model()
@@ -66,7 +69,10 @@ bool Model::loadModelFromFile(const string& pFileName)
         // Load model using "assimp" API
         // - Create an instance of the Importer class
         Assimp::Importer importer;
-        mScene = importer.ReadFile(fileName, aiProcess_CalcTangentSpace | aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_SortByPType);
+        {
+            TraceZone zoneImport("import model");
+            mScene = importer.ReadFile(fileName, aiProcess_CalcTangentSpace | aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_SortByPType);
+        }
 
         // If the import failed, report it
         if(!mScene)
@@ -375,6 +381,7 @@ void  Model::getVisualInfo(const aiScene* mScene)
 
 void Model::getGeometry(const aiScene* mScene)
 {
+    TraceZone zone("getGeometry");
     listAllVertices.clear();
 
     // Estimate number of vertices per entity and globally
@@ -530,10 +537,44 @@ void Model::attachTexture(GLuint id, string path)
         visualEntities[i].setTextureId(id);
         visualEntities[i].setTexturePath(path);
     }
+    updateVariants();
+}
+
+void Model::updateVariants()
+{
+    // Textured: a texture file was loaded (material based entities are bound to the empty texture)
+    // Colour: alpha of the vertex colours, all set or all unset (mixed entities keep the per fragment check)
+    entityVariants.assign(visualEntities.size(), 0);
+    variants.clear();
+    numTriangles = 0;
+    for(unsigned int i = 0; i < visualEntities.size(); ++i)
+    {
+        vector<Vertex>& vertices = visualEntities[i].getListVertices();
+        if(vertices.empty())
+            continue;
+        numTriangles += visualEntities[i].getListFaceIndices().size();
+
+        unsigned int numColoured = 0;
+        for(unsigned int v = 0; v < vertices.size(); ++v)
+            if(vertices[v].getColour()[3] != 0.0f)
+                numColoured++;
+
+        unsigned int variant = 0;
+        if(!visualEntities[i].getTexturePath().empty())
+            variant |= SHADER_VARIANT::TEXTURED;
+        if(numColoured == vertices.size())
+            variant |= SHADER_VARIANT::VERTEX_COLOUR;
+        else if(numColoured == 0)
+            variant |= SHADER_VARIANT::MATERIAL_COLOUR;
+        entityVariants[i] = variant;
+        if(find(variants.begin(), variants.end(), variant) == variants.end())
+            variants.push_back(variant);
+    }
 }
 
 void Model::bindToOpenGL()
 {
+    TraceZone zone("bind model");
     if(isFirstBind)
     {
         for(unsigned int i = 0; i < visualEntities.size(); ++i)
@@ -597,6 +638,7 @@ void Model::bindToOpenGL()
     // Bind root labelling of the semantic tree
     bindLabelToOpenGL(*itRootLabel);
     isFirstBind = false;
+    updateVariants();
 }
 
 void Model::bindLabelToOpenGL(Entity part)
@@ -667,7 +709,7 @@ void Model::setPolygonColour(float r, float g, float b)
     bindToOpenGL();
 }
 
-void Model::render()
+void Model::render(int variant)
 {
     // Max number of allowes textures
     GLint maxTexs;
@@ -680,6 +722,8 @@ void Model::render()
     {
         if(visualEntities[i].getListVertices().empty())
             continue;
+        if(variant >= 0 && i < entityVariants.size() && entityVariants[i] != (unsigned int)variant)
+            continue;
 
         glBindVertexArray(visualEntities[i].getVAO());
         glBindBuffer(GL_ARRAY_BUFFER, visualEntities[i].getVBO());
@@ -707,6 +751,19 @@ void Model::render()
     }
 }
 
+void Model::renderInstanced(unsigned int numInstances, unsigned int baseInstance)
+{
+    // Per instance attributes are expected to be already attached to the VAOs
+    for(unsigned int i = 0; i < visualEntities.size(); ++i)
+    {
+        if(visualEntities[i].getListVertices().empty())
+            continue;
+
+        glBindVertexArray(visualEntities[i].getVAO());
+        glDrawElementsInstancedBaseInstance(mDrawType, visualEntities[i].getListFaceIndices().size()*3, GL_UNSIGNED_INT, 0, numInstances, baseInstance);
+    }
+}
+
 void Model::renderLabelling()
 {
     vector<unsigned int> pathParent(currentTreeNode);
@@ -749,6 +806,25 @@ void Model::renderLabelling()
     }
 }
 
+void Model::renderParts()
+{
+    // Children are drawn after their parents: the deepest label of a face is the one kept
+    GLint partShader = glGetUniformLocation(mShader, "partId");
+    unsigned int idxLabel = 0;
+    for(Tree<Entity>::iterator itTree = semanticTree.begin(); itTree != semanticTree.end(); ++itTree)
+    {
+        idxLabel++;
+        if((*itTree).getListFaceIndices().empty())
+            continue;
+        glBindVertexArray((*itTree).getVAO());
+        glBindBuffer(GL_ARRAY_BUFFER, (*itTree).getVBO());
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, (*itTree).getEBO());
+        glUniform1ui(partShader, idxLabel);
+        glDrawElements(GL_TRIANGLES, (*itTree).getListFaceIndices().size()*3, GL_UNSIGNED_INT, 0);
+    }
+    glUniform1ui(partShader, 0);
+}
+
 void Model::renderParent()
 {
     // Render parent node part to edit
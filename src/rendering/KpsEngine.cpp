@@ -0,0 +1,179 @@
+#include <algorithm>
+
+#include "rendering/KpsEngine.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define KPS_SIMD
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+KpsEngine::KpsEngine() : numSphere(0)
+{
+}
+
+KpsEngine::~KpsEngine()
+{
+}
+
+void KpsEngine::setSphere(vector<Vertex>& vertices, float* centre)
+{
+	numSphere = vertices.size();
+	unsigned int numPadded = (numSphere + 3) & ~3u;
+	sphereX.assign(numPadded, 0.0f);
+	sphereY.assign(numPadded, 0.0f);
+	sphereZ.assign(numPadded, 0.0f);
+	for(unsigned int i = 0; i < numSphere; ++i)
+	{
+		float* pos = vertices[i].getPosition();
+		sphereX[i] = pos[0] - centre[0];
+		sphereY[i] = pos[1] - centre[1];
+		sphereZ[i] = pos[2] - centre[2];
+	}
+	gatherIdx.resize(numPadded);
+	gatherV.resize(numPadded);
+}
+
+void KpsEngine::project(const glm::mat4& mvp, const vector<KpsInstance>& kps, float sizeSample)
+{
+	unsigned int numKps = kps.size();
+	unsigned int numPadded = (numKps + 3) & ~3u;
+	projX.assign(numPadded, 0.0f);
+	projY.assign(numPadded, 0.0f);
+	projZ.assign(numPadded, 0.0f);
+	visible.assign(numKps, 0);
+
+	// Keypoint centres as SoA (reuse the output arrays as input)
+	for(unsigned int i = 0; i < numKps; ++i)
+	{
+		projX[i] = kps[i].X;
+		projY[i] = kps[i].Y;
+		projZ[i] = kps[i].Z;
+	}
+
+	float transPxl = sizeSample / 2.0f;
+#ifdef KPS_SIMD
+	const __m128 half = _mm_set1_ps(transPxl);
+	for(unsigned int i = 0; i < numPadded; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(&projX[i]);
+		__m128 y = _mm_loadu_ps(&projY[i]);
+		__m128 z = _mm_loadu_ps(&projZ[i]);
+		__m128 c[4];
+		for(int r = 0; r < 4; ++r)
+			c[r] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(mvp[0][r]), x), _mm_mul_ps(_mm_set1_ps(mvp[1][r]), y)),
+							  _mm_add_ps(_mm_mul_ps(_mm_set1_ps(mvp[2][r]), z), _mm_set1_ps(mvp[3][r])));
+		__m128 invW = _mm_div_ps(_mm_set1_ps(1.0f), c[3]);
+		_mm_storeu_ps(&projX[i], _mm_add_ps(_mm_mul_ps(_mm_mul_ps(c[0], invW), half), half));
+		_mm_storeu_ps(&projY[i], _mm_sub_ps(half, _mm_mul_ps(_mm_mul_ps(c[1], invW), half)));
+		_mm_storeu_ps(&projZ[i], c[2]);
+	}
+#else
+	for(unsigned int i = 0; i < numKps; ++i)
+	{
+		glm::vec4 proj2D = mvp * glm::vec4(projX[i], projY[i], projZ[i], 1.0f);
+		projX[i] = proj2D.x / proj2D.w * transPxl + transPxl;
+		projY[i] = -1 * proj2D.y / proj2D.w * transPxl + transPxl;
+		projZ[i] = proj2D.z;
+	}
+#endif
+}
+
+void KpsEngine::testVisibility(const glm::mat4& mvp, const vector<KpsInstance>& kps, const vector<float>& depth, int widthDepth, int heightDepth, bool isSelfOcc)
+{
+	visible.assign(kps.size(), 0);
+	if(numSphere == 0 || depth.size() < (size_t)(2*widthDepth*heightDepth))
+		return;
+
+	for(unsigned int i = 0; i < kps.size(); ++i)
+		visible[i] = countVisible(mvp, kps[i], depth.data(), widthDepth, heightDepth, isSelfOcc) > numSphere*0.025;
+}
+
+unsigned int KpsEngine::countVisible(const glm::mat4& mvp, const KpsInstance& kp, const float* depth, int widthDepth, int heightDepth, bool isSelfOcc)
+{
+	// MVP * (T + S*v) folded into one affine transform of the centred sphere vertices
+	glm::vec4 colX = mvp[0]*kp.Sx;
+	glm::vec4 colY = mvp[1]*kp.Sy;
+	glm::vec4 colZ = mvp[2]*kp.Sz;
+	glm::vec4 colT = mvp[0]*kp.X + mvp[1]*kp.Y + mvp[2]*kp.Z + mvp[3];
+
+	float transX = widthDepth / 2.0f;
+	float transY = heightDepth / 2.0f;
+	unsigned int numPadded = sphereX.size();
+	unsigned int numOk = 0;
+
+#ifdef KPS_SIMD
+	// 1) Project sphere vertices and compute their depth buffer index (-1 when outside)
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 halfX = _mm_set1_ps(transX);
+	const __m128 halfY = _mm_set1_ps(transY);
+	const __m128 width = _mm_set1_ps((float)widthDepth);
+	const __m128 height = _mm_set1_ps((float)heightDepth);
+	const __m128 ten = _mm_set1_ps(10.0f);
+	for(unsigned int v = 0; v < numPadded; v += 4)
+	{
+		__m128 x = _mm_loadu_ps(&sphereX[v]);
+		__m128 y = _mm_loadu_ps(&sphereY[v]);
+		__m128 z = _mm_loadu_ps(&sphereZ[v]);
+		__m128 c[4];
+		for(int r = 0; r < 4; ++r)
+			c[r] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(colX[r]), x), _mm_mul_ps(_mm_set1_ps(colY[r]), y)),
+							  _mm_add_ps(_mm_mul_ps(_mm_set1_ps(colZ[r]), z), _mm_set1_ps(colT[r])));
+		__m128 invW = _mm_div_ps(one, c[3]);
+		__m128 px = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(c[0], invW), halfX), halfX);
+		__m128 py = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(c[1], invW), halfY), halfY);
+		__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(c[3], zero), _mm_cmpge_ps(px, zero)),
+								   _mm_and_ps(_mm_and_ps(_mm_cmplt_ps(px, width), _mm_cmpge_ps(py, zero)), _mm_cmplt_ps(py, height)));
+		// Coordinates are positive inside, so truncation is floor
+		__m128 col = _mm_cvtepi32_ps(_mm_cvttps_epi32(px));
+		__m128 row = _mm_cvtepi32_ps(_mm_cvttps_epi32(py));
+		__m128i idx = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(row, width), col));
+		idx = _mm_or_si128(_mm_and_si128(_mm_castps_si128(inside), idx), _mm_andnot_si128(_mm_castps_si128(inside), _mm_set1_epi32(-1)));
+		_mm_storeu_si128((__m128i*)&gatherIdx[v], idx);
+		_mm_storeu_ps(&gatherV[v], _mm_sub_ps(one, _mm_min_ps(one, _mm_div_ps(c[2], ten))));
+	}
+	for(unsigned int v = numSphere; v < numPadded; ++v)
+		gatherIdx[v] = -1;
+
+	// 2) Gather depth (value + coverage) of all projections and test them 4 at a time
+	const __m128 alphaMin = _mm_set1_ps(0.66f);
+	for(unsigned int v = 0; v < numPadded; v += 4)
+	{
+		float d[4], a[4];
+		for(int l = 0; l < 4; ++l)
+		{
+			int idx = gatherIdx[v + l];
+			d[l] = idx < 0 ? 0.0f : depth[2*idx];
+			a[l] = idx < 0 ? 0.0f : depth[2*idx + 1];
+		}
+		__m128 valueDepth = _mm_loadu_ps(d);
+		__m128 isObject = _mm_cmpgt_ps(_mm_loadu_ps(a), alphaMin);
+		__m128 isOk = isObject;
+		if(isSelfOcc)
+			isOk = _mm_and_ps(isObject, _mm_and_ps(_mm_cmpgt_ps(_mm_loadu_ps(&gatherV[v]), valueDepth), _mm_cmpneq_ps(valueDepth, zero)));
+		int mask = _mm_movemask_ps(isOk);
+		numOk += (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1);
+	}
+#else
+	for(unsigned int v = 0; v < numSphere; ++v)
+	{
+		glm::vec4 proj2D = colX*sphereX[v] + colY*sphereY[v] + colZ*sphereZ[v] + colT;
+		if(proj2D.w <= 0.0f)
+			continue;
+		float px = proj2D.x / proj2D.w * transX + transX;
+		float py = proj2D.y / proj2D.w * transY + transY;
+		if(px < 0.0f || py < 0.0f || px >= widthDepth || py >= heightDepth)
+			continue;
+		int idx = (int)py * widthDepth + (int)px;
+		float valueDepth = depth[2*idx];
+		float valueDepthAlpha = depth[2*idx + 1];
+		float valueV = 1.0f - min(1.0f, proj2D.z / 10.0f);
+		if(valueDepthAlpha > 0.66f && (!isSelfOcc || (valueV > valueDepth && valueDepth != 0)))
+			numOk++;
+	}
+#endif
+
+	return numOk;
+}
@@ -3,6 +3,9 @@
 #include <time.h>
 #include <math.h>
 #include <iomanip>
+#include <sstream>
+#include <cstring>
+#include <algorithm>
 
 // Qt Dependencies
 #include <QPainter>
@@ -12,6 +15,7 @@
 #include <qDebug>
 #include <QFile>
 #include <QDir>
+#include <QMetaMethod>
 
 // OpenGL function recognition
 #include <GL/glew.h>
@@ -21,6 +25,8 @@
 #include "lodepng.h"
 
 #include "rendering/Render.hpp"
+#include "rendering/Trace.hpp"
+#include "rendering/ShaderCache.hpp"
 
 #include "glm/ext.hpp"
 
@@ -30,8 +36,11 @@ Render::Render(QWidget *parent, const QGLFormat &format, Sampler* pSampler, Samp
 	QGLWidget(format, parent), 
 	mSampler(pSampler),
 	mDepth(pDepth),
-	widthRender(766),
-	heightRender(766),
+	widthRender(VIEW_SIZE),
+	heightRender(VIEW_SIZE),
+	depthPool(GL_RG32F, 32, GL_RG, GL_FLOAT),
+	normalPool(GL_RG16F, 32, GL_RG, GL_FLOAT),
+	idPool(GL_RG16UI, 32, GL_RG_INTEGER, GL_UNSIGNED_SHORT),
 	cam(), vuv(glm::vec3(0.0f, 1.0f, 0.0f)),
 	mMousePos(glm::vec2(-1,-1)),
 	PATH_OUTPUT(pathOutput),
@@ -44,6 +53,29 @@ Render::Render(QWidget *parent, const QGLFormat &format, Sampler* pSampler, Samp
 	currentFPS = 30;
 
 	isLabel = false;
+	isKpsQuery = true;
+	kpsSlot = 0;
+	kpsSphere = NULL;
+	vboKps = 0;
+	isKpsDirty = true;
+	outputChecksum = 0;
+	annotationName = "annotations.bin";
+	isWorker = false;
+	lastPreview = 0.0;
+	fboRender = 0;
+	numSamples = maxSamples = 0;
+	maxRenderSize = VIEW_SIZE;
+	sampleRenderSize = sampleMSAA = 0;
+	downsampleFilter = DOWNSAMPLE_BOX;
+	downsampleShaders[0] = downsampleShaders[1] = 0;
+	vaoDownsample = 0;
+	outputMask = allocatedOutputs = 0;
+	normalMSAA = idMSAA = 0;
+	maxIntegerSamples = maxTextureSamples = 0;
+	outputShaders[0] = outputShaders[1] = 0;
+	currentInstance = 0;
+	prePassTriangles = 0;
+	isPrePassOffset = false;
 }
 
 Render::~Render()
@@ -53,6 +85,17 @@ Render::~Render()
 
 	for(unsigned int i = 0; i < listModels.size(); ++i)
 			delete listModels[i];
+
+	delete kpsSphere;
+	glDeleteBuffers(1, &vboKps);
+	for (map<string, KpsQuery>::iterator it = kpsQueries.begin(); it != kpsQueries.end(); ++it)
+		deleteKpsQuery(it->second);
+	samplePool.release();
+	resolvePool.release();
+	TargetPool* outputPools[3] = { &depthPool, &normalPool, &idPool };
+	for(unsigned int i = 0; i < 3; ++i)
+		outputPools[i]->release();
+	glDeleteVertexArrays(1, &vaoDownsample);
 }
 
 void Render::initializeGL()
@@ -71,64 +114,20 @@ void Render::initializeGL()
 	glLineWidth(2);
 
 	// Amount of sampling
-	GLint numMSAA;
-	glGetIntegerv(GL_MAX_SAMPLES, &numMSAA);
-	cout << "Max samples: " << numMSAA << endl;
-	int num_samples = numMSAA; // FSAA max number: 32!
-
-	// Define MSAA framebuffer
-	glGenRenderbuffers(1, &imgMSAA);
-	glBindRenderbuffer(GL_RENDERBUFFER, imgMSAA);
-	glRenderbufferStorageMultisample(GL_RENDERBUFFER, num_samples, GL_RGBA, widthRender, heightRender);
-	glBindRenderbuffer(GL_RENDERBUFFER, 0);
-
-	glGenRenderbuffers(1, &depthMSAA);
-	glBindRenderbuffer(GL_RENDERBUFFER, depthMSAA);
-	glRenderbufferStorageMultisample(GL_RENDERBUFFER, num_samples, GL_RGBA32F, widthRender, heightRender);
-
-	// Depth buffer
-	GLuint zBuffer;
-	glGenRenderbuffers(1, &zBuffer);
-	glBindRenderbuffer(GL_RENDERBUFFER, zBuffer);
-	glRenderbufferStorageMultisample(GL_RENDERBUFFER, num_samples, GL_DEPTH_COMPONENT32F, widthRender, heightRender);
-
-	glGenFramebuffers(1, &fboRender);
-	glBindFramebuffer(GL_FRAMEBUFFER, fboRender);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, imgMSAA);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_RENDERBUFFER, depthMSAA);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, zBuffer);
-	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-		cout << "Not properly installed MS-FBO: " << glCheckFramebufferStatus(GL_FRAMEBUFFER) << endl;
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-	// Define FBO binary
-	glGenRenderbuffers(1, &bufBinary);
-	glBindRenderbuffer(GL_RENDERBUFFER, bufBinary);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA, widthRender, heightRender);
+	glGetIntegerv(GL_MAX_SAMPLES, &maxSamples);
+	cout << "Max samples: " << maxSamples << endl;
+	glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &maxRenderSize);
+	glGetIntegerv(GL_MAX_INTEGER_SAMPLES, &maxIntegerSamples);
+	glGetIntegerv(GL_MAX_COLOR_TEXTURE_SAMPLES, &maxTextureSamples);
+	glGenVertexArrays(1, &vaoDownsample);
 
-	glGenFramebuffers(1, &fboBinary);
-	glBindFramebuffer(GL_FRAMEBUFFER, fboBinary);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, bufBinary);
-	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-		cout << "Not properly installed FBO for binary" << endl;
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	// Interactive view: widget size with the most samples (FSAA max number: 32!)
+	allocateRenderTargets(VIEW_SIZE, VIEW_SIZE, maxSamples, 0);
 
-	// Define Depth framebuffer
-	glGenRenderbuffers(1, &bufDepth);
-	glBindRenderbuffer(GL_RENDERBUFFER, bufDepth);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA32F, widthRender, heightRender);
-
-	glGenFramebuffers(1, &fboDepth);
-	glBindFramebuffer(GL_FRAMEBUFFER, fboDepth);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, bufDepth);
-	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-		cout << "Not properly installed FBO for depth" << endl;
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-	// Define Depth FBO Visualiser
+	// Define Depth FBO Visualiser (depth, coverage as bytes)
 	glGenRenderbuffers(1, &bufDepthVis);
 	glBindRenderbuffer(GL_RENDERBUFFER, bufDepthVis);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA, mDepth->width(), mDepth->height());
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RG8, mDepth->width(), mDepth->height());
 
 	glGenFramebuffers(1, &fboDepthVis);
 	glBindFramebuffer(GL_FRAMEBUFFER, fboDepthVis);
@@ -145,6 +144,7 @@ void Render::initializeGL()
 	nameShaders.push_back("ortho");
 	nameShaders.push_back("background");
 	nameShaders.push_back("labelling");
+	nameShaders.push_back("kps");
 	loadShaders(nameShaders);
 	
 	// First of all create an empty texture (transparent) used by material based objs in the shaders
@@ -193,6 +193,29 @@ void Render::initializeGL()
 	brush = createObj("Cylinder", programShaders[TYPE_SHADER::ORTHO]);
 	brush->setDrawType(DRAW_TYPE::LINES);
 	brush->setTranslation(2.0f,2.0f,2.0f);
+
+	// Keypoints: one shared sphere drawn instanced (position, scale and colour per keypoint)
+	kpsSphere = createObj("Sphere", programShaders[TYPE_SHADER::KPS]);
+	kpsSphere->setDrawType(DRAW_TYPE::LINES);
+	kpsEngine.setSphere(kpsSphere->getListAllVertices(), kpsSphere->getBB().getCenter());
+	glGenBuffers(1, &vboKps);
+	for(unsigned int i = 0; i < kpsSphere->getNumVisualEntities(); ++i)
+	{
+		glBindVertexArray(kpsSphere->getVisualEntity(i).getVAO());
+		glBindBuffer(GL_ARRAY_BUFFER, vboKps);
+		glEnableVertexAttribArray(SHADER_IN::instPosition);
+		glVertexAttribPointer(SHADER_IN::instPosition, 3, GL_FLOAT, GL_FALSE, sizeof(float)*10, 0);
+		glVertexAttribDivisor(SHADER_IN::instPosition, 1);
+		glEnableVertexAttribArray(SHADER_IN::instScale);
+		glVertexAttribPointer(SHADER_IN::instScale, 3, GL_FLOAT, GL_FALSE, sizeof(float)*10, (const GLvoid*)(sizeof(float)*3));
+		glVertexAttribDivisor(SHADER_IN::instScale, 1);
+		glEnableVertexAttribArray(SHADER_IN::instColour);
+		glVertexAttribPointer(SHADER_IN::instColour, 4, GL_FLOAT, GL_FALSE, sizeof(float)*10, (const GLvoid*)(sizeof(float)*6));
+		glVertexAttribDivisor(SHADER_IN::instColour, 1);
+	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	isKpsDirty = true;
 	
 	// UI Components and their ortho projection
 	uiQuad = createQuad(programShaders[TYPE_SHADER::ORTHO], DRAW_TYPE::LINES);
@@ -242,9 +265,20 @@ void Render::updateProjectionMatrix()
 
 void Render::setUpLights()
 {
+	// Active lights first (shader variants loop over them only, the generic one gets zero lights after them)
+	glm::vec3 position[Lights::MAX_LIGHTS], diffuse[Lights::MAX_LIGHTS];
+	unsigned int numActive = 0;
+	for(unsigned int i = 0; i < Lights::MAX_LIGHTS; ++i)
+		if(mLights.onLight[i])
+		{
+			position[numActive] = mLights.position[i];
+			diffuse[numActive] = mLights.diffuse[i];
+			numActive++;
+		}
+
 	GLuint lightPosShader = glGetUniformLocation(currentShader, "lightPosition");
 	// glUniform3fv(lightPosShader, 1, glm::value_ptr(mLights.position[0]));
-	glUniform3fv(lightPosShader, Lights::MAX_LIGHTS, (GLfloat*)mLights.position);
+	glUniform3fv(lightPosShader, Lights::MAX_LIGHTS, (GLfloat*)position);
 
 	GLint attShader = glGetUniformLocation(currentShader, "lightAttenuation");
 	glUniform3fv(attShader, 1, glm::value_ptr(mLights.attenuation[0]));
@@ -256,7 +290,7 @@ void Render::setUpLights()
 	glUniform3fv(ambientShader, 1, glm::value_ptr(mLights.ambient[0]));
 	GLuint diffuseShader = glGetUniformLocation(currentShader, "diffuseLight");
 	// glUniform3fv(diffuseShader, 1, glm::value_ptr(mLights.diffuse[0]));
-	glUniform3fv(diffuseShader, Lights::MAX_LIGHTS, (GLfloat*)(mLights.diffuse));
+	glUniform3fv(diffuseShader, Lights::MAX_LIGHTS, (GLfloat*)diffuse);
 	GLuint specularShader = glGetUniformLocation(currentShader, "specularLight");
 	glUniform3fv(specularShader, 1, glm::value_ptr(mLights.specular[0]));
 
@@ -276,14 +310,307 @@ void Render::computeFPS()
 	countFPS = 0;
 }
 
+void Render::allocateRenderTargets(int width, int height, int samples, unsigned int outputs)
+{
+	samples = max(0, min(samples, maxSamples));
+	// Outputs are read per sample: at least one sample, within the limits of multisample textures
+	if(outputs != 0)
+		samples = max(1, min(samples, maxTextureSamples));
+	if(outputs & ((1 << OUTPUT_INSTANCE) | (1 << OUTPUT_PART)))
+		samples = min(samples, maxIntegerSamples);
+	if(fboRender != 0 && width == widthRender && height == heightRender && samples == numSamples && outputs == allocatedOutputs)
+		return;
+	TraceZone zone("allocate targets");
+	if(fboRender != 0)
+	{
+		GLuint fbos[3] = { fboRender, fboBinary, fboDepth };
+		glDeleteFramebuffers(3, fbos);
+		GLuint buffers[4] = { imgMSAA, zMSAA, bufBinary, bufDepth };
+		glDeleteRenderbuffers(4, buffers);
+		GLuint outputBuffers[3] = { depthMSAA, normalMSAA, idMSAA };
+		if(allocatedOutputs != 0)
+			glDeleteTextures(3, outputBuffers);
+		else
+			glDeleteRenderbuffers(1, &depthMSAA);
+		normalMSAA = idMSAA = 0;
+	}
+	widthRender = width;
+	heightRender = height;
+	numSamples = samples;
+	allocatedOutputs = outputs;
+	cout << "Render targets: " << widthRender << "x" << heightRender << ", " << numSamples << " samples" << endl;
+
+	// Define MSAA framebuffer
+	glGenRenderbuffers(1, &imgMSAA);
+	glBindRenderbuffer(GL_RENDERBUFFER, imgMSAA);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, numSamples, GL_RGBA, widthRender, heightRender);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	// Scene depth for keypoints and preview: depth and coverage (outDepth of the shaders)
+	depthMSAA = createMultisample(GL_RG32F, outputs != 0);
+
+	// Depth buffer
+	glGenRenderbuffers(1, &zMSAA);
+	glBindRenderbuffer(GL_RENDERBUFFER, zMSAA);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, numSamples, GL_DEPTH_COMPONENT32F, widthRender, heightRender);
+
+	// Extra outputs requested for the samples
+	if(outputs & (1 << OUTPUT_NORMAL))
+		normalMSAA = createMultisample(GL_RG16F, true);
+	if(outputs & ((1 << OUTPUT_INSTANCE) | (1 << OUTPUT_PART)))
+		idMSAA = createMultisample(GL_RG16UI, true);
+
+	glGenFramebuffers(1, &fboRender);
+	glBindFramebuffer(GL_FRAMEBUFFER, fboRender);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, imgMSAA);
+	if(outputs != 0)
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D_MULTISAMPLE, depthMSAA, 0);
+	else
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_RENDERBUFFER, depthMSAA);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, zMSAA);
+	if(normalMSAA != 0)
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D_MULTISAMPLE, normalMSAA, 0);
+	if(idMSAA != 0)
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, GL_TEXTURE_2D_MULTISAMPLE, idMSAA, 0);
+	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		cout << "Not properly installed MS-FBO: " << glCheckFramebufferStatus(GL_FRAMEBUFFER) << endl;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	// Define FBO binary
+	glGenRenderbuffers(1, &bufBinary);
+	glBindRenderbuffer(GL_RENDERBUFFER, bufBinary);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA, widthRender, heightRender);
+
+	glGenFramebuffers(1, &fboBinary);
+	glBindFramebuffer(GL_FRAMEBUFFER, fboBinary);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, bufBinary);
+	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		cout << "Not properly installed FBO for binary" << endl;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	// Define Depth framebuffer
+	glGenRenderbuffers(1, &bufDepth);
+	glBindRenderbuffer(GL_RENDERBUFFER, bufDepth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RG32F, widthRender, heightRender);
+
+	glGenFramebuffers(1, &fboDepth);
+	glBindFramebuffer(GL_FRAMEBUFFER, fboDepth);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, bufDepth);
+	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		cout << "Not properly installed FBO for depth" << endl;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+GLuint Render::createMultisample(GLenum internalFormat, bool isTexture)
+{
+	// Textures keep fixed sample locations to share the framebuffer with the renderbuffers
+	GLuint buffer;
+	if(isTexture)
+	{
+		glGenTextures(1, &buffer);
+		glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, buffer);
+		glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, numSamples, internalFormat, widthRender, heightRender, GL_TRUE);
+		glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
+	}
+	else
+	{
+		glGenRenderbuffers(1, &buffer);
+		glBindRenderbuffer(GL_RENDERBUFFER, buffer);
+		glRenderbufferStorageMultisample(GL_RENDERBUFFER, numSamples, internalFormat, widthRender, heightRender);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	}
+	return buffer;
+}
+
+void Render::resolveSample(RenderTarget& target, int width, int height)
+{
+	TraceGpuZone gpuZone("sample resolve");
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, fboRender);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+
+	// Rendered at the sample size: the MSAA resolve is the only copy
+	if(width == widthRender && height == heightRender)
+	{
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target.fbo);
+		glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		return;
+	}
+
+	// Supersampled: resolve at render size, then filter down into the target
+	RenderTarget& resolved = resolvePool.acquire(widthRender, heightRender);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolved.fbo);
+	glBlitFramebuffer(0, 0, widthRender, heightRender, 0, 0, widthRender, heightRender, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	if(downsampleFilter == DOWNSAMPLE_LINEAR)
+	{
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, resolved.fbo);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target.fbo);
+		glBlitFramebuffer(0, 0, widthRender, heightRender, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+		return;
+	}
+
+	GLuint& shader = downsampleShaders[downsampleFilter == DOWNSAMPLE_LANCZOS ? 1 : 0];
+	if(shader == 0)
+		shader = compileProgram("downsample", downsampleFilter == DOWNSAMPLE_LANCZOS ? "#define LANCZOS\n" : "", false);
+	glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+	glViewport(0, 0, width, height);
+	glDisable(GL_DEPTH_TEST);
+	glUseProgram(shader);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, resolved.tex);
+	glUniform1i(glGetUniformLocation(shader, "src"), 0);
+	glUniform2f(glGetUniformLocation(shader, "scale"), (float)widthRender / width, (float)heightRender / height);
+	glUniform2i(glGetUniformLocation(shader, "srcSize"), widthRender, heightRender);
+	glBindVertexArray(vaoDownsample);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindVertexArray(0);
+	glEnable(GL_DEPTH_TEST);
+	glViewport(0, 0, widthRender, heightRender);
+}
+
+RenderTarget& Render::resolveOutput(GLuint texture, TargetPool& samples, int width, int height)
+{
+	// A resolve blit would average depths and normals of the edges: sample 0 of the pixel under each target pixel instead
+	RenderTarget& target = samples.acquire(width, height);
+	bool isInteger = texture == idMSAA;
+	GLuint& shader = outputShaders[isInteger ? 1 : 0];
+	if(shader == 0)
+		shader = compileProgram("resolve", isInteger ? "#define INTEGER\n" : "", false);
+	glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+	glViewport(0, 0, width, height);
+	glDisable(GL_DEPTH_TEST);
+	glUseProgram(shader);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, texture);
+	glUniform1i(glGetUniformLocation(shader, "src"), 0);
+	glUniform2f(glGetUniformLocation(shader, "scale"), (float)widthRender / width, (float)heightRender / height);
+	glBindVertexArray(vaoDownsample);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindVertexArray(0);
+	glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
+	glEnable(GL_DEPTH_TEST);
+	glViewport(0, 0, widthRender, heightRender);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, target.fbo);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	return target;
+}
+
+void Render::prepareOutputs()
+{
+	// One atlas per requested output, same layout as the colour atlas of the sampler
+	int windowSize = mSampler->getWindowSize();
+	unsigned int numOutputs = 0;
+	for(unsigned int type = 0; type < NUM_OUTPUTS; ++type)
+		if(outputMask & (1 << type))
+		{
+			if(outputAtlases.size() <= numOutputs)
+				outputAtlases.push_back(OutputAtlas());
+			OutputAtlas& atlas = outputAtlases[numOutputs++];
+			unsigned int size = windowSize * windowSize * OutputEncoder::getChannels(type);
+			atlas.type = type;
+			atlas.data.assign(size, 0);
+		}
+	outputAtlases.resize(numOutputs);
+}
+
+void Render::readOutputs(int width, int height, int x, int y)
+{
+	TraceZone zone("readback outputs");
+	int windowSize = mSampler->getWindowSize();
+	int sizeSample = mSampler->getSizeSample();
+	// Rows of a single 16 bits channel are not 4 byte aligned for odd widths
+	glPixelStorei(GL_PACK_ALIGNMENT, 2);
+	for(unsigned int a = 0; a < outputAtlases.size(); ++a)
+	{
+		OutputAtlas& atlas = outputAtlases[a];
+		unsigned int channels = OutputEncoder::getChannels(atlas.type);
+		// - Stored formats: depth R16, normals RG16 snorm, ids RG16UI (instance, part)
+		outputPixels.resize(width * height * channels);
+		if(atlas.type == OUTPUT_DEPTH)
+		{
+			resolveOutput(depthMSAA, depthPool, width, height);
+			glReadPixels(0, 0, width, height, GL_RED, GL_UNSIGNED_SHORT, outputPixels.data());
+		}
+		else if(atlas.type == OUTPUT_NORMAL)
+		{
+			resolveOutput(normalMSAA, normalPool, width, height);
+			glReadPixels(0, 0, width, height, GL_RG, GL_SHORT, outputPixels.data());
+		}
+		else
+		{
+			resolveOutput(idMSAA, idPool, width, height);
+			glReadPixels(0, 0, width, height, atlas.type == OUTPUT_PART ? GL_GREEN_INTEGER : GL_RED_INTEGER, GL_UNSIGNED_SHORT, outputPixels.data());
+		}
+
+		// Copy into the atlas at the place of the sample
+		for(int row = 0; row < height; ++row)
+			memcpy(&atlas.data[((y*sizeSample + row)*windowSize + x*sizeSample) * channels],
+				&outputPixels[row * width * channels], width * channels * sizeof(unsigned short));
+	}
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+}
+
 void Render::resizeGL(int width, int height)
 {
 	glViewport(0, 0, width, height);
 	updateGL();	
 }
 
+void Render::redraw()
+{
+	// updateGL() is skipped for an unmapped widget, the worker draws regardless of the window state
+	if(isWorker)
+		glDraw();
+	else
+		updateGL();
+}
+
+void Render::beginWorker(QThread* thread)
+{
+	mFPS->stop();
+	isWorker = true;
+	lastPreview = 0.0;
+	mSampler->setDeferredUpload(true);
+	mDepth->setDeferredUpload(true);
+	doneCurrent();
+	context()->moveToThread(thread);
+}
+
+void Render::endWorker()
+{
+	isWorker = false;
+	mSampler->setDeferredUpload(false);
+	mDepth->setDeferredUpload(false);
+	makeCurrent();
+	mFPS->start(10);
+	mSampler->showAtlas(mSampler->getAtlasImage(), mSampler->getWindowSize());
+	mDepth->showAtlas(mDepth->getAtlasImage(), mDepth->getWindowSize());
+	makeCurrent();
+}
+
+void Render::postPreviews()
+{
+	// Queued to the preview widgets (GUI thread), throttled so copies do not slow down generation.
+	// Workers have no preview connected: no copies and no switch to the context of a sampler.
+	static const QMetaMethod sampleSignal = QMetaMethod::fromSignal(&Render::updateSamplePreview);
+	static const QMetaMethod depthSignal = QMetaMethod::fromSignal(&Render::updateDepthPreview);
+	if(!isSignalConnected(sampleSignal) && !isSignalConnected(depthSignal))
+		return;
+	if(!isPreviewDue())
+		return;
+	lastPreview = Trace::now();
+	emit updateSamplePreview(mSampler->getAtlasImage(), mSampler->getWindowSize());
+	emit updateDepthPreview(mDepth->getAtlasImage(), mDepth->getWindowSize());
+}
+
+bool Render::isPreviewDue()
+{
+	return Trace::now() - lastPreview >= PREVIEW_INTERVAL * 1000.0;
+}
+
 void Render::paintGL()
 {
+	TraceZone zone("paintGL");
+
 	// Update camera movement
 	if (isFreeCamera)
 	{
@@ -318,6 +645,11 @@ void Render::paintGL()
 		cam.fixedPos = glm::vec3(fixedTrans*glm::vec4(0.0f, 0.0f, cam.distance, 1.0f));
 	}
 
+	// Samples use the framebuffers of the job (see createSamples), the interactive view its own without the extra outputs
+	if (!isSampling)
+		allocateRenderTargets(VIEW_SIZE, VIEW_SIZE, maxSamples, 0);
+	glViewport(0, 0, widthRender, heightRender);
+
 	// Call object geometry to render
 	if (isAntiAliasing)
 		glEnable(GL_MULTISAMPLE);
@@ -368,10 +700,34 @@ void Render::paintGL()
 	// Render background image (if selected)
 	renderBackground();
 
-	// Real render pass scene
+	// Real render pass scene (extra outputs cleared to 0 as background and only written by it)
+	GLenum sceneBuffers[4] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1,
+		normalMSAA != 0 ? GL_COLOR_ATTACHMENT2 : GL_NONE, idMSAA != 0 ? GL_COLOR_ATTACHMENT3 : GL_NONE };
+	glDrawBuffers(4, sceneBuffers);
+	if (normalMSAA != 0)
+	{
+		GLfloat zeroNormal[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		glClearBufferfv(GL_COLOR, 2, zeroNormal);
+	}
+	if (idMSAA != 0)
+	{
+		GLuint zeroId[4] = { 0, 0, 0, 0 };
+		glClearBufferuiv(GL_COLOR, 3, zeroId);
+	}
+	{
+		TraceGpuZone gpuZone("scene");
+		for (unsigned i = 0; i < listModels.size(); ++i)
+		{
+			currentInstance = i + 1;
+			render(listModels[i], listModels[i]->getShader());
+		}
+		currentInstance = 0;
+	}
 	glDrawBuffers(2, attachments);
-	for (unsigned i = 0; i < listModels.size(); ++i)
-		render(listModels[i], listModels[i]->getShader());
+
+	// Keypoint visibility against the scene depth (results collected by saveAnnotations)
+	if (isSampling && isKpsQuery && !listModels.empty())
+		queryKps();
 
 	// Render keypoints (if tab selected)
 	if (isKpsMode && !listModels.empty())
@@ -391,33 +747,66 @@ void Render::paintGL()
 	if(isAntiAliasing)
 		glDisable(GL_MULTISAMPLE);
 
-	// Anti-aliasing post processing (adding framebuffer output into the default window FB = 0)
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, fboRender);
-	glReadBuffer(GL_COLOR_ATTACHMENT0);
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-	glBlitFramebuffer(0, 0, widthRender, heightRender, 0, 0, widthRender, heightRender, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	{
+		TraceGpuZone gpuZone("resolve blits");
 
-	// Copy depth information into depth-FBO
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, fboRender);
-	glReadBuffer(GL_COLOR_ATTACHMENT1);
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fboDepth);
-	glBlitFramebuffer(0, 0, widthRender, heightRender, 0, 0, widthRender, heightRender, GL_COLOR_BUFFER_BIT, GL_LINEAR);
-
-	// Copy depth into visualisation window
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, fboDepth);
-	glClampColor(GL_CLAMP_FRAGMENT_COLOR, GL_FALSE);
-	depth.clear();
-	depth.resize(widthRender * heightRender * 4, 0); 
-	glReadPixels(0, 0, widthRender, heightRender, GL_RGBA, GL_FLOAT, depth.data());
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fboDepthVis);
-	glBlitFramebuffer(0, 0, widthRender, heightRender, 0, 0, mDepth->width(), mDepth->height(), GL_COLOR_BUFFER_BIT, GL_LINEAR);
-	depthByte.clear();
-	depthByte.resize(mDepth->width()*mDepth->height() * 4, 0);
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, fboDepthVis);
-	glReadPixels(0, 0, mDepth->width(), mDepth->height(), GL_RGBA, GL_UNSIGNED_BYTE, depthByte.data());	
-	mDepth->transferViewportImg(depthByte.data(), 0, 0);
-	mDepth->updateGL();
-	makeCurrent();
+		// Anti-aliasing post processing (adding framebuffer output into the default window FB = 0)
+		// - Samples are resolved straight into their target instead (see resolveSample)
+		if(!isSampling)
+		{
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, fboRender);
+			glReadBuffer(GL_COLOR_ATTACHMENT0);
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+			glBlitFramebuffer(0, 0, widthRender, heightRender, 0, 0, widthRender, heightRender, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+		}
+	}
+
+	// Depth is resolved and read back only for the consumers of this frame:
+	// - Float depth for the CPU keypoint visibility test
+	// - Depth window when shown, or the next preview posted by a worker
+	bool isDepthRead = isSampling && !isKpsQuery;
+	bool isDepthPreview = isWorker ? isPreviewDue() : mDepth->isVisible();
+	if (isDepthRead || isDepthPreview)
+	{
+		TraceGpuZone gpuZone("resolve depth");
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, fboRender);
+		glReadBuffer(GL_COLOR_ATTACHMENT1);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fboDepth);
+		glBlitFramebuffer(0, 0, widthRender, heightRender, 0, 0, widthRender, heightRender, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, fboDepth);
+		glClampColor(GL_CLAMP_FRAGMENT_COLOR, GL_FALSE);
+	}
+	if (isDepthRead)
+	{
+		TraceZone zoneReadback("readback depth");
+		depth.resize(widthRender * heightRender * 2, 0);
+		glReadPixels(0, 0, widthRender, heightRender, GL_RG, GL_FLOAT, depth.data());
+	}
+	if (isDepthPreview)
+	{
+		TraceZone zoneDepth("depth preview");
+		int widthVis = mDepth->width(), heightVis = mDepth->height();
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fboDepthVis);
+		glBlitFramebuffer(0, 0, widthRender, heightRender, 0, 0, widthVis, heightVis, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, fboDepthVis);
+		glPixelStorei(GL_PACK_ALIGNMENT, 2);
+		depthByte.resize(widthVis * heightVis * 4, 0);
+		glReadPixels(0, 0, widthVis, heightVis, GL_RG, GL_UNSIGNED_BYTE, depthByte.data());
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		// Grey image with coverage as alpha, expanded in place from the back
+		for (int pxl = widthVis * heightVis - 1; pxl >= 0; --pxl)
+		{
+			GLubyte value = depthByte[2 * pxl], coverage = depthByte[2 * pxl + 1];
+			depthByte[4 * pxl] = depthByte[4 * pxl + 1] = depthByte[4 * pxl + 2] = value;
+			depthByte[4 * pxl + 3] = coverage;
+		}
+		mDepth->transferViewportImg(depthByte.data(), 0, 0);
+		if(!isWorker)
+		{
+			mDepth->updateGL();
+			makeCurrent();
+		}
+	}
 
 	countFPS++;
 }
@@ -461,29 +850,93 @@ void Render::render(Model* obj, GLuint shader)
 	// Bring model to origin
 	float *centre = obj->getBB().getCenter();
 	model  = glm::translate(model , glm::vec3(-centre[0], -centre[1], -centre[2]));
+	// Normals are transformed once per object instead of per vertex
+	normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
 
 	if(isLabel && isEditMode)
 	{
-		currentShader = getShader(LABELLING);
+		useSceneShader(getShader(LABELLING));
 		obj->setShader(currentShader);
-		glUseProgram(currentShader);
-
-		GLuint uniModelLabel = glGetUniformLocation(currentShader, "model");
-		glUniformMatrix4fv(uniModelLabel, 1, GL_FALSE, glm::value_ptr(model));
-		setUpLights();
-		updateViewMatrix();
-		updateProjectionMatrix();
-
 		obj->renderLabelling();
 	}
 
 	// Loop throughout all models and visualise them!
-	currentShader = shader;
+	// - Phong models: one pass per group of entities with the variant of their material (edit mode keeps the generic one)
+	if(shader == programShaders[TYPE_SHADER::PHONG] && !isEditMode)
+	{
+		// Dense models: depth only pass first, then only the visible fragment of each pixel is lit (early-Z on GL_EQUAL,
+		// exact as all variants share the invariant position). Drivers breaking the invariance can push the pre-pass back
+		// by a polygon offset and compare with GL_LEQUAL instead: fragments within the offset are then lit too.
+		bool isPrePass = prePassTriangles > 0 && obj->getNumTriangles() >= prePassTriangles;
+		if(isPrePass)
+		{
+			TraceGpuZone gpuZone("depth pre-pass");
+			glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+			if(isPrePassOffset)
+			{
+				glEnable(GL_POLYGON_OFFSET_FILL);
+				glPolygonOffset(1.0f, 1.0f);
+			}
+			useSceneShader(getPhongVariant(SHADER_VARIANT::DEPTH_ONLY));
+			obj->setShader(currentShader);
+			obj->render();
+			glDisable(GL_POLYGON_OFFSET_FILL);
+			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+			glDepthFunc(isPrePassOffset ? GL_LEQUAL : GL_EQUAL);
+			glDepthMask(GL_FALSE);
+		}
+		vector<unsigned int>& variants = obj->getVariants();
+		for(unsigned int i = 0; i < variants.size(); ++i)
+		{
+			useSceneShader(getPhongVariant(variants[i]));
+			obj->setShader(currentShader);
+			obj->render(variants[i]);
+		}
+
+		// Part output: labels of the semantic tree drawn over the visible surface (same depth) into the part channel only
+		if(allocatedOutputs & (1 << OUTPUT_PART))
+		{
+			TraceGpuZone gpuZone("part labels");
+			glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+			glColorMaski(3, GL_FALSE, GL_TRUE, GL_FALSE, GL_FALSE);
+			glDepthFunc(isPrePass && isPrePassOffset ? GL_LEQUAL : GL_EQUAL);
+			glDepthMask(GL_FALSE);
+			useSceneShader(getPhongVariant(SHADER_VARIANT::DEPTH_ONLY));
+			obj->setShader(currentShader);
+			obj->renderParts();
+			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		}
+		if(isPrePass || (allocatedOutputs & (1 << OUTPUT_PART)))
+		{
+			glDepthFunc(GL_LESS);
+			glDepthMask(GL_TRUE);
+		}
+	}
+	else
+	{
+		useSceneShader(shader);
+		obj->setShader(currentShader);
+		if(isEditMode)
+			obj->renderParent();
+		else
+			obj->render();
+	}
+	
+	currentShader = saveShader;
 	obj->setShader(currentShader);
+}
+
+void Render::useSceneShader(GLuint shader)
+{
+	currentShader = shader;
 	glUseProgram(currentShader); // Now this shader program is used in the rendering
 
 	GLint uniModel = glGetUniformLocation(currentShader, "model");
 	glUniformMatrix4fv(uniModel, 1, GL_FALSE, glm::value_ptr(model));
+	GLint uniNormal = glGetUniformLocation(currentShader, "normalMatrix");
+	glUniformMatrix3fv(uniNormal, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+	glUniform1ui(glGetUniformLocation(currentShader, "instanceId"), currentInstance);
+	glUniform1ui(glGetUniformLocation(currentShader, "partId"), 0);
 
 	// Lighting
 	setUpLights();
@@ -492,14 +945,6 @@ void Render::render(Model* obj, GLuint shader)
 	updateViewMatrix();
 	// - Screen coordinate transformation
 	updateProjectionMatrix();
-
-	if(isEditMode)
-		obj->renderParent();
-	else
-		obj->render();
-	
-	currentShader = saveShader;
-	obj->setShader(currentShader);
 }
 
 void Render::renderUI()
@@ -541,6 +986,7 @@ void Render::renderUI()
 
 void Render::renderBackground()
 {
+	TraceGpuZone gpuZone("background");
 	glDisable(GL_DEPTH_TEST);
 	// glDisable(GL_CULL_FACE);
 
@@ -607,50 +1053,46 @@ void Render::renderBrush()
 
 void Render::renderKps()
 {
+	TraceGpuZone gpuZone("keypoints");
+	if (model_kps.empty())
+		return;
+	updateKpsInstances();
+
 	if (!isKpsSelfOcc)
 	{
 		glDisable(GL_DEPTH_TEST);
 	}
 
 	Model* obj = listModels.back();
-	for (map<string, Model*>::iterator it = model_kps.begin(); it != model_kps.end(); ++it)
-	{
-		Model* currentKp = it->second;
-		model = glm::mat4();
-		if (isSampling)
-			model = glm::translate(model, glm::vec3(0.0f, 0.0f, cam.fixedPos.z - mSampler->getDistance()));
+	model = glm::mat4();
+	if (isSampling)
+		model = glm::translate(model, glm::vec3(0.0f, 0.0f, cam.fixedPos.z - mSampler->getDistance()));
 
-		float rx = obj->getRX();
-		float ry = -obj->getRY();
-		float rz = obj->getRZ();
-		if (isSampling)
-		{
-			ry = -(float)mSampler->getCurrentAngleY();
-			rx = (float)mSampler->getAngleX();
-		}
-		else if (!isFreeCamera && !isSampling)
-		{
-			ry -= cam.azimuth;
-			rx -= cam.elevation;
-		}
-		model = glm::rotate(model, rx, glm::vec3(1.0f, 0.0f, 0.0f));
-		model = glm::rotate(model, ry, glm::vec3(0.0f, 1.0f, 0.0f));
-		model = glm::rotate(model, rz, glm::vec3(0.0f, 0.0f, 1.0f));
-		model = glm::translate(model, glm::vec3(currentKp->getTX(), currentKp->getTY(), currentKp->getTZ()));
-		model = glm::scale(model, glm::vec3(currentKp->getSX(), currentKp->getSY(), currentKp->getSZ()));
-		float *centre = currentKp->getBB().getCenter();
-		model = glm::translate(model, glm::vec3(-centre[0], -centre[1], -centre[2]));
-
-		currentShader = currentKp->getShader();
-		glUseProgram(currentShader);
-		GLint uniModel = glGetUniformLocation(currentShader, "model");
-		glUniformMatrix4fv(uniModel, 1, GL_FALSE, glm::value_ptr(model));
-
-		setUpLights();
-		updateViewMatrix();
-		updateProjectionMatrix();
-		currentKp->render();
+	float rx = obj->getRX();
+	float ry = -obj->getRY();
+	float rz = obj->getRZ();
+	if (isSampling)
+	{
+		ry = -(float)mSampler->getCurrentAngleY();
+		rx = (float)mSampler->getAngleX();
+	}
+	else if (!isFreeCamera && !isSampling)
+	{
+		ry -= cam.azimuth;
+		rx -= cam.elevation;
 	}
+	model = glm::rotate(model, rx, glm::vec3(1.0f, 0.0f, 0.0f));
+	model = glm::rotate(model, ry, glm::vec3(0.0f, 1.0f, 0.0f));
+	model = glm::rotate(model, rz, glm::vec3(0.0f, 0.0f, 1.0f));
+
+	// All keypoints in a single draw (placement comes from the instance buffer)
+	currentShader = kpsSphere->getShader();
+	glUseProgram(currentShader);
+	GLint uniModel = glGetUniformLocation(currentShader, "model");
+	glUniformMatrix4fv(uniModel, 1, GL_FALSE, glm::value_ptr(model));
+	updateViewMatrix();
+	updateProjectionMatrix();
+	kpsSphere->renderInstanced(model_kps.size());
 
 	if (!isKpsSelfOcc)
 	{
@@ -660,6 +1102,8 @@ void Render::renderKps()
 
 void Render::computeBB2D()
 {
+	TraceZone zone("computeBB2D");
+	TraceGpuZone gpuZone("computeBB2D");
 	binaryView.resize(widthRender*heightRender*4);
 	BB *bb2D, *bb3D;
 	for(unsigned i = 0; i < listModels.size(); ++i)
@@ -736,30 +1180,36 @@ void Render::computeBB2D()
 			int pxlY0 = floor(max(0.0f, (heightRender/2.0f)*limY0 + (heightRender/2.0f)));
 			int pxlX1 = ceil(min((float)widthRender, (widthRender/2.0f)*limX1 + (widthRender/2.0f)));
 			int pxlY1 = ceil(min((float)heightRender, (heightRender/2.0f)*limY1 + (heightRender/2.0f)));
-			for(int row = pxlY0; row < pxlY1; ++row)
-				for(int col = pxlX0; col < pxlX1; ++col)
-				{
-					unsigned int idx = 4*(row*heightRender+ col);
-					if(binaryView[idx] != 0)
-					{
-						if(row < bb2D->getY0())
-							bb2D->setY0(row);
-						else if(row > bb2D->getY1())
-							bb2D->setY1(row);
-
-						if(col < bb2D->getX0())
-							bb2D->setX0(col);
-						else if(col > bb2D->getX1())
-							bb2D->setX1(col);
-					}
-				}
+			scanMask(binaryView, widthRender, pxlX0, pxlY0, pxlX1, pxlY1, *bb2D);
 
 			bb2D->updateCenter();
 		}
 }
 
+void Render::scanMask(const vector<GLubyte>& mask, int width, int x0, int y0, int x1, int y1, BB& bb)
+{
+	for(int row = y0; row < y1; ++row)
+		for(int col = x0; col < x1; ++col)
+		{
+			unsigned int idx = 4*(row*width + col);
+			if(mask[idx] != 0)
+			{
+				if(row < bb.getY0())
+					bb.setY0(row);
+				else if(row > bb.getY1())
+					bb.setY1(row);
+
+				if(col < bb.getX0())
+					bb.setX0(col);
+				else if(col > bb.getX1())
+					bb.setX1(col);
+			}
+		}
+}
+
 bool Render::loadModelFromFile(const string& fileName, GLuint shader)
 {
+	TraceZone zone("load model");
 	// Remove previous object
 	std::map<std::string, Kp> old_kps;
 	if(!listModels.empty())
@@ -798,6 +1248,45 @@ bool Render::loadModelFromFile(const string& fileName, GLuint shader)
 		// If it has no Kps, keep old ones (remove when all annotated)
 		if(mModel->getKps().empty())
 			mModel->setKps(old_kps);
+		if(outputMask & (1 << OUTPUT_PART))
+			loadSegmentation(fileName);
+	}
+	return true;
+}
+
+bool Render::loadSegmentation(const string& modelFile)
+{
+	// Same file and layout as the labelling tab: labels in pre-order, each one "k name", "c r g b", "p path" and its geometry
+	string segPath = modelFile.substr(0, modelFile.find_last_of('.')) + ".seg";
+	ifstream segmentationFile(segPath.c_str());
+	if(!segmentationFile.is_open())
+		return false;
+	TraceZone zone("load segmentation");
+	string line;
+	QStringList rgb, labelNodes;
+	vector<unsigned int> treePath;
+	while(getline(segmentationFile, line))
+	{
+		if(line.empty())
+			continue;
+		switch(line[0])
+		{
+			case 'c':
+				rgb = QString(line.erase(0,2).c_str()).split(" ");
+				break;
+			case 'p':
+				labelNodes = line.size() > 2 ? QString(line.erase(0,2).c_str()).split(" ") : QStringList();
+				treePath.resize(labelNodes.size());
+				for(int i = 0; i < labelNodes.size(); ++i)
+					treePath[i] = atoi(labelNodes[i].toStdString().c_str());
+				if(rgb.size() < 3)
+					rgb = QString("0 0 0").split(" ");
+				loadSegmentationFromFile(segmentationFile, treePath, atoi(rgb[0].toStdString().c_str())/255.0f,
+					atoi(rgb[1].toStdString().c_str())/255.0f, atoi(rgb[2].toStdString().c_str())/255.0f);
+				break;
+			default:
+				break;
+		}
 	}
 	return true;
 }
@@ -835,13 +1324,20 @@ bool Render::loadSegmentationFromFile(ifstream& segmentationFile, vector<unsigne
 	itTree->setAmbient(r,g,b);
 
 	// Retrieve vertices, normals and finally faces
+	if(readSegmentation(segmentationFile, *itTree))
+		getModel()->updateLabels(*itTree);
+
+	return true;
+}
+
+bool Render::readSegmentation(istream& segmentationFile, Entity& part)
+{
 	string line;
-	bool isFinished = false;
 	Vertex v;
 	Face f;
 	QStringList listPoints;
 	QString delimiters(" ");
-	while(getline(segmentationFile, line) && !isFinished)
+	while(getline(segmentationFile, line))
 	{
 		// cout << line << endl;
 		switch(line[0])
@@ -857,25 +1353,24 @@ bool Render::loadSegmentationFromFile(ifstream& segmentationFile, vector<unsigne
 			case 't':
 				listPoints = QString(line.erase(0,2).c_str()).split(delimiters);
 				v.setTexcoord(atof(listPoints[0].toStdString().c_str()), atof(listPoints[1].toStdString().c_str()));
-				itTree->getListVertices().push_back(v);
+				part.getListVertices().push_back(v);
 				break;
 			case 'f':
 				listPoints = QString(line.erase(0,2).c_str()).split(delimiters);
 				f.setFace(atoi(listPoints[0].toStdString().c_str()), atoi(listPoints[1].toStdString().c_str()), atoi(listPoints[2].toStdString().c_str()));
-				itTree->getListFaceIndices().push_back(f);
+				part.getListFaceIndices().push_back(f);
 				break;
 			default:
-				isFinished = true;
-				getModel()->updateLabels(*itTree);
-				break;
+				return true;
 		}
 	}
 
-	return true;
+	return false;
 }
 
 void Render::loadBackgroundImgFromFile(const std::string& fileName)
 {
+	TraceZone zone("load background");
 	backgroundQuad->getVisualEntity(0).setTexturePath(fileName);
 	glBindTexture(GL_TEXTURE_2D, backgroundQuad->getVisualEntity(0).getTextureId());
 	if(fileName != "")
@@ -960,80 +1455,147 @@ Model* Render::createObj(const char* objStr, GLuint shader, float r, float g, fl
 void Render::loadShaders(vector<string> nameShaders)
 {
 	for(unsigned i = 0; i < nameShaders.size(); ++i)
+		programShaders.push_back(compileProgram(nameShaders[i], "", programShaders.size() != TYPE_SHADER::DEPTH));
+}
+
+GLuint Render::compileProgram(const string& name, const string& defines, bool hasDepthOutput)
+{
+	string fileName= ":/shaders/";
+	fileName.append(name);
+
+	// - Vertex Shader
+	QFile vertexFile, fragmentFile;
+	string vertexFileName = fileName;
+	vertexFile.setFileName(vertexFileName.append(".vert").c_str());
+	if (!vertexFile.open(QIODevice::ReadOnly | QIODevice::Text))
 	{
-		string fileName= ":/shaders/";
-		fileName.append(nameShaders[i]);
+		qWarning() << "Cannot open vertex shader file!" << endl;
+		exit(EXIT_FAILURE);
+	}
+	QByteArray vertexData = vertexFile.readAll();
+	vertexFile.close();
+	// Specialisation defines go right after #version (first line)
+	vertexData.insert(vertexData.indexOf('\n') + 1, defines.c_str());
+
+	// - Fragment Shader
+	string fragmentFileName = fileName;
+	fragmentFile.setFileName(fragmentFileName.append(".frag").c_str());
+	if (!fragmentFile.open(QIODevice::ReadOnly | QIODevice::Text))
+	{
+		qWarning() << "Cannot open fragment shader file!" << endl;
+		exit(EXIT_FAILURE);
+	}
+	QByteArray fragmentData = fragmentFile.readAll();
+	fragmentFile.close();
+	fragmentData.insert(fragmentData.indexOf('\n') + 1, defines.c_str());
 
-		// - Vertex Shader
-		QFile vertexFile, fragmentFile;
-		string vertexFileName = fileName;
-		vertexFile.setFileName(vertexFileName.append(".vert").c_str());
-		if (!vertexFile.open(QIODevice::ReadOnly | QIODevice::Text))
-		{
-			qWarning() << "Cannot open vertex shader file!" << endl;
-			exit(EXIT_FAILURE);
-		}
-		QByteArray vertexData = vertexFile.readAll();
-		vertexFile.close();
-		const GLchar* vertexSource = vertexData.data();
-		GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-		glShaderSource(vertexShader, 1, &vertexSource, NULL);
-		glCompileShader(vertexShader);
-
-		// - Fragment Shader
-		string fragmentFileName = fileName;
-		fragmentFile.setFileName(fragmentFileName.append(".frag").c_str());
-		if (!fragmentFile.open(QIODevice::ReadOnly | QIODevice::Text))
-		{
-			qWarning() << "Cannot open fragment shader file!" << endl;
-			exit(EXIT_FAILURE);
-		}
-		QByteArray fragmentData = fragmentFile.readAll();
-		fragmentFile.close();
-		const GLchar* fragmentSource = fragmentData.data();
-		GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-		glShaderSource(fragmentShader, 1, &fragmentSource, NULL);
-		glCompileShader(fragmentShader);
-
-		// Check whether a shader has successfully been compiled
-		GLint statusV, statusF;
-		glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &statusV);
-		glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &statusF);
-		if(statusV == GL_TRUE && statusF == GL_TRUE)
-			cout << "Shader " << nameShaders[i] << " loaded: OK!" << endl;
-		else
+	string nameVariant = name;
+	if(!defines.empty())
+		nameVariant.append(" variant");
+
+	// Binary of a previous run (same sources, bindings and driver)
+	string cacheKey;
+	if(ShaderCache::isEnabled())
+	{
+		cacheKey = ShaderCache::getKey(vertexData.constData(), fragmentData.constData(), hasDepthOutput ? "render outColour outDepth" : "render outColour");
+		GLuint program = ShaderCache::load(cacheKey);
+		if(program != 0)
 		{
-			cout << "Shader " << nameShaders[i] << " loaded: NO!" << endl;
-			char buffer[512];
-			glGetShaderInfoLog(vertexShader, 512, NULL, buffer);
-			cout << "REASON: " << buffer << endl;
+			cout << "Shader " << nameVariant << " loaded: OK! (cache)" << endl;
+			glUseProgram(program);
+			return program;
 		}
+	}
 
-		// Create final shader workflow
-		programShaders.push_back(glCreateProgram());
-		glAttachShader(programShaders[i], vertexShader);
-		glAttachShader(programShaders[i], fragmentShader);
+	const GLchar* vertexSource = vertexData.data();
+	GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(vertexShader, 1, &vertexSource, NULL);
+	glCompileShader(vertexShader);
+
+	const GLchar* fragmentSource = fragmentData.data();
+	GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(fragmentShader, 1, &fragmentSource, NULL);
+	glCompileShader(fragmentShader);
+
+	// Check whether a shader has successfully been compiled
+	GLint statusV, statusF;
+	glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &statusV);
+	glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &statusF);
+	if(statusV == GL_TRUE && statusF == GL_TRUE)
+		cout << "Shader " << nameVariant << " loaded: OK!" << endl;
+	else
+	{
+		cout << "Shader " << nameVariant << " loaded: NO!" << endl;
+		char buffer[512];
+		glGetShaderInfoLog(statusV == GL_TRUE ? fragmentShader : vertexShader, 512, NULL, buffer);
+		// Defines of the variant on the same line
+		string definesLine = defines;
+		replace(definesLine.begin(), definesLine.end(), '\n', ' ');
+		cout << "REASON (" << nameVariant << ", defines: " << definesLine << "): " << buffer << endl;
+	}
 
-		// Associate shader input (attribute)
-		glBindAttribLocation(programShaders[i], SHADER_IN::position, "position");
-		glBindAttribLocation(programShaders[i], SHADER_IN::colour, "colour");
-		glBindAttribLocation(programShaders[i], SHADER_IN::texcoord, "texcoord");
-		glBindAttribLocation(programShaders[i], SHADER_IN::normal, "normal");
-	
-		// Associate shader output
-		glBindFragDataLocation(programShaders[i], 0, "outColour");
-		if (i != TYPE_SHADER::DEPTH)
-			glBindFragDataLocation(programShaders[i], 1, "outDepth");
-
-		glLinkProgram(programShaders[i]);
-		glUseProgram(programShaders[i]); // only 1 program active at a time
-
-		// Associate variable connection code <-> shader (uniform)
-		// GLint uniColor = glGetUniformLocation(shaderProgram, "triangleColor");
-		// glUniform3f(uniColor, 1.0f, 0.0f, 0.0f);
-		glDeleteShader(vertexShader);
-		glDeleteShader(fragmentShader);
+	// Create final shader workflow
+	GLuint program = glCreateProgram();
+	glAttachShader(program, vertexShader);
+	glAttachShader(program, fragmentShader);
+
+	// Associate shader input (attribute)
+	glBindAttribLocation(program, SHADER_IN::position, "position");
+	glBindAttribLocation(program, SHADER_IN::colour, "colour");
+	glBindAttribLocation(program, SHADER_IN::texcoord, "texcoord");
+	glBindAttribLocation(program, SHADER_IN::normal, "normal");
+	glBindAttribLocation(program, SHADER_IN::instPosition, "instPosition");
+	glBindAttribLocation(program, SHADER_IN::instScale, "instScale");
+	glBindAttribLocation(program, SHADER_IN::instColour, "instColour");
+
+	// Associate shader output
+	glBindFragDataLocation(program, 0, "outColour");
+	if (hasDepthOutput)
+		glBindFragDataLocation(program, 1, "outDepth");
+
+	ShaderCache::prepare(program);
+	glLinkProgram(program);
+	glUseProgram(program); // only 1 program active at a time
+	GLint statusLink;
+	glGetProgramiv(program, GL_LINK_STATUS, &statusLink);
+	if(!cacheKey.empty() && statusLink == GL_TRUE)
+		ShaderCache::save(cacheKey, program);
+
+	// Associate variable connection code <-> shader (uniform)
+	// GLint uniColor = glGetUniformLocation(shaderProgram, "triangleColor");
+	// glUniform3f(uniColor, 1.0f, 0.0f, 0.0f);
+	glDeleteShader(vertexShader);
+	glDeleteShader(fragmentShader);
+	return program;
+}
+
+GLuint Render::getPhongVariant(unsigned int variant)
+{
+	// Depth only draws skip lighting and materials: a single variant
+	unsigned int numLights = mLights.getNumActive();
+	if(variant & SHADER_VARIANT::DEPTH_ONLY)
+	{
+		variant = SHADER_VARIANT::DEPTH_ONLY;
+		numLights = 0;
 	}
+	unsigned int key = variant | (numLights << 8);
+	map<unsigned int, GLuint>::iterator it = phongVariants.find(key);
+	if(it != phongVariants.end())
+		return it->second;
+
+	stringstream defines;
+	defines << "#define NUM_LIGHTS " << numLights << "\n";
+	if(!(variant & SHADER_VARIANT::TEXTURED))
+		defines << "#define UNTEXTURED\n";
+	if(variant & SHADER_VARIANT::VERTEX_COLOUR)
+		defines << "#define VERTEX_COLOUR\n";
+	if(variant & SHADER_VARIANT::MATERIAL_COLOUR)
+		defines << "#define MATERIAL_COLOUR\n";
+	if(variant & SHADER_VARIANT::DEPTH_ONLY)
+		defines << "#define DEPTH_ONLY\n";
+	GLuint program = compileProgram("phong", defines.str(), true);
+	phongVariants[key] = program;
+	return program;
 }
 
 void Render::keyPressEvent(QKeyEvent *event)
@@ -1337,7 +1899,8 @@ bool Render::createSamples(bool toSave, string& chosenPath)
 		cout << "No moadels have been loaded!" << endl;
 		return false;
 	}
-	clock_t timePreview = clock();
+	TraceZone zone("createSamples");
+	double timePreview = Trace::now();
 
 	// Start instance of a new saved scene
 	isSampling = true;
@@ -1369,26 +1932,32 @@ bool Render::createSamples(bool toSave, string& chosenPath)
 		}
 		if(dir.mkdir(QString(path.c_str())))
 			cout << "New directory of samples " << path << " created" << endl;
+
+		// Annotations of the run go through one buffered writer per output folder
+		string annotationPath = dirAnnotations;
+		annotationPath.append("/" + annotationName);
+		if(annotationWriter.getPath() != annotationPath)
+		{
+			pipeline.drain();
+			annotationWriter.open(annotationPath);
+		}
 	}
 
 	int size = mSampler->getSizeSample();
 	int widthSample = size;
 	int heightSample = size;
 
-	// NEW framebuffer for the rendered sample
-	// - colour texture for samples
-	glGenTextures(1, &texSample);
-	glBindTexture(GL_TEXTURE_2D, texSample);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, widthSample, heightSample, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-	// - FBO sample
-	glGenFramebuffers(1, &fboSample);
-	glBindFramebuffer(GL_FRAMEBUFFER, fboSample);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texSample, 0);
-	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-		cout << "Not properly installed FBO for samples" << endl;
+	// Scene rendered at the size of the job (filtered down to each sample)
+	if(sampleRenderSize > 0)
+	{
+		int sizeRender = min(maxRenderSize, max(size, sampleRenderSize));
+		allocateRenderTargets(sizeRender, sizeRender, sampleMSAA, outputMask);
+	}
+	else
+		allocateRenderTargets(VIEW_SIZE, VIEW_SIZE, maxSamples, outputMask);
+
+	// Framebuffer for the rendered sample (reused per size bucket, the sample is its bottom-left corner)
+	RenderTarget& target = samplePool.acquire(widthSample, heightSample);
 
 	// Iterate over all different rendered viewports and portions stored in the texture
 	vector<GLubyte> pixels(widthSample*heightSample*4, 0);
@@ -1399,7 +1968,9 @@ bool Render::createSamples(bool toSave, string& chosenPath)
 	bool isFinished = false;
 	string imgPath, nameFile;
 
-	float currentY = 0; // azimuth updates (check)
+	// Fixed number of azimuth updates (the one of the plan, not the sum of the steps reaching 360)
+	unsigned int numViews = mSampler->getViewsPerTurn();
+	unsigned int idxView = 0;
 	while(!isFinished)
 	{
 		if(toSave)
@@ -1413,58 +1984,129 @@ bool Render::createSamples(bool toSave, string& chosenPath)
 			imgPath.append(".png");
 		}
 
-		mSampler->makeCurrent();
-		mSampler->defineCleanTexture();
-		mSampler->updateGL();
-		makeCurrent();
+		if(isWorker)
+			mSampler->defineCleanTexture();
+		else
+		{
+			mSampler->makeCurrent();
+			mSampler->defineCleanTexture();
+			mSampler->updateGL();
+			makeCurrent();
+		}
+		prepareOutputs();
 		for(int i = 0; i < mSampler->getNumSamples() && !isFinished; ++i)
 			for(int j = 0; j < mSampler->getNumSamples() && !isFinished; ++j)
 			{
-				// Update angle Y-rotation camera in the view (need to refresh twice... why? double buffered?)
-				updateGL();
-				updateGL();
+				// Update angle Y-rotation camera in the view (once: the sample no longer comes from the swapped window buffer)
+				redraw();
 
-				// Save the pre render framebuffer in another one fixed to sample viewport
-				glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
-				glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fboSample);
-				glBlitFramebuffer(0, 0, widthRender, heightRender, 0, 0, widthSample, heightSample, GL_COLOR_BUFFER_BIT, GL_LINEAR);
-				glBindFramebuffer(GL_FRAMEBUFFER, fboSample);
+				// Scene resolved into the framebuffer fixed to the sample viewport
+				resolveSample(target, widthSample, heightSample);
+				glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
 
-				glReadPixels(0, 0, widthSample, heightSample, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+				{
+					TraceZone zoneReadback("readback sample");
+					glReadPixels(0, 0, widthSample, heightSample, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+				}
 				mSampler->transferViewportImg(pixels.data(), i, j);
+				if(toSave && !outputAtlases.empty())
+					readOutputs(widthSample, heightSample, i, j);
 
 				// Keep track of annotations per sample
 				if(toSave)
+				{
 					saveAnnotations(nameFile, i, j);
+					resolveKpsQueries(false);
+				}
 
 				// Update camera for next sample
 				mSampler->updateCurrentAngleY();
 
-				currentY += mSampler->getAngleY();
-				if(currentY >= 360.0f)
+				if(++idxView >= numViews)
 					isFinished = true;
 			}
 
 		if(toSave)
 		{
-			// Store image with its samples
-			mSampler->saveToImg(imgPath);
-
-			// Store annotations in a txt file
-			string line;
-			string annotationPath = dirAnnotations;
-			annotationPath.append("/annotations.txt");			
-			ofstream annotationFile;
-			annotationFile.open(annotationPath, fstream::app);
-			if(annotationFile.is_open())
+			// Keypoints of the last frames still waiting for their queries
+			resolveKpsQueries(true);
+
+			// Checksum of the atlas pixels and annotations (the same whether the image is written here or by the pipeline)
+			string text;
+			for(unsigned int idxAnn = 0; idxAnn < listAnnotations.size(); ++idxAnn)
+				text.append(AnnotationReader::toText(listAnnotations[idxAnn]) + "\n");
+			const vector<GLubyte>& atlas = mSampler->getAtlas();
+			outputChecksum = RunManifest::crc32(atlas.data(), atlas.size(), outputChecksum);
+			for(unsigned int idxOut = 0; idxOut < outputAtlases.size(); ++idxOut)
+				outputChecksum = RunManifest::crc32((const unsigned char*)outputAtlases[idxOut].data.data(), outputAtlases[idxOut].data.size() * sizeof(unsigned short), outputChecksum);
+			outputChecksum = RunManifest::crc32((const unsigned char*)text.data(), text.size(), outputChecksum);
+			string key;
+			if(shardWriter.isOpen())
+			{
+				key = QDir(path.c_str()).dirName().toStdString();
+				key.append("/");
+				key.append(nameFile);
+			}
+
+			if(pipeline.isRunning())
+			{
+				// Encoded and written by the pipeline threads while the next samples render
+				SampleJob* job = pipeline.acquire();
+				job->isShard = shardWriter.isOpen();
+				job->path = job->isShard ? key : imgPath;
+				job->size = mSampler->getWindowSize();
+				job->atlas.assign(atlas.begin(), atlas.end());
+				job->outputs.resize(outputAtlases.size());
+				for(unsigned int idxOut = 0; idxOut < outputAtlases.size(); ++idxOut)
+				{
+					job->outputs[idxOut].type = outputAtlases[idxOut].type;
+					job->outputs[idxOut].data.assign(outputAtlases[idxOut].data.begin(), outputAtlases[idxOut].data.end());
+				}
+				job->annotations.swap(listAnnotations);
+				job->text.swap(text);
+				pipeline.submit(job);
+			}
+			else
 			{
+				// Store image with its samples (own file or shard member together with its annotations)
+				vector<unsigned char> png;
+				mSampler->encodeImg(png);
+				for(unsigned int idxOut = 0; idxOut < outputAtlases.size(); ++idxOut)
+					OutputEncoder::encode(outputAtlases[idxOut], mSampler->getWindowSize(), outputAtlases[idxOut].png);
+				TraceZone zoneWrite("write sample");
+				if(shardWriter.isOpen())
+				{
+					vector<ShardEntry> entries;
+					entries.push_back(ShardEntry("png"));
+					entries.back().data.swap(png);
+					for(unsigned int idxOut = 0; idxOut < outputAtlases.size(); ++idxOut)
+					{
+						entries.push_back(ShardEntry(OutputEncoder::getExt(outputAtlases[idxOut].type)));
+						entries.back().data.swap(outputAtlases[idxOut].png);
+					}
+					entries.push_back(ShardEntry("txt"));
+					entries.back().data.assign(text.begin(), text.end());
+					shardWriter.write(key, entries);
+				}
+				else
+				{
+					lodepng::save_file(png, imgPath);
+					for(unsigned int idxOut = 0; idxOut < outputAtlases.size(); ++idxOut)
+						lodepng::save_file(outputAtlases[idxOut].png, OutputEncoder::getPath(imgPath, outputAtlases[idxOut].type));
+				}
+
+				// Store annotations (binary store, see AnnotationReader::convertToText for the txt layout)
 				for(unsigned int idxAnn = 0; idxAnn < listAnnotations.size(); ++idxAnn)
-					annotationFile << listAnnotations[idxAnn] << endl;
-				listAnnotations.clear();
-				annotationFile.close();
+					annotationWriter.write(listAnnotations[idxAnn]);
 			}
+			listAnnotations.clear();
 		}
-		else
+		if(isWorker)
+		{
+			postPreviews();
+			emit renderedView();
+		}
+		else if(!toSave)
 		{
 			mSampler->makeCurrent();
 			mSampler->updateGL();
@@ -1473,15 +2115,11 @@ bool Render::createSamples(bool toSave, string& chosenPath)
 
 	makeCurrent();
 
-	// glDeleteRenderbuffers(1, &depthBuffer);
-	glDeleteTextures(1, &texSample);
-	glDeleteFramebuffers(1, &fboSample);
-
 	// Unbind usage of any other FBO rather than the default one
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-	timePreview = (float)clock() - (float)timePreview;
-	std::cout << "Time for " << 360.0f / mSampler->getAngleY() << " viewports of " 
+	timePreview = (Trace::now() - timePreview) / 1000.0;
+	std::cout << "Time for " << numViews << " viewports of " 
 	<< mSampler->getSizeSample() << " x " << mSampler->getSizeSample() << " pixels: " << timePreview << "ms" << endl;
 
 	isSampling = false;
@@ -1491,9 +2129,10 @@ bool Render::createSamples(bool toSave, string& chosenPath)
 
 void Render::saveAnnotations(std::string& imgName, int posSampleX, int posSampleY)
 {
+	TraceZone zone("annotations");
 	// Annotations scheme:
 	// IMGNAME ROW COL HEIGHT WIDTH AZIMUTH ELEVATION DISTANCE PART
-	std::stringstream annotationStr;
+	AnnotationRecord annotation;
 	for (unsigned int obj = 0; obj < listImgBB.size(); ++obj)
 	{
 		// General case (only 1 object in the scenario), although there should be only one
@@ -1501,7 +2140,8 @@ void Render::saveAnnotations(std::string& imgName, int posSampleX, int posSample
 			continue;
 
 		// Image name
-		annotationStr << imgName << ".png ";
+		annotation.image = imgName + ".png";
+		annotation.model = listModels[obj]->getFileName();
 
 		// Bounding box information
 		BB bb = listImgBB[obj];
@@ -1511,7 +2151,10 @@ void Render::saveAnnotations(std::string& imgName, int posSampleX, int posSample
 		height = ceil(bb.getSizeY() / heightRender * mSampler->getSizeSample());
 		left = bb.getX0() / widthRender * mSampler->getSizeSample() + posSampleX*mSampler->getSizeSample();
 		top = (mSampler->getNumSamples() - 1 - posSampleY)*mSampler->getSizeSample() + mSampler->getSizeSample() - (bb.getY0() / heightRender * mSampler->getSizeSample()) - height;
-		annotationStr << top << " " << left << " " << height << " " << width << " ";
+		annotation.top = top;
+		annotation.left = left;
+		annotation.height = height;
+		annotation.width = width;
 
 		// Azimuth, elevatin and distance
 		float azimuth, elevation, distance, tilt;
@@ -1519,7 +2162,10 @@ void Render::saveAnnotations(std::string& imgName, int posSampleX, int posSample
 		elevation = mSampler->getAngleX();
 		tilt = mSampler->getTilt();
 		distance = mSampler->getDistance();
-		annotationStr << azimuth << " " << elevation << " " << tilt << " " << distance<< " ";
+		annotation.azimuth = azimuth;
+		annotation.elevation = elevation;
+		annotation.tilt = tilt;
+		annotation.distance = distance;
 
 		// Keypoints
 		map<string, Kp> list_kps = getModel()->getKps();
@@ -1528,131 +2174,38 @@ void Render::saveAnnotations(std::string& imgName, int posSampleX, int posSample
 		vector<string> kps_vis(list_kps.size());
 		if (list_kps.size() > 0)
 		{
-			Kp kp;
+			// Order keypoints by their annotation position (single pass)
+			vector<KpsInstance> kps_inst(list_kps.size());
+			for (map<string, Kp>::iterator it = list_kps.begin(); it != list_kps.end(); ++it)
+			{
+				Kp& kp = it->second;
+				if (kp.pos < 0 || kp.pos >= (int)list_kps.size())
+					continue;
+				kps_names[kp.pos] = kp.name;
+				map<string, Kp>::iterator ball = model_kps.find(kp.name);
+				if (ball != model_kps.end())
+					kps_inst[kp.pos] = KpsInstance(ball->second.X, ball->second.Y, ball->second.Z, ball->second.Sx, ball->second.Sy, ball->second.Sz);
+			}
+
+			// Project and test all keypoints at once with the same MVP
+			glm::mat4 mvp = proj*view*computeKpsModel();
+			kpsEngine.project(mvp, kps_inst, (float)mSampler->getSizeSample());
+			if (!isKpsQuery)
+				kpsEngine.testVisibility(mvp, kps_inst, depth, widthRender, heightRender, isKpsSelfOcc);
 			for (unsigned int i = 0; i < list_kps.size(); ++i)
 			{
-				for (map<string, Kp>::iterator it = list_kps.begin(); it != list_kps.end(); ++it)
-				{
-					kp = it->second;
-					if (kp.pos == i)
-						break;
-				}
-				kps_names[i] = kp.name;
-				
-				// Project 3D points
-				kps_pos[i] = computeKpsProj(model_kps[kp.name]);
+				kps_pos[i] = kpsEngine.getProj(i);
 				// Check if already out of image resolution / truncated (-1) 
 				if (kps_pos[i].x < 0 || kps_pos[i].y < 0 || kps_pos[i].x > mSampler->getSizeSample() || kps_pos[i].y >mSampler->getSizeSample())		
 					kps_vis[i] = "-1";
-				// (1) visible (0) oocluded/truncated
-				else if (isKpsVisible(model_kps[kp.name]))
+				// (1) visible (0) oocluded/truncated, (?) from the queries of this frame once available
+				else if (isKpsQuery)
+					kps_vis[i] = "?";
+				else if (kpsEngine.isVisible(i))
 					kps_vis[i] = "1";
 				else
 					kps_vis[i] = "0";
 			}
-
-			// Update kps for Diningtable (Savarese et al Pascal3D annotation)
-			// - Most top left pxl = TopLeftFront (check)
-			if (kps_names.size() == 8 && kps_names[1] == "Top_Left_Back")
-			{
-				glm::vec3 aux_pos;
-				string aux_vis;
-				if (azimuth > 45 && azimuth <= 135)
-				{
-					// Top_Left_Front -> Top_Left_Back, Top_Left_Back -> Top_Right_Back, Top_Right_Back -> Top_Right_Front, Top_Right_Front -> Top_Left_Front
-					aux_pos = kps_pos[1];
-					kps_pos[1] = kps_pos[0];
-					kps_pos[0] = kps_pos[2];
-					kps_pos[2] = kps_pos[3];
-					kps_pos[3] = aux_pos;
-					aux_vis = kps_vis[1];
-					kps_vis[1] = kps_vis[0];
-					kps_vis[0] = kps_vis[2];
-					kps_vis[2] = kps_vis[3];
-					kps_vis[3] = aux_vis;
-
-					// -> Bottom
-					aux_pos = kps_pos[5];
-					kps_pos[5] = kps_pos[4];
-					kps_pos[4] = kps_pos[6];
-					kps_pos[6] = kps_pos[7];
-					kps_pos[7] = aux_pos;
-					aux_vis = kps_vis[5];
-					kps_vis[5] = kps_vis[4];
-					kps_vis[4] = kps_vis[6];
-					kps_vis[6] = kps_vis[7];
-					kps_vis[7] = aux_vis;
-				}
-				else if (azimuth > 135 && azimuth <= 225)
-				{
-					// Top_Left_Front -> Top_Right_Back, Top_Right_Back -> Top_Left_Front, Top_Left_Back -> Top_Right_Front, Top_Right_Front -> Top_Left_Back
-					aux_pos = kps_pos[3];
-					kps_pos[3] = kps_pos[0];
-					kps_pos[0] = aux_pos;
-					aux_pos = kps_pos[1];
-					kps_pos[1] = kps_pos[2];
-					kps_pos[2] = aux_pos;
-					aux_vis = kps_vis[3];
-					kps_vis[3] = kps_vis[0];
-					kps_vis[0] = aux_vis;
-					aux_vis = kps_vis[1];
-					kps_vis[1] = kps_vis[2];
-					kps_vis[2] = aux_vis;
-
-					// -> Bottom
-					aux_pos = kps_pos[7];
-					kps_pos[7] = kps_pos[4];
-					kps_pos[4] = aux_pos;
-					aux_pos = kps_pos[5];
-					kps_pos[5] = kps_pos[6];
-					kps_pos[6] = aux_pos;
-					aux_vis = kps_vis[7];
-					kps_vis[7] = kps_vis[4];
-					kps_vis[4] = aux_vis;
-					aux_vis = kps_vis[5];
-					kps_vis[5] = kps_vis[6];
-					kps_vis[6] = aux_vis;
-				}
-				else if (azimuth > 225 && azimuth <= 315)
-				{
-					// Top_Left_Front -> Top_Right_Front, Top_Right_Front -> Top_Right_Back, Top_Right_Back -> Top_Left_Back, Top_Left_Back -> Top_Left_Front
-					aux_pos = kps_pos[2];
-					kps_pos[2] = kps_pos[0];
-					kps_pos[0] = kps_pos[1];
-					kps_pos[1] = kps_pos[3];
-					kps_pos[3] = aux_pos;
-					aux_vis = kps_vis[2];
-					kps_vis[2] = kps_vis[0];
-					kps_vis[0] = kps_vis[1];
-					kps_vis[1] = kps_vis[3];
-					kps_vis[3] = aux_vis;
-
-					// -> Bottom
-					aux_pos = kps_pos[6];
-					kps_pos[6] = kps_pos[4];
-					kps_pos[4] = kps_pos[5];
-					kps_pos[5] = kps_pos[7];
-					kps_pos[7] = aux_pos;
-					aux_vis = kps_vis[6];
-					kps_vis[6] = kps_vis[4];
-					kps_vis[4] = kps_vis[5];
-					kps_vis[5] = kps_vis[7];
-					kps_vis[7] = aux_vis;
-				}
-
-			}
-	
-			// Update for Sail_Left and Sail_Right (boat)
-			if (list_kps.find("Mast_Top") != list_kps.end())
-				if ((kps_vis[9] == "1" || kps_vis[10] == "1") && kps_pos[9].x > kps_pos[10].x)
-				{
-					glm::vec3 aux_vec3 = kps_pos[9];
-					kps_pos[9] = kps_pos[10];
-					kps_pos[10] = aux_vec3;
-					string aux_vis = kps_vis[9];
-					kps_vis[9] = kps_vis[10];
-					kps_vis[10] = aux_vis;
-				}
 		}
 		// Make occluded those who are too close from regions that are closer to the camera
 		/*
@@ -1684,177 +2237,376 @@ void Render::saveAnnotations(std::string& imgName, int posSampleX, int posSample
 			kps_pos[i].y += (mSampler->getNumSamples() - 1 - posSampleY)*mSampler->getSizeSample();
 		}
 
-		// Matlab notation [1..size] and row,col
-		for (int i = 0; i < kps_names.size(); ++i)
-			annotationStr << kps_names[i] << " " << floor(kps_pos[i].y) + 1 << " " << floor(kps_pos[i].x) + 1 << " " << kps_vis[i] << " "; 
+		// Keypoints waiting for query results are ordered and stored by resolveKpsQueries
+		annotation.kps.clear();
+		if (find(kps_vis.begin(), kps_vis.end(), "?") != kps_vis.end())
+		{
+			KpsPending pending;
+			pending.annotation = listAnnotations.size();
+			pending.slot = 1 - kpsSlot;
+			pending.azimuth = azimuth;
+			pending.names = kps_names;
+			pending.pos = kps_pos;
+			pending.vis = kps_vis;
+			pendingKps.push_back(pending);
+		}
+		else
+		{
+			orderKps(kps_names, kps_pos, kps_vis, azimuth);
+			setKpsAnnotation(annotation, kps_names, kps_pos, kps_vis);
+		}
 
 		// Parts (not implemented yet)
 		// annotationStr << "All";
 
-		listAnnotations.push_back(annotationStr.str());
+		listAnnotations.push_back(annotation);
+	}
+}
+
+void Render::setKpsAnnotation(AnnotationRecord& annotation, const vector<string>& kps_names, const vector<glm::vec3>& kps_pos, const vector<string>& kps_vis)
+{
+	// Matlab notation [1..size] and row,col
+	annotation.kps.clear();
+	for (unsigned int i = 0; i < kps_names.size(); ++i)
+		annotation.kps.push_back(KpsAnnotation(kps_names[i], floor(kps_pos[i].y) + 1, floor(kps_pos[i].x) + 1, atoi(kps_vis[i].c_str())));
+}
+
+void Render::orderKps(const vector<string>& kps_names, vector<glm::vec3>& kps_pos, vector<string>& kps_vis, float azimuth)
+{
+	// Update kps for Diningtable (Savarese et al Pascal3D annotation)
+	// - Most top left pxl = TopLeftFront (check)
+	if (kps_names.size() == 8 && kps_names[1] == "Top_Left_Back")
+	{
+		glm::vec3 aux_pos;
+		string aux_vis;
+		if (azimuth > 45 && azimuth <= 135)
+		{
+			// Top_Left_Front -> Top_Left_Back, Top_Left_Back -> Top_Right_Back, Top_Right_Back -> Top_Right_Front, Top_Right_Front -> Top_Left_Front
+			aux_pos = kps_pos[1];
+			kps_pos[1] = kps_pos[0];
+			kps_pos[0] = kps_pos[2];
+			kps_pos[2] = kps_pos[3];
+			kps_pos[3] = aux_pos;
+			aux_vis = kps_vis[1];
+			kps_vis[1] = kps_vis[0];
+			kps_vis[0] = kps_vis[2];
+			kps_vis[2] = kps_vis[3];
+			kps_vis[3] = aux_vis;
+
+			// -> Bottom
+			aux_pos = kps_pos[5];
+			kps_pos[5] = kps_pos[4];
+			kps_pos[4] = kps_pos[6];
+			kps_pos[6] = kps_pos[7];
+			kps_pos[7] = aux_pos;
+			aux_vis = kps_vis[5];
+			kps_vis[5] = kps_vis[4];
+			kps_vis[4] = kps_vis[6];
+			kps_vis[6] = kps_vis[7];
+			kps_vis[7] = aux_vis;
+		}
+		else if (azimuth > 135 && azimuth <= 225)
+		{
+			// Top_Left_Front -> Top_Right_Back, Top_Right_Back -> Top_Left_Front, Top_Left_Back -> Top_Right_Front, Top_Right_Front -> Top_Left_Back
+			aux_pos = kps_pos[3];
+			kps_pos[3] = kps_pos[0];
+			kps_pos[0] = aux_pos;
+			aux_pos = kps_pos[1];
+			kps_pos[1] = kps_pos[2];
+			kps_pos[2] = aux_pos;
+			aux_vis = kps_vis[3];
+			kps_vis[3] = kps_vis[0];
+			kps_vis[0] = aux_vis;
+			aux_vis = kps_vis[1];
+			kps_vis[1] = kps_vis[2];
+			kps_vis[2] = aux_vis;
+
+			// -> Bottom
+			aux_pos = kps_pos[7];
+			kps_pos[7] = kps_pos[4];
+			kps_pos[4] = aux_pos;
+			aux_pos = kps_pos[5];
+			kps_pos[5] = kps_pos[6];
+			kps_pos[6] = aux_pos;
+			aux_vis = kps_vis[7];
+			kps_vis[7] = kps_vis[4];
+			kps_vis[4] = aux_vis;
+			aux_vis = kps_vis[5];
+			kps_vis[5] = kps_vis[6];
+			kps_vis[6] = aux_vis;
+		}
+		else if (azimuth > 225 && azimuth <= 315)
+		{
+			// Top_Left_Front -> Top_Right_Front, Top_Right_Front -> Top_Right_Back, Top_Right_Back -> Top_Left_Back, Top_Left_Back -> Top_Left_Front
+			aux_pos = kps_pos[2];
+			kps_pos[2] = kps_pos[0];
+			kps_pos[0] = kps_pos[1];
+			kps_pos[1] = kps_pos[3];
+			kps_pos[3] = aux_pos;
+			aux_vis = kps_vis[2];
+			kps_vis[2] = kps_vis[0];
+			kps_vis[0] = kps_vis[1];
+			kps_vis[1] = kps_vis[3];
+			kps_vis[3] = aux_vis;
+
+			// -> Bottom
+			aux_pos = kps_pos[6];
+			kps_pos[6] = kps_pos[4];
+			kps_pos[4] = kps_pos[5];
+			kps_pos[5] = kps_pos[7];
+			kps_pos[7] = aux_pos;
+			aux_vis = kps_vis[6];
+			kps_vis[6] = kps_vis[4];
+			kps_vis[4] = kps_vis[5];
+			kps_vis[5] = kps_vis[7];
+			kps_vis[7] = aux_vis;
+		}
+
 	}
+	
+	// Update for Sail_Left and Sail_Right (boat)
+	if (find(kps_names.begin(), kps_names.end(), "Mast_Top") != kps_names.end())
+		if ((kps_vis[9] == "1" || kps_vis[10] == "1") && kps_pos[9].x > kps_pos[10].x)
+		{
+			glm::vec3 aux_vec3 = kps_pos[9];
+			kps_pos[9] = kps_pos[10];
+			kps_pos[10] = aux_vec3;
+			string aux_vis = kps_vis[9];
+			kps_vis[9] = kps_vis[10];
+			kps_vis[10] = aux_vis;
+		}
 }
 
 void Render::createKp(Kp kp)
 {
-	delete model_kps[kp.name];
-	model_kps[kp.name] = createObj("Sphere", programShaders[TYPE_SHADER::PHONG], 0.75f, 0.0f, 0.0f);
-	model_kps[kp.name]->setDrawType(DRAW_TYPE::LINES);
-	model_kps[kp.name]->setTranslation(kp.X, kp.Y, kp.Z);
-	model_kps[kp.name]->setScaling(kp.Sx, kp.Sy, kp.Sz);
+	model_kps[kp.name] = kp;
+	isKpsDirty = true;
 }
 
 void Render::destroyKp(std::string id)
 {
-	delete model_kps[id];
 	model_kps.erase(id);
+	isKpsDirty = true;
+
+	map<string, KpsQuery>::iterator it = kpsQueries.find(id);
+	if (it != kpsQueries.end())
+	{
+		deleteKpsQuery(it->second);
+		kpsQueries.erase(it);
+	}
+}
+
+void Render::resetKps()
+{
+	if(!listModels.empty())
+		getModel()->setKps(map<string, Kp>());
+	while(!model_kps.empty())
+		destroyKp(model_kps.begin()->first);
 }
 
 void Render::drawActiveKps(string id)
 {
-	float r = 0.75f;
-	float g = 0.0f;
-	float b = 0.0f;
-	for (map<string, Model*>::iterator it = model_kps.begin(); it != model_kps.end(); ++it)
-	{
-		Model* ball = it->second;
-		for (unsigned int i = 0; i < ball->getVisualEntity(0).getListVertices().size(); ++i)
-			ball->getVisualEntity(0).getListVertices()[i].setColour(r, g, b, 1.0f);
-		ball->updateMeshes();
-		ball->updateBB();
-		ball->attachTexture(emptyTex);
-	}
-	Model* ball = model_kps[id];
-	g = 0.75f;
-	for (unsigned int i = 0; i < ball->getVisualEntity(0).getListVertices().size(); ++i)
-		ball->getVisualEntity(0).getListVertices()[i].setColour(r, g, b, 1.0f);
-	ball->updateMeshes();
-	ball->updateBB();
-	ball->attachTexture(emptyTex);
+	// Only the instance colours change
+	activeKp = id;
+	isKpsDirty = true;
 }
 
 void Render::updateKpsX(string id, float X)
 {
-	Model* ball = model_kps[id];
-	ball->setTranslationX(X);
+	model_kps[id].X = X;
+	isKpsDirty = true;
 }
 void Render::updateKpsY(string id, float Y)
 {
-	Model* ball = model_kps[id];
-	ball->setTranslationY(Y);
+	model_kps[id].Y = Y;
+	isKpsDirty = true;
 }
 void Render::updateKpsZ(string id, float Z)
 {
-	Model* ball = model_kps[id];
-	ball->setTranslationZ(Z);
+	model_kps[id].Z = Z;
+	isKpsDirty = true;
 }
 
 void Render::updateKpsSx(std::string id, float Sx)
 {
-	Model* ball = model_kps[id];
-	ball->setSx(Sx);
+	model_kps[id].Sx = Sx;
+	isKpsDirty = true;
 }
 void Render::updateKpsSy(std::string id, float Sy)
 {
-	Model* ball = model_kps[id];
-	ball->setSy(Sy);
+	model_kps[id].Sy = Sy;
+	isKpsDirty = true;
 }
 void Render::updateKpsSz(std::string id, float Sz)
 {
-	Model* ball = model_kps[id];
-	ball->setSz(Sz);
+	model_kps[id].Sz = Sz;
+	isKpsDirty = true;
 }
 
-glm::vec3 Render::computeKpsProj(Model* currentKp)
+void Render::updateKpsInstances()
 {
-	model = glm::mat4();
-	model = glm::translate(model, glm::vec3(0.0f, 0.0f, cam.fixedPos.z - mSampler->getDistance()));
-	model = glm::rotate(model, (float)mSampler->getAngleX(), glm::vec3(1.0f, 0.0f, 0.0f));
-	model = glm::rotate(model, -(float)mSampler->getCurrentAngleY(), glm::vec3(0.0f, 1.0f, 0.0f));
-	model = glm::scale(model, glm::vec3(getModel()->getSX(), getModel()->getSY(), getModel()->getSZ()));
+	if (!isKpsDirty)
+		return;
+
+	// Per instance: position (centre of the sphere removed), scale and colour (active one in yellow)
+	float* centre = kpsSphere->getBB().getCenter();
+	vector<float> instances;
+	instances.reserve(model_kps.size() * 10);
+	for (map<string, Kp>::iterator it = model_kps.begin(); it != model_kps.end(); ++it)
+	{
+		Kp& kp = it->second;
+		instances.push_back(kp.X - kp.Sx*centre[0]);
+		instances.push_back(kp.Y - kp.Sy*centre[1]);
+		instances.push_back(kp.Z - kp.Sz*centre[2]);
+		instances.push_back(kp.Sx);
+		instances.push_back(kp.Sy);
+		instances.push_back(kp.Sz);
+		instances.push_back(0.75f);
+		instances.push_back(it->first == activeKp ? 0.75f : 0.0f);
+		instances.push_back(0.0f);
+		instances.push_back(1.0f);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, vboKps);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(float)*instances.size(), instances.data(), GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	isKpsDirty = false;
+}
+
+glm::mat4 Render::computeKpsModel()
+{
+	// Object transform shared by all keypoints of the current sample
+	glm::mat4 kpsModel;
+	kpsModel = glm::translate(kpsModel, glm::vec3(0.0f, 0.0f, cam.fixedPos.z - mSampler->getDistance()));
+	kpsModel = glm::rotate(kpsModel, (float)mSampler->getAngleX(), glm::vec3(1.0f, 0.0f, 0.0f));
+	kpsModel = glm::rotate(kpsModel, -(float)mSampler->getCurrentAngleY(), glm::vec3(0.0f, 1.0f, 0.0f));
+	kpsModel = glm::scale(kpsModel, glm::vec3(getModel()->getSX(), getModel()->getSY(), getModel()->getSZ()));
 	if (!isKpsAz)
 	{
-		model = glm::rotate(model, (float)mSampler->getCurrentAngleY(), glm::vec3(0.0f, 1.0f, 0.0f));
+		kpsModel = glm::rotate(kpsModel, (float)mSampler->getCurrentAngleY(), glm::vec3(0.0f, 1.0f, 0.0f));
 	}
-	model = glm::translate(model, glm::vec3(currentKp->getTX(), currentKp->getTY(), currentKp->getTZ()));
-	glm::vec4 proj2D = proj*view*model * glm::vec4(0.0f, 0.0f, 0.0f, 1);
-	float transPxl = (float)mSampler->getSizeSample() / 2.0f;
-	glm::vec3 p2d(proj2D.x / proj2D.w * transPxl + transPxl, -1*proj2D.y / proj2D.w * transPxl + transPxl, proj2D.z);
-	return p2d;
+	return kpsModel;
 }
 
-bool Render::isKpsVisible(Model* currentKp)
+void Render::queryKps()
 {
-	float transPxl = widthRender / 2.0f;
+	TraceGpuZone gpuZone("keypoint queries");
+	// Frames still pending in the slot about to be reused are completed first
+	resolveKpsQueries(false);
+	if (model_kps.empty())
+		return;
+	updateKpsInstances();
+
+	currentShader = kpsSphere->getShader();
+	glUseProgram(currentShader);
+	updateViewMatrix();
+	updateProjectionMatrix();
+	model = computeKpsModel();
+	GLint uniModel = glGetUniformLocation(currentShader, "model");
+	glUniformMatrix4fv(uniModel, 1, GL_FALSE, glm::value_ptr(model));
 
-	// Visualisation code (leave it for future plots)
-	/*
-	vector<float> depthObj(widthRender*heightRender, 0);
-	vector<GLubyte> depthObj_png(4 * widthRender*heightRender, 0);
-	vector<GLubyte> depthObj_png_(4 * widthRender*heightRender, 0);
-	vector<GLubyte> depthObj_png2(4 * widthRender*heightRender, 0);
-	vector<GLubyte> depthObj_png2_(4 * widthRender*heightRender, 0);
-	string path_raw = "Z:/depth.png";
-	string path_raw2 = "Z:/depth2.png";
-	for (int i = 0; i < depth.size(); ++i)
-	{
-		depthObj_png[i] = floor(depth[i] * 255.0);
-		depthObj_png2[i] = floor(depthKps[i] * 255.0);
-	}
-	for (int col = 0; col < 4 * heightRender; col += 4)
-		for (int row = 0; row < heightRender; row += 1)
+	// Proxy spheres only take part in the depth test (nothing is written)
+	DRAW_TYPE saveDrawType = kpsSphere->getDrawType();
+	kpsSphere->setDrawType(DRAW_TYPE::SOLID);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthMask(GL_FALSE);
+	glEnable(GL_DEPTH_TEST);
+	unsigned int instance = 0;
+	for (map<string, Kp>::iterator it = model_kps.begin(); it != model_kps.end(); ++it, ++instance)
+	{
+		KpsQuery& query = kpsQueries[it->first];
+		if (query.total[0] == 0)
 		{
-			depthObj_png_[row * 4 * heightRender + col + 0] = depthObj_png[(heightRender - 1 - row) * 4 * heightRender + col + 0];
-			depthObj_png_[row * 4 * heightRender + col + 1] = depthObj_png[(heightRender - 1 - row) * 4 * heightRender + col + 1];
-			depthObj_png_[row * 4 * heightRender + col + 2] = depthObj_png[(heightRender - 1 - row) * 4 * heightRender + col + 2];
-			depthObj_png_[row * 4 * heightRender + col + 3] = depthObj_png[(heightRender - 1 - row) * 4 * heightRender + col + 3];
-			depthObj_png2_[row * 4 * heightRender + col + 0] = depthObj_png2[(heightRender - 1 - row) * 4 * heightRender + col + 0];
-			depthObj_png2_[row * 4 * heightRender + col + 1] = depthObj_png2[(heightRender - 1 - row) * 4 * heightRender + col + 1];
-			depthObj_png2_[row * 4 * heightRender + col + 2] = depthObj_png2[(heightRender - 1 - row) * 4 * heightRender + col + 2];
-			depthObj_png2_[row * 4 * heightRender + col + 3] = depthObj_png2[(heightRender - 1 - row) * 4 * heightRender + col + 3];
+			glGenQueries(2, query.total);
+			glGenQueries(2, query.onObject);
+			glGenQueries(2, query.front);
 		}
-	lodepng::encode(path_raw.c_str(), depthObj_png_.data(), heightRender, widthRender);
-	lodepng::encode(path_raw2.c_str(), depthObj_png2_.data(), heightRender, widthRender);
-	*/
 
-	model = glm::mat4();
-	model = glm::translate(model, glm::vec3(0.0f, 0.0f, cam.fixedPos.z - mSampler->getDistance()));
-	model = glm::rotate(model, (float)mSampler->getAngleX(), glm::vec3(1.0f, 0.0f, 0.0f));
-	model = glm::rotate(model, -(float)mSampler->getCurrentAngleY(), glm::vec3(0.0f, 1.0f, 0.0f));
-	model = glm::scale(model, glm::vec3(getModel()->getSX(), getModel()->getSY(), getModel()->getSZ()));
-	if (!isKpsAz)
-	{
-		model = glm::rotate(model, (float)mSampler->getCurrentAngleY(), glm::vec3(0.0f, 1.0f, 0.0f));
+		// - All samples covered by the sphere
+		glDepthFunc(GL_ALWAYS);
+		glBeginQuery(GL_SAMPLES_PASSED, query.total[kpsSlot]);
+		kpsSphere->renderInstanced(1, instance);
+		glEndQuery(GL_SAMPLES_PASSED);
+
+		// - Samples on top of the object: sphere pushed to the far plane (the background keeps the cleared depth)
+		glDepthFunc(GL_GREATER);
+		glDepthRange(1.0, 1.0);
+		glBeginQuery(GL_SAMPLES_PASSED, query.onObject[kpsSlot]);
+		kpsSphere->renderInstanced(1, instance);
+		glEndQuery(GL_SAMPLES_PASSED);
+		glDepthRange(0.0, 1.0);
+
+		// - Samples in front of the scene (object or background)
+		glDepthFunc(GL_LESS);
+		glBeginQuery(GL_SAMPLES_PASSED, query.front[kpsSlot]);
+		kpsSphere->renderInstanced(1, instance);
+		glEndQuery(GL_SAMPLES_PASSED);
 	}
-	model = glm::translate(model, glm::vec3(currentKp->getTX(), currentKp->getTY(), currentKp->getTZ()));
-	model = glm::scale(model, glm::vec3(currentKp->getSX(), currentKp->getSY(), currentKp->getSZ()));
-	float* centre = currentKp->getBB().getCenter();
-	model = glm::translate(model, glm::vec3(-centre[0], -centre[1], -centre[2]));
-	vector<Vertex> list_vertex = currentKp->getListAllVertices();
-	int numOk = 0;
-	for (unsigned int i = 0; i < list_vertex.size(); ++i)
-	{
-		// Vertex v = list_vertex[rand() % list_vertex.size()];
-		Vertex v = list_vertex[i];
-		float* coord = v.getPosition();
-		glm::vec4 proj2D = proj*view*model * glm ::vec4(coord[0], coord[1], coord[2], 1);
-		glm::vec2 p2d(proj2D.x / proj2D.w * transPxl + transPxl, proj2D.y / proj2D.w * transPxl + transPxl);
-		// Check if at least 1 projection is visible
-		int row = floor(p2d.y);
-		int col = floor(p2d.x);
-		unsigned int idx = 4*(row*widthRender + col);
-		if (idx < 1 || idx >= 4 * (widthRender*widthRender))
+	glDepthFunc(GL_LESS);
+	glDepthMask(GL_TRUE);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	kpsSphere->setDrawType(saveDrawType);
+	kpsSlot = 1 - kpsSlot;
+}
+
+void Render::deleteKpsQuery(KpsQuery& query)
+{
+	glDeleteQueries(2, query.total);
+	glDeleteQueries(2, query.onObject);
+	glDeleteQueries(2, query.front);
+}
+
+bool Render::isKpsQueryAvailable(const KpsPending& pending)
+{
+	for (unsigned int i = 0; i < pending.names.size(); ++i)
+	{
+		map<string, KpsQuery>::iterator it = kpsQueries.find(pending.names[i]);
+		if (pending.vis[i] != "?" || it == kpsQueries.end() || it->second.total[0] == 0)
 			continue;
-		float valueDepth = depth[idx];
-		float valueDepthAlpha = depth[idx + 3];
-		float valueV = 1.0f - min(1.0f, proj2D.z / 10.0f);
-		// float valueV = depthKps[idx];
-		// float valueVAlpha = depth[idx + 3];
-		// NOTE: 0.000006 is 32F precision error (try without adding anything "valueV + 00000006")		
-		if ((!isKpsSelfOcc && valueDepthAlpha > 0.66f) || (valueV > valueDepth && valueDepth != 0 && valueDepthAlpha > 0.66f)) // && abs(valueV - valueDepth) < 0.01) //  && valueVAlpha == 1.0f)
-			numOk++;
+		GLuint ids[3] = { it->second.total[pending.slot], it->second.onObject[pending.slot], it->second.front[pending.slot] };
+		for (unsigned int q = 0; q < 3; ++q)
+		{
+			GLuint isAvailable = GL_FALSE;
+			glGetQueryObjectuiv(ids[q], GL_QUERY_RESULT_AVAILABLE, &isAvailable);
+			if (isAvailable == GL_FALSE)
+				return false;
+		}
 	}
-	if (numOk > list_vertex.size()*0.025) // Only if more than 1% of vertices are visible
-		return true;
-	return false;
+	return true;
+}
+
+void Render::resolveKpsQueries(bool isFlush)
+{
+	// Oldest frames first, waiting only for a slot about to be reused (or on flush)
+	while (!pendingKps.empty())
+	{
+		KpsPending& pending = pendingKps.front();
+		if (!isFlush && pending.slot != kpsSlot && !isKpsQueryAvailable(pending))
+			break;
+		for (unsigned int i = 0; i < pending.vis.size(); ++i)
+			if (pending.vis[i] == "?")
+				pending.vis[i] = isKpsQueryVisible(pending.names[i], pending.slot) ? "1" : "0";
+		orderKps(pending.names, pending.pos, pending.vis, pending.azimuth);
+		setKpsAnnotation(listAnnotations[pending.annotation], pending.names, pending.pos, pending.vis);
+		pendingKps.pop_front();
+	}
+}
+
+bool Render::isKpsQueryVisible(const std::string& name, unsigned int slot)
+{
+	map<string, KpsQuery>::iterator it = kpsQueries.find(name);
+	if (it == kpsQueries.end() || it->second.total[0] == 0)
+		return false;
+
+	GLuint total = 0, onObject = 0, front = 0;
+	glGetQueryObjectuiv(it->second.total[slot], GL_QUERY_RESULT, &total);
+	glGetQueryObjectuiv(it->second.onObject[slot], GL_QUERY_RESULT, &onObject);
+	glGetQueryObjectuiv(it->second.front[slot], GL_QUERY_RESULT, &front);
+
+	// Samples must lie on the object, the per sample form of the CPU coverage > 0.66 (edge pixels count their covered samples).
+	// Every background sample is in front, so with self-occlusion they are taken out of the front ones.
+	GLuint background = total - min(total, onObject);
+	GLuint passed = isKpsSelfOcc ? front - min(front, background) : onObject;
+
+	// Same criterion as the CPU test: more than 2.5% of the sphere passes
+	return total > 0 && passed > total*0.025f;
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include <iostream>
 #include <time.h>
+#include <cstring>
 #include <QFile>
 #include <QPainter>
 
@@ -12,12 +13,17 @@
 #include "lodepng.h"
 
 #include "rendering/Sampler.hpp"
+#include "rendering/Trace.hpp"
+#include "rendering/ShaderCache.hpp"
 
 using namespace std;
 
 Sampler::Sampler(QWidget *parent, const QGLFormat &format) : QGLWidget(format, parent)
 {
-
+	texCapacity = 0;
+	previewSize = 0;
+	isDeferredUpload = false;
+	viewsPerTurn = 0;
 }
 
 Sampler::~Sampler()
@@ -68,6 +74,12 @@ void Sampler::resizeGL(int width, int height)
 
 void Sampler::paintGL()
 {
+	// Preview of another thread: only its own copy is read, not the atlas state being updated by the run
+	if(!previewAtlas.isNull())
+	{
+		uploadTexture(previewAtlas.constBits(), previewSize);
+		previewAtlas = QImage();
+	}
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
 	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
@@ -82,17 +94,31 @@ void Sampler::loadShader()
 	vertexFile.open(QIODevice::ReadOnly | QIODevice::Text);
 	QByteArray vertexData = vertexFile.readAll();
 	vertexFile.close();
-	const GLchar* vertexSource = vertexData.data();
-	string str = vertexSource;
-	GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vertexShader, 1, &vertexSource, NULL);
-	glCompileShader(vertexShader);
 
 	// - Fragment Shader
 	fragmentFile.setFileName(":/shaders/base.frag");
 	fragmentFile.open(QIODevice::ReadOnly | QIODevice::Text);
 	QByteArray fragmentData = fragmentFile.readAll();
 	fragmentFile.close();
+
+	// Binary of a previous run (shared by both sampler widgets and the workers)
+	string cacheKey;
+	if(ShaderCache::isEnabled())
+	{
+		cacheKey = ShaderCache::getKey(vertexData.constData(), fragmentData.constData(), "sampler outColour");
+		mShader = ShaderCache::load(cacheKey);
+		if(mShader != 0)
+		{
+			glUseProgram(mShader);
+			return;
+		}
+	}
+
+	const GLchar* vertexSource = vertexData.data();
+	GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(vertexShader, 1, &vertexSource, NULL);
+	glCompileShader(vertexShader);
+
 	const GLchar* fragmentSource = fragmentData.data();
 	GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
 	glShaderSource(fragmentShader, 1, &fragmentSource, NULL);
@@ -113,8 +139,13 @@ void Sampler::loadShader()
 	glBindAttribLocation(mShader, 2, "texcoord");
 	glBindFragDataLocation(mShader, 0, "outColour");
 
+	ShaderCache::prepare(mShader);
 	glLinkProgram(mShader);
 	glUseProgram(mShader);
+	GLint statusLink;
+	glGetProgramiv(mShader, GL_LINK_STATUS, &statusLink);
+	if(!cacheKey.empty() && statusLink == GL_TRUE)
+		ShaderCache::save(cacheKey, mShader);
 	
 	glDeleteShader(vertexShader);
 	glDeleteShader(fragmentShader);
@@ -134,8 +165,39 @@ void Sampler::loadSampler()
 
 void Sampler::defineCleanTexture()
 {
-	vector<GLuint> emptyTextureTemplate(windowSize*windowSize, 0);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, windowSize, windowSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, emptyTextureTemplate.data());
+	arrayTex.assign(windowSize*windowSize*4, 0);
+	if(!isDeferredUpload)
+		uploadTexture(arrayTex.data(), windowSize);
+}
+
+void Sampler::uploadTexture(const GLubyte* data, int size)
+{
+	// The preview texture is only reallocated when the atlas outgrows it
+	int capacity = (size + 31) / 32 * 32;
+	if(capacity > texCapacity)
+	{
+		texCapacity = capacity;
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, texCapacity, texCapacity, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	}
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, size, size, GL_RGBA, GL_UNSIGNED_BYTE, data);
+	float scale = (float)size / texCapacity;
+	glUniform2f(glGetUniformLocation(mShader, "texScale"), scale, scale);
+}
+
+void Sampler::showAtlas(const QImage& atlas, int size)
+{
+	if(atlas.isNull() || atlas.width() != size || atlas.height() != size)
+		return;
+	previewAtlas = atlas;
+	previewSize = size;
+	updateGL();
+}
+
+QImage Sampler::getAtlasImage()
+{
+	if(arrayTex.size() != (unsigned int)(windowSize*windowSize*4))
+		return QImage();
+	return QImage(arrayTex.data(), windowSize, windowSize, QImage::Format_RGBA8888).copy();
 }
 
 void Sampler::createQuad()
@@ -174,6 +236,16 @@ void Sampler::createQuad()
 
 void Sampler::transferViewportImg(GLubyte* viewportImg, int x, int y)
 {
+	TraceZone zone("atlas transfer");
+	// Atlas copy (images are encoded from it)
+	if(arrayTex.size() != (unsigned int)(windowSize*windowSize*4))
+		arrayTex.assign(windowSize*windowSize*4, 0);
+	for(int row = 0; row < sizeSample; ++row)
+		memcpy(&arrayTex[((y*sizeSample + row)*windowSize + x*sizeSample)*4], viewportImg + row*sizeSample*4, sizeSample*4);
+
+	if(isDeferredUpload)
+		return;
+
 	// First of all, context need to be activated to render in this window
 	makeCurrent();
 	// Redefine an already existing 2D texture only in the specified subregion
@@ -209,34 +281,36 @@ void Sampler::transferViewportDepth(GLubyte* viewportDepth)
 
 void Sampler::saveToImg(string& imgPath)
 {
-	makeCurrent();
-	updateGL();
-	updateGL();
+	vector<unsigned char> png;
+	encodeImg(png);
+	lodepng::save_file(png, imgPath);
+}
 
-	// Get texture information with transparency (glReadPixels does not provide transparency but background colour)
-	vector<GLubyte> texDataRGBA(windowSize*windowSize*4);
+void Sampler::encodeImg(vector<unsigned char>& png)
+{
+	TraceZone zone("png encode");
+	// Atlas from the CPU copy with transparency, no read back of the window (which would need its size to match the atlas)
+	// Rows are stored bottom-up (OpenGL) and images are top-down
 	vector<GLubyte> revTexDataRGBA(windowSize*windowSize*4);
-	glReadPixels(0, 0, windowSize, windowSize, GL_RGBA, GL_UNSIGNED_BYTE, texDataRGBA.data());
-	//glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, texDataRGBA.data());
+	flipRows(arrayTex.data(), revTexDataRGBA.data(), 4*windowSize, windowSize);
 
-	for(int col = 0; col < 4*windowSize; col += 4)
-		for(int row = 0; row < windowSize; row += 1)
-		{
-			revTexDataRGBA[row*4*windowSize + col + 0] = texDataRGBA[(windowSize-1 - row)*4*windowSize + col + 0];
-			revTexDataRGBA[row*4*windowSize + col + 1] = texDataRGBA[(windowSize-1 - row)*4*windowSize + col + 1];
-			revTexDataRGBA[row*4*windowSize + col + 2] = texDataRGBA[(windowSize-1 - row)*4*windowSize + col + 2];
-			revTexDataRGBA[row*4*windowSize + col + 3] = texDataRGBA[(windowSize-1 - row)*4*windowSize + col + 3];
-		}
+	// PNG in memory (written to a file or appended to a shard)
+	png.clear();
+	lodepng::encode(png, revTexDataRGBA.data(), windowSize, windowSize);
+}
 
-	lodepng::encode(imgPath.c_str(), revTexDataRGBA.data(), windowSize, windowSize);
+void Sampler::flipRows(const GLubyte* src, GLubyte* dst, int rowBytes, int numRows)
+{
+	for(int row = 0; row < numRows; ++row)
+		memcpy(&dst[row*rowBytes], &src[(numRows-1 - row)*rowBytes], rowBytes);
 }
 
 void Sampler::updateTexture()
 {
+	// No relayout of the window: the preview shows the atlas scaled to it
 	windowSize = sizeSample*numSamples;
-	loadSampler();
-	parentWidget()->setFixedWidth(windowSize);
-	parentWidget()->setFixedHeight(windowSize);
-	updateGL();
+	if(!isDeferredUpload)
+		makeCurrent();
+	defineCleanTexture();
 }
 
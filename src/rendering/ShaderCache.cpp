@@ -0,0 +1,150 @@
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+#include <cstdio>
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QThread>
+
+#include "rendering/ShaderCache.hpp"
+
+using namespace std;
+
+static const char* CACHE_HEADER = "PROGRAMBINARY\t1";
+
+string ShaderCache::dir;
+
+void ShaderCache::setDir(const string& path)
+{
+	dir = path;
+	if(!dir.empty() && !QDir().mkpath(dir.c_str()))
+	{
+		cout << "Shader cache: cannot create " << dir << " (programs are compiled every run)" << endl;
+		dir.clear();
+	}
+}
+
+string ShaderCache::getKey(const string& vertexSource, const string& fragmentSource, const string& linkInfo)
+{
+	// FNV-1a (64 bits) of everything the binary depends on, fields separated by a 0 byte
+	string fields[4] = { vertexSource, fragmentSource, linkInfo, getDriver() };
+	unsigned long long hash = 14695981039346656037ULL;
+	for(unsigned int i = 0; i < 4; ++i)
+		for(unsigned int c = 0; c <= fields[i].size(); ++c)
+		{
+			hash ^= c < fields[i].size() ? (unsigned char)fields[i][c] : 0;
+			hash *= 1099511628211ULL;
+		}
+
+	stringstream key;
+	key << hex << setw(16) << setfill('0') << hash;
+	return key.str();
+}
+
+GLuint ShaderCache::load(const string& key)
+{
+	if(!isEnabled() || !isSupported())
+		return 0;
+	ifstream file(getPath(key).c_str(), ios::binary);
+	if(!file.is_open())
+		return 0;
+
+	// Header, driver that produced the binary, format and size
+	string header, driver;
+	GLenum format = 0;
+	unsigned int length = 0;
+	getline(file, header);
+	getline(file, driver);
+	file >> format >> length;
+	file.get();
+	if(!file || header != CACHE_HEADER || driver != getDriver() || length == 0)
+		return 0;
+	vector<char> binary(length);
+	file.read(binary.data(), length);
+	if((unsigned int)file.gcount() != length)
+		return 0;
+
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, format, binary.data(), length);
+	GLint status = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if(status != GL_TRUE)
+	{
+		glDeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
+
+void ShaderCache::prepare(GLuint program)
+{
+	if(isEnabled() && isSupported())
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+}
+
+bool ShaderCache::save(const string& key, GLuint program)
+{
+	if(!isEnabled() || !isSupported())
+		return false;
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if(length <= 0)
+		return false;
+	vector<char> binary(length);
+	GLsizei written = 0;
+	GLenum format = 0;
+	glGetProgramBinary(program, length, &written, &format, binary.data());
+	if(written <= 0)
+		return false;
+
+	// Temporary name per process and thread, then renamed over the previous file (if any)
+	string path = getPath(key);
+	stringstream tmpPath;
+	tmpPath << path << "." << QCoreApplication::applicationPid() << "-" << QThread::currentThreadId() << ".tmp";
+	ofstream file(tmpPath.str().c_str(), ios::binary);
+	file << CACHE_HEADER << "\n" << getDriver() << "\n" << format << " " << written << "\n";
+	file.write(binary.data(), written);
+	file.close();
+	if(!file)
+	{
+		remove(tmpPath.str().c_str());
+		return false;
+	}
+	if(rename(tmpPath.str().c_str(), path.c_str()) != 0)
+	{
+		remove(path.c_str());
+		if(rename(tmpPath.str().c_str(), path.c_str()) != 0)
+		{
+			remove(tmpPath.str().c_str());
+			return false;
+		}
+	}
+	return true;
+}
+
+bool ShaderCache::isSupported()
+{
+	if(!GLEW_VERSION_4_1 && !GLEW_ARB_get_program_binary)
+		return false;
+	GLint numFormats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+	return numFormats > 0;
+}
+
+string ShaderCache::getDriver()
+{
+	const char* strings[4] = { (const char*)glGetString(GL_VENDOR), (const char*)glGetString(GL_RENDERER),
+		(const char*)glGetString(GL_VERSION), (const char*)glGetString(GL_SHADING_LANGUAGE_VERSION) };
+	string driver;
+	for(unsigned int i = 0; i < 4; ++i)
+	{
+		if(i > 0)
+			driver.append(" | ");
+		if(strings[i] != NULL)
+			driver.append(strings[i]);
+	}
+	return driver;
+}
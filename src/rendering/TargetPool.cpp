@@ -0,0 +1,45 @@
+#include <iostream>
+
+#include "rendering/TargetPool.hpp"
+
+using namespace std;
+
+TargetPool::TargetPool(GLenum pInternalFormat, int pBucket, GLenum pFormat, GLenum pType) : internalFormat(pInternalFormat), format(pFormat), type(pType), bucket(pBucket)
+{
+}
+
+RenderTarget& TargetPool::acquire(int width, int height)
+{
+	pair<int, int> key(roundUp(width, bucket), roundUp(height, bucket));
+	map<pair<int, int>, RenderTarget>::iterator it = targets.find(key);
+	if(it != targets.end())
+		return it->second;
+
+	RenderTarget target;
+	target.width = key.first;
+	target.height = key.second;
+
+	glGenTextures(1, &target.tex);
+	glBindTexture(GL_TEXTURE_2D, target.tex);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, target.width, target.height, 0, format, type, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	glGenFramebuffers(1, &target.fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, target.tex, 0);
+	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		cout << "Not properly installed FBO for samples (" << target.width << "x" << target.height << ")" << endl;
+
+	return targets[key] = target;
+}
+
+void TargetPool::release()
+{
+	for(map<pair<int, int>, RenderTarget>::iterator it = targets.begin(); it != targets.end(); ++it)
+	{
+		glDeleteFramebuffers(1, &it->second.fbo);
+		glDeleteTextures(1, &it->second.tex);
+	}
+	targets.clear();
+}
@@ -0,0 +1,325 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <sstream>
+#include <algorithm>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QThread>
+
+#include "rendering/Trace.hpp"
+
+using namespace std;
+
+enum TRACE_THREAD { THREAD_CPU = 1, THREAD_GPU = 2 };
+
+struct TraceGpuPending
+{
+	const char* name;
+	GLuint queryBegin, queryEnd;
+};
+
+// Zones in flight before polling for finished GPU results
+static const unsigned int MAX_PENDING = 64;
+
+atomic<bool> Trace::isRunning(false);
+
+// Started during static initialisation, before any thread can read it
+static QElapsedTimer traceClock;
+static bool isClockStarted = (traceClock.start(), true);
+static ofstream traceFile;
+static string tracePath;
+static double traceStart = 0.0;
+static bool isFirstEvent = true;
+// Stages keyed by the literal of the zone (merged by name in the summary)
+static map<pair<int, const char*>, TraceStage> traceStages;
+// Finished zones of each thread not yet inside a finished parent (start, duration): zones end before their parents,
+// so the children of a zone are the last ones starting after it
+static map<int, vector<pair<double, double> > > traceFinished;
+
+static bool isGpuTimer = false;
+static bool isGpuCalibrated = false;
+static double gpuOffset = 0.0; // CPU clock - GPU clock (microseconds)
+static vector<GLuint> allQueries, freeQueries;
+static deque<TraceGpuPending> pendingGpu;
+
+// Worker threads get their own tracks after the CPU and GPU ones
+static QMutex traceMutex;
+static map<Qt::HANDLE, int> threadIds;
+static map<int, string> threadNames;
+static int nextThread = THREAD_GPU + 1;
+
+static int getThreadId()
+{
+	Qt::HANDLE handle = QThread::currentThreadId();
+	map<Qt::HANDLE, int>::iterator it = threadIds.find(handle);
+	if(it != threadIds.end())
+		return it->second;
+	threadIds[handle] = nextThread;
+	return nextThread++;
+}
+
+static void writeEvent(const char* name, int tid, double start, double duration)
+{
+	traceFile << (isFirstEvent ? "\n" : ",\n") << "{\"name\":\"" << name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+		<< fixed << setprecision(3) << ",\"ts\":" << start - traceStart << ",\"dur\":" << duration << "}";
+	isFirstEvent = false;
+
+	vector<pair<double, double> >& finished = traceFinished[tid];
+	double nested = 0.0;
+	while(!finished.empty() && finished.back().first >= start)
+	{
+		nested += finished.back().second;
+		finished.pop_back();
+	}
+	finished.push_back(make_pair(start, duration));
+
+	TraceStage& stage = traceStages[make_pair(tid, name)];
+	stage.count++;
+	stage.total += duration;
+	stage.self += max(0.0, duration - nested);
+	stage.max = max(stage.max, duration);
+}
+
+static string getTrackName(int tid)
+{
+	if(tid == THREAD_CPU)
+		return "CPU";
+	if(tid == THREAD_GPU)
+		return "GPU";
+	map<int, string>::iterator it = threadNames.find(tid);
+	if(it != threadNames.end())
+		return it->second;
+	stringstream name;
+	name << "Thread " << tid;
+	return name.str();
+}
+
+static void writeThreadName(int tid, const char* name)
+{
+	traceFile << (isFirstEvent ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid << ",\"args\":{\"name\":\"" << name << "\"}}";
+	isFirstEvent = false;
+}
+
+// GPU zones finish in order: resolve from the oldest one, waiting for the results or only while available
+static void resolveGpu(bool isWait)
+{
+	while(!pendingGpu.empty())
+	{
+		const TraceGpuPending& zone = pendingGpu.front();
+		if(!isWait)
+		{
+			GLint available = 0;
+			glGetQueryObjectiv(zone.queryEnd, GL_QUERY_RESULT_AVAILABLE, &available);
+			if(!available)
+				break;
+		}
+		GLuint64 timeBegin = 0, timeEnd = 0;
+		glGetQueryObjectui64v(zone.queryBegin, GL_QUERY_RESULT, &timeBegin);
+		glGetQueryObjectui64v(zone.queryEnd, GL_QUERY_RESULT, &timeEnd);
+		writeEvent(zone.name, THREAD_GPU, timeBegin / 1000.0 + gpuOffset, (timeEnd - timeBegin) / 1000.0);
+		freeQueries.push_back(zone.queryBegin);
+		freeQueries.push_back(zone.queryEnd);
+		pendingGpu.pop_front();
+	}
+}
+
+static int getTrackRank(const TraceStage& stage)
+{
+	return stage.isGpu ? 2 : stage.track == "CPU" ? 0 : 1;
+}
+
+static bool compareStages(const TraceStage& a, const TraceStage& b)
+{
+	if(getTrackRank(a) != getTrackRank(b))
+		return getTrackRank(a) < getTrackRank(b);
+	if(a.track != b.track)
+		return a.track < b.track;
+	return a.self > b.self;
+}
+
+bool Trace::begin(const string& path)
+{
+	if(isRunning)
+		end();
+	QMutexLocker lock(&traceMutex);
+
+	traceFile.open(path.c_str());
+	if(!traceFile.is_open())
+	{
+		cout << "Trace: cannot create " << path << endl;
+		return false;
+	}
+	tracePath = path;
+	isFirstEvent = true;
+	traceStages.clear();
+	traceFinished.clear();
+	traceStart = now();
+
+	// Timer queries: core since GL 3.3
+	isGpuTimer = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+	isGpuCalibrated = false;
+	if(!isGpuTimer)
+		cout << "Trace: no GL timer queries, only CPU zones are traced" << endl;
+
+	traceFile << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	threadIds[QThread::currentThreadId()] = THREAD_CPU;
+	writeThreadName(THREAD_CPU, "CPU");
+	writeThreadName(THREAD_GPU, "GPU");
+	for(map<int, string>::iterator it = threadNames.begin(); it != threadNames.end(); ++it)
+		if(it->first > THREAD_GPU)
+			writeThreadName(it->first, it->second.c_str());
+	isRunning = true;
+	return true;
+}
+
+void Trace::end(vector<TraceStage>* stages)
+{
+	QMutexLocker lock(&traceMutex);
+	if(!isRunning)
+		return;
+
+	resolveGpu(true);
+	isRunning = false;
+	if(!allQueries.empty())
+		glDeleteQueries(allQueries.size(), allQueries.data());
+	allQueries.clear();
+	freeQueries.clear();
+
+	double duration = now() - traceStart;
+	traceFile << "\n]}" << endl;
+	traceFile.close();
+
+	// Summary per track: threads of the same name merged (encoders...), nested zones only counted in the self time of their parents
+	map<pair<string, string>, TraceStage> merged;
+	map<string, set<int> > trackThreads;
+	for(map<pair<int, const char*>, TraceStage>::iterator it = traceStages.begin(); it != traceStages.end(); ++it)
+	{
+		string track = getTrackName(it->first.first);
+		trackThreads[track].insert(it->first.first);
+		TraceStage& stage = merged[make_pair(track, string(it->first.second))];
+		stage.name = it->first.second;
+		stage.track = track;
+		stage.isGpu = it->first.first == THREAD_GPU;
+		stage.count += it->second.count;
+		stage.total += it->second.total;
+		stage.self += it->second.self;
+		stage.max = max(stage.max, it->second.max);
+	}
+	vector<TraceStage> summary;
+	for(map<pair<string, string>, TraceStage>::iterator it = merged.begin(); it != merged.end(); ++it)
+	{
+		it->second.numThreads = trackThreads[it->second.track].size();
+		summary.push_back(it->second);
+	}
+	sort(summary.begin(), summary.end(), compareStages);
+
+	cout << endl << "Trace of " << fixed << setprecision(1) << duration / 1e6 << "s written to " << tracePath << endl;
+	double busy = 0.0;
+	for(unsigned int i = 0; i < summary.size(); ++i)
+	{
+		const TraceStage& stage = summary[i];
+		if(i == 0 || stage.track != summary[i-1].track)
+		{
+			stringstream header;
+			header << stage.track << " stage (" << stage.numThreads << (stage.numThreads == 1 ? " thread)" : " threads)");
+			cout << left << setw(24) << header.str() << right << setw(10) << "calls" << setw(12) << "total ms" << setw(10) << "self ms"
+				<< setw(10) << "mean ms" << setw(10) << "max ms" << setw(8) << "run %" << endl;
+			busy = 0.0;
+		}
+		double runShare = 100.0 * stage.self / (duration * stage.numThreads);
+		busy += runShare;
+		cout << left << setw(24) << stage.name << right << setprecision(2)
+			<< setw(10) << stage.count << setw(12) << stage.total / 1000.0 << setw(10) << stage.self / 1000.0 << setw(10) << stage.total / 1000.0 / stage.count
+			<< setw(10) << stage.max / 1000.0 << setw(8) << setprecision(1) << runShare << endl;
+		if(i + 1 == summary.size() || summary[i+1].track != stage.track)
+			cout << left << setw(24) << "  busy" << right << setw(60) << busy << endl;
+	}
+	cout.unsetf(ios::floatfield);
+	cout << setprecision(6) << endl;
+	traceStages.clear();
+	traceFinished.clear();
+	if(stages)
+		stages->swap(summary);
+}
+
+double Trace::now()
+{
+	return traceClock.nsecsElapsed() / 1000.0;
+}
+
+void Trace::addCpuEvent(const char* name, double start, double duration)
+{
+	QMutexLocker lock(&traceMutex);
+	if(isRunning)
+		writeEvent(name, getThreadId(), start, duration);
+}
+
+void Trace::addCounter(const char* name, double value)
+{
+	QMutexLocker lock(&traceMutex);
+	if(!isRunning)
+		return;
+	traceFile << (isFirstEvent ? "\n" : ",\n") << "{\"name\":\"" << name << "\",\"ph\":\"C\",\"pid\":1"
+		<< fixed << setprecision(3) << ",\"ts\":" << now() - traceStart << ",\"args\":{\"value\":" << value << "}}";
+	isFirstEvent = false;
+}
+
+void Trace::setThreadName(const char* name)
+{
+	QMutexLocker lock(&traceMutex);
+	int tid = getThreadId();
+	threadNames[tid] = name;
+	if(isRunning)
+		writeThreadName(tid, name);
+}
+
+GLuint Trace::addTimestamp()
+{
+	if(!isGpuTimer)
+		return 0;
+
+	// Offset between the GPU and CPU clocks, taken once the context of the trace is current
+	if(!isGpuCalibrated)
+	{
+		GLint64 gpuTime = 0;
+		glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+		gpuOffset = now() - gpuTime / 1000.0;
+		isGpuCalibrated = true;
+	}
+
+	GLuint query;
+	if(freeQueries.empty())
+	{
+		glGenQueries(1, &query);
+		allQueries.push_back(query);
+	}
+	else
+	{
+		query = freeQueries.back();
+		freeQueries.pop_back();
+	}
+	glQueryCounter(query, GL_TIMESTAMP);
+	return query;
+}
+
+void Trace::addGpuEvent(const char* name, GLuint queryBegin, GLuint queryEnd)
+{
+	if(queryEnd == 0)
+	{
+		freeQueries.push_back(queryBegin);
+		return;
+	}
+	QMutexLocker lock(&traceMutex);
+	TraceGpuPending zone;
+	zone.name = name;
+	zone.queryBegin = queryBegin;
+	zone.queryEnd = queryEnd;
+	pendingGpu.push_back(zone);
+	if(pendingGpu.size() > MAX_PENDING)
+		resolveGpu(false);
+}
@@ -0,0 +1,22 @@
+#include <QApplication>
+
+#include "ui/GenerationThread.hpp"
+#include "ui/MainWindow.hpp"
+
+using namespace std;
+
+GenerationThread::GenerationThread(MainWindow* pWindow, Render* pView) : QThread(pWindow), window(pWindow), glView(pView), isCancelled(0)
+{
+
+}
+
+void GenerationThread::run()
+{
+	isCancelled = 0;
+	glView->makeCurrent();
+	window->executePlan(plan);
+
+	// Context back to the GUI thread (only its current thread can move it)
+	glView->doneCurrent();
+	glView->context()->moveToThread(QApplication::instance()->thread());
+}
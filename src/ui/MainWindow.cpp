@@ -2,6 +2,7 @@
 #include <time.h>
 
 #include <QWidget>
+#include <QApplication>
 #include <QColorDialog>
 #include <QHBoxLayout>
 #include <QFileDialog>
@@ -9,17 +10,42 @@
 #include <QRect>
 #include <QGLFormat>
 #include <QTextStream>
+#include <QDir>
 #include <qDebug>
 
 #include "ui/MainWindow.hpp"
+#include "rendering/Trace.hpp"
+#include "rendering/ShaderCache.hpp"
 
 using namespace std;
 
-MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent)
+// Random generation: sample size drawn in [RANDOM_SIZE_MIN, RANDOM_SIZE_MAX) x RANDOM_SIZE
+static const double RANDOM_SIZE = 512.0;
+static const double RANDOM_SIZE_MIN = 0.75;
+static const double RANDOM_SIZE_MAX = 1.25;
+
+MainWindow::MainWindow(QWidget* parent, bool isHeadless) : QMainWindow(parent)
 {
 	setupUi(this);
 
 	// Get paths from config file
+	isKpsQuery = true;
+	isShardOutput = false;
+	shardSizeMB = 1024;
+	runSeed = 1;
+	viewSampling = VIEW_RANDOM;
+	isTrace = false;
+	pipelineThreads = 0;
+	pipelineImages = 8;
+	renderSuperSampling = 2;
+	renderMSAA = 4;
+	downsampleFilter = DOWNSAMPLE_BOX;
+	depthPrePassTriangles = 200000;
+	isDepthPrePassOffset = false;
+	workerId = -1;
+	workerLease = 0;
+	workerUnits = 0;
+	workerBeat = 0.0;
 	getPaths();
 	modelFileName = "";
 
@@ -39,6 +65,8 @@ MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent)
 	embedGLWidget(winPreview, imgSampler);
 	winPreview->setFixedWidth(imgSampler->getSizeSample()*imgSampler->getNumSamples());
 	winPreview->setFixedHeight(imgSampler->getSizeSample()*imgSampler->getNumSamples());
+	if(isHeadless)
+		winPreview->setAttribute(Qt::WA_DontShowOnScreen);
 	winPreview->show();
 
 	// Depth visualiser
@@ -51,13 +79,22 @@ MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent)
 	embedGLWidget(winDepth, imgDepth);
 	winDepth->setFixedWidth(depthSize);
 	winDepth->setFixedHeight(depthSize);
+	if(isHeadless)
+		winDepth->setAttribute(Qt::WA_DontShowOnScreen);
 	winDepth->show();
 
 	// Main render
 	glView = new Render(this, glFormat, imgSampler, imgDepth, PATH_OUTPUT, PATH_OBJ);
+	glView->setIsKpsQuery(isKpsQuery);
+	glView->setDownsampleFilter(downsampleFilter);
+	glView->setDepthPrePass(depthPrePassTriangles, isDepthPrePassOffset);
 	updateViewerInfo();
 	embedGLWidget(frameRenderer, glView);
 
+	// Generation runs on its own thread with the render context, previews come back as images
+	generation = new GenerationThread(this, glView);
+	progressGeneration = NULL;
+
 	// Set global positions in the screen (by now, hardcoded)
 	QRect screenGeom = QDesktopWidget().availableGeometry();
 	move((int)(screenGeom.width()*0.15), (int)(screenGeom.height()*0.15));
@@ -68,6 +105,10 @@ MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent)
 	connect(glView, SIGNAL(updateFPS(const QString&)), showFPS, SLOT(setText(const QString&)));
 	connect(glView, SIGNAL(updateBrushGUI(int)), spinBrushSize, SLOT(setValue(int)));
 	connect(glView, SIGNAL(updateCompleteness()), this, SLOT(updateLabelCompleteness()));
+	connect(glView, &Render::updateSamplePreview, imgSampler, &Sampler::showAtlas);
+	connect(glView, &Render::updateDepthPreview, imgDepth, &Sampler::showAtlas);
+	connect(generation, SIGNAL(updateProgress(int, const QString&)), this, SLOT(updateGenerationProgress(int, const QString&)));
+	connect(generation, SIGNAL(finished()), this, SLOT(endGeneration()));
 
 	// View updates connections
 	connect(tableView, SIGNAL(itemSelectionChanged()), this, SLOT(setRemoveViewStatus()));
@@ -102,10 +143,18 @@ MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent)
 	on_checkKpsNoAz_clicked();
 
 	on_tabWidget_currentChanged(0);
+
+	if(isHeadless)
+		setAttribute(Qt::WA_DontShowOnScreen);
 }
 
 MainWindow::~MainWindow()
 {
+	if(generation->isRunning())
+	{
+		generation->cancel();
+		generation->wait();
+	}
 	delete winPreview, winDepth;
 	delete imgSampler, imgDepth;
 	delete glView;
@@ -122,6 +171,9 @@ void MainWindow::getPaths()
 		exit(EXIT_FAILURE);
 	}
 
+	// Program binaries in the temporary folder unless SHADER_CACHE says otherwise
+	string shaderCacheDir = QDir::tempPath().toStdString() + "/render-shaders";
+
 	QTextStream in(&pathsFile);
     while (!in.atEnd())
 	{
@@ -140,8 +192,52 @@ void MainWindow::getPaths()
 			PATH_OUTPUT = strWords[1].toStdString();
 		else if(strWords[0].toStdString() == "PATH_OBJ")
 			PATH_OBJ = strWords[1].toStdString();
+		else if(strWords[0].toStdString() == "KPS_VISIBILITY")
+			isKpsQuery = strWords[1].toStdString() != "DEPTH";
+		else if(strWords[0].toStdString() == "OUTPUT_SINK")
+			isShardOutput = strWords[1].toStdString() == "SHARDS";
+		else if(strWords[0].toStdString() == "SHARD_SIZE_MB")
+		{
+			// 0 or unparsable would rotate the shard on every sample
+			int sizeMB = strWords[1].toInt();
+			if(sizeMB > 0)
+				shardSizeMB = sizeMB;
+			else
+				cout << "Config: invalid SHARD_SIZE_MB " << strWords[1].toStdString() << ", keeping " << shardSizeMB << " MB" << endl;
+		}
+		else if(strWords[0].toStdString() == "JOB_FILE")
+			PATH_JOB = strLine.mid(strWords[0].size() + 1).toStdString();
+		else if(strWords[0].toStdString() == "TRACE")
+			isTrace = strWords[1].toInt() != 0;
+		else if(strWords[0].toStdString() == "PIPELINE_THREADS")
+			pipelineThreads = strWords[1].toUInt();
+		else if(strWords[0].toStdString() == "PIPELINE_IMAGES")
+			pipelineImages = strWords[1].toUInt();
+		else if(strWords[0].toStdString() == "RENDER_SUPERSAMPLING")
+			renderSuperSampling = strWords[1].toUInt();
+		else if(strWords[0].toStdString() == "RENDER_MSAA")
+			renderMSAA = strWords[1].toUInt();
+		else if(strWords[0].toStdString() == "RENDER_DOWNSAMPLE")
+		{
+			string filter = strWords[1].toStdString();
+			downsampleFilter = filter == "LINEAR" ? DOWNSAMPLE_LINEAR : filter == "LANCZOS" ? DOWNSAMPLE_LANCZOS : DOWNSAMPLE_BOX;
+		}
+		else if(strWords[0].toStdString() == "RENDER_DEPTH_PREPASS")
+			depthPrePassTriangles = strWords[1].toUInt();
+		else if(strWords[0].toStdString() == "RENDER_DEPTH_PREPASS_OFFSET")
+			isDepthPrePassOffset = strWords[1].toInt() != 0;
+		else if(strWords[0].toStdString() == "SHADER_CACHE")
+			shaderCacheDir = strLine.mid(strWords[0].size() + 1).toStdString();
+		else if(strWords[0].toStdString() == "SEED")
+			runSeed = strWords[1].toULongLong();
+		else if(strWords[0].toStdString() == "VIEW_SAMPLING")
+		{
+			string mode = strWords[1].toStdString();
+			viewSampling = mode == "STRATIFIED" ? VIEW_STRATIFIED : mode == "HALTON" ? VIEW_HALTON : mode == "FIBONACCI" ? VIEW_FIBONACCI : VIEW_RANDOM;
+		}
 	}
 	pathsFile.close();
+	ShaderCache::setDir(shaderCacheDir == "NONE" ? "" : shaderCacheDir);
 }
 
 void MainWindow::embedGLWidget(QWidget* base, QWidget* glView)
@@ -702,6 +798,7 @@ void MainWindow::on_buttonSaveView_clicked()
 {
 	imgSampler->setNumImg(1);
 	bool isSaved = glView->saveViewToImage();
+	glView->closeAnnotations();
 	if(isSaved)
 		cout << "image saved: OK!" << endl;
 	else
@@ -710,449 +807,531 @@ void MainWindow::on_buttonSaveView_clicked()
 
 void MainWindow::on_buttonScript_clicked()
 {
-	// Hardcoded info for generating synthetic data (ObjectNet3D)
-	/*
-	const string classes[] = { "Aeroplane", "Bicycle", "Boat", "Bottle", "Bus", "Car", "Chair", "Diningtable", "Motorbike", "Sofa", "Train", "TVMonitor" };
-	labelBackground->setText(QString("Z:/PhD/Data/Real/Car/KITTI/test/images"));
-	// For random stuff
-	lineRandomMaxSamples->setText("1000");
-	radioInterval->setChecked(true);
-	radioRange->setChecked(false);
-	vector<string> textAz, textEl, textTh, textDist;
-	// -> Aeroplane
-	textAz.push_back("0,15,30,45,60,75,90,105,120,135,150,165,180,195,210,225,240,255,270,285,300,315,330,345");
-	textEl.push_back("-60,-45,-30,-15,0,15,30,75");
-	textTh.push_back("-30,-15,0,15,30,45");
-	textDist.push_back("1.2,2.5");
-	// - Bicycle
-	textAz.push_back("0,15,30,45,60,75,90,105,120,135,150,165,180,195,210,225,240,255,270,285,300,315,330,345");
-	textEl.push_back("-30,-15,0,15,30,45");
-	textTh.push_back("-30,-15,0,15,30");
-	textDist.push_back("1.2,2.5");
-	// - Boat
-	textAz.push_back("0,15,30,45,60,75,90,105,120,135,150,165,180,195,210,225,240,255,270,285,300,315,330,345");
-	textEl.push_back("-15,0,15,30");
-	textTh.push_back("-15,0,15");
-	textDist.push_back("1.2,2.5");
-	// - Bottle
-	textAz.push_back("0,15,30,345");
-	textEl.push_back("-45,-30,-15,0,15,30,45,60");
-	textTh.push_back("-180,-45,-15,0,15,30");
-	textDist.push_back("1.2,2.5");
-	// - Bus
-	textAz.push_back("0,15,30,45,60,75,90,105,120,135,150,165,180,195,210,225,240,255,270,285,300,315,330,345");
-	textEl.push_back("-15,0,15");
-	textTh.push_back("-15,0,15");
-	textDist.push_back("1.2,2.5");
-	// - Car
-	textAz.push_back("0,15,30,45,60,75,90,105,120,135,150,165,180,195,210,225,240,255,270,285,300,315,330,345");
-	textEl.push_back("-15,0,15,30");
-	textTh.push_back("-15,0,15");
-	textDist.push_back("1.2,2.5");
-	// - Chair
-	textAz.push_back("0,15,30,45,60,75,90,150,165,270,285,300,315,330,345");
-	textEl.push_back("-15,0,15,30,45");
-	textTh.push_back("-15,0,15");
-	textDist.push_back("1.2,2.5");
-	// - Diningtable
-	textAz.push_back("0,15,30,45,60,75,90,270,285,300,315,330,345");
-	textEl.push_back("0,15,30,45");
-	textTh.push_back("-15,0,15");
-	textDist.push_back("1.2,2.5");
-	// - Motorbike
-	textAz.push_back("0,15,30,45,60,75,90,105,120,135,150,165,180,195,210,225,240,255,270,285,300,315,330,345");
-	textEl.push_back("-30,-15,0,15,30");
-	textTh.push_back("-30,-15,0,15,30");
-	textDist.push_back("1.2,2.5");
-	// - Sofa
-	textAz.push_back("0,15,30,45,60,300,315,330,345");
-	textEl.push_back("-15,0,15,30");
-	textTh.push_back("-15,0,15,30");
-	textDist.push_back("1.2,2.5");
-	// - Train
-	textAz.push_back("0,15,30,45,315,330,345");
-	textEl.push_back("-15,0,15,30");
-	textTh.push_back("-30,-15,0,15,30");
-	textDist.push_back("1.2,2.5");
-	// - TVMonitor
-	textAz.push_back("0,15,30,45,60,300,315,330,345");
-	textEl.push_back("-30,-15,0,15,30,45");
-	textTh.push_back("-15,0,15");
-	textDist.push_back("1.2,2.5");
-	*/
-	/*
-	checkRandom->setChecked(false);
-	vector<string> textEl, textTh, textDist;
-	textTh.push_back("0");
-	textDist.push_back("2.0");
-	// -> Aeroplane
-	textEl.push_back("-30, 0, 25, 50");
-	// - Bicycle
-	textEl.push_back("-20, 0, 20, 40");
-	// - Boat
-	textEl.push_back("-15, 0, 15, 30");
-	// - Bottle
-	textEl.push_back("-25, 0, 20, 40");
-	// - Bus
-	textEl.push_back("-10, 0, 15, 30");
-	// - Car
-	textEl.push_back("-10, 0, 15, 30");
-	// - Chair	
-	textEl.push_back("-10, 5, 20, 35");
-	// - Diningtable
-	textEl.push_back("0, 15, 30, 45");
-	// - Motorbike
-	textEl.push_back("-15, 0, 15, 30");
-	// - Sofa
-	textEl.push_back("-10, 0, 15, 30");
-	// - Train
-	textEl.push_back("-10, 0, 15, 30");
-	// - TVMonitor
-	textEl.push_back("-15, 0, 15, 30");
-	*/ 
+	if(generation->isRunning())
+		return;
 
-	/*
-	// For 360 az
-	lineTilt->setText(QString(textTh[0].c_str()));
-	lineDistance->setText(QString(textDist[0].c_str()));
-	for (unsigned int i = 0; i < 11; ++i)
-	{
-		if (i == 3) // bottle (+ rounded table case in script code)
-		{
-			checkKpsNoAz->setChecked(true);
-			checkKpsNoSelfOcc->setChecked(true);
-		}
-		else
-		{
-			checkKpsNoAz->setChecked(false);
-			checkKpsNoSelfOcc->setChecked(false);
-		}
-		on_checkKpsNoSelfOcc_clicked();
-		on_checkKpsNoAz_clicked();
-		
-		labelModel->setText(QString(string("Z:/PhD/Data/Syn/" + classes[i] + "/set01").c_str()));
-		labelOutput->setText(QString(string("Z:/PhD/Data/Syn/" +  classes[i] + "/p3d_1000").c_str()));
-		// For 360 az (Journal DA)
-		// lineAngleX->setText(QString(textEl[i].c_str()));
-
-		// For random stuff (Paper Kps+Vp)
-		lineAngleY->setText(QString(textAz[i].c_str()));
-		lineAngleX->setText(QString(textEl[i].c_str()));
-		lineTilt->setText(QString(textTh[i].c_str()));
-		lineDistance->setText(QString(textDist[i].c_str()));
-
-		runScript();
-	}
-	exit(0);
-	*/
+	// Job file of the config (all classes, see data/jobs) or parameters of the script tab
+	JobPlan plan;
+	plan.setSeed(runSeed);
+	bool isPlanned = !PATH_JOB.empty() ? planJobFile(PATH_JOB, plan) : planScript(plan);
+	if(isPlanned)
+		startGeneration(plan);
+}
+
+void MainWindow::startGeneration(JobPlan& plan)
+{
+	// Window modal: the GUI keeps repainting but cannot change the scene under the generation thread
+	progressGeneration = new QProgressDialog("Generation of synthetic images", "Cancel", 0, 100, this);
+	progressGeneration->setWindowModality(Qt::WindowModal);
+	progressGeneration->setAutoClose(false);
+	progressGeneration->setAutoReset(false);
+	progressGeneration->setMinimumDuration(0);
+	progressGeneration->setValue(0);
+	connect(progressGeneration, SIGNAL(canceled()), this, SLOT(cancelGeneration()));
+	centralWidget()->setEnabled(false);
 
-	runScript();
-	exit(0);
+	// The render context belongs to the thread until the end of the run
+	generation->setPlan(plan);
+	glView->beginWorker(generation);
+	generation->start();
 }
 
-void MainWindow::runScript()
+void MainWindow::updateGenerationProgress(int percent, const QString& text)
 {
-	srand(1);
-	clock_t timeScript = clock();
+	if(progressGeneration == NULL || progressGeneration->wasCanceled())
+		return;
+	progressGeneration->setValue(percent);
+	progressGeneration->setLabelText(text);
+}
 
-	if (!labelModel->text().compare(QString("-")) || !labelOutput->text().compare(QString("-")) || !labelBackground->text().compare(QString("-")))
+void MainWindow::cancelGeneration()
+{
+	// Stops after the current task: finished units are in the manifest and a new run resumes from them
+	cout << "Generation cancelled, finishing current task" << endl;
+	generation->cancel();
+}
+
+void MainWindow::endGeneration()
+{
+	progressGeneration->deleteLater();
+	progressGeneration = NULL;
+	glView->endWorker();
+	// Finished run: leave through the event loop so the windows and the render context are destroyed in order
+	if(!generation->isCancelRequested())
 	{
-		cout << "Folders for model selection, output and background image not selected" << endl;
+		generation->wait();
+		qApp->quit();
 		return;
 	}
 
-	// Setup config
-	imgSampler->makeCurrent();
-	glView->makeCurrent();
+	// Back to the GUI state
+	imgSampler->setAngleY(boxAngleY->value());
+	if(glView->isModel())
+		updateKps(glView->getModel()->getKps());
+	centralWidget()->setEnabled(true);
+	show();
+	glView->show();
+	winPreview->show();
+	winDepth->show();
+}
 
-	// Do not see the whole GUI in non-random generation
-	// Note: for random generation stay shown to correctly update window sizes
-	/*
-	if (!checkRandom->isChecked())
+void MainWindow::saveUnit(RunManifest& manifest, const string& model, const string& unit, string& saveObj)
+{
+	// Finished in a previous run: only keep the image numbering
+	if(manifest.isDone(model, unit))
 	{
-		hide();
-		winPreview->hide();
-		winDepth->hide();
+		const ManifestUnit& done = manifest.getUnit(model, unit);
+		imgSampler->setNumImg(done.firstImg + done.numImgs);
+		return;
 	}
-	*/
 
-	// Azimuth interval
-	boxAngleY->setValue(boxAngleY->value());
-	// Range
-	bool isRange = radioRange->isChecked();
-	float step = boxAngleDisc->value();
-	// Elevation and distance discrete values
-	vector<float> azimuths, elevations, tilts, distances;
-	if (!isRange)
-	{
-		QStringList txtAz = lineAngleY->text().split(",");
-		for (int i = 0; i < txtAz.size(); ++i)
-			azimuths.push_back(txtAz[i].toDouble());
-	}
+	unsigned int firstImg = imgSampler->getNumImg();
+	glView->resetOutputChecksum();
+	glView->saveViewToImage(saveObj);
+	manifest.markDone(model, unit, ManifestUnit(firstImg, imgSampler->getNumImg() - firstImg, glView->getOutputChecksum()));
+
+	// Units are journaled once their outputs are on disk
+	if(manifest.getNumPending() >= 64)
+		commitOutputs(manifest);
+	workerUnits++;
+	reportWorkerProgress();
+}
+
+void MainWindow::reportWorkerProgress()
+{
+	// Finished units of a worker process after views, units and model loads, at most once per second (its node stops it when silent)
+	if (workerId < 0 || Trace::now() - workerBeat < 1e6)
+		return;
+	workerBeat = Trace::now();
+	cout << "@PROGRESS " << workerUnits << endl;
+}
+
+void MainWindow::commitOutputs(RunManifest& manifest)
+{
+	// Pending units with the length of the files holding them
+	glView->flushOutputs();
+	if (!glView->getAnnotationPath().empty())
+		manifest.setOffset(glView->getAnnotationPath(), glView->getAnnotationLength());
+	if (!glView->getShardPath().empty())
+		manifest.setOffset(glView->getShardPath(), glView->getShardLength());
+	manifest.commit();
+}
+
+string MainWindow::getBackgroundPath(const JobClass& job, unsigned int idxBackground)
+{
+	// int idxBackground = rand() % 711 + 1;
+	// pathBackground.append("/neg (");
+	// pathBackground.append(imgSampler->IntToStr(idxBackground));
+	// pathBackground.append(").png");
+	string pathBackground = job.backgroundDir;
+	pathBackground.append("/");
+	string strNum = imgSampler->IntToStr(idxBackground);
+	for (unsigned i = 0; i < 6 - strNum.length(); ++i)
+		pathBackground.append("0");
+	pathBackground.append(strNum);
+	pathBackground.append(".png");
+
+	// White background for testing
+	// pathBackground = "D:/PhD/Data/Syn/whiteBg.png";
+	return pathBackground;
+}
+
+JobClass MainWindow::getScriptJob()
+{
+	JobClass job;
+	job.modelDir = labelModel->text().toStdString();
+	job.outputDir = labelOutput->text().toStdString();
+	job.backgroundDir = labelBackground->text().toStdString();
+	job.ext = lineExt->text().toStdString();
+
+	job.isRandom = checkRandom->isChecked();
+	job.isRange = radioRange->isChecked();
+	QStringList txtAz = lineAngleY->text().split(",");
+	for (int i = 0; i < txtAz.size() && !job.isRange; ++i)
+		job.azimuths.push_back(txtAz[i].toDouble());
 	QStringList txtElev = lineAngleX->text().split(",");
 	for (int i = 0; i < txtElev.size(); ++i)
-		elevations.push_back(txtElev[i].toDouble());
+		job.elevations.push_back(txtElev[i].toDouble());
 	QStringList txtTilt = lineTilt->text().split(",");
 	for (int i = 0; i < txtTilt.size(); ++i)
-		tilts.push_back(txtTilt[i].toDouble());
+		job.tilts.push_back(txtTilt[i].toDouble());
 	QStringList txtDist = lineDistance->text().split(",");
 	for (int i = 0; i < txtDist.size(); ++i)
-		distances.push_back(txtDist[i].toDouble());
+		job.distances.push_back(txtDist[i].toDouble());
+	job.azStep = boxAngleY->value();
+	job.step = boxAngleDisc->value();
+	job.numSamplesModel = lineRandomMaxSamples->text().toInt();
+	job.sampling = viewSampling;
+	job.sizeSample = imgSampler->getSizeSample();
+	job.gridSamples = imgSampler->getNumSamples();
+
+	job.isKpsNoAz = checkKpsNoAz->isChecked();
+	job.isKpsNoSelfOcc = checkKpsNoSelfOcc->isChecked();
+	// Hardcoded for rounded tables (as the script always did, job files set ROUND_FROM)
+	if (labelOutput->text().contains("Diningtable"))
+		job.roundFrom = 8;
+	job.isShards = isShardOutput;
+	job.shardSizeMB = shardSizeMB;
+	return job;
+}
+
+bool MainWindow::planScript(JobPlan& plan)
+{
+	if (!labelModel->text().compare(QString("-")) || !labelOutput->text().compare(QString("-")) || !labelBackground->text().compare(QString("-")))
+	{
+		cout << "Folders for model selection, output and background image not selected" << endl;
+		return false;
+	}
+
+	plan.addClass(getScriptJob());
+	return plan.expand();
+}
+
+bool MainWindow::planJobFile(const string& path, JobPlan& plan)
+{
+	return plan.load(path) && plan.expand();
+}
+
+int MainWindow::runWorker(const string& jobFile, unsigned int id, unsigned int numEncoders)
+{
+	// Same plan as the driver: task indices of its commands refer to it
+	JobPlan plan;
+	plan.setSeed(runSeed);
+	if(!planJobFile(jobFile, plan))
+		return EXIT_FAILURE;
+	workerId = (int)id;
+	if(numEncoders > 0)
+		pipelineThreads = numEncoders;
 
-	if (elevations.empty() || distances.empty()|| tilts.empty() || (!isRange && azimuths.empty()))
+	// Render context of this process (created with the hidden windows), drawn as on the generation thread without previews
+	show();
+	QApplication::processEvents();
+	disconnect(glView, &Render::updateSamplePreview, 0, 0);
+	disconnect(glView, &Render::updateDepthPreview, 0, 0);
+	connect(glView, &Render::renderedView, this, &MainWindow::reportWorkerProgress);
+	glView->beginWorker(QThread::currentThread());
+
+	// Commands on stdin: "RUN first last lease hash" and "QUIT", answers tagged with '@' among the log lines
+	unsigned int planHash = plan.getHash();
+	cout << "@READY" << endl;
+	string line;
+	while(getline(cin, line))
 	{
-		cout << "Wrong elevation, distance or tilt selection\n" << endl;
-		return;
+		stringstream command(line);
+		string name;
+		unsigned int firstTask = 0, lastTask = 0, lease = 0, hash = 0;
+		command >> name >> firstTask >> lastTask >> lease >> hash;
+		if(name == "QUIT")
+			break;
+		else if(name != "RUN" || firstTask >= lastTask || lastTask > plan.getTasks().size())
+		{
+			cout << "Worker " << id << ": unknown command " << line << endl;
+			continue;
+		}
+		else if(hash != planHash)
+		{
+			// Task indices of another plan (other catalog or job file): its outputs would not be the driver's
+			cout << "@REFUSED " << planHash << endl;
+			glView->endWorker();
+			return EXIT_FAILURE;
+		}
+		workerLease = lease;
+		executePlan(plan, firstTask, lastTask);
+		cout << "@DONE " << firstTask << " " << lastTask << endl;
 	}
+	glView->endWorker();
+	return EXIT_SUCCESS;
+}
+
+void MainWindow::executePlan(JobPlan& plan, unsigned int firstTask, unsigned int lastTask)
+{
+	double timeScript = Trace::now();
+	time_t timeStart = time(NULL);
+	vector<RenderTask>& tasks = plan.getTasks();
+	lastTask = min(lastTask, (unsigned int)tasks.size());
+	// Outputs of a worker are named after its lease: those of a lease taken away from a stalled worker are not mixed up
+	// with the ones of the worker generating the item again
+	string worker;
+	if (workerId >= 0)
+		worker = "-w" + imgSampler->IntToStr(workerId) + "-l" + imgSampler->IntToStr(workerLease);
+
+	// Setup config (generation thread: no GUI widgets from here, the samplers keep their atlas on the CPU)
+	glView->makeCurrent();
+	if (pipelineImages > 0)
+		glView->startPipeline(pipelineThreads, pipelineImages);
 
-	// Filter of 3D model extensions
-	QStringList extFiles;
-	string ext = string("*").append(lineExt->text().toStdString());
-	extFiles << ext.c_str();
-
-	// Create save directory if does not exist
-	string savePath = labelOutput->text().toStdString() + "/";
-	QDir saveDir(savePath.c_str());
-	if (!saveDir.exists())
-		QDir().mkdir(savePath.c_str());
-
-	// Create a README.txt file to describe annotations and names
-	ofstream readmeFile;
-	readmeFile.open(savePath + "README.txt");
-	if(readmeFile.is_open())
+	// Do not see the whole GUI in non-random generation
+	// Note: for random generation stay shown to correctly update window sizes
+	/*
+	if (!checkRandom->isChecked())
 	{
-		readmeFile << ">> README.txt" << endl;
-		readmeFile << "FOLDER STRUCTURE: " << endl;
-		readmeFile << "img_pNUM_INSTANCE" << endl;
-		readmeFile << "ANNOTATION STRUCTURE: " << endl;
-		readmeFile << "IMG_NAME ROW COL HEIGHT WIDTH AZIMUTH ELEVATION DISTANCE PART_NAME_1 PART_1_X PART_1_Y PART_1_Z" << endl;
+		hide();
+		winPreview->hide();
+		winDepth->hide();
 	}
-	readmeFile.close();
+	*/
 
 	cout << endl << "Generation of synthetic images" << endl;
-	string pathSet;
-	int idxNewModel = 0;
-	for(int iSet = 0; iSet < 1 /*listSets.size()*/; ++iSet)
+	RunManifest manifest;
+	ViewSampler viewSampler;
+	JobClass params;
+	int idxClass = -1;
+	int idxModel = -1;
+	unsigned int idxObj = 0;
+	string saveObj;
+	bool isLoaded = false;
+	float doneCost = 0.0f;
+	float totalCost = 0.0f;
+	for (unsigned int idxTask = firstTask; idxTask < lastTask; ++idxTask)
+		totalCost += tasks[idxTask].cost;
+	int lastProgress = 0;
+	for (unsigned int idxTask = firstTask; idxTask < lastTask; ++idxTask)
 	{
-		QDir dirModels(labelModel->text());
-		dirModels.setFilter(QDir::Dirs| QDir::NoDotAndDotDot);
-		QStringList listModels = dirModels.entryList();
+		const RenderTask& task = tasks[idxTask];
+		if (generation->isCancelRequested())
+		{
+			cout << "Generation cancelled before task " << idxTask+1 << "/" << tasks.size() << endl;
+			break;
+		}
+		TraceZone zoneTask("task");
 
-		string pathModel;
-		for (int iModel = 0; iModel < listModels.size(); ++iModel)
+		// New class: output folder, sinks and manifest
+		if ((int)task.idxClass != idxClass)
 		{
-			// Hardcoded for rounded tables:
-			if (iModel > 7 && QString(savePath.c_str()).contains("Diningtable"))
+			if (idxClass >= 0)
+			{
+				commitOutputs(manifest);
+				glView->closeAnnotations();
+				glView->closeShards();
+				manifest.close();
+			}
+			idxClass = task.idxClass;
+			idxModel = -1;
+			const JobClass& job = plan.getClasses()[idxClass];
+
+			// Output folder and README (prepared by the driver for its workers)
+			string savePath = job.outputDir + "/";
+			if (workerId < 0)
+				JobPlan::prepareOutput(job);
+
+			// Journal of finished units: restarting the job on the same output folder and config skips them
+			// and cuts the outputs back to them (workers journal to their own file, appended to the run manifest by the driver)
+			if (workerId < 0)
+			{
+				manifest.open(savePath + "manifest.txt");
+				manifest.truncateOutputs();
+			}
+			else
 			{
-				tilts.clear(); tilts.push_back(0);
-				step = 1.0f;
-				checkKpsNoAz->setChecked(true);
-				on_checkKpsNoAz_clicked();				
+				manifest.open(savePath + "manifest" + worker + ".txt");
+				manifest.load(savePath + "manifest.txt");
 			}
 
-			imgSampler->setNumImg(1);
-			// Find files that can be read (.obj, .3ds, .dae)
-			pathModel = labelModel->text().toStdString() + "/";
-			pathModel.append(listModels[iModel].toStdString());
-			QDir dirFiles(pathModel.c_str());
-			dirFiles.setFilter(QDir::Files| QDir::NoDotAndDotDot);
-			dirFiles.setNameFilters(extFiles);
-			QStringList listFiles = dirFiles.entryList();
+			// Samples appended to tar shards instead of one file per image (one set of shards per worker lease)
+			if(job.isShards)
+				glView->openShards(savePath, job.shardSizeMB, "shard" + worker);
+			commitOutputs(manifest);
 
-			// No 3D model found... try next folder...
-			if(listFiles.empty())
-				continue;
+			// Stage timings of the whole run (Chrome trace in the folder of the first class)
+			if (isTrace && !Trace::isEnabled())
+			{
+				char stamp[32];
+				strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&timeStart));
+				string name = savePath + "trace-" + stamp;
+				if (workerId >= 0)
+					name += worker + "-t" + imgSampler->IntToStr(firstTask);
+				Trace::begin(name + ".json");
+			}
 
-			cout << endl << "Model " << idxNewModel+1 << ": " << endl;
-			pathModel.append("/" + listFiles[0].toStdString());
+			// Atlas and azimuth step (one image per sample in random generation)
+			if (job.sizeSample > 0 && job.gridSamples > 0)
+			{
+				imgSampler->setNumSamples(job.gridSamples);
+				imgSampler->updateSizeSample(job.sizeSample);
+			}
+			imgSampler->setAngleY(job.isRandom ? 360.0 : job.azStep);
+
+			// Scene framebuffers of the job: largest sample times the supersampling
+			unsigned int maxSizeSample = job.isRandom ? (unsigned int)ceil(RANDOM_SIZE * RANDOM_SIZE_MAX) : imgSampler->getSizeSample();
+			unsigned int superSampling = job.superSampling > 0 ? job.superSampling : max(1u, renderSuperSampling);
+			glView->setSampleTargets(maxSizeSample * superSampling, job.msaa > 0 ? job.msaa : renderMSAA);
+			glView->setOutputs(job.outputs);
+			if (!job.name.empty())
+				cout << endl << "Class " << job.name << endl;
+		}
 
-			string saveObj = savePath;
+		// New model: load it with its parameters
+		if ((int)task.idxModel != idxModel)
+		{
+			commitOutputs(manifest);
+			idxModel = task.idxModel;
+			params = plan.getModelParams(idxClass, idxModel);
+			glView->setAnnotationName(workerId >= 0 ? "annotations-c" + imgSampler->IntToStr(idxTask) + worker + ".bin" : "annotations.bin");
+
+			// Numbering goes on from the units of the model before this task (generated by another worker)
+			unsigned int numImg = 1;
+			unsigned int perImage = imgSampler->getNumSamples() * imgSampler->getNumSamples();
+			for (unsigned int i = idxTask; i > 0 && tasks[i-1].idxClass == task.idxClass && tasks[i-1].idxModel == task.idxModel; --i)
+				numImg += params.isRandom ? 1 : (tasks[i-1].numRenders + perImage - 1) / perImage;
+			imgSampler->setNumImg(numImg);
+			cout << endl << "Model " << idxModel+1 << ": " << endl;
+			idxObj = manifest.addModel(params.models[idxModel]);
+			saveObj = params.outputDir;
 			saveObj.append("/obj_");
-			saveObj.append(imgSampler->IntToStr(idxNewModel));
+			saveObj.append(imgSampler->IntToStr(idxObj));
+			// Annotation store of the model cut back to its committed records (part of a chunk resumed or handed over
+			// from a stopped worker) and journaled before anything is appended to it
+			string annotationPath = saveObj + "/" + glView->getAnnotationName();
+			unsigned long long committed;
+			if (manifest.getOffset(annotationPath, committed))
+				AnnotationStore::truncate(annotationPath, committed);
+			manifest.setOffset(annotationPath, AnnotationStore::getLength(annotationPath));
+			manifest.commit();
+
+			glView->setIsKpsAz(!params.isKpsNoAz);
+			glView->setIsKpsSelfOcc(!params.isKpsNoSelfOcc);
 
 			// Loading model... ... ...
-			bool isLoaded = glView->loadModelFromFile(pathModel, glView->getShader(TYPE_SHADER::PHONG));
-			// Update Keypoints GUI + Render
-			updateKps(glView->getModel()->getKps());
-
-			if (checkRandom->isChecked()) // Random sampling
+			// (keypoints of the model only: inheriting the ones of the previous model would depend on the task order)
+			glView->resetKps();
+			isLoaded = glView->loadModelFromFile(params.modelFiles[idxModel], glView->getShader(TYPE_SHADER::PHONG));
+			// Update Keypoints of the render (GUI list refreshed at the end of the run)
+			map<string, Kp> kps = glView->getModel()->getKps();
+			for (map<string, Kp>::iterator it = kps.begin(); it != kps.end(); ++it)
+				glView->createKp(it->second);
+			reportWorkerProgress();
+
+			// Viewpoints: discrete angles (with +-step/2 tolerance) or ranges, constrained by the views table
+			if (params.isRandom)
 			{
-				int azStep = (int)boxAngleY->value();
-				int azRange = (int)floor(360.0 / boxAngleY->value());
-				boxAngleY->setValue(360.0); // Only one pass (1 image per random azimuth)
-				unsigned int numSamplesModel = lineRandomMaxSamples->text().toInt();
-				if (numSamplesModel == 0)
-				{
-					cout << "Wrong input for number of random samples per model" << endl;
-					return;
-				}
-				if (isRange && (elevations.size() != 2 || distances.size() != 2 || tilts.size() != 2))
+				viewSampler.setMode(params.sampling, params.numSamplesModel, (unsigned int)SampleRng(plan.getSeed(), idxObj, 0, RNG_PATTERN).next());
+				int azRange = (int)floor(360.0 / params.azStep);
+				if (params.isRange)
 				{
-					cout << "Wrong input for elevation/distance ranges (2 elems: lower and upper bound)" << endl;
-					return;
+					viewSampler.getAzimuth().setRange(0, azRange * params.azStep);
+					viewSampler.getElevation().setRange(params.elevations[0], params.elevations[1]);
+					viewSampler.getTilt().setRange(params.tilts[0], params.tilts[1]);
 				}
-				for (unsigned int idxSample = 0; idxSample < numSamplesModel; ++idxSample)
+				else
 				{
-					// Change image size
-					imgSampler->makeCurrent();
-					imgSampler->updateNumSamples(1);
-					double r = ((double)rand() / RAND_MAX) * 0.5 + 0.75;
-					int sizeSample = (int)floor(512.0 * r);
-					imgSampler->updateSizeSample(sizeSample);
-					imgSampler->setSizeSample(sizeSample);
-					glView->makeCurrent();
-					// Select random az, el, th, d
-					// - Set random azimuth based on granularity
-					float az = 0.0f;
-					if (isRange)
-						az = (rand() % azRange) * azStep;
-					else
-						az = findAngle(azimuths, 0, 360, step, true);
-					imgSampler->setCurrentAngleY(az);
-					// - Set random elevation based on range input (2 elems)
-					float el = 0.0f;
-					if (isRange)
-						el = elevations[0] + ((double)rand() / RAND_MAX)*(elevations[1] - elevations[0]);
-					else
-						el = findAngle(elevations, -90, 90, step, false);
-					imgSampler->setAngleX(floor(el * 100)/100.0);					
-					// - Set random tilt based on range input (2 elems)
-					float th = 0.0f;
-					if (isRange)
-						th = tilts[0] + ((double)rand() / RAND_MAX)*(tilts[1] - tilts[0]);
-					else
-						th = findAngle(tilts, -180, 180, step, true);
-					imgSampler->setTilt(floor(th * 100) / 100.0);
-					// - Set random distance based on range input (2 elems) -> always range!
-					float d = distances[0] + ((double)rand() / RAND_MAX)*(distances[1] - distances[0]);
-					imgSampler->setDistance(floor(d * 100) / 100.0);
-					// Bg image
-					string pathBackground = labelBackground->text().toStdString();
-					pathBackground.append("/");
-					int idxBackground = rand() % 7517 + 1;
-					string strNum = imgSampler->IntToStr(idxBackground);
-					for (unsigned i = 0; i < 6 - strNum.length(); ++i)
-						pathBackground.append("0");
-					pathBackground.append(strNum);
-					pathBackground.append(".png");
-					glView->loadBackgroundImgFromFile(pathBackground);
-					// Update lights randomly within a specific range (+ intensity)
-					float light_range = 0.5;
-					vector<glm::vec3> old_lights(8);
-					for (int l = 0; l < Lights::MAX_LIGHTS; ++l)
-					{
-						old_lights[l] = glView->getLights().position[l];
-						float light = ((float)rand() / RAND_MAX)*light_range - light_range / 2.0f;
-						glView->getLights().position[l] += glm::vec3(light, light, light);
-						light = ((float)rand() / RAND_MAX) * 0.5 + 0.25;
-						glView->getLights().diffuse[l] = glm::vec3(light, light, light);
-					}
-
-					// Store random image
-					// update objet scaling randomly within a specific range
-					float maxScale = 1.25f; float minScale = 0.75;
-					// Hardcoded for rounded tables:
-					if (iModel > 7 && QString(savePath.c_str()).contains("Diningtable"))
-					{
-						maxScale = 1.0f;
-						minScale = 1.0f;
-					}
-					float scaleX = (float)rand() / RAND_MAX * (maxScale - minScale) + minScale;
-					float scaleY = (float)rand() / RAND_MAX * (maxScale - minScale) + minScale;
-					float scaleZ = (float)rand() / RAND_MAX * (maxScale - minScale) + minScale;
-					glView->getModel()->setScaling(scaleX, scaleY, scaleZ);
-					glView->saveViewToImage(saveObj);
-
-					// Restore light position
-					for (int l = 0; l < Lights::MAX_LIGHTS; ++l)
-						glView->getLights().position[l] = old_lights[l];
+					viewSampler.getAzimuth().setIntervals(params.azimuths, 0, 360, params.step / 2.0f, true);
+					viewSampler.getElevation().setIntervals(params.elevations, -90, 90, params.step / 2.0f, false);
+					viewSampler.getTilt().setIntervals(params.tilts, -180, 180, params.step / 2.0f, true);
 				}
-				boxAngleY->setValue(azStep);
-			}
-			else
-			{
-				for (unsigned int idxTilt = 0; idxTilt < tilts.size() && isLoaded; ++idxTilt)
+				viewSampler.getDistance().setRange(params.distances[0], params.distances[1]);
+				vector<RangeView> views;
+				for (int iView = 0; iView < imgSampler->numViews(); ++iView)
+					views.push_back(imgSampler->getRangeView(iView));
+				viewSampler.setViews(views, imgSampler->isAzimuth(), imgSampler->isElevation());
+				if (viewSampler.getAzimuth().isEmpty() || viewSampler.getElevation().isEmpty() || viewSampler.getTilt().isEmpty())
 				{
-					// Update tilt
-					imgSampler->setTilt(tilts[idxTilt]);
-
-					for (unsigned int idxElevation = 0; idxElevation < elevations.size() && isLoaded; ++idxElevation)
-					{
-						// Update elevation
-						imgSampler->setAngleX(elevations[idxElevation]);
-
-						for (unsigned int idxDistance = 0; idxDistance < distances.size() && isLoaded; ++idxDistance)
-						{
-							imgSampler->setDistance(distances[idxDistance]);
-
-							// Load random background
-							string pathBackground = labelBackground->text().toStdString();
-							pathBackground.append("/");
-
-							// int idxBackground = rand() % 711 + 1;
-							// pathBackground.append("/neg (");
-							// pathBackground.append(imgSampler->IntToStr(idxBackground));
-							// pathBackground.append(").png");
-							int idxBackground = rand() % 7517 + 1;
-							string strNum = imgSampler->IntToStr(idxBackground);
-							for (unsigned i = 0; i < 6 - strNum.length(); ++i)
-								pathBackground.append("0");
-							pathBackground.append(strNum);
-							pathBackground.append(".png");
-
-
-							// White background for testing
-							// pathBackground = "D:/PhD/Data/Syn/whiteBg.png";
-							glView->loadBackgroundImgFromFile(pathBackground);
-
-							// Start from azimuth angle  0
-							imgSampler->resetCurrentAngleY();
-							// Once all setup is done, store the images
-							glView->saveViewToImage(saveObj);
-						}
-					}
+					cout << "Wrong input for azimuth/elevation/tilt (no value within the valid ranges)" << endl;
+					isLoaded = false;
 				}
 			}
-			idxNewModel++;
 		}
-	}
 
-	// Show again GUI
-	show();
-	glView->show();
-	winPreview->show();
-	winDepth->show();
-
-	timeScript = (float)clock() - (float)timeScript;
-	cout << "Time script: " << timeScript << "ms" << endl << endl;
-}
-
-float MainWindow::findAngle(vector<float> intervals, float minValue, float maxValue, float step, bool isCircular)
-{
-	while (1)
-	{
-		float value = minValue + ((float)rand() / RAND_MAX) * (maxValue - minValue);
-		float minDist = 9999.0f;
-		float minValue = 0.0f;
-		for (unsigned int i = 0; i < intervals.size(); ++i)
+		// Views of the task as counted by the plan (numbering of the following tasks relies on it)
+		imgSampler->setViewsPerTurn(task.numRenders);
+		if (isLoaded && params.isRandom) // Random sampling
 		{
-			if (isCircular)
-			{
-				float dist = min(abs(intervals[i] - value), abs(intervals[i] - 360 - value));
-				if (dist < minDist)
-					minDist = dist;
-			}
-			else
+			// Random values of sample (seed, model, sample), independent of the order of generation
+			unsigned int idxSample = task.idxSample;
+			SampleRng rngSize(plan.getSeed(), idxObj, idxSample, RNG_SIZE);
+			SampleRng rngView(plan.getSeed(), idxObj, idxSample, RNG_VIEW);
+			SampleRng rngBackground(plan.getSeed(), idxObj, idxSample, RNG_BACKGROUND);
+			SampleRng rngLights(plan.getSeed(), idxObj, idxSample, RNG_LIGHTS);
+			SampleRng rngScale(plan.getSeed(), idxObj, idxSample, RNG_SCALE);
+
+			// Change image size (atlas and sample target are set up by the render from the pools)
+			imgSampler->setNumSamples(1);
+			double r = RANDOM_SIZE_MIN + rngSize.uniform() * (RANDOM_SIZE_MAX - RANDOM_SIZE_MIN);
+			int sizeSample = (int)floor(RANDOM_SIZE * r);
+			imgSampler->setSizeSample(sizeSample);
+			// Select az, el, th, d
+			ViewSample view = viewSampler.sample(rngView, idxSample);
+			// - Azimuth based on granularity in range mode
+			float az = view.azimuth;
+			if (params.isRange)
+				az = floor(az / params.azStep) * params.azStep;
+			imgSampler->setCurrentAngleY(az);
+			imgSampler->setAngleX(floor(view.elevation * 100)/100.0);
+			imgSampler->setTilt(floor(view.tilt * 100) / 100.0);
+			// - Distance always range (2 elems)
+			imgSampler->setDistance(floor(view.distance * 100) / 100.0);
+			// Bg image
+			if (!manifest.isDone(params.models[idxModel], task.unitKey))
+				glView->loadBackgroundImgFromFile(getBackgroundPath(params, rngBackground.integer(params.numBackgrounds) + 1));
+			// Update lights randomly within a specific range (+ intensity)
+			float light_range = 0.5;
+			vector<glm::vec3> old_lights(8);
+			for (int l = 0; l < Lights::MAX_LIGHTS; ++l)
 			{
-				float dist = abs(intervals[i] - value);
-				if (dist < minDist)
-					minDist = dist;
+				old_lights[l] = glView->getLights().position[l];
+				float light = rngLights.uniform()*light_range - light_range / 2.0f;
+				glView->getLights().position[l] += glm::vec3(light, light, light);
+				light = rngLights.uniform() * 0.5 + 0.25;
+				glView->getLights().diffuse[l] = glm::vec3(light, light, light);
 			}
 
-			if (minDist < step / 2.0f)
-				return value;
+			// Store random image
+			// update objet scaling randomly within a specific range (not for rounded models)
+			float maxScale = params.isRound ? 1.0f : 1.25f;
+			float minScale = params.isRound ? 1.0f : 0.75f;
+			float scaleX = rngScale.uniform(minScale, maxScale);
+			float scaleY = rngScale.uniform(minScale, maxScale);
+			float scaleZ = rngScale.uniform(minScale, maxScale);
+			glView->getModel()->setScaling(scaleX, scaleY, scaleZ);
+			saveUnit(manifest, params.models[idxModel], task.unitKey, saveObj);
+
+			// Restore light position
+			for (int l = 0; l < Lights::MAX_LIGHTS; ++l)
+				glView->getLights().position[l] = old_lights[l];
+		}
+		else if (isLoaded) // Full azimuth turn per tilt x elevation x distance
+		{
+			imgSampler->setTilt(task.tilt);
+			imgSampler->setAngleX(task.elevation);
+			imgSampler->setDistance(task.distance);
+
+			// Load random background
+			SampleRng rngBackground(plan.getSeed(), idxObj, task.idxSample, RNG_BACKGROUND);
+			if (!manifest.isDone(params.models[idxModel], task.unitKey))
+				glView->loadBackgroundImgFromFile(getBackgroundPath(params, rngBackground.integer(params.numBackgrounds) + 1));
+
+			// Start from azimuth angle  0
+			imgSampler->resetCurrentAngleY();
+			// Once all setup is done, store the images
+			saveUnit(manifest, params.models[idxModel], task.unitKey, saveObj);
+		}
+
+		// Progress and estimated time left from the task costs
+		doneCost += task.cost;
+		int progress = (int)(100.0f * doneCost / totalCost);
+		if (progress > lastProgress)
+		{
+			lastProgress = progress;
+			double elapsed = difftime(time(NULL), timeStart);
+			int left = (int)(elapsed / doneCost * (totalCost - doneCost));
+			cout << "Progress: " << progress << "% (task " << idxTask+1 << "/" << tasks.size() << "), time left " << left / 3600 << "h " << (left / 60) % 60 << "min" << endl;
+			generation->reportProgress(progress, QString("Task %1/%2, time left %3h %4min").arg(idxTask+1).arg(tasks.size()).arg(left / 3600).arg((left / 60) % 60));
 		}
 	}
+
+	// Write index of the last annotation file
+	commitOutputs(manifest);
+	glView->closeAnnotations();
+	glView->closeShards();
+	manifest.close();
+	glView->stopPipeline();
+	glView->setSampleTargets(0, 0);
+	glView->setOutputs(0);
+	imgSampler->setViewsPerTurn(0);
+	glView->makeCurrent();
+	Trace::end();
+
+	timeScript = (Trace::now() - timeScript) / 1000.0;
+	cout << "Time script: " << timeScript << "ms" << endl << endl;
 }
 
 // KEYPOINT tab